@@ -17,35 +17,462 @@
    be Unix-style, and there should be one newline character at the end
    of last row in the file.
 
+   When the input is a regular file, it is memory mapped rather than
+   read.  If it has one line of exactly W numbers per row of the image,
+   the rows are parsed and encoded by several threads at once.  Any
+   other input is read one number at a time, in the same way that
+   `scanf()' would read it.  Either way, the output is the same as when
+   every number is read with `scanf()', but the numbers are parsed
+   without it, so that most numbers do not need the C library at all.
+
+   The input can also be a raw grid of exactly W*H little endian 32-bit
+   or 16-bit floats, without any header, in the same order as the
+   numbers of the CSV.  Raw 32-bit floats are encoded straight from the
+   memory mapped input.
+
+   Several images with different encodings, or classes, can be written
+   from one input by giving one B.A per image, each followed by its
+   own options.  The input is then only parsed once, and every row of
+   numbers is encoded by all classes in turn.
+
+   Images are written as TGA, or as PNG when their file names end in
+   ".png".  PNG images have the same pixels as the TGA images, as
+   8-bit grayscale or RGB, so that they need not be converted.  The
+   rows of a PNG image are filtered and compressed by several threads
+   in fixed-size blocks, so the output does not depend on the number of
+   threads.  The default, Paeth filtering with zlib's run-length
+   strategy, compresses SSH fields about as well as the adaptive
+   filters of libpng, at several times the speed.
+
+   In batch mode, the dates of a dates list are converted by a pool of
+   worker threads, one date per thread at a time, so that memory use is
+   bounded by the number of threads.  Dates whose images are all newer
+   than their input are skipped.
+
+   In pyramid mode, each image is instead written as a directory of
+   fixed-size tiles named Z_X_Y after its file name without the
+   extension, plus a "manifest.json" that describes the levels.  The
+   levels are computed on the SSH values before encoding, each one by
+   averaging 2x2 blocks of the next finer level, skipping NaNs, so
+   that coastlines do not bleed into the sea.  Level 0 is the coarsest
+   and fits in one tile; tiles are numbered from the top left and are
+   padded with NaNs.
+
+   In keyframe mode, only every Nth date of a batch is written as
+   usual, as a keyframe, and the dates in between as 8-bit delta
+   frames, which hold the change of every fixed-point code from the
+   frame before, as the decoder sees it, in steps of a given size.
+   Most of a delta frame is then close to the value for no change, and
+   smooth, which the PNG filters predict well.  `SSHDeltaDecoder' in
+   "sshlayer.js" is the reference decoder.
+
+   In video mode, the dates of a batch are written as the frames of a
+   single YUV4MPEG2 stream to the standard output, in the order of the
+   dates list, with the pixels of an 8-bit class as the luma and
+   neutral chroma, so that any video encoder can read them without
+   going through intermediate images.  Frames are encoded by several
+   threads at once and written as soon as all frames before them are.
+
+   The statistics of the SSH values are computed as they are encoded,
+   and written to a little endian binary file, in the same manner as
+   "tstats.c" writes its statistics:
+
+     "OEVSSTA1"            8-byte signature
+     num_bins, num_tiles   32-bit integers
+     hist_min, hist_max    32-bit floats, in centimeters
+     1 + num_tiles records of:
+       min, max, mean      32-bit floats, NaN if there are no samples
+                           but NaN
+       count, nan_count    64-bit integers, of all and of NaN samples
+       hist[num_bins]      64-bit integers
+
+   The first record is of the whole frame, and the others are of the
+   tiles of a pyramid, coarsest level first, each level from the top
+   left tile.  The bins of the histogram are of equal width from
+   hist_min to hist_max, and values outside of that range are counted
+   in the first or last bin.  Padding is not counted in the tiles.  In
+   batch mode, the record of all dates is merged from the statistics
+   files of the dates, which are only read and not written again for
+   dates that are up to date.
+
 */
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
-#include <alloca.h>
+#include <ctype.h>
+#include <float.h>
+#include <math.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <zlib.h>
+
+#if defined(__SSE2__) && !defined(CSVTOTGA_NO_SIMD)
+#define CSVTOTGA_SSE2
+#include <emmintrin.h>
+#endif
+
+/* Encoding parameters, as given on the command line.  */
+struct EncParams_tag {
+  unsigned int bpp; /* Bits per pixel of the output image */
+  unsigned int bbd; /* Bits Before Decimal */
+  unsigned int bad; /* Bits After Decimal */
+  unsigned int overflow, noise_margin, s_chs, s_ics, bitsplit, chanflow;
+};
+typedef struct EncParams_tag EncParams;
+
+/* The encoding of `EncParams', resolved once for all samples by
+   `enc_kernel_init()'.  See there for what each step does.  */
+struct EncKernel_tag {
+  unsigned int bytes; /* Bytes per pixel */
+  float scale;
+  int noise_half, max, min;
+  unsigned int zero, mask;
+  unsigned int chs; /* Resolved channel shift */
+  int bitsplit;
+  /* 0xff for the channels that flow, zero otherwise */
+  unsigned int blue_flow, green_flow;
+  /* Internal channel shift of each channel */
+  unsigned int blue_ics, green_ics, red_ics;
+  /* Encodes `n' samples into consecutive pixels.  */
+  void (*encode_row)(const struct EncKernel_tag *k, const float *in,
+		     unsigned int n, unsigned char *out);
+};
+typedef struct EncKernel_tag EncKernel;
+
+/* An output image: how to encode it and where to write it.  */
+struct EncClass_tag {
+  EncParams params;
+  EncKernel kernel;
+  const char *out_name; /* NULL for the standard output */
+  FILE *fout;
+  unsigned char *image;
+
+  /* PNG output, chosen by an `out_name' that ends in ".png" */
+  int png;
+  unsigned int png_filter; /* PNG filter type, or PNG_FILTER_ADAPTIVE */
+  int png_level; /* zlib compression level */
+  int png_strategy; /* zlib compression strategy */
+
+  /* Fixed-point units per step of the delta frames of keyframe mode */
+  unsigned int delta_quantum;
+};
+typedef struct EncClass_tag EncClass;
+
+/* Maximum number of output images per invocation */
+#define MAX_CLASSES 16
+
+/* Maximum length of the "format.json" of a class */
+#define FORMAT_TEXT_SIZE 1024
+
+/* Choose the PNG filter of each row by the smallest sum of absolute
+   differences, as libpng does.  */
+#define PNG_FILTER_ADAPTIVE 5
+
+/* Filtered PNG data is compressed in independent blocks of at least
+   this many bytes, one block per thread at a time.  Each block is
+   primed with the last 32 KiB of the one before it, so that splitting
+   costs only a few bytes, and the output does not depend on the number
+   of threads.  */
+#define PNG_BLOCK_SIZE (128 * 1024)
+
+/* An image being filtered and compressed into PNG data by the worker
+   threads.  Row `i' of the PNG is row `height - 1 - i' of the image,
+   since the image is stored bottom-up for TGA.  */
+struct PngJob_tag {
+  const unsigned char *image;
+  unsigned int width, height;
+  unsigned int bytes; /* Bytes per pixel */
+  unsigned int filter;
+  int level, strategy;
+  size_t row_len; /* Filtered row length, including the filter type */
+  unsigned char *filtered;
+
+  unsigned int rows_per_block;
+  unsigned int num_blocks;
+  unsigned char **blocks;
+  size_t *block_lens;
+  uLong *block_adlers;
+
+  pthread_mutex_t lock;
+  unsigned int next_block;
+  int phase; /* 0 while filtering, 1 while compressing */
+  int failed;
+};
+typedef struct PngJob_tag PngJob;
+
+/* A level of a tile pyramid: the samples in image order, that is,
+   north up with longitude zero in the center, with NaN for missing
+   data.  */
+struct PyrLevel_tag {
+  unsigned int width, height;
+  unsigned int tiles_x, tiles_y;
+  float *samples;
+};
+typedef struct PyrLevel_tag PyrLevel;
+
+/* Maximum number of pyramid levels */
+#define MAX_LEVELS 32
+
+/* The histograms of the statistics have `STATS_BINS' bins of equal
+   width from `STATS_MIN' to `STATS_MAX' centimeters.  Samples out of
+   that range are counted in the first or the last bin.  */
+#define STATS_BINS 128
+#define STATS_MIN -128.0f
+#define STATS_MAX 128.0f
+
+/* Statistics of the SSH samples of a frame or a tile */
+struct SampleStats_tag {
+  float min, max; /* Infinite while there are no samples but NaN */
+  double sum; /* Of the samples that are not NaN */
+  /* Of all samples, and of NaN samples, 64-bit for all dates at once */
+  uint64_t count, nan_count;
+  uint64_t hist[STATS_BINS];
+};
+typedef struct SampleStats_tag SampleStats;
+
+/* The statistics of a frame, and in pyramid mode, of every tile in the
+   order that `TileJob' numbers them.  */
+struct FrameStats_tag {
+  SampleStats frame;
+  unsigned int num_tiles;
+  SampleStats *tiles;
+};
+typedef struct FrameStats_tag FrameStats;
+
+/* The tiles of all levels of a pyramid, which the worker threads take
+   off of a shared counter, coarsest level first.  */
+struct TileJob_tag {
+  EncClass *classes;
+  unsigned int num_classes;
+  char **dirs; /* The tile directory of each class */
+  const PyrLevel *levels;
+  unsigned int num_levels;
+  unsigned int tile_size;
+  SampleStats *tile_stats; /* NULL if not wanted */
+
+  pthread_mutex_t lock;
+  unsigned int next_tile;
+  unsigned int num_tiles;
+  int failed;
+};
+typedef struct TileJob_tag TileJob;
+
+/* Dates being converted in batch mode by the worker threads, one date
+   per thread at a time, so that at most one input and one set of
+   images per thread are held in memory.  */
+struct BatchJob_tag {
+  const EncClass *classes;
+  unsigned int num_classes;
+  unsigned int width, height;
+  const char *in_tmpl;
+  unsigned int input_format;
+  unsigned int tile_size;
+  /* Keyframe mode if not zero: the number of dates per keyframe */
+  unsigned int key_interval;
+  /* Video mode if not zero: the number of frames per second */
+  unsigned int video_rate;
+  const unsigned char *chroma; /* Both chroma planes of every frame */
+  size_t chroma_len;
+  /* If not NULL, the statistics file name, with `%s' for the date */
+  const char *stats_tmpl;
+  char **dates;
+  unsigned int num_dates;
+  int verbose;
+  /* Convert every date, even if its images are newer than its input,
+     as they were written with other parameters.  */
+  int force;
+
+  pthread_mutex_t lock;
+  unsigned int next_date;
+  unsigned int num_skipped;
+  SampleStats all_stats; /* Of all dates */
+  int failed;
+  /* Video mode: signaled whenever a frame is written */
+  pthread_cond_t written;
+  unsigned int next_frame;
+};
+typedef struct BatchJob_tag BatchJob;
+
+/* Pixels of delta frames: NaN, and the pixel for no change, around
+   which up to `DELTA_MAX' steps either way are stored.  */
+#define DELTA_NAN 0
+#define DELTA_ZERO 128
+#define DELTA_MAX 127
+
+/* Input formats */
+#define INPUT_CSV 0
+#define INPUT_F32 1 /* Raw little endian 32-bit floats */
+#define INPUT_F16 2 /* Raw little endian 16-bit floats */
+
+/* Rows of input shared by the worker threads.  Row `r' of CSV input is
+   the line [ row_starts[r], row_ends[r] ), without its newline, and
+   row `r' of raw input starts `r * width' samples into `raw'.  Every
+   row is parsed once and encoded into the image of every class.  */
+struct ConvJob_tag {
+  EncClass *classes;
+  unsigned int num_classes;
+  unsigned int width;
+  unsigned int num_rows;
+  const char **row_starts;
+  const char **row_ends;
+  const unsigned char *raw;
+  unsigned int input_format;
+  /* If not NULL, rows are stored here as in `store_grid_row()' rather
+     than encoded.  */
+  float *grid;
+  /* If not NULL, the statistics of all rows are added here.  */
+  SampleStats *stats;
+
+  pthread_mutex_t lock;
+  unsigned int next_row;
+  int malformed;
+};
+typedef struct ConvJob_tag ConvJob;
+
+/* Number of rows that a worker takes at once */
+#define ROW_BLOCK 16
+
+void enc_params_init(EncParams *params, unsigned int bpp);
+void enc_kernel_init(EncKernel *k, const EncParams *params);
+void encode_row_scalar(const EncKernel *k, const float *in, unsigned int n,
+		       unsigned char *out);
+#ifdef CSVTOTGA_SSE2
+void encode_row_gray8(const EncKernel *k, const float *in, unsigned int n,
+		      unsigned char *out);
+void encode_row_rgb24(const EncKernel *k, const float *in, unsigned int n,
+		      unsigned char *out);
+#endif
+void encode_split_row(const EncKernel *k, const float *in,
+		      unsigned int width, unsigned char *row);
+void write_tga_header(FILE *fp, unsigned int width, unsigned int height,
+		      unsigned int bpp);
+const char *parse_float(const char *p, const char *end, float *value);
+int load_input(FILE *fp, const char **data, size_t *len,
+	       void **map, size_t *map_len);
+void free_input(const char *data, void *map, size_t map_len);
+int index_rows(const char *data, size_t len, unsigned int height,
+	       const char **row_starts, const char **row_ends);
+int parse_row(const char *p, const char *end, unsigned int width,
+	      float *values);
+void *conv_worker(void *arg);
+int conv_rows(EncClass *classes, unsigned int num_classes,
+	      const char *data, size_t len,
+	      unsigned int width, unsigned int height, long num_threads,
+	      float *grid, SampleStats *stats);
+void conv_stream(EncClass *classes, unsigned int num_classes,
+		 const char *data, size_t len,
+		 unsigned int width, unsigned int height, SampleStats *stats);
+float half_to_float(unsigned int h);
+const float *decode_raw_row(unsigned int input_format,
+			    const unsigned char *in, unsigned int n,
+			    float *buffer);
+int conv_raw(EncClass *classes, unsigned int num_classes,
+	     unsigned int input_format, const char *data, size_t len,
+	     unsigned int width, unsigned int height, long num_threads,
+	     float *grid, SampleStats *stats);
+int conv_frame(EncClass *classes, unsigned int num_classes, FILE *fin,
+	       unsigned int input_format, unsigned int width,
+	       unsigned int height, unsigned int tile_size, long num_threads,
+	       FrameStats *stats);
+int write_image(FILE *fp, const EncClass *cls, const unsigned char *image,
+		unsigned int width, unsigned int height, unsigned int bytes,
+		long num_threads);
+void store_grid_row(const float *in, unsigned int width, float *out);
+void downsample_level(const PyrLevel *src, PyrLevel *dest);
+char *pyramid_dir(const char *out_name);
+void *tile_worker(void *arg);
+int write_manifest(const char *dir, const EncClass *cls,
+		   const PyrLevel *levels, unsigned int num_levels,
+		   unsigned int tile_size);
+int conv_pyramid(EncClass *classes, unsigned int num_classes,
+		 unsigned int input_format, const char *data, size_t len,
+		 unsigned int width, unsigned int height,
+		 unsigned int tile_size, long num_threads, FrameStats *stats);
+int read_grid(unsigned int input_format, const char *data, size_t len,
+	      unsigned int width, unsigned int height, long num_threads,
+	      float *grid, SampleStats *stats);
+void quantize_row(const EncKernel *k, const float *in, unsigned int n,
+		  unsigned int *codes);
+void encode_delta_row(const EncKernel *k, unsigned int quantum,
+		      const float *in, unsigned int n, unsigned int *codes,
+		      unsigned char *out);
+void stats_init(SampleStats *stats);
+void stats_add(SampleStats *stats, const float *in, unsigned int n);
+void stats_merge(SampleStats *dest, const SampleStats *src);
+int write_stats(const char *filename, const FrameStats *stats);
+int read_stats(const char *filename, SampleStats *stats);
+void run_threads(void *(*worker)(void*), void *arg, long num_threads);
+void png_filter_row(unsigned int filter, unsigned int bytes,
+		    const unsigned char *cur, const unsigned char *prev,
+		    unsigned int n, unsigned char *out, unsigned char *scratch);
+void *png_worker(void *arg);
+int write_png(FILE *fp, const unsigned char *image, unsigned int width,
+	      unsigned int height, unsigned int bytes, unsigned int filter,
+	      int level, int strategy, long num_threads);
+char *expand_name(const char *tmpl, const char *date);
+int format_name(const EncClass *cls, char **filename);
+void format_text(const EncClass *cls, unsigned int key_interval,
+		 unsigned int width, unsigned int height,
+		 unsigned int tile_size, char *text);
+int format_matches(const char *filename, const char *text);
+int write_format(const char *filename, const char *text);
+int same_format_dir(const char *name_a, const char *name_b);
+int batch_names(const BatchJob *job, const char *date, char **in_name,
+		char **out_names, char **part_names);
+void free_batch_names(const BatchJob *job, char *in_name, char **out_names,
+		      char **part_names);
+int batch_up_to_date(const BatchJob *job, const char *in_name,
+		     char **out_names, char **part_names);
+int read_date_stats(BatchJob *job, const char *date, const char *in_name,
+		    SampleStats *stats);
+int write_date_stats(BatchJob *job, const char *date,
+		     const FrameStats *stats);
+void *batch_worker(void *arg);
+void *keyed_worker(void *arg);
+void *video_worker(void *arg);
+int conv_batch(const EncClass *classes, unsigned int num_classes,
+	       const char *dates_name, const char *in_tmpl,
+	       unsigned int input_format, unsigned int width,
+	       unsigned int height, unsigned int tile_size,
+	       unsigned int key_interval, unsigned int video_rate,
+	       const char *stats_tmpl, long num_threads, int verbose);
 
 int main(int argc, char *argv[]) {
   unsigned int width = 1440, height = 721, bpp = 24;
 
-  /* The two most important user parameters.  */
-  unsigned int bbd = 8; /* Bits Before Decimal */
-  unsigned int bad = 7; /* Bits After Decimal.  18 for max detail (and
-			   worst JPEG compression due to high noise),
-			   7 preferred for high detail.  */
-
-  unsigned int overflow = 2, noise_margin = 0, s_chs = 1, s_ics = 1,
-    bitsplit = 0, chanflow = 1;
+  /* Every B.A on the command line starts another output image, or
+     class, and the options that follow it apply to that class.  */
+  EncClass classes[MAX_CLASSES];
+  unsigned int num_classes = 1;
+  long num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+  /* Batch mode: the dates list and the input file name template */
+  const char *dates_name = NULL, *in_tmpl = NULL;
+  int verbose = 0;
+  unsigned int input_format = INPUT_CSV;
+  unsigned int tile_size = 0; /* Pyramid mode if not zero */
+  unsigned int key_interval = 0; /* Keyframe mode if not zero */
+  unsigned int video_rate = 0; /* Video mode if not zero */
+  const char *stats_name = NULL; /* Statistics file, if wanted */
+  char *prog_name = argv[0];
+  unsigned int c;
 
   { /* Check if the command line is valid, or display help.  */
     int help = 0;
     if (argc == 2 && (!strcmp(argv[1], "-h") || !strcmp(argv[1], "--help")))
       help = 1;
-    if (argc > 4)
-      help = -1;
     if (help == 1) {
-      printf("Usage: %s [WxHxD] [B.A] [OPTIONS] <INPUT.dat >OUTPUT.tga\n\n",
-	     argv[0]);
+      printf("Usage: %s [WxHxD] [B.A] [OPTIONS] <INPUT.dat >OUTPUT.tga\n"
+	     "   or: %s [WxHxD] B.A [OPTIONS] -fOUTPUT.png|tga B.A [OPTIONS]\n"
+	     "         -fOUTPUT.png|tga... <INPUT.dat\n"
+	     "   or: %s [WxHxD] -dDATES -rINPUT B.A [OPTIONS] -fOUTPUT.png|tga...\n"
+	     "\n",
+	     argv[0], argv[0], argv[0]);
       puts(
 "`[]' delimits optional parameters.  Capital letters represent the\n"
 "parameters described below:\n"
@@ -56,36 +483,172 @@ int main(int argc, char *argv[]) {
 "    B    Bits before decimal to store for each output SSH sample (default 8)\n"
 "    A    Bits after decimal to store for each output SSH sample (default 7)\n"
 "\n"
+"Every B.A after the first starts another output image, so that the\n"
+"input is only read once for all of them.  Options apply to the image\n"
+"of the B.A that they follow, or to the first image if they come first.\n"
+"Images whose file names end in `.png' are written as PNG, 8-bit\n"
+"grayscale or RGB, and all other images as TGA.\n"
+"\n"
+"In pyramid mode, the data is repeatedly halved in resolution down to\n"
+"a single tile, and every level is cut into tiles.\n"
+"\n"
+"In batch mode, every date listed in the DATES file is converted, from\n"
+"and to the file names given with `%s' replaced by the date.  Images\n"
+"that are newer than their input are skipped, unless the parameters\n"
+"recorded in the `format.json' next to the images of each class\n"
+"changed, in which case every date is converted again.  Each class\n"
+"needs a directory of its own for that.  In keyframe mode, only\n"
+"every Nth date is written as usual, and the dates in between as\n"
+"8-bit delta frames that hold the change from the date before.  In\n"
+"video mode, an 8-bit image without a file name is written as a video\n"
+"of all dates instead.\n"
+"\n"
+"The statistics of the SSH values, and in pyramid mode of every tile,\n"
+"can be written to a binary file.  In batch mode, there is one per\n"
+"date, and one for all dates with `all' for the date, which is merged\n"
+"from the others so that dates that are up to date are not read.\n"
+"\n"
 "Options (see the source code for more details):\n"
 "  -mM    Noise margin (default 0)"
 "  -hH    Channel shift: (default 1)\n"
 "  -iI    Internal channel shift: (default 1)\n"
 "  -pP    Bit split: (default 0)\n"
 "  -cC    Channel flow: Integer specifying a boolean value (default 1)\n"
-"  -oO    Overflow: Integer specifying a boolean value (default 2)");
+"  -oO    Overflow: Integer specifying a boolean value (default 2)\n"
+"  -fFILE    Write the image to FILE rather than the standard output\n"
+"  -nN    PNG filter: 0 to 4 for the PNG filter types, 5 to choose per row\n"
+"         (default 4, Paeth)\n"
+"  -zZ    PNG compression level from 0 to 9 (default 6)\n"
+"  -sS    PNG compression strategy: 0 default, 1 filtered, 2 Huffman only,\n"
+"         3 run-length (default 3)\n"
+"  -tT    Number of threads (default: the number of processors)\n"
+"  -eE    Input format: csv, or f32 or f16 for W*H raw little endian\n"
+"         32-bit or 16-bit floats, in the same order as the CSV numbers\n"
+"         (default csv)\n"
+"  -dDATES   Batch mode: Convert the dates listed in the file DATES\n"
+"  -rINPUT   Batch mode: Input file name, with `%s' for the date\n"
+"  -v     Batch mode: Print the progress\n"
+"  -aFILE    Write the minimum, maximum, mean, number of NaNs and a\n"
+"         histogram of the SSH values to FILE (`%s' for the date in batch\n"
+"         mode)\n"
+"  -kN    Keyframe mode: Write a keyframe every N dates (batch mode only)\n"
+"  -qQ    Keyframe mode: Fixed-point units per step of the delta frames\n"
+"         (default 1)\n"
+"  -y[R]  Video mode: Write the image of every date as a frame of a\n"
+"         YUV4MPEG2 video at R frames per second to the standard output\n"
+"         (batch mode only, default 25)\n"
+"  -gS    Pyramid mode: Write every image as SxS tiles at all levels of\n"
+"         detail into a directory named like the image without its\n"
+"         extension, described by the `manifest.json' in it");
       return 0;
-    } else if (help == -1) {
-      fprintf(stderr,
-	      "%s: Invalid command line.\n"
-	      "Type `%s --help' for command line usage.\n",
-	      argv[0], argv[0]);
-      return 1;
     }
   }
 
   { /* Parse the command line arguments.  */
     /* Variables that keep track of which segments were specified.  */
     int dims_spec = 0, bits_spec = 0;
-    char *prog_name = *argv++;
+    EncParams *params;
+    argv++;
+
+    /* The bit depth is only known once all arguments are parsed.  */
+    memset(classes, 0, sizeof(classes));
+    for (c = 0; c < MAX_CLASSES; c++) {
+      classes[c].png_filter = 4;
+      classes[c].png_level = 6;
+      classes[c].png_strategy = Z_RLE;
+      classes[c].delta_quantum = 1;
+    }
+    enc_params_init(&classes[0].params, 0);
+    params = &classes[0].params;
     while (--argc > 0) {
       if ((*argv)[0] == '-') {
   	switch ((*argv)[1]) {
-  	case 'm': noise_margin = strtoul(*argv + 2, NULL, 0); break;
-	case 'h': s_chs = strtoul(*argv + 2, NULL, 0); break;
-	case 'i': s_ics = strtoul(*argv + 2, NULL, 0); break;
-	case 'p': bitsplit = strtoul(*argv + 2, NULL, 0); break;
-	case 'c': chanflow = strtoul(*argv + 2, NULL, 0); break;
-	case 'o': overflow = strtoul(*argv + 2, NULL, 0); break;
+  	case 'm': params->noise_margin = strtoul(*argv + 2, NULL, 0); break;
+	case 'h': params->s_chs = strtoul(*argv + 2, NULL, 0); break;
+	case 'i': params->s_ics = strtoul(*argv + 2, NULL, 0); break;
+	case 'p': params->bitsplit = strtoul(*argv + 2, NULL, 0); break;
+	case 'c': params->chanflow = strtoul(*argv + 2, NULL, 0); break;
+	case 'o': params->overflow = strtoul(*argv + 2, NULL, 0); break;
+	case 'f':
+	  classes[num_classes-1].out_name = *argv + 2;
+	  break;
+	case 'd': dates_name = *argv + 2; break;
+	case 'a': stats_name = *argv + 2; break;
+	case 'r': in_tmpl = *argv + 2; break;
+	case 'v': verbose = 1; break;
+	case 'g':
+	  tile_size = strtoul(*argv + 2, NULL, 0);
+	  if (tile_size == 0) {
+	    fprintf(stderr, "%s: Error: Invalid tile size.\n", prog_name);
+	    return 1;
+	  }
+	  break;
+	case 'k':
+	  key_interval = strtoul(*argv + 2, NULL, 0);
+	  if (key_interval == 0) {
+	    fprintf(stderr, "%s: Error: Invalid keyframe interval.\n",
+		    prog_name);
+	    return 1;
+	  }
+	  break;
+	case 'y':
+	  video_rate = strtoul(*argv + 2, NULL, 0);
+	  if (video_rate == 0)
+	    video_rate = 25;
+	  break;
+	case 'q':
+	  classes[num_classes-1].delta_quantum = strtoul(*argv + 2, NULL, 0);
+	  if (classes[num_classes-1].delta_quantum == 0) {
+	    fprintf(stderr, "%s: Error: Invalid delta step.\n", prog_name);
+	    return 1;
+	  }
+	  break;
+	case 'e':
+	  if (!strcmp(*argv + 2, "csv"))
+	    input_format = INPUT_CSV;
+	  else if (!strcmp(*argv + 2, "f32"))
+	    input_format = INPUT_F32;
+	  else if (!strcmp(*argv + 2, "f16"))
+	    input_format = INPUT_F16;
+	  else {
+	    fprintf(stderr, "%s: Error: Invalid input format: %s\n",
+		    prog_name, *argv + 2);
+	    return 1;
+	  }
+	  break;
+	case 'n':
+	  classes[num_classes-1].png_filter = strtoul(*argv + 2, NULL, 0);
+	  if (classes[num_classes-1].png_filter > PNG_FILTER_ADAPTIVE) {
+	    fprintf(stderr, "%s: Error: Invalid PNG filter.\n", prog_name);
+	    return 1;
+	  }
+	  break;
+	case 'z':
+	  classes[num_classes-1].png_level = strtol(*argv + 2, NULL, 0);
+	  if (classes[num_classes-1].png_level < 0 ||
+	      classes[num_classes-1].png_level > 9) {
+	    fprintf(stderr, "%s: Error: Invalid PNG compression level.\n",
+		    prog_name);
+	    return 1;
+	  }
+	  break;
+	case 't':
+	  num_threads = strtol(*argv + 2, NULL, 0);
+	  if (num_threads <= 0) {
+	    fprintf(stderr, "%s: Error: Invalid number of threads.\n",
+		    prog_name);
+	    return 1;
+	  }
+	  break;
+	case 's':
+	  classes[num_classes-1].png_strategy = strtol(*argv + 2, NULL, 0);
+	  if (classes[num_classes-1].png_strategy < Z_DEFAULT_STRATEGY ||
+	      classes[num_classes-1].png_strategy > Z_RLE) {
+	    fprintf(stderr, "%s: Error: Invalid PNG compression strategy.\n",
+		    prog_name);
+	    return 1;
+	  }
+	  break;
 
   	default:
   	  fprintf(stderr, "%s: Error: Invalid option: %s\n",
@@ -122,217 +685,2813 @@ int main(int argc, char *argv[]) {
   	char *str_bad = strchr(*argv, '.');
 
   	if (bits_spec) {
-  	  fprintf(stderr,
-  		  "%s: Error: Multiple precision specifications found.\n",
-  		  prog_name);
-  	  return 1;
+	  if (num_classes == MAX_CLASSES) {
+	    fprintf(stderr, "%s: Error: Too many output images.\n",
+		    prog_name);
+	    return 1;
+	  }
+	  params = &classes[num_classes++].params;
+	  enc_params_init(params, 0);
   	}
   	bits_spec = 1;
 
   	*str_bad++ = '\0';
-  	bbd = strtoul(str_bbd, NULL, 0);
-  	bad = strtoul(str_bad, NULL, 0);
+  	params->bbd = strtoul(str_bbd, NULL, 0);
+  	params->bad = strtoul(str_bad, NULL, 0);
       }
 
       argv++;
     }
 
-    if (bbd + bad > bpp) {
+    if ((dates_name == NULL) != (in_tmpl == NULL) ||
+	(in_tmpl != NULL && strstr(in_tmpl, "%s") == NULL)) {
       fprintf(stderr,
-"%s: Error: The requested number of bits before and after decimal\n"
-"exceeds the bit depth.\n",
-	      prog_name);
+	      "%s: Error: Batch mode needs both a dates file and an input\n"
+	      "file name with `%%s' for the date.\n", prog_name);
       return 1;
     }
 
-    if (bpp != 8 && bpp != 24) {
-      fprintf(stderr, "%s: Error: Unsupported bit depth.\n", prog_name);
+    if (stats_name != NULL &&
+	(*stats_name == '\0' ||
+	 (dates_name != NULL && strstr(stats_name, "%s") == NULL))) {
+      fprintf(stderr,
+	      "%s: Error: The statistics file needs a name, with `%%s' for\n"
+	      "the date in batch mode.\n", prog_name);
       return 1;
     }
 
-    if (bbd + bad <= 8) {
-      bpp = 8;
-      s_chs = 0;
+    if (key_interval != 0 && (dates_name == NULL || tile_size != 0)) {
+      fprintf(stderr, "%s: Error: Keyframe mode only works in batch mode,\n"
+	      "without pyramid mode.\n", prog_name);
+      return 1;
     }
 
-    if (bitsplit) {
-      s_chs = 12;
-      if (bbd + bad != 12) {
+    if (video_rate != 0 &&
+	(dates_name == NULL || tile_size != 0 || key_interval != 0 ||
+	 num_classes != 1 || classes[0].out_name != NULL)) {
+      fprintf(stderr,
+	      "%s: Error: Video mode only works in batch mode, with one image\n"
+	      "without a file name, without pyramid or keyframe mode.\n",
+	      prog_name);
+      return 1;
+    }
+
+    for (c = 0; c < num_classes; c++) {
+      unsigned int d;
+      params = &classes[c].params;
+      params->bpp = bpp;
+      if (params->bbd + params->bad > params->bpp) {
+	fprintf(stderr,
+"%s: Error: The requested number of bits before and after decimal\n"
+"exceeds the bit depth.\n",
+		prog_name);
+	return 1;
+      }
+
+      if (bpp != 8 && bpp != 24) {
+	fprintf(stderr, "%s: Error: Unsupported bit depth.\n", prog_name);
+	return 1;
+      }
+
+      if (params->bbd + params->bad <= 8) {
+	params->bpp = 8;
+	params->s_chs = 0;
+      }
+
+      if (params->bitsplit) {
+	params->s_chs = 12;
+	if (params->bbd + params->bad != 12) {
+	  fprintf(stderr,
+		  "%s: Error: Bitsplit can only be used with 12-bit formats.\n",
+		  prog_name);
+	  return 1;
+	}
+      }
+
+      if (classes[c].out_name != NULL) {
+	size_t name_len = strlen(classes[c].out_name);
+	classes[c].png = (name_len >= 4 &&
+		  !strcmp(classes[c].out_name + name_len - 4, ".png"));
+      }
+
+      if (video_rate != 0 && params->bpp != 8) {
+	fprintf(stderr, "%s: Error: Video mode needs an 8-bit format.\n",
+		prog_name);
+	return 1;
+      }
+
+      if (dates_name != NULL && video_rate == 0 &&
+	  (classes[c].out_name == NULL ||
+	   strstr(classes[c].out_name, "%s") == NULL)) {
+	fprintf(stderr,
+		"%s: Error: Every image needs a file name with `%%s' for the\n"
+		"date in batch mode.\n", prog_name);
+	return 1;
+      }
+
+      if (tile_size != 0 && classes[c].out_name == NULL) {
 	fprintf(stderr,
-		"%s: Error: Bitsplit can only be used with 12-bit formats.\n",
+		"%s: Error: Every image needs a file name in pyramid mode.\n",
 		prog_name);
 	return 1;
       }
+
+      for (d = 0; d < c; d++) {
+	if ((classes[c].out_name == NULL) ? classes[d].out_name == NULL :
+	    classes[d].out_name != NULL &&
+	    !strcmp(classes[c].out_name, classes[d].out_name)) {
+	  fprintf(stderr,
+		  "%s: Error: Multiple images would be written to %s.\n",
+		  prog_name, (classes[c].out_name == NULL) ?
+		  "the standard output" : classes[c].out_name);
+	  return 1;
+	}
+      }
     }
   }
 
-  /* Write the TGA header.  */
-  putchar(0); /* ID length */
-  putchar(0); /* Color map type (none) */
-  putchar(2); /* Image type (True Color) */
+  for (c = 0; c < num_classes; c++)
+    enc_kernel_init(&classes[c].kernel, &classes[c].params);
+
+  if (dates_name != NULL)
+    return conv_batch(classes, num_classes, dates_name, in_tmpl,
+		      input_format, width, height, tile_size, key_interval,
+		      video_rate, stats_name, num_threads, verbose);
+
+  for (c = 0; c < num_classes; c++) {
+    if (classes[c].out_name == NULL)
+      classes[c].fout = stdout;
+  }
+  if (stats_name != NULL) {
+    FrameStats stats;
+    int retval = conv_frame(classes, num_classes, stdin, input_format,
+			    width, height, tile_size, num_threads, &stats);
+    if (retval == 0)
+      retval = write_stats(stats_name, &stats);
+    free(stats.tiles);
+    return retval;
+  }
+  return conv_frame(classes, num_classes, stdin, input_format,
+		    width, height, tile_size, num_threads, NULL);
+}
+
+/* Set the default encoding parameters.  */
+void enc_params_init(EncParams *params, unsigned int bpp) {
+  params->bpp = bpp;
+  /* The two most important user parameters.  */
+  params->bbd = 8; /* Bits Before Decimal */
+  params->bad = 7; /* Bits After Decimal.  18 for max detail (and
+		      worst JPEG compression due to high noise), 7
+		      preferred for high detail.  */
+  params->overflow = 2; params->noise_margin = 0;
+  params->s_chs = 1; params->s_ics = 1;
+  params->bitsplit = 0; params->chanflow = 1;
+}
+
+/* Write the header of a TGA image.  */
+void write_tga_header(FILE *fp, unsigned int width, unsigned int height,
+		      unsigned int bpp) {
+  putc(0, fp); /* ID length */
+  putc(0, fp); /* Color map type (none) */
+  putc(2, fp); /* Image type (True Color) */
 
   /* No color map specification.  */
-  putchar(0); putchar(0); putchar(0); putchar(0); putchar(0);
+  putc(0, fp); putc(0, fp); putc(0, fp); putc(0, fp); putc(0, fp);
 
   { /* Image specification.  16-bit integers are stored in little
        endian in the TGA header.  */
     uint16_t xorg = 0, yorg = 0;
-#define PUT_SHORT(var) putchar(var & 0xff); putchar((var >> 8) & 0xff)
+#define PUT_SHORT(var) putc(var & 0xff, fp); putc((var >> 8) & 0xff, fp)
     PUT_SHORT(xorg);  PUT_SHORT(yorg);
     PUT_SHORT(width); PUT_SHORT(height);
-    putchar(bpp);
+    putc(bpp, fp);
     /* Image descriptor.  When this is just set to zero the first row
        of pixels start at the bottom of the TGA and continue upward.
        Add 32 for top-down TGA.
        Add 8 if there is an 8-bit alpha channel.  */
-    putchar(0);
-  }
-
-  { /* Convert the data.  */
-    float in_val;
-
-    /* `row_buffer' is used so that we can shift longitude zero to be
-       at the center of the image.  */
-    unsigned int rowb_size = width * (bpp >> 3);
-    unsigned char *row_buffer = (unsigned char*)alloca(rowb_size);
-    unsigned int col_start = (width / 2) * (bpp >> 3);
-    unsigned int col_pos = col_start;
-
-    while (scanf("%f", &in_val) != EOF) {
-      unsigned int chs = s_chs, ics = s_ics;
-      unsigned int out_val;
-      unsigned char red, green, blue;
-
-      /* Shift the desired number of bits after the decimal to be
-	 before the decimal.  */
-      out_val = (unsigned int)(in_val * (1 << bad));
-
-      overflow = 2;
-      if (overflow == 2) {
-	/* Saturating Overflow: Any numbers greater than the maximum or
-	   less than the minimum are truncated to the numeric
-	   limits.  */
-	int tout_val = out_val;
-	int max = (1 << (bbd - 1 + bad)) - 1;
-	int min = -max; /* Reserve the largest negative for NaN.  */
-
-	/* The largest negative is reserved for NaN.  In order to
-	   avoid JPEG noise problems, move the minimum upward by the
-	   noise margin (if any).  */
-	/* NOTE: noise_margin is assumed to be only useful for 8-bit
-	   grayscale JPEG images that use saturating overflow.  */
-	min += noise_margin;
-	/* As a compensatory measure to make sure the range reduction
-	   in both the maximum and minimum values are equal, the
-	   stored value will be shifted up by half of the noise
-	   margin.  */
-	out_val += noise_margin / 2; tout_val = out_val;
-
-	if (tout_val > max) out_val = (unsigned int)max;
-	if (tout_val < min) out_val = (unsigned int)min;
-      }
-
-      /* Shift value zero to be at the middle of the unsigned value
-	 range.  */
-      out_val += 1 << (bbd - 1 + bad);
-
-      if (overflow == 1) {
-	/* BounceBack Wrap Overflow: If the first overflow bit is set,
-	 make the rest of the number wrap from the unsigned max
-	 downward to zero rather than wrap directly to unsigned
-	 zero.  */
-	if (out_val & (1 << (bbd + bad)))
-	  out_val = ~out_val;
-      } /* else Snap-Wrap Overflow as default.  */
-
-      /* Mask out any bits that are too far in front of the
-	 decimal.  */
-      out_val &= ~(~0 << (bbd + bad));
-
-      /* Set `out_val' to all zeros for NaN.  */
-      if (in_val != in_val)
-	out_val = 0;
-
-      /* CHannel Shift: Use this if the data doesn't require all three
-	 channels and you don't want it to appear in the green or blue
-	 channels.  This can result in greater detail appearing in the
-	 JPEG image.  (JPEG assumes that pure blue will appear dimmer
-	 and hence require less luminance detail.)  */
-
-      /* Option I: Shift so that the most significant bit is the first
-	 bit of the red channel.  */
-      if (chs == 1 && bbd + bad <= 24)
-	chs = 24 - (bbd + bad);
-      /* Option II: Only shift right far enough to exclude the range
-	 of the blue channel, if possible.  */
-      else if (chs == 2 && bbd + bad <= 16)
-	chs = 8;
-      else
-	chs = 0;
-      out_val <<= chs;
-
-      /* Prepare to write out the three least significant bytes such
-	 that the most significant byte is in the red channel.  */
-      blue = out_val & 0xff;
-      green = (out_val >> 8) & 0xff;
-      red = (out_val >> 16) & 0xff;
-
-      /* Bit Split: Only use upper 4 most significant bits per
-	 channel.  Only works with 12-bit fixed point formats.  Not
-	 recommended.  */
-      if (bitsplit == 1) {
-	blue = green & 0xf0;
-	green = (red & 0x0f) << 4;
-	red &= 0xf0;
-	chs = 0;
-      }
-
-      if (chanflow == 1) {
-	/* BounceBack Wrap: If the bit before a byte is 1, make the
-	   byte wrap from 255 downward to zero rather than wrap
-	   directly to zero for visual smoothness (better JPEG
-	   compression).  */
-	if (chs < 8 && green & 0x01)
-	  blue = ~blue;
-	if (chs < 16 && red & 0x01)
-	  green = ~green;
-      }
-
-      /* Internal Channel Shift: If not all the bits in the most
-	 significant channel are used, shift the partial bits of a
-	 channel to be the most significant bits.  This possibly makes
-	 sure that the JPEG compression algorithm will give these bits
-	 a fair amount of detail.  */
-      if (ics == 1) {
-	ics = bbd + bad + chs;
-	if (ics <= 8) {
-	  ics = 8 - ics;
-	  blue <<= ics;
-	} else if (ics <= 16) {
-	  ics = 16 - ics;
-	  green <<= ics;
-	} else if (ics <= 24) {
-	  ics = 24 - ics;
-	  red <<= ics;
-	} else
-	  ics = 0;
-      }
-
-      /* Write the actual pixel value.  */
-      if (bpp == 8)
-	row_buffer[col_pos++] = blue;
-      else {
-	row_buffer[col_pos++] = blue;
-	row_buffer[col_pos++] = green;
-	row_buffer[col_pos++] = red;
-      }
-      col_pos %= rowb_size;
-      if (col_pos == col_start)
-	fwrite(row_buffer, rowb_size, 1, stdout);
-
-      getchar(); /* Ignore the delimeter that follows.  */
+    putc(0, fp);
+  }
+}
+
+/* Resolve the encoding parameters into `k', and choose the row
+   encoder for them.  */
+void enc_kernel_init(EncKernel *k, const EncParams *params) {
+  unsigned int bits = params->bbd + params->bad;
+  unsigned int chs = params->s_chs;
+
+  k->bytes = params->bpp >> 3;
+  /* Shift the desired number of bits after the decimal to be before
+     the decimal.  */
+  k->scale = 1 << params->bad;
+
+  /* Saturating Overflow: Any numbers greater than the maximum or less
+     than the minimum are truncated to the numeric limits.  This is the
+     only overflow mode that is ever used, whatever -o says.  */
+  k->max = (1 << (bits - 1)) - 1;
+  /* The largest negative is reserved for NaN.  In order to avoid JPEG
+     noise problems, move the minimum upward by the noise margin (if
+     any).  */
+  /* NOTE: noise_margin is assumed to be only useful for 8-bit
+     grayscale JPEG images that use saturating overflow.  */
+  k->min = -k->max + params->noise_margin;
+  /* As a compensatory measure to make sure the range reduction in
+     both the maximum and minimum values are equal, the stored value
+     will be shifted up by half of the noise margin.  */
+  k->noise_half = params->noise_margin / 2;
+
+  /* Shift value zero to be at the middle of the unsigned value range,
+     and mask out any bits that are too far in front of the decimal.
+     Snap-Wrap Overflow never applies after saturation.  */
+  k->zero = 1 << (bits - 1);
+  k->mask = ~(~0u << bits);
+
+  /* CHannel Shift: Use this if the data doesn't require all three
+     channels and you don't want it to appear in the green or blue
+     channels.  This can result in greater detail appearing in the JPEG
+     image.  (JPEG assumes that pure blue will appear dimmer and hence
+     require less luminance detail.)  */
+
+  /* Option I: Shift so that the most significant bit is the first bit
+     of the red channel.  */
+  if (chs == 1 && bits <= 24)
+    chs = 24 - bits;
+  /* Option II: Only shift right far enough to exclude the range of the
+     blue channel, if possible.  */
+  else if (chs == 2 && bits <= 16)
+    chs = 8;
+  else
+    chs = 0;
+  k->chs = chs;
+
+  /* Bit Split: Only use upper 4 most significant bits per channel.
+     Only works with 12-bit fixed point formats.  Not recommended.  */
+  k->bitsplit = (params->bitsplit == 1);
+  if (k->bitsplit)
+    chs = 0;
+
+  /* BounceBack Wrap: If the bit before a byte is 1, make the byte wrap
+     from 255 downward to zero rather than wrap directly to zero for
+     visual smoothness (better JPEG compression).  */
+  k->blue_flow = (params->chanflow == 1 && chs < 8) ? 0xff : 0;
+  k->green_flow = (params->chanflow == 1 && chs < 16) ? 0xff : 0;
+
+  /* Internal Channel Shift: If not all the bits in the most
+     significant channel are used, shift the partial bits of a channel
+     to be the most significant bits.  This possibly makes sure that
+     the JPEG compression algorithm will give these bits a fair amount
+     of detail.  */
+  k->blue_ics = k->green_ics = k->red_ics = 0;
+  if (params->s_ics == 1) {
+    unsigned int ics = bits + chs;
+    if (ics <= 8)
+      k->blue_ics = 8 - ics;
+    else if (ics <= 16)
+      k->green_ics = 16 - ics;
+    else if (ics <= 24)
+      k->red_ics = 24 - ics;
+  }
+
+  /* Only 8-bit formats are written to 8-bit images, and those never
+     use any but the blue channel.  */
+#ifdef CSVTOTGA_SSE2
+  if (k->bitsplit)
+    k->encode_row = encode_row_scalar;
+  else if (k->bytes == 1)
+    k->encode_row = encode_row_gray8;
+  else
+    k->encode_row = encode_row_rgb24;
+#else
+  k->encode_row = encode_row_scalar;
+#endif
+}
+
+/* Quantize one SSH sample into its fixed-point code, before any
+   channel shifts: zero for NaN, and between `k->zero + k->min' and
+   `k->zero + k->max' for all other samples.  */
+static inline unsigned int quantize_one(const EncKernel *k, float in_val) {
+  unsigned int out_val;
+  int tout_val;
+
+  out_val = (unsigned int)(in_val * k->scale);
+  out_val += k->noise_half; tout_val = out_val;
+  if (tout_val > k->max) out_val = (unsigned int)k->max;
+  if (tout_val < k->min) out_val = (unsigned int)k->min;
+  out_val = (out_val + k->zero) & k->mask;
+
+  /* Set `out_val' to all zeros for NaN.  */
+  if (in_val != in_val)
+    out_val = 0;
+  return out_val;
+}
+
+/* Encode one SSH sample into a 24-bit value, with the blue channel in
+   the least significant byte.  */
+static inline unsigned int encode_one(const EncKernel *k, float in_val) {
+  unsigned int out_val, blue, green, red;
+
+  out_val = quantize_one(k, in_val) << k->chs;
+
+  /* Prepare to write out the three least significant bytes such that
+     the most significant byte is in the red channel.  */
+  blue = out_val & 0xff;
+  green = (out_val >> 8) & 0xff;
+  red = (out_val >> 16) & 0xff;
+  if (k->bitsplit) {
+    blue = green & 0xf0;
+    green = (red & 0x0f) << 4;
+    red &= 0xf0;
+  }
+  blue ^= k->blue_flow & -(green & 0x01);
+  green ^= k->green_flow & -(red & 0x01);
+  blue = (blue << k->blue_ics) & 0xff;
+  green = (green << k->green_ics) & 0xff;
+  red = (red << k->red_ics) & 0xff;
+  return blue | (green << 8) | (red << 16);
+}
+
+/* Encode `n' samples into `n' pixels of `k->bytes' bytes, one sample
+   at a time.  This works for all parameters.  */
+void encode_row_scalar(const EncKernel *k, const float *in, unsigned int n,
+		       unsigned char *out) {
+  unsigned int i;
+  if (k->bytes == 1) {
+    for (i = 0; i < n; i++)
+      out[i] = encode_one(k, in[i]);
+  } else {
+    for (i = 0; i < n; i++) {
+      unsigned int value = encode_one(k, in[i]);
+      *out++ = value & 0xff;
+      *out++ = (value >> 8) & 0xff;
+      *out++ = (value >> 16) & 0xff;
+    }
+  }
+}
+
+#ifdef CSVTOTGA_SSE2
+/* `EncKernel' in vector registers */
+struct EncVec_tag {
+  __m128 scale, limit, sign;
+  __m128i noise_half, max, min, zero, mask, chs, byte, one;
+  __m128i blue_flow, green_flow, blue_ics, green_ics, red_ics;
+};
+typedef struct EncVec_tag EncVec;
+
+static void enc_vec_init(const EncKernel *k, EncVec *v) {
+  v->scale = _mm_set1_ps(k->scale);
+  v->limit = _mm_set1_ps(2147483648.0f);
+  v->sign = _mm_set1_ps(-0.0f);
+  v->noise_half = _mm_set1_epi32(k->noise_half);
+  v->max = _mm_set1_epi32(k->max);
+  v->min = _mm_set1_epi32(k->min);
+  v->zero = _mm_set1_epi32(k->zero);
+  v->mask = _mm_set1_epi32(k->mask);
+  v->chs = _mm_cvtsi32_si128(k->chs);
+  v->byte = _mm_set1_epi32(0xff);
+  v->one = _mm_set1_epi32(0x01);
+  v->blue_flow = _mm_set1_epi32(k->blue_flow);
+  v->green_flow = _mm_set1_epi32(k->green_flow);
+  v->blue_ics = _mm_cvtsi32_si128(k->blue_ics);
+  v->green_ics = _mm_cvtsi32_si128(k->green_ics);
+  v->red_ics = _mm_cvtsi32_si128(k->red_ics);
+}
+
+/* Quantize four samples as `encode_one()' does, up to the channel
+   shift.  Returns zero if any scaled sample does not fit in 32 bits,
+   since `encode_one()' converts those with a 64-bit truncation.  */
+static inline int quantize4_sse2(const EncVec *v, const float *in,
+				 __m128i *result) {
+  __m128 x = _mm_loadu_ps(in);
+  __m128 y = _mm_mul_ps(x, v->scale);
+  __m128i nan = _mm_castps_si128(_mm_cmpunord_ps(x, x));
+  __m128i out, gt, lt;
+  if (_mm_movemask_ps(_mm_cmpge_ps(_mm_andnot_ps(v->sign, y), v->limit)))
+    return 0;
+
+  out = _mm_add_epi32(_mm_cvttps_epi32(y), v->noise_half);
+  gt = _mm_cmpgt_epi32(out, v->max);
+  lt = _mm_cmplt_epi32(out, v->min);
+  out = _mm_or_si128(_mm_and_si128(gt, v->max), _mm_andnot_si128(gt, out));
+  out = _mm_or_si128(_mm_and_si128(lt, v->min), _mm_andnot_si128(lt, out));
+  out = _mm_and_si128(_mm_add_epi32(out, v->zero), v->mask);
+  *result = _mm_andnot_si128(nan, out);
+  return 1;
+}
+
+/* Encode four samples as `encode_one()' does, without bit split.  */
+static inline int encode4_sse2(const EncVec *v, const float *in,
+			       __m128i *result) {
+  __m128i out, blue, green, red;
+  if (!quantize4_sse2(v, in, &out))
+    return 0;
+  out = _mm_sll_epi32(out, v->chs);
+
+  blue = _mm_and_si128(out, v->byte);
+  green = _mm_and_si128(_mm_srli_epi32(out, 8), v->byte);
+  red = _mm_and_si128(_mm_srli_epi32(out, 16), v->byte);
+  blue = _mm_xor_si128(blue, _mm_and_si128(v->blue_flow,
+	   _mm_sub_epi32(_mm_setzero_si128(), _mm_and_si128(green, v->one))));
+  green = _mm_xor_si128(green, _mm_and_si128(v->green_flow,
+	   _mm_sub_epi32(_mm_setzero_si128(), _mm_and_si128(red, v->one))));
+  blue = _mm_and_si128(_mm_sll_epi32(blue, v->blue_ics), v->byte);
+  green = _mm_and_si128(_mm_sll_epi32(green, v->green_ics), v->byte);
+  red = _mm_and_si128(_mm_sll_epi32(red, v->red_ics), v->byte);
+  *result = _mm_or_si128(blue, _mm_or_si128(_mm_slli_epi32(green, 8),
+					    _mm_slli_epi32(red, 16)));
+  return 1;
+}
+
+/* Encode 8-bit pixels, eight at a time.  8-bit formats have no
+   channel shift, and nothing in the other channels to flow into
+   blue, so only the internal channel shift is left.  */
+void encode_row_gray8(const EncKernel *k, const float *in, unsigned int n,
+		      unsigned char *out) {
+  EncVec v;
+  unsigned int i = 0;
+  enc_vec_init(k, &v);
+  for (; i + 8 <= n; i += 8) {
+    __m128i lo, hi;
+    if (quantize4_sse2(&v, in + i, &lo) &&
+	quantize4_sse2(&v, in + i + 4, &hi)) {
+      __m128i packed;
+      lo = _mm_and_si128(_mm_sll_epi32(lo, v.blue_ics), v.byte);
+      hi = _mm_and_si128(_mm_sll_epi32(hi, v.blue_ics), v.byte);
+      packed = _mm_packs_epi32(lo, hi);
+      _mm_storel_epi64((__m128i*)(out + i), _mm_packus_epi16(packed, packed));
+    } else
+      encode_row_scalar(k, in + i, 8, out + i);
+  }
+  encode_row_scalar(k, in + i, n - i, out + i);
+}
+
+/* Encode 24-bit pixels, four at a time.  */
+void encode_row_rgb24(const EncKernel *k, const float *in, unsigned int n,
+		      unsigned char *out) {
+  EncVec v;
+  unsigned int i = 0;
+  enc_vec_init(k, &v);
+  for (; i + 4 <= n; i += 4) {
+    __m128i packed;
+    if (encode4_sse2(&v, in + i, &packed)) {
+      /* SSE2 implies little endian, so each 32-bit value is already
+	 in pixel order, followed by a zero byte that the next pixel
+	 overwrites.  */
+      unsigned int value;
+      value = _mm_cvtsi128_si32(packed);
+      memcpy(out, &value, 4);
+      value = _mm_cvtsi128_si32(_mm_srli_si128(packed, 4));
+      memcpy(out + 3, &value, 4);
+      value = _mm_cvtsi128_si32(_mm_srli_si128(packed, 8));
+      memcpy(out + 6, &value, 4);
+      value = _mm_cvtsi128_si32(_mm_srli_si128(packed, 12));
+      out[9] = value & 0xff;
+      out[10] = (value >> 8) & 0xff;
+      out[11] = (value >> 16) & 0xff;
+      out += 12;
+    } else {
+      encode_row_scalar(k, in + i, 4, out);
+      out += 12;
+    }
+  }
+  encode_row_scalar(k, in + i, n - i, out);
+}
+#endif /* CSVTOTGA_SSE2 */
+
+/* Powers of ten that are exact in single and double precision */
+static const float pow10_flt[11] = {
+  1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f
+};
+static const double pow10_dbl[23] = {
+  1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+#define IS_DELIM(c) ((c) == ',' || isspace((unsigned char)(c)))
+
+/* Parse the number at `p', stopping at `end', into `value'.  Returns a
+   pointer past the number, or NULL if there is no number at `p'.  The
+   result is always the same as that of `strtof()', which `scanf()'
+   uses as well: decimal numbers are rounded correctly to single
+   precision.
+
+   Numbers with up to 7 significant digits and a small exponent are
+   exact in single precision, so a single division or multiplication
+   by an exact power of ten gives the correctly rounded result.
+   Numbers with up to 19 significant digits are computed in double
+   precision instead, and that is rounded to single precision unless
+   it is too close to a point halfway between two single precision
+   numbers to be sure which way the exact value rounds.  NaN is also
+   recognized here.  Everything else is left to `strtof()'.  */
+const char *parse_float(const char *p, const char *end, float *value) {
+  const char *start = p;
+  uint64_t mant = 0;
+  unsigned int num_digits = 0;
+  int exp10 = 0;
+  int negative = 0, any_digits = 0, truncated = 0;
+
+  if (p < end && (*p == '-' || *p == '+'))
+    negative = (*p++ == '-');
+  if (end - p >= 3 && (p[0] | 0x20) == 'n' && (p[1] | 0x20) == 'a' &&
+      (p[2] | 0x20) == 'n' && (end - p == 3 || IS_DELIM(p[3]))) {
+    *value = negative ? -NAN : NAN;
+    return p + 3;
+  }
+
+  /* Keep the first 19 significant digits, which always fit.  */
+  for (; p < end && *p >= '0' && *p <= '9'; p++) {
+    any_digits = 1;
+    if (num_digits < 19) {
+      mant = mant * 10 + (*p - '0');
+      if (mant != 0) num_digits++;
+    } else {
+      exp10++;
+      if (*p != '0') truncated = 1;
+    }
+  }
+  if (p < end && *p == '.') {
+    for (p++; p < end && *p >= '0' && *p <= '9'; p++) {
+      any_digits = 1;
+      if (num_digits < 19) {
+	mant = mant * 10 + (*p - '0');
+	if (mant != 0) num_digits++;
+	exp10--;
+      } else if (*p != '0')
+	truncated = 1;
+    }
+  }
+  if (any_digits && p < end && (*p | 0x20) == 'e') {
+    const char *q = p + 1;
+    int exp_negative = 0, exp_val = 0;
+    if (q < end && (*q == '-' || *q == '+'))
+      exp_negative = (*q++ == '-');
+    if (q < end && *q >= '0' && *q <= '9') {
+      for (; q < end && *q >= '0' && *q <= '9'; q++) {
+	if (exp_val < 10000)
+	  exp_val = exp_val * 10 + (*q - '0');
+      }
+      exp10 += exp_negative ? -exp_val : exp_val;
+      p = q;
+    } else
+      any_digits = 0; /* Let `strtof()' decide.  */
+  }
+
+  if (any_digits && (p == end || IS_DELIM(*p))) {
+    if (mant == 0) {
+      *value = negative ? -0.0f : 0.0f;
+      return p;
+    }
+    if (!truncated && mant <= (1 << 24) && exp10 >= -10 && exp10 <= 10) {
+      float f = (float)mant;
+      f = (exp10 < 0) ? f / pow10_flt[-exp10] : f * pow10_flt[exp10];
+      *value = negative ? -f : f;
+      return p;
+    }
+    if (exp10 >= -22 && exp10 <= 22) {
+      /* The relative error of `d' is at most three units in the last
+	 place of double precision, plus the truncated digits.  */
+      double d = (double)mant;
+      float f;
+      d = (exp10 < 0) ? d / pow10_dbl[-exp10] : d * pow10_dbl[exp10];
+      f = (float)d;
+      if (f >= FLT_MIN && f <= FLT_MAX) {
+	double tol = d * 1e-15;
+	double mid_up = ((double)f + nextafterf(f, INFINITY)) / 2;
+	double mid_down = ((double)f + nextafterf(f, 0)) / 2;
+	if (fabs(d - mid_up) > tol && fabs(d - mid_down) > tol) {
+	  *value = negative ? -f : f;
+	  return p;
+	}
+      }
+    }
+  }
+
+  { /* Slow path */
+    char buf[128];
+    char *tail;
+    size_t n = 0;
+    for (p = start; p < end && !IS_DELIM(*p) && n < sizeof(buf) - 1; p++)
+      buf[n++] = *p;
+    buf[n] = '\0';
+    *value = strtof(buf, &tail);
+    if (tail == buf)
+      return NULL;
+    return start + (tail - buf);
+  }
+}
+
+/* Map the rest of `fp' into memory if it is a regular file, or read
+   all of it otherwise.  `map' is set to the start of the mapping, or
+   NULL if the data was read into memory allocated with `malloc()', and
+   `map_len' to the length of the mapping.  Returns zero on success,
+   one on failure.  */
+int load_input(FILE *fp, const char **data, size_t *len,
+	       void **map, size_t *map_len) {
+  struct stat st;
+  char *buf;
+  size_t buf_size;
+  int fd = fileno(fp);
+
+  *map = NULL;
+  *map_len = 0;
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+    off_t offset = lseek(fd, 0, SEEK_CUR);
+    void *addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (offset >= 0 && offset <= st.st_size && addr != MAP_FAILED) {
+      madvise(addr, st.st_size, MADV_SEQUENTIAL);
+      *data = (const char*)addr + offset;
+      *len = st.st_size - offset;
+      *map = addr;
+      *map_len = st.st_size;
+      return 0;
+    }
+    if (addr != MAP_FAILED)
+      munmap(addr, st.st_size);
+  }
+
+  *len = 0;
+  buf_size = 1 << 20;
+  buf = (char*)malloc(buf_size);
+  while (buf != NULL) {
+    size_t num_read = fread(buf + *len, 1, buf_size - *len, fp);
+    *len += num_read;
+    if (*len < buf_size)
+      break;
+    buf_size *= 2;
+    buf = (char*)realloc(buf, buf_size);
+  }
+  if (buf == NULL) {
+    fputs("Error: Out of memory.\n", stderr);
+    return 1;
+  }
+  if (ferror(fp)) {
+    fprintf(stderr, "Error: Could not read the input: %s\n",
+	    strerror(errno));
+    free(buf);
+    return 1;
+  }
+  *data = buf;
+  return 0;
+}
+
+/* Free the input returned by `load_input()'.  */
+void free_input(const char *data, void *map, size_t map_len) {
+  if (map != NULL)
+    munmap(map, map_len);
+  else
+    free((void*)data);
+}
+
+/* Find the lines of the input.  Returns zero if there are exactly
+   `height' lines, one otherwise.  */
+int index_rows(const char *data, size_t len, unsigned int height,
+	       const char **row_starts, const char **row_ends) {
+  const char *p = data, *end = data + len;
+  unsigned int num_rows = 0;
+  while (p < end) {
+    const char *nl = (const char*)memchr(p, '\n', end - p);
+    if (num_rows == height)
+      return 1;
+    row_starts[num_rows] = p;
+    row_ends[num_rows] = (nl != NULL) ? nl : end;
+    num_rows++;
+    p = (nl != NULL) ? nl + 1 : end;
+  }
+  return (num_rows != height);
+}
+
+/* Encode one row of samples into `row', with longitude zero shifted
+   from the left to the center.  */
+void encode_split_row(const EncKernel *k, const float *in,
+		      unsigned int width, unsigned char *row) {
+  unsigned int half = width / 2;
+  k->encode_row(k, in, width - half, row + half * k->bytes);
+  k->encode_row(k, in + width - half, half, row);
+}
+
+/* Parse a line of exactly `width' comma separated numbers.  Returns
+   zero on success, one if the line is malformed.  */
+int parse_row(const char *p, const char *end, unsigned int width,
+	      float *values) {
+  unsigned int j;
+  for (j = 0; j < width; j++) {
+    p = parse_float(p, end, &values[j]);
+    if (p == NULL)
+      return 1;
+    if (j + 1 < width) {
+      if (p == end || *p != ',')
+	return 1;
+      p++;
+    } else if (p != end)
+      return 1;
+  }
+  return 0;
+}
+
+/* Take blocks of rows off of the shared counter and parse and encode
+   them, until all rows are done or any row is found to be malformed.  */
+void *conv_worker(void *arg) {
+  ConvJob *job = (ConvJob*)arg;
+  unsigned int width = job->width;
+  float *values = (float*)malloc(sizeof(float) * width);
+  SampleStats stats;
+
+  if (values == NULL) {
+    pthread_mutex_lock(&job->lock);
+    job->malformed = 1;
+    pthread_mutex_unlock(&job->lock);
+    return NULL;
+  }
+  stats_init(&stats);
+
+  while (1) {
+    unsigned int first, last, r, c;
+    pthread_mutex_lock(&job->lock);
+    first = job->next_row;
+    job->next_row += ROW_BLOCK;
+    if (job->malformed)
+      first = job->num_rows;
+    pthread_mutex_unlock(&job->lock);
+    if (first >= job->num_rows)
+      break;
+    last = first + ROW_BLOCK;
+    if (last > job->num_rows)
+      last = job->num_rows;
+
+    for (r = first; r < last; r++) {
+      const float *row = values;
+      if (job->raw != NULL) {
+	size_t sample_size = (job->input_format == INPUT_F32) ? 4 : 2;
+	row = decode_raw_row(job->input_format,
+			     job->raw + sample_size * width * r,
+			     width, values);
+      } else if (parse_row(job->row_starts[r], job->row_ends[r],
+			   width, values) != 0) {
+	pthread_mutex_lock(&job->lock);
+	job->malformed = 1;
+	pthread_mutex_unlock(&job->lock);
+	free(values);
+	return NULL;
+      }
+      if (job->stats != NULL)
+	stats_add(&stats, row, width);
+      if (job->grid != NULL) {
+	store_grid_row(row, width,
+		       job->grid + (size_t)width * (job->num_rows - 1 - r));
+	continue;
+      }
+      for (c = 0; c < job->num_classes; c++) {
+	const EncKernel *k = &job->classes[c].kernel;
+	encode_split_row(k, row, width, job->classes[c].image +
+			 (size_t)width * k->bytes * r);
+      }
+    }
+  }
+  free(values);
+  if (job->stats != NULL) {
+    pthread_mutex_lock(&job->lock);
+    stats_merge(job->stats, &stats);
+    pthread_mutex_unlock(&job->lock);
+  }
+  return NULL;
+}
+
+/* Encode the input into the image of every class, or store it into
+   `grid' if that is not NULL, on `num_threads' threads, if it has one
+   line of exactly `width' numbers per row, and add its samples to
+   `stats' if that is not NULL.  Returns zero on success, or one if the
+   input has to be read as a stream instead.  */
+int conv_rows(EncClass *classes, unsigned int num_classes,
+	      const char *data, size_t len,
+	      unsigned int width, unsigned int height, long num_threads,
+	      float *grid, SampleStats *stats) {
+  ConvJob job;
+
+  if (width == 0 || height == 0)
+    return 1;
+  job.classes = classes;
+  job.num_classes = num_classes;
+  job.width = width;
+  job.num_rows = height;
+  job.row_starts = (const char**)malloc(sizeof(char*) * height);
+  job.row_ends = (const char**)malloc(sizeof(char*) * height);
+  job.raw = NULL;
+  job.input_format = INPUT_CSV;
+  job.grid = grid;
+  job.stats = stats;
+  job.next_row = 0;
+  job.malformed = 0;
+  if (job.row_starts == NULL || job.row_ends == NULL ||
+      index_rows(data, len, height, job.row_starts, job.row_ends) != 0) {
+    free(job.row_starts); free(job.row_ends);
+    return 1;
+  }
+
+  pthread_mutex_init(&job.lock, NULL);
+  if (num_threads > (height + ROW_BLOCK - 1) / ROW_BLOCK)
+    num_threads = (height + ROW_BLOCK - 1) / ROW_BLOCK;
+  run_threads(conv_worker, &job, num_threads);
+  pthread_mutex_destroy(&job.lock);
+  free(job.row_starts); free(job.row_ends);
+  return job.malformed;
+}
+
+/* Convert a 16-bit float to a 32-bit float.  */
+float half_to_float(unsigned int h) {
+  uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+  unsigned int exponent = (h >> 10) & 0x1f, mantissa = h & 0x3ff;
+  uint32_t bits;
+  float value;
+  if (exponent == 0x1f) /* Infinity or NaN */
+    bits = sign | 0x7f800000 | ((uint32_t)mantissa << 13);
+  else if (exponent != 0)
+    bits = sign | ((uint32_t)(exponent + 127 - 15) << 23) |
+      ((uint32_t)mantissa << 13);
+  else {
+    /* Zero or subnormal, which is exact as a normal 32-bit float.  */
+    value = mantissa * (1.0f / 16777216.0f);
+    memcpy(&bits, &value, sizeof(bits));
+    bits |= sign;
+  }
+  memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+/* Get a row of `n' raw samples as floats.  Little endian 32-bit floats
+   are used in place when this host is also little endian and they are
+   aligned, and anything else is decoded into `buffer'.  */
+const float *decode_raw_row(unsigned int input_format,
+			    const unsigned char *in, unsigned int n,
+			    float *buffer) {
+  static const uint16_t one = 1;
+  unsigned int j;
+  if (input_format == INPUT_F32) {
+    if (*(const unsigned char*)&one == 1 &&
+	(uintptr_t)in % sizeof(float) == 0)
+      return (const float*)in;
+    for (j = 0; j < n; j++) {
+      uint32_t bits = (uint32_t)in[4*j] | ((uint32_t)in[4*j+1] << 8) |
+	((uint32_t)in[4*j+2] << 16) | ((uint32_t)in[4*j+3] << 24);
+      memcpy(&buffer[j], &bits, sizeof(float));
+    }
+  } else {
+    for (j = 0; j < n; j++)
+      buffer[j] = half_to_float(in[2*j] | (in[2*j+1] << 8));
+  }
+  return buffer;
+}
+
+/* Encode raw input into the image of every class, or store it into
+   `grid' if that is not NULL, on `num_threads' threads, and add its
+   samples to `stats' if that is not NULL.  Returns zero on success,
+   one if the input is not exactly `width * height' samples.  */
+int conv_raw(EncClass *classes, unsigned int num_classes,
+	     unsigned int input_format, const char *data, size_t len,
+	     unsigned int width, unsigned int height, long num_threads,
+	     float *grid, SampleStats *stats) {
+  ConvJob job;
+  size_t sample_size = (input_format == INPUT_F32) ? 4 : 2;
+
+  if (len != sample_size * width * height) {
+    fprintf(stderr, "Error: Expected %lu bytes of raw input, found %lu.\n",
+	    (unsigned long)(sample_size * width * height),
+	    (unsigned long)len);
+    return 1;
+  }
+  if (width == 0 || height == 0)
+    return 0;
+  job.classes = classes;
+  job.num_classes = num_classes;
+  job.width = width;
+  job.num_rows = height;
+  job.row_starts = NULL;
+  job.row_ends = NULL;
+  job.raw = (const unsigned char*)data;
+  job.input_format = input_format;
+  job.grid = grid;
+  job.stats = stats;
+  job.next_row = 0;
+  job.malformed = 0;
+
+  pthread_mutex_init(&job.lock, NULL);
+  if (num_threads > (height + ROW_BLOCK - 1) / ROW_BLOCK)
+    num_threads = (height + ROW_BLOCK - 1) / ROW_BLOCK;
+  run_threads(conv_worker, &job, num_threads);
+  pthread_mutex_destroy(&job.lock);
+  if (job.malformed)
+    fputs("Error: Out of memory.\n", stderr);
+  return job.malformed;
+}
+
+/* Encode the input one number at a time and write out every complete
+   row, exactly as reading it with `scanf("%f")' and skipping one
+   delimiter after every number would.  TGA images are written out one
+   row at a time, using the first row of the image as a buffer, and PNG
+   images keep the first `height' rows to be written out later.  The
+   first `height' rows are added to `stats' if that is not NULL.  */
+void conv_stream(EncClass *classes, unsigned int num_classes,
+		 const char *data, size_t len,
+		 unsigned int width, unsigned int height, SampleStats *stats) {
+  const char *p = data, *end = data + len;
+  float *values = (float*)malloc(sizeof(float) * (width + 1));
+  unsigned int num_values = 0, num_rows = 0;
+  float in_val = 0;
+
+  if (width == 0) {
+    free(values);
+    return;
+  }
+  if (values == NULL) {
+    fputs("Error: Out of memory.\n", stderr);
+    return;
+  }
+  while (1) {
+    const char *next;
+    float value;
+    while (p < end && isspace((unsigned char)*p))
+      p++;
+    if (p == end)
+      break;
+    /* Like `scanf()', leave the previous value if there is no number,
+       and like the GNU C library's `scanf()', skip any sign and
+       decimal point that did not start one, and any exponent marker
+       and sign that are not followed by digits.  */
+    next = parse_float(p, end, &value);
+    if (next != NULL) {
+      p = next; in_val = value;
+      if (p < end && (*p | 0x20) == 'e') {
+	next = p + 1;
+	if (next < end && (*next == '-' || *next == '+'))
+	  next++;
+	if (next == end || *next < '0' || *next > '9')
+	  p = next;
+      }
+    } else {
+      if (*p == '-' || *p == '+')
+	p++;
+      if (p < end && *p == '.')
+	p++;
+    }
+
+    values[num_values++] = in_val;
+    if (num_values == width) {
+      unsigned int c;
+      if (stats != NULL && num_rows < height)
+	stats_add(stats, values, width);
+      for (c = 0; c < num_classes; c++) {
+	const EncKernel *k = &classes[c].kernel;
+	if (!classes[c].png) {
+	  encode_split_row(k, values, width, classes[c].image);
+	  fwrite(classes[c].image, width * k->bytes, 1, classes[c].fout);
+	} else if (num_rows < height)
+	  encode_split_row(k, values, width, classes[c].image +
+			   (size_t)width * k->bytes * num_rows);
+      }
+      num_values = 0;
+      num_rows++;
+    }
+
+    if (p < end)
+      p++; /* Ignore the delimeter that follows.  */
+  }
+  free(values);
+}
+
+/* Convert the input `fin' into the image of every class.  Each image
+   is written to `fout' of its class, or to a new file named `out_name'
+   if `fout' is NULL.  If `stats' is not NULL, the statistics of the
+   frame, and in pyramid mode of its tiles, are computed into it, and
+   the caller must free its `tiles'.  Returns zero on success, one on
+   failure.  */
+int conv_frame(EncClass *classes, unsigned int num_classes, FILE *fin,
+	       unsigned int input_format, unsigned int width,
+	       unsigned int height, unsigned int tile_size, long num_threads,
+	       FrameStats *stats) {
+  const char *data;
+  size_t len, map_len;
+  void *map;
+  unsigned int c;
+  int streamed = 0, retval = 0;
+  SampleStats *frame_stats = NULL;
+
+  if (stats != NULL) {
+    stats_init(&stats->frame);
+    stats->num_tiles = 0;
+    stats->tiles = NULL;
+    frame_stats = &stats->frame;
+  }
+  if (tile_size != 0) {
+    if (load_input(fin, &data, &len, &map, &map_len) != 0)
+      return 1;
+    retval = conv_pyramid(classes, num_classes, input_format, data, len,
+			  width, height, tile_size, num_threads, stats);
+    free_input(data, map, map_len);
+    return retval;
+  }
+
+  for (c = 0; c < num_classes; c++) {
+    classes[c].image = NULL;
+    if (classes[c].out_name != NULL)
+      classes[c].fout = NULL;
+  }
+  for (c = 0; c < num_classes; c++) {
+    EncClass *cls = &classes[c];
+    if (cls->fout == NULL &&
+	(cls->fout = fopen(cls->out_name, "wb")) == NULL) {
+      fprintf(stderr, "Error: Could not open %s: %s\n",
+	      cls->out_name, strerror(errno));
+      retval = 1;
+      break;
+    }
+    if (!cls->png)
+      write_tga_header(cls->fout, width, height, cls->params.bpp);
+    /* Rows that are missing from the input are left black in PNG
+       images.  */
+    cls->image = (unsigned char*)
+      calloc((size_t)width * height * cls->kernel.bytes + 1, 1);
+    if (cls->image == NULL) {
+      fputs("Error: Out of memory.\n", stderr);
+      retval = 1;
+      break;
+    }
+  }
+
+  if (retval == 0 && load_input(fin, &data, &len, &map, &map_len) != 0)
+    retval = 1;
+  if (retval == 0) {
+    if (input_format != INPUT_CSV)
+      retval = conv_raw(classes, num_classes, input_format, data, len,
+			width, height, num_threads, NULL, frame_stats);
+    else if (conv_rows(classes, num_classes, data, len, width, height,
+		       num_threads, NULL, frame_stats) != 0) {
+      /* This writes out the TGA images as it goes.  */
+      if (frame_stats != NULL)
+	stats_init(frame_stats);
+      conv_stream(classes, num_classes, data, len, width, height,
+		  frame_stats);
+      streamed = 1;
+    }
+    free_input(data, map, map_len);
+  }
+  if (retval == 0) {
+    for (c = 0; c < num_classes; c++) {
+      if (!classes[c].png && !streamed)
+	fwrite(classes[c].image, width * classes[c].kernel.bytes, height,
+	       classes[c].fout);
+    }
+
+    for (c = 0; c < num_classes; c++) {
+      EncClass *cls = &classes[c];
+      if (cls->png &&
+	  write_png(cls->fout, cls->image, width, height, cls->kernel.bytes,
+		    cls->png_filter, cls->png_level, cls->png_strategy,
+		    num_threads) != 0) {
+	fprintf(stderr, "Error: Could not write %s.\n", cls->out_name);
+	retval = 1;
+      }
+    }
+  }
+
+  for (c = 0; c < num_classes; c++) {
+    EncClass *cls = &classes[c];
+    free(cls->image);
+    cls->image = NULL;
+    if (cls->out_name != NULL && cls->fout != NULL) {
+      if (fclose(cls->fout) != 0 && retval == 0) {
+	fprintf(stderr, "Error: Could not write %s: %s\n",
+		cls->out_name, strerror(errno));
+	retval = 1;
+      }
+      cls->fout = NULL;
+    }
+  }
+  return retval;
+}
+
+/* Write an image of a class with `bytes' bytes per pixel, whose
+   pixels `image' holds bottom-up as for TGA.  Returns zero on success,
+   one on failure.  */
+int write_image(FILE *fp, const EncClass *cls, const unsigned char *image,
+		unsigned int width, unsigned int height, unsigned int bytes,
+		long num_threads) {
+  if (cls->png)
+    return write_png(fp, image, width, height, bytes, cls->png_filter,
+		     cls->png_level, cls->png_strategy, num_threads);
+  write_tga_header(fp, width, height, bytes * 8);
+  fwrite(image, (size_t)width * bytes, height, fp);
+  return ferror(fp) ? 1 : 0;
+}
+
+/* Store one row of samples into `out' with longitude zero shifted
+   from the left to the center, as `encode_split_row()' does.  */
+void store_grid_row(const float *in, unsigned int width, float *out) {
+  unsigned int half = width / 2;
+  memcpy(out + half, in, sizeof(float) * (width - half));
+  memcpy(out, in + width - half, sizeof(float) * half);
+}
+
+/* Halve the resolution of a level into `dest', whose dimensions must
+   be those of `src' halved and rounded up.  Every sample is the mean
+   of the samples of the up to 2x2 block that it covers, ignoring NaN,
+   or NaN if all of them are NaN.  */
+void downsample_level(const PyrLevel *src, PyrLevel *dest) {
+  unsigned int i, j;
+  for (i = 0; i < dest->height; i++) {
+    const float *rows[2];
+    float *out = dest->samples + (size_t)dest->width * i;
+    unsigned int num_rows = (2 * i + 1 < src->height) ? 2 : 1;
+    rows[0] = src->samples + (size_t)src->width * 2 * i;
+    rows[1] = rows[0] + src->width;
+    for (j = 0; j < dest->width; j++) {
+      unsigned int num_cols = (2 * j + 1 < src->width) ? 2 : 1;
+      unsigned int m, n, count = 0;
+      float sum = 0;
+      for (m = 0; m < num_rows; m++) {
+	for (n = 0; n < num_cols; n++) {
+	  float value = rows[m][2*j+n];
+	  if (!isnan(value)) {
+	    sum += value;
+	    count++;
+	  }
+	}
+      }
+      out[j] = (count > 0) ? sum / count : NAN;
+    }
+  }
+}
+
+/* Get the name of the tile directory of an image: the name of the
+   image without its extension.  The result is allocated with
+   `malloc()'.  */
+char *pyramid_dir(const char *out_name) {
+  char *dir = (char*)malloc(strlen(out_name) + 1);
+  char *dot, *slash;
+  if (dir == NULL)
+    return NULL;
+  strcpy(dir, out_name);
+  dot = strrchr(dir, '.');
+  slash = strrchr(dir, '/');
+  if (dot != NULL && (slash == NULL || dot > slash + 1))
+    *dot = '\0';
+  return dir;
+}
+
+/* Take tiles off of the shared counter, and cut each of them out of
+   its level and write it for every class.  Tiles are padded with NaN
+   past the edges of their level.  Every tile has its own statistics,
+   so they need no lock.  */
+void *tile_worker(void *arg) {
+  TileJob *job = (TileJob*)arg;
+  unsigned int size = job->tile_size;
+  float *tile = (float*)malloc(sizeof(float) * size * size);
+  unsigned char *image = (unsigned char*)malloc((size_t)size * size * 3 + 1);
+
+  while (tile != NULL && image != NULL) {
+    const PyrLevel *level;
+    unsigned int t, index, z, x, y, i, j, c;
+    pthread_mutex_lock(&job->lock);
+    t = job->next_tile++;
+    if (job->failed)
+      t = job->num_tiles;
+    pthread_mutex_unlock(&job->lock);
+    if (t >= job->num_tiles)
+      break;
+    index = t;
+    for (z = 0; t >= job->levels[z].tiles_x * job->levels[z].tiles_y; z++)
+      t -= job->levels[z].tiles_x * job->levels[z].tiles_y;
+    level = &job->levels[z];
+    x = t % level->tiles_x;
+    y = t / level->tiles_x;
+
+    for (i = 0; i < size; i++) {
+      unsigned int row = y * size + i;
+      float *out = tile + (size_t)size * i;
+      for (j = 0; j < size; j++) {
+	unsigned int col = x * size + j;
+	out[j] = (row < level->height && col < level->width) ?
+	  level->samples[(size_t)level->width * row + col] : NAN;
+      }
+      /* The padding is not part of the statistics.  */
+      if (job->tile_stats != NULL && row < level->height)
+	stats_add(&job->tile_stats[index], out,
+		  (level->width - x * size < size) ?
+		  level->width - x * size : size);
+    }
+
+    for (c = 0; c < job->num_classes; c++) {
+      const EncClass *cls = &job->classes[c];
+      const EncKernel *k = &cls->kernel;
+      char *filename = (char*)malloc(strlen(job->dirs[c]) + 48);
+      FILE *fp = NULL;
+      int failed = 1;
+      for (i = 0; i < size; i++)
+	k->encode_row(k, tile + (size_t)size * i, size,
+		      image + (size_t)size * k->bytes * (size - 1 - i));
+      if (filename != NULL) {
+	sprintf(filename, "%s/%u_%u_%u.%s", job->dirs[c], z, x, y,
+		cls->png ? "png" : "tga");
+	fp = fopen(filename, "wb");
+	if (fp == NULL)
+	  fprintf(stderr, "Error: Could not open %s: %s\n",
+		  filename, strerror(errno));
+	else {
+	  failed = write_image(fp, cls, image, size, size, k->bytes, 1);
+	  if (fclose(fp) != 0)
+	    failed = 1;
+	  if (failed)
+	    fprintf(stderr, "Error: Could not write %s.\n", filename);
+	}
+      }
+      free(filename);
+      if (failed) {
+	pthread_mutex_lock(&job->lock);
+	job->failed = 1;
+	pthread_mutex_unlock(&job->lock);
+	break;
+      }
+    }
+  }
+  if (tile == NULL || image == NULL) {
+    pthread_mutex_lock(&job->lock);
+    job->failed = 1;
+    pthread_mutex_unlock(&job->lock);
+  }
+  free(tile);
+  free(image);
+  return NULL;
+}
+
+/* Write the "manifest.json" that describes the pyramid of a class into
+   its tile directory `dir'.  The manifest is written last and renamed
+   into place, so that it is only there once all tiles are.  Returns
+   zero on success, one on failure.  */
+int write_manifest(const char *dir, const EncClass *cls,
+		   const PyrLevel *levels, unsigned int num_levels,
+		   unsigned int tile_size) {
+  char *filename = (char*)malloc(strlen(dir) + 32);
+  char *part_name = (char*)malloc(strlen(dir) + 32);
+  FILE *fp = NULL;
+  unsigned int z;
+  int retval = 1;
+
+  if (filename == NULL || part_name == NULL) {
+    fputs("Error: Out of memory.\n", stderr);
+    free(filename); free(part_name);
+    return 1;
+  }
+  sprintf(filename, "%s/manifest.json", dir);
+  sprintf(part_name, "%s/manifest.json.part", dir);
+  fp = fopen(part_name, "wt");
+  if (fp == NULL) {
+    fprintf(stderr, "Error: Could not open %s: %s\n",
+	    part_name, strerror(errno));
+    free(filename); free(part_name);
+    return 1;
+  }
+  fprintf(fp, "{\n"
+	  "  \"tileSize\": %u,\n"
+	  "  \"maxZoom\": %u,\n"
+	  "  \"format\": \"%s\",\n"
+	  "  \"bitsBefDec\": %u,\n"
+	  "  \"bitsAftDec\": %u,\n"
+	  "  \"noiseMargin\": %u,\n"
+	  "  \"levels\": [\n", tile_size, num_levels - 1,
+	  cls->png ? "png" : "tga", cls->params.bbd, cls->params.bad,
+	  cls->params.noise_margin);
+  for (z = 0; z < num_levels; z++) {
+    fprintf(fp, "    { \"width\": %u, \"height\": %u, "
+	    "\"tilesX\": %u, \"tilesY\": %u }%s\n",
+	    levels[z].width, levels[z].height,
+	    levels[z].tiles_x, levels[z].tiles_y,
+	    (z + 1 < num_levels) ? "," : "");
+  }
+  fputs("  ]\n"
+	"}\n", fp);
+  if (fclose(fp) != 0)
+    fprintf(stderr, "Error: Could not write %s.\n", part_name);
+  else if (rename(part_name, filename) != 0)
+    fprintf(stderr, "Error: Could not rename %s: %s\n",
+	    part_name, strerror(errno));
+  else
+    retval = 0;
+  if (retval != 0)
+    remove(part_name);
+  free(filename); free(part_name);
+  return retval;
+}
+
+/* Build a pyramid of the input by halving its resolution until it fits
+   into one tile, and write the tiles of every level for every class,
+   with `num_threads' threads.  Level zero is the coarsest.  Every level
+   is encoded from the averaged floats, rather than from a finer image,
+   so that every level has the full precision of its class.  If
+   `stats' is not NULL, the statistics of the finest level and of every
+   tile are computed into it.  Returns zero on success, one on
+   failure.  */
+int conv_pyramid(EncClass *classes, unsigned int num_classes,
+		 unsigned int input_format, const char *data, size_t len,
+		 unsigned int width, unsigned int height,
+		 unsigned int tile_size, long num_threads, FrameStats *stats) {
+  PyrLevel levels[MAX_LEVELS];
+  char *dirs[MAX_CLASSES];
+  TileJob job;
+  unsigned int num_levels = 1, num_dirs = 0, z, c;
+  unsigned int level_width = width, level_height = height;
+  int retval = 0;
+
+  if (width == 0 || height == 0) {
+    fputs("Error: Pyramid mode needs a nonempty input.\n", stderr);
+    return 1;
+  }
+  while ((level_width > tile_size || level_height > tile_size) &&
+	 num_levels < MAX_LEVELS) {
+    level_width = (level_width + 1) / 2;
+    level_height = (level_height + 1) / 2;
+    num_levels++;
+  }
+  level_width = width;
+  level_height = height;
+  for (z = num_levels; z-- > 0; ) {
+    levels[z].width = level_width;
+    levels[z].height = level_height;
+    levels[z].tiles_x = (level_width + tile_size - 1) / tile_size;
+    levels[z].tiles_y = (level_height + tile_size - 1) / tile_size;
+    levels[z].samples = (float*)
+      malloc(sizeof(float) * level_width * level_height);
+    if (levels[z].samples == NULL)
+      retval = 1;
+    level_width = (level_width + 1) / 2;
+    level_height = (level_height + 1) / 2;
+  }
+  if (retval != 0)
+    fputs("Error: Out of memory.\n", stderr);
+
+  /* Read the finest level, and average it down to the coarser ones.  */
+  if (retval == 0)
+    retval = read_grid(input_format, data, len, width, height, num_threads,
+		       levels[num_levels-1].samples,
+		       (stats != NULL) ? &stats->frame : NULL);
+  for (z = num_levels - 1; retval == 0 && z > 0; z--)
+    downsample_level(&levels[z], &levels[z-1]);
+
+  for (c = 0; retval == 0 && c < num_classes; c++) {
+    dirs[c] = pyramid_dir(classes[c].out_name);
+    if (dirs[c] == NULL) {
+      fputs("Error: Out of memory.\n", stderr);
+      retval = 1;
+      break;
+    }
+    num_dirs++;
+    if (mkdir(dirs[c], 0777) != 0 && errno != EEXIST) {
+      fprintf(stderr, "Error: Could not create %s: %s\n",
+	      dirs[c], strerror(errno));
+      retval = 1;
+    }
+  }
+
+  if (retval == 0) {
+    job.classes = classes;
+    job.num_classes = num_classes;
+    job.dirs = dirs;
+    job.levels = levels;
+    job.num_levels = num_levels;
+    job.tile_size = tile_size;
+    job.next_tile = 0;
+    job.num_tiles = 0;
+    for (z = 0; z < num_levels; z++)
+      job.num_tiles += levels[z].tiles_x * levels[z].tiles_y;
+    job.tile_stats = NULL;
+    if (stats != NULL) {
+      stats->tiles = (SampleStats*)
+	malloc(sizeof(SampleStats) * job.num_tiles);
+      if (stats->tiles == NULL) {
+	fputs("Error: Out of memory.\n", stderr);
+	retval = 1;
+      } else {
+	stats->num_tiles = job.num_tiles;
+	for (z = 0; z < job.num_tiles; z++)
+	  stats_init(&stats->tiles[z]);
+	job.tile_stats = stats->tiles;
+      }
+    }
+    job.failed = 0;
+  }
+  if (retval == 0) {
+    pthread_mutex_init(&job.lock, NULL);
+    if (num_threads > job.num_tiles)
+      num_threads = job.num_tiles;
+    run_threads(tile_worker, &job, num_threads);
+    pthread_mutex_destroy(&job.lock);
+    retval = job.failed;
+  }
+
+  for (c = 0; retval == 0 && c < num_classes; c++)
+    retval = write_manifest(dirs[c], &classes[c], levels, num_levels,
+			    tile_size);
+
+  for (c = 0; c < num_dirs; c++)
+    free(dirs[c]);
+  for (z = 0; z < num_levels; z++)
+    free(levels[z].samples);
+  return retval;
+}
+
+/* Store the samples of raw or CSV input into `grid' as
+   `store_grid_row()' does, on `num_threads' threads, and add them to
+   `stats' if that is not NULL.  CSV input must have one line of
+   exactly `width' numbers per row.  Returns zero on success, one on
+   failure.  */
+int read_grid(unsigned int input_format, const char *data, size_t len,
+	      unsigned int width, unsigned int height, long num_threads,
+	      float *grid, SampleStats *stats) {
+  if (input_format != INPUT_CSV)
+    return conv_raw(NULL, 0, input_format, data, len, width, height,
+		    num_threads, grid, stats);
+  if (conv_rows(NULL, 0, data, len, width, height, num_threads, grid,
+		stats) != 0) {
+    fprintf(stderr, "Error: Expected one line of exactly %u numbers "
+	    "per row.\n", width);
+    return 1;
+  }
+  return 0;
+}
+
+/* Quantize `n' samples into their fixed-point codes, as a keyframe
+   holds them.  */
+void quantize_row(const EncKernel *k, const float *in, unsigned int n,
+		  unsigned int *codes) {
+  unsigned int i;
+  for (i = 0; i < n; i++)
+    codes[i] = quantize_one(k, in[i]);
+}
+
+/* Encode `n' samples into the 8-bit pixels of a delta frame, against
+   the codes of the previous frame as the decoder reconstructs them,
+   and update `codes' to the reconstruction of this frame.  Each pixel
+   is `DELTA_ZERO' plus the difference between the codes in steps of
+   `quantum', rounded to the nearest step and limited to
+   `DELTA_MAX' steps either way, or `DELTA_NAN' for NaN.  Since the
+   differences are taken from the reconstruction rather than from the
+   exact previous codes, the error never exceeds half a step for long:
+   whatever a limited step leaves out is carried over to the next
+   frame.  Samples that were NaN in the previous frame start from code
+   `k->zero', the code of zero.  */
+void encode_delta_row(const EncKernel *k, unsigned int quantum,
+		      const float *in, unsigned int n, unsigned int *codes,
+		      unsigned char *out) {
+  int lo = (int)k->zero + k->min, hi = (int)k->zero + k->max;
+  int half = quantum / 2;
+  unsigned int i;
+  for (i = 0; i < n; i++) {
+    int code = quantize_one(k, in[i]), base, diff, steps;
+    if (code == 0) {
+      out[i] = DELTA_NAN;
+      codes[i] = 0;
+      continue;
+    }
+    base = (codes[i] != 0) ? (int)codes[i] : (int)k->zero;
+    diff = code - base;
+    steps = (diff >= 0) ? (diff + half) / (int)quantum :
+      -((-diff + half) / (int)quantum);
+    if (steps > DELTA_MAX) steps = DELTA_MAX;
+    if (steps < -DELTA_MAX) steps = -DELTA_MAX;
+    code = base + steps * (int)quantum;
+    if (code > hi) code = hi;
+    if (code < lo) code = lo;
+    out[i] = DELTA_ZERO + steps;
+    codes[i] = code;
+  }
+}
+
+/* Start statistics without any samples.  */
+void stats_init(SampleStats *stats) {
+  memset(stats, 0, sizeof(SampleStats));
+  stats->min = INFINITY;
+  stats->max = -INFINITY;
+}
+
+/* Add `n' samples to the statistics.  */
+void stats_add(SampleStats *stats, const float *in, unsigned int n) {
+  const float bin_scale = STATS_BINS / (STATS_MAX - STATS_MIN);
+  float min = stats->min, max = stats->max;
+  double sum = 0;
+  unsigned int i, nan_count = 0;
+  for (i = 0; i < n; i++) {
+    float value = in[i];
+    unsigned int bin;
+    if (value != value) {
+      nan_count++;
+      continue;
+    }
+    if (value < min) min = value;
+    if (value > max) max = value;
+    sum += value;
+    if (value < STATS_MIN)
+      bin = 0;
+    else if (value >= STATS_MAX)
+      bin = STATS_BINS - 1;
+    else {
+      bin = (unsigned int)((value - STATS_MIN) * bin_scale);
+      if (bin >= STATS_BINS) bin = STATS_BINS - 1;
+    }
+    stats->hist[bin]++;
+  }
+  stats->min = min;
+  stats->max = max;
+  stats->sum += sum;
+  stats->count += n;
+  stats->nan_count += nan_count;
+}
+
+/* Add the samples of `src' to the statistics `dest'.  */
+void stats_merge(SampleStats *dest, const SampleStats *src) {
+  unsigned int b;
+  if (src->min < dest->min) dest->min = src->min;
+  if (src->max > dest->max) dest->max = src->max;
+  dest->sum += src->sum;
+  dest->count += src->count;
+  dest->nan_count += src->nan_count;
+  for (b = 0; b < STATS_BINS; b++)
+    dest->hist[b] += src->hist[b];
+}
+
+static void put_u32(unsigned char *p, uint32_t value) {
+  p[0] = value & 0xff;
+  p[1] = (value >> 8) & 0xff;
+  p[2] = (value >> 16) & 0xff;
+  p[3] = (value >> 24) & 0xff;
+}
+
+static uint32_t get_u32(const unsigned char *p) {
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+    ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void put_u64(unsigned char *p, uint64_t value) {
+  put_u32(p, (uint32_t)value);
+  put_u32(p + 4, (uint32_t)(value >> 32));
+}
+
+static uint64_t get_u64(const unsigned char *p) {
+  return get_u32(p) | ((uint64_t)get_u32(p + 4) << 32);
+}
+
+static void put_float(unsigned char *p, float value) {
+  uint32_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  put_u32(p, bits);
+}
+
+static float get_float(const unsigned char *p) {
+  uint32_t bits = get_u32(p);
+  float value;
+  memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+/* Size of a statistics record in the file, see the top of this file */
+#define STATS_RECORD_SIZE (4 * 3 + 8 * (2 + STATS_BINS))
+
+static const char stats_signature[8] =
+  { 'O', 'E', 'V', 'S', 'S', 'T', 'A', '1' };
+
+/* Write the statistics of a frame in the format described at the top
+   of this file.  The file is written under a temporary name and
+   renamed once it is complete.  Returns zero on success, one on
+   failure.  */
+int write_stats(const char *filename, const FrameStats *stats) {
+  unsigned char header[8 + 4 * 4], record[STATS_RECORD_SIZE];
+  char *part_name = (char*)malloc(strlen(filename) + 8);
+  unsigned int r, b;
+  FILE *fp;
+  int retval = 0;
+
+  if (part_name == NULL) {
+    fputs("Error: Out of memory.\n", stderr);
+    return 1;
+  }
+  sprintf(part_name, "%s.part", filename);
+  fp = fopen(part_name, "wb");
+  if (fp == NULL) {
+    fprintf(stderr, "Error: Could not open %s: %s\n",
+	    part_name, strerror(errno));
+    free(part_name);
+    return 1;
+  }
+  memcpy(header, stats_signature, sizeof(stats_signature));
+  put_u32(header + 8, STATS_BINS);
+  put_u32(header + 12, stats->num_tiles);
+  put_float(header + 16, STATS_MIN);
+  put_float(header + 20, STATS_MAX);
+  fwrite(header, sizeof(header), 1, fp);
+  for (r = 0; r <= stats->num_tiles; r++) {
+    const SampleStats *s = (r == 0) ? &stats->frame : &stats->tiles[r-1];
+    uint64_t num_values = s->count - s->nan_count;
+    put_float(record, (num_values > 0) ? s->min : NAN);
+    put_float(record + 4, (num_values > 0) ? s->max : NAN);
+    put_float(record + 8, (num_values > 0) ? s->sum / num_values : NAN);
+    put_u64(record + 12, s->count);
+    put_u64(record + 20, s->nan_count);
+    for (b = 0; b < STATS_BINS; b++)
+      put_u64(record + 28 + 8 * b, s->hist[b]);
+    fwrite(record, sizeof(record), 1, fp);
+  }
+  if (ferror(fp) | fclose(fp)) {
+    fprintf(stderr, "Error: Could not write %s.\n", part_name);
+    retval = 1;
+  } else if (rename(part_name, filename) != 0) {
+    fprintf(stderr, "Error: Could not rename %s: %s\n",
+	    part_name, strerror(errno));
+    retval = 1;
+  }
+  if (retval != 0)
+    remove(part_name);
+  free(part_name);
+  return retval;
+}
+
+/* Read the statistics of the frame, but not of the tiles, from a file
+   that was written by `write_stats()'.  Returns zero on success, one
+   on failure, without any message.  */
+int read_stats(const char *filename, SampleStats *stats) {
+  unsigned char header[8 + 4 * 4], record[STATS_RECORD_SIZE];
+  FILE *fp = fopen(filename, "rb");
+  uint64_t num_values;
+  unsigned int b;
+  int retval;
+
+  if (fp == NULL)
+    return 1;
+  retval = (fread(header, sizeof(header), 1, fp) != 1 ||
+	    memcmp(header, stats_signature, sizeof(stats_signature)) ||
+	    get_u32(header + 8) != STATS_BINS ||
+	    get_float(header + 16) != STATS_MIN ||
+	    get_float(header + 20) != STATS_MAX ||
+	    fread(record, sizeof(record), 1, fp) != 1);
+  fclose(fp);
+  if (retval != 0)
+    return 1;
+
+  stats_init(stats);
+  stats->count = get_u64(record + 12);
+  stats->nan_count = get_u64(record + 20);
+  num_values = stats->count - stats->nan_count;
+  if (num_values > 0) {
+    stats->min = get_float(record);
+    stats->max = get_float(record + 4);
+    stats->sum = (double)get_float(record + 8) * num_values;
+  }
+  for (b = 0; b < STATS_BINS; b++)
+    stats->hist[b] = get_u64(record + 28 + 8 * b);
+  return 0;
+}
+
+/* Run `worker(arg)' on `num_threads' threads, or on this thread if
+   none can be started, and wait for them to finish.  */
+void run_threads(void *(*worker)(void*), void *arg, long num_threads) {
+  pthread_t *threads;
+  long num_started = 0, i;
+  if (num_threads <= 1) {
+    worker(arg);
+    return;
+  }
+  threads = (pthread_t*)malloc(sizeof(pthread_t) * num_threads);
+  for (i = 0; threads != NULL && i < num_threads; i++) {
+    if (pthread_create(&threads[i], NULL, worker, arg) != 0)
+      break;
+    num_started++;
+  }
+  if (num_started == 0)
+    worker(arg);
+  for (i = 0; i < num_started; i++)
+    pthread_join(threads[i], NULL);
+  free(threads);
+}
+
+/* Filter a row of `n' bytes with `bytes' bytes per pixel into `out',
+   which gets the filter type byte followed by the filtered row.
+   `prev' is the previous row, which is all zeros for the first row.
+   `scratch' must hold `n + 1' bytes for the adaptive filter.  */
+void png_filter_row(unsigned int filter, unsigned int bytes,
+		    const unsigned char *cur, const unsigned char *prev,
+		    unsigned int n, unsigned char *out, unsigned char *scratch) {
+  unsigned int i;
+
+  if (filter == PNG_FILTER_ADAPTIVE) {
+    unsigned long best_sum = ~0ul;
+    unsigned int f;
+    for (f = 0; f < PNG_FILTER_ADAPTIVE; f++) {
+      unsigned char *dest = (f == 0) ? out : scratch;
+      unsigned long sum = 0;
+      png_filter_row(f, bytes, cur, prev, n, dest, NULL);
+      for (i = 1; i <= n && sum < best_sum; i++)
+	sum += (dest[i] < 128) ? dest[i] : 256 - dest[i];
+      if (sum < best_sum) {
+	best_sum = sum;
+	if (dest != out)
+	  memcpy(out, dest, n + 1);
+      }
+    }
+    return;
+  }
+
+  out[0] = filter;
+  out++;
+  switch (filter) {
+  case 0: /* None */
+    memcpy(out, cur, n);
+    break;
+  case 1: /* Sub */
+    for (i = 0; i < bytes && i < n; i++)
+      out[i] = cur[i];
+    for (; i < n; i++)
+      out[i] = cur[i] - cur[i-bytes];
+    break;
+  case 2: /* Up */
+    for (i = 0; i < n; i++)
+      out[i] = cur[i] - prev[i];
+    break;
+  case 3: /* Average */
+    for (i = 0; i < bytes && i < n; i++)
+      out[i] = cur[i] - (prev[i] >> 1);
+    for (; i < n; i++)
+      out[i] = cur[i] - ((cur[i-bytes] + prev[i]) >> 1);
+    break;
+  case 4: /* Paeth */
+    for (i = 0; i < bytes && i < n; i++)
+      out[i] = cur[i] - prev[i];
+    for (; i < n; i++) {
+      int a = cur[i-bytes], b = prev[i], c = prev[i-bytes];
+      int pa = abs(b - c), pb = abs(a - c), pc = abs(a + b - 2 * c);
+      int pred = (pa <= pb && pa <= pc) ? a : (pb <= pc) ? b : c;
+      out[i] = cur[i] - pred;
     }
+    break;
+  }
+}
+
+/* Take blocks of PNG rows off of the shared counter and filter them
+   while in phase 0, or compress them while in phase 1.  */
+void *png_worker(void *arg) {
+  PngJob *job = (PngJob*)arg;
+  unsigned int row_bytes = job->width * job->bytes;
+  unsigned char *bufs = (unsigned char*)malloc(3 * (size_t)row_bytes + 1);
+
+  if (bufs == NULL) {
+    pthread_mutex_lock(&job->lock);
+    job->failed = 1;
+    pthread_mutex_unlock(&job->lock);
+    return NULL;
+  }
+
+  while (1) {
+    unsigned int b, first, last;
+    pthread_mutex_lock(&job->lock);
+    b = job->next_block++;
+    if (job->failed)
+      b = job->num_blocks;
+    pthread_mutex_unlock(&job->lock);
+    if (b >= job->num_blocks)
+      break;
+    first = b * job->rows_per_block;
+    last = first + job->rows_per_block;
+    if (last > job->height)
+      last = job->height;
+
+    if (job->phase == 0) {
+      /* PNG pixels are red, green, blue, whereas TGA pixels are blue,
+	 green, red.  */
+      unsigned char *cur = bufs, *prev = bufs + row_bytes;
+      unsigned char *scratch = bufs + 2 * (size_t)row_bytes;
+      unsigned int i, r;
+      for (r = (first > 0) ? first - 1 : first; r < last; r++) {
+	const unsigned char *src =
+	  job->image + (size_t)row_bytes * (job->height - 1 - r);
+	unsigned char *swap;
+	if (job->bytes == 1)
+	  memcpy(cur, src, row_bytes);
+	else {
+	  for (i = 0; i < row_bytes; i += 3) {
+	    cur[i] = src[i+2]; cur[i+1] = src[i+1]; cur[i+2] = src[i];
+	  }
+	}
+	if (r == 0)
+	  memset(prev, 0, row_bytes);
+	if (r >= first)
+	  png_filter_row(job->filter, job->bytes, cur, prev, row_bytes,
+			 job->filtered + job->row_len * r, scratch);
+	swap = prev; prev = cur; cur = swap;
+      }
+    } else {
+      /* Compress the block as raw deflate data that ends on a byte
+	 boundary, to be concatenated with the other blocks.  */
+      const unsigned char *in = job->filtered + job->row_len * first;
+      size_t in_len = job->row_len * (last - first);
+      size_t dict_len = job->row_len * first;
+      z_stream strm;
+      int ok = 0;
+      memset(&strm, 0, sizeof(strm));
+      if (dict_len > 32768)
+	dict_len = 32768;
+      job->block_adlers[b] = adler32(adler32(0, NULL, 0), in, in_len);
+      if (deflateInit2(&strm, job->level, Z_DEFLATED, -15, 8, job->strategy)
+	  == Z_OK) {
+	size_t bound = deflateBound(&strm, in_len) + 16;
+	job->blocks[b] = (unsigned char*)malloc(bound);
+	if (job->blocks[b] != NULL &&
+	    (dict_len == 0 ||
+	     deflateSetDictionary(&strm, in - dict_len, dict_len) == Z_OK)) {
+	  strm.next_in = (Bytef*)in;
+	  strm.avail_in = in_len;
+	  strm.next_out = job->blocks[b];
+	  strm.avail_out = bound;
+	  if (b + 1 == job->num_blocks)
+	    ok = (deflate(&strm, Z_FINISH) == Z_STREAM_END);
+	  else
+	    ok = (deflate(&strm, Z_SYNC_FLUSH) == Z_OK &&
+		  strm.avail_in == 0 && strm.avail_out != 0);
+	  job->block_lens[b] = bound - strm.avail_out;
+	}
+	deflateEnd(&strm);
+      }
+      if (!ok) {
+	pthread_mutex_lock(&job->lock);
+	job->failed = 1;
+	pthread_mutex_unlock(&job->lock);
+      }
+    }
+  }
+  free(bufs);
+  return NULL;
+}
+
+/* Write a 32-bit big endian integer into `p'.  */
+#define PUT_BE32(p, v) ((p)[0] = ((v) >> 24) & 0xff, \
+			(p)[1] = ((v) >> 16) & 0xff, \
+			(p)[2] = ((v) >> 8) & 0xff, (p)[3] = (v) & 0xff)
+
+/* Write the bottom-up TGA pixels of `image' as a PNG image, with
+   `bytes' bytes per pixel, the given PNG `filter' and zlib compression
+   `level' and `strategy', using `num_threads' threads.  Returns zero
+   on success, one on failure.  */
+int write_png(FILE *fp, const unsigned char *image, unsigned int width,
+	      unsigned int height, unsigned int bytes, unsigned int filter,
+	      int level, int strategy, long num_threads) {
+  static const unsigned char signature[8] =
+    { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+  static const unsigned char iend[12] =
+    { 0, 0, 0, 0, 'I', 'E', 'N', 'D', 0xae, 0x42, 0x60, 0x82 };
+  unsigned char ihdr[8 + 13 + 4], idat[8], zhead[2], tail[8];
+  PngJob job;
+  size_t data_len;
+  uLong crc, adler;
+  unsigned int b, zheader;
+  int retval = 1;
+
+  memset(&job, 0, sizeof(job));
+  job.image = image;
+  job.width = width;
+  job.height = height;
+  job.bytes = bytes;
+  job.filter = filter;
+  job.level = level;
+  job.strategy = strategy;
+  job.row_len = (size_t)width * bytes + 1;
+  job.rows_per_block = (PNG_BLOCK_SIZE + job.row_len - 1) / job.row_len;
+  job.num_blocks = (height + job.rows_per_block - 1) / job.rows_per_block;
+  if (job.num_blocks == 0)
+    job.num_blocks = 1; /* Compress the empty image data anyways.  */
+  job.filtered = (unsigned char*)malloc(job.row_len * height + 1);
+  job.blocks = (unsigned char**)calloc(job.num_blocks, sizeof(char*));
+  job.block_lens = (size_t*)calloc(job.num_blocks, sizeof(size_t));
+  job.block_adlers = (uLong*)calloc(job.num_blocks, sizeof(uLong));
+  if (job.filtered == NULL || job.blocks == NULL ||
+      job.block_lens == NULL || job.block_adlers == NULL) {
+    fputs("Error: Out of memory.\n", stderr);
+    goto cleanup;
+  }
+
+  pthread_mutex_init(&job.lock, NULL);
+  if (num_threads > job.num_blocks)
+    num_threads = job.num_blocks;
+  for (job.phase = 0; job.phase < 2 && !job.failed; job.phase++) {
+    job.next_block = 0;
+    run_threads(png_worker, &job, num_threads);
+  }
+  pthread_mutex_destroy(&job.lock);
+  if (job.failed)
+    goto cleanup;
+
+  /* Header chunk: 8-bit grayscale or RGB, no interlacing.  */
+  PUT_BE32(ihdr, 13u);
+  memcpy(ihdr + 4, "IHDR", 4);
+  PUT_BE32(ihdr + 8, width);
+  PUT_BE32(ihdr + 12, height);
+  ihdr[16] = 8;
+  ihdr[17] = (bytes == 1) ? 0 : 2;
+  ihdr[18] = 0; ihdr[19] = 0; ihdr[20] = 0;
+  crc = crc32(0, ihdr + 4, 17);
+  PUT_BE32(ihdr + 21, crc);
+
+  /* The image data goes into one chunk: a zlib header, the compressed
+     blocks, and the Adler-32 checksum of all blocks.  */
+  zheader = (0x78 << 8) |
+    (((level < 2) ? 0 : (level < 6) ? 1 : (level == 6) ? 2 : 3) << 6);
+  zheader += 31 - zheader % 31;
+  zhead[0] = zheader >> 8; zhead[1] = zheader & 0xff;
+  data_len = sizeof(zhead) + 4;
+  adler = adler32(0, NULL, 0);
+  for (b = 0; b < job.num_blocks; b++) {
+    /* Only the last block can be shorter than the others.  */
+    unsigned int rows = (b + 1 == job.num_blocks) ?
+      height - b * job.rows_per_block : job.rows_per_block;
+    data_len += job.block_lens[b];
+    adler = adler32_combine(adler, job.block_adlers[b], job.row_len * rows);
+  }
+  if (data_len > 0x7fffffff) {
+    fputs("Error: Image too large for one PNG chunk.\n", stderr);
+    goto cleanup;
+  }
+  PUT_BE32(idat, (unsigned)data_len);
+  memcpy(idat + 4, "IDAT", 4);
+  crc = crc32(0, idat + 4, 4);
+  crc = crc32(crc, zhead, sizeof(zhead));
+  for (b = 0; b < job.num_blocks; b++)
+    crc = crc32(crc, job.blocks[b], job.block_lens[b]);
+  PUT_BE32(tail, adler);
+  crc = crc32(crc, tail, 4);
+  PUT_BE32(tail + 4, crc);
+
+  fwrite(signature, sizeof(signature), 1, fp);
+  fwrite(ihdr, sizeof(ihdr), 1, fp);
+  fwrite(idat, sizeof(idat), 1, fp);
+  fwrite(zhead, sizeof(zhead), 1, fp);
+  for (b = 0; b < job.num_blocks; b++)
+    fwrite(job.blocks[b], job.block_lens[b], 1, fp);
+  fwrite(tail, sizeof(tail), 1, fp);
+  fwrite(iend, sizeof(iend), 1, fp);
+  retval = ferror(fp) ? 1 : 0;
+
+ cleanup:
+  if (job.blocks != NULL) {
+    for (b = 0; b < job.num_blocks; b++)
+      free(job.blocks[b]);
+  }
+  free(job.blocks); free(job.block_lens); free(job.block_adlers);
+  free(job.filtered);
+  return retval;
+}
+
+/* Replace the first `%s' in `tmpl' with `date'.  The result is
+   allocated with `malloc()'.  */
+char *expand_name(const char *tmpl, const char *date) {
+  const char *subst = strstr(tmpl, "%s");
+  size_t prefix_len = subst - tmpl;
+  char *name = (char*)malloc(strlen(tmpl) + strlen(date) + 8);
+  if (name == NULL)
+    return NULL;
+  memcpy(name, tmpl, prefix_len);
+  strcpy(name + prefix_len, date);
+  strcat(name, subst + 2);
+  return name;
+}
+
+/* Get the name of the "format.json" of a class, in the directory of
+   its file name template, into `*filename', or NULL if the directory
+   itself depends on the date.  Returns zero on success, one if out of
+   memory.  */
+int format_name(const EncClass *cls, char **filename) {
+  const char *slash = strrchr(cls->out_name, '/');
+  size_t dir_len = (slash != NULL) ? (size_t)(slash - cls->out_name) : 0;
+
+  *filename = NULL;
+  if (slash != NULL && strstr(cls->out_name, "%s") < slash)
+    return 0;
+  *filename = (char*)malloc(dir_len + 16);
+  if (*filename == NULL) {
+    fputs("Error: Out of memory.\n", stderr);
+    return 1;
+  }
+  if (slash != NULL) {
+    memcpy(*filename, cls->out_name, dir_len);
+    strcpy(*filename + dir_len, "/format.json");
+  } else
+    strcpy(*filename, "format.json");
+  return 0;
+}
+
+/* Print the "format.json" that describes the images of a class into
+   `text', which must hold `FORMAT_TEXT_SIZE' characters.  Besides
+   what the clients decode the images by, and in keyframe mode, the
+   number of dates per keyframe and the step of the delta frames, it
+   holds every other parameter that the images depend on, so that a
+   batch can tell whether the existing images were written the same
+   way.  */
+void format_text(const EncClass *cls, unsigned int key_interval,
+		 unsigned int width, unsigned int height,
+		 unsigned int tile_size, char *text) {
+  const EncParams *params = &cls->params;
+  size_t len;
+  len = snprintf(text, FORMAT_TEXT_SIZE, "{\n"
+		 "  \"format\": \"%s\",\n"
+		 "  \"bitsBefDec\": %u,\n"
+		 "  \"bitsAftDec\": %u,\n"
+		 "  \"noiseMargin\": %u", cls->png ? "png" : "tga",
+		 params->bbd, params->bad, params->noise_margin);
+  if (key_interval != 0)
+    len += snprintf(text + len, FORMAT_TEXT_SIZE - len, ",\n"
+		    "  \"keyInterval\": %u,\n"
+		    "  \"deltaQuantum\": %u", key_interval,
+		    cls->delta_quantum);
+  if (tile_size != 0)
+    len += snprintf(text + len, FORMAT_TEXT_SIZE - len, ",\n"
+		    "  \"tileSize\": %u", tile_size);
+  snprintf(text + len, FORMAT_TEXT_SIZE - len, ",\n"
+	   "  \"width\": %u,\n"
+	   "  \"height\": %u,\n"
+	   "  \"bitsPerPixel\": %u,\n"
+	   "  \"overflow\": %u,\n"
+	   "  \"channelShift\": %u,\n"
+	   "  \"internalShift\": %u,\n"
+	   "  \"bitSplit\": %u,\n"
+	   "  \"channelFlow\": %u,\n"
+	   "  \"pngFilter\": %u,\n"
+	   "  \"pngLevel\": %d,\n"
+	   "  \"pngStrategy\": %d\n"
+	   "}\n", width, height, params->bpp, params->overflow,
+	   params->s_chs, params->s_ics, params->bitsplit, params->chanflow,
+	   cls->png_filter, cls->png_level, cls->png_strategy);
+}
+
+/* Check whether the file `filename' holds exactly `text'.  Returns
+   one if it does, zero if it does not or cannot be read.  */
+int format_matches(const char *filename, const char *text) {
+  char old_text[FORMAT_TEXT_SIZE];
+  FILE *fp = fopen(filename, "rb");
+  size_t len;
+  if (fp == NULL)
+    return 0;
+  len = fread(old_text, 1, sizeof(old_text) - 1, fp);
+  fclose(fp);
+  old_text[len] = '\0';
+  return !strcmp(old_text, text);
+}
+
+/* Write `text' to the file `filename', under a temporary name that is
+   renamed once it is complete.  Returns zero on success, one on
+   failure.  */
+int write_format(const char *filename, const char *text) {
+  char *part_name = (char*)malloc(strlen(filename) + 8);
+  FILE *fp;
+  int retval = 0;
+
+  if (part_name == NULL) {
+    fputs("Error: Out of memory.\n", stderr);
+    return 1;
+  }
+  sprintf(part_name, "%s.part", filename);
+  fp = fopen(part_name, "wt");
+  if (fp == NULL) {
+    fprintf(stderr, "Error: Could not open %s: %s\n",
+	    part_name, strerror(errno));
+    free(part_name);
+    return 1;
+  }
+  fputs(text, fp);
+  if (ferror(fp) | fclose(fp)) {
+    fprintf(stderr, "Error: Could not write %s.\n", part_name);
+    retval = 1;
+  } else if (rename(part_name, filename) != 0) {
+    fprintf(stderr, "Error: Could not rename %s: %s\n",
+	    part_name, strerror(errno));
+    retval = 1;
+  }
+  if (retval != 0)
+    remove(part_name);
+  free(part_name);
+  return retval;
+}
+
+/* Check whether the "format.json" files `name_a' and `name_b' are in
+   the same directory, by name or, if both directories exist, by file
+   identity.  */
+int same_format_dir(const char *name_a, const char *name_b) {
+  size_t len_a = strlen(name_a) - strlen("format.json");
+  size_t len_b = strlen(name_b) - strlen("format.json");
+  char *dir_a, *dir_b;
+  struct stat st_a, st_b;
+  int same;
+
+  if (!strcmp(name_a, name_b))
+    return 1;
+  dir_a = (char*)malloc(len_a + 2);
+  dir_b = (char*)malloc(len_b + 2);
+  if (dir_a == NULL || dir_b == NULL) {
+    free(dir_a); free(dir_b);
+    return 0;
   }
+  memcpy(dir_a, name_a, len_a);
+  strcpy(dir_a + len_a, ".");
+  memcpy(dir_b, name_b, len_b);
+  strcpy(dir_b + len_b, ".");
+  same = (stat(dir_a, &st_a) == 0 && stat(dir_b, &st_b) == 0 &&
+	  st_a.st_dev == st_b.st_dev && st_a.st_ino == st_b.st_ino);
+  free(dir_a);
+  free(dir_b);
+  return same;
+}
 
+/* Expand the file names of a date: its input, and for every class,
+   its image and the temporary name that the image is written under,
+   or in pyramid mode, the name of its manifest, which stands for the
+   tiles when checking the date.  Returns zero on success, one if out
+   of memory.  */
+int batch_names(const BatchJob *job, const char *date, char **in_name,
+		char **out_names, char **part_names) {
+  unsigned int c;
+
+  *in_name = expand_name(job->in_tmpl, date);
+  for (c = 0; c < job->num_classes; c++) {
+    out_names[c] = NULL;
+    part_names[c] = NULL;
+  }
+  if (*in_name == NULL)
+    goto fail;
+  for (c = 0; c < job->num_classes; c++) {
+    out_names[c] = expand_name(job->classes[c].out_name, date);
+    if (out_names[c] == NULL)
+      goto fail;
+    if (job->tile_size != 0) {
+      char *dir = pyramid_dir(out_names[c]);
+      if (dir == NULL)
+	goto fail;
+      part_names[c] = (char*)malloc(strlen(dir) + 32);
+      if (part_names[c] != NULL)
+	sprintf(part_names[c], "%s/manifest.json", dir);
+      free(dir);
+      if (part_names[c] == NULL)
+	goto fail;
+    } else {
+      part_names[c] = (char*)malloc(strlen(out_names[c]) + 32);
+      if (part_names[c] == NULL)
+	goto fail;
+      sprintf(part_names[c], "%s.part", out_names[c]);
+    }
+  }
   return 0;
+
+ fail:
+  fputs("Error: Out of memory.\n", stderr);
+  free_batch_names(job, *in_name, out_names, part_names);
+  *in_name = NULL;
+  return 1;
+}
+
+/* Free the names from `batch_names()'.  */
+void free_batch_names(const BatchJob *job, char *in_name, char **out_names,
+		      char **part_names) {
+  unsigned int c;
+  free(in_name);
+  for (c = 0; c < job->num_classes; c++) {
+    free(out_names[c]);
+    free(part_names[c]);
+  }
+}
+
+/* Check whether all images of a date are newer than its input.
+   Returns one if they are, zero if not, or -1 if the input cannot be
+   found.  */
+int batch_up_to_date(const BatchJob *job, const char *in_name,
+		     char **out_names, char **part_names) {
+  struct stat in_st, out_st;
+  unsigned int c;
+
+  if (stat(in_name, &in_st) != 0) {
+    fprintf(stderr, "Error: Could not open %s: %s\n",
+	    in_name, strerror(errno));
+    return -1;
+  }
+  if (job->force)
+    return 0;
+  for (c = 0; c < job->num_classes; c++) {
+    const char *name = (job->tile_size != 0) ? part_names[c] : out_names[c];
+    if (stat(name, &out_st) != 0 || out_st.st_mtime < in_st.st_mtime)
+      return 0;
+  }
+  return 1;
+}
+
+/* Read the statistics of a date whose images are up to date from its
+   statistics file, if that is newer than its input `in_name'.
+   Returns zero on success, or one if the date has to be converted
+   again for its statistics.  */
+int read_date_stats(BatchJob *job, const char *date, const char *in_name,
+		    SampleStats *stats) {
+  struct stat in_st, stats_st;
+  char *stats_name = expand_name(job->stats_tmpl, date);
+  int retval = 1;
+
+  if (stats_name != NULL && stat(in_name, &in_st) == 0 &&
+      stat(stats_name, &stats_st) == 0 &&
+      stats_st.st_mtime >= in_st.st_mtime)
+    retval = read_stats(stats_name, stats);
+  free(stats_name);
+  return retval;
+}
+
+/* Write the statistics of a date to its statistics file, and add them
+   to the statistics of all dates.  Returns zero on success, one on
+   failure.  */
+int write_date_stats(BatchJob *job, const char *date,
+		     const FrameStats *stats) {
+  char *stats_name = expand_name(job->stats_tmpl, date);
+  int retval;
+
+  if (stats_name == NULL) {
+    fputs("Error: Out of memory.\n", stderr);
+    return 1;
+  }
+  retval = write_stats(stats_name, stats);
+  free(stats_name);
+  if (retval == 0) {
+    pthread_mutex_lock(&job->lock);
+    stats_merge(&job->all_stats, &stats->frame);
+    pthread_mutex_unlock(&job->lock);
+  }
+  return retval;
+}
+
+/* Take dates off of the shared counter and convert each of them,
+   unless all of its images are newer than its input.  The images are
+   written under temporary names and renamed once they are complete,
+   so that an interrupted conversion is never taken as up to date.  In
+   pyramid mode, the same goes for the manifests, which are written
+   last.  The statistics of a date that is skipped are read from its
+   statistics file, or if that is out of date, the date is converted
+   anyway.  */
+void *batch_worker(void *arg) {
+  BatchJob *job = (BatchJob*)arg;
+  EncClass classes[MAX_CLASSES];
+  char *out_names[MAX_CLASSES], *part_names[MAX_CLASSES];
+  unsigned int num_classes = job->num_classes;
+
+  memcpy(classes, job->classes, sizeof(EncClass) * num_classes);
+  while (1) {
+    const char *date;
+    char *in_name;
+    FILE *fin;
+    FrameStats stats;
+    FrameStats *frame_stats = (job->stats_tmpl != NULL) ? &stats : NULL;
+    unsigned int i, c;
+    int retval = 0, up_to_date = 0;
+
+    pthread_mutex_lock(&job->lock);
+    i = job->next_date++;
+    pthread_mutex_unlock(&job->lock);
+    if (i >= job->num_dates)
+      break;
+    date = job->dates[i];
+
+    if (batch_names(job, date, &in_name, out_names, part_names) != 0)
+      retval = 1;
+    else {
+      up_to_date = batch_up_to_date(job, in_name, out_names, part_names);
+      if (up_to_date < 0)
+	retval = 1;
+      else if (up_to_date && frame_stats != NULL &&
+	       read_date_stats(job, date, in_name, &stats.frame) != 0)
+	up_to_date = 0;
+    }
+
+    if (retval == 0 && up_to_date) {
+      pthread_mutex_lock(&job->lock);
+      job->num_skipped++;
+      if (frame_stats != NULL)
+	stats_merge(&job->all_stats, &stats.frame);
+      pthread_mutex_unlock(&job->lock);
+    } else if (retval == 0) {
+      fin = fopen(in_name, "rb");
+      if (fin == NULL) {
+	fprintf(stderr, "Error: Could not open %s: %s\n",
+		in_name, strerror(errno));
+	retval = 1;
+      } else if (job->tile_size != 0) {
+	for (c = 0; c < num_classes; c++)
+	  classes[c].out_name = out_names[c];
+	retval = conv_frame(classes, num_classes, fin, job->input_format,
+			    job->width, job->height, job->tile_size, 1,
+			    frame_stats);
+	fclose(fin);
+      } else {
+	for (c = 0; c < num_classes; c++)
+	  classes[c].out_name = part_names[c];
+	retval = conv_frame(classes, num_classes, fin, job->input_format,
+			    job->width, job->height, 0, 1, frame_stats);
+	fclose(fin);
+	for (c = 0; c < num_classes; c++) {
+	  if (retval == 0 && rename(part_names[c], out_names[c]) != 0) {
+	    fprintf(stderr, "Error: Could not rename %s: %s\n",
+		    part_names[c], strerror(errno));
+	    retval = 1;
+	  }
+	  if (retval != 0)
+	    remove(part_names[c]);
+	}
+      }
+      if (fin != NULL && frame_stats != NULL) {
+	/* The statistics file is written last, so that it is never
+	   newer than the images if they failed.  */
+	if (retval == 0)
+	  retval = write_date_stats(job, date, &stats);
+	free(stats.tiles);
+      }
+      if (retval == 0 && job->verbose) {
+	pthread_mutex_lock(&job->lock);
+	printf("Finished date %s.\n", date);
+	fflush(stdout);
+	pthread_mutex_unlock(&job->lock);
+      }
+    }
+
+    if (retval != 0) {
+      pthread_mutex_lock(&job->lock);
+      job->failed = 1;
+      pthread_mutex_unlock(&job->lock);
+    }
+    if (in_name != NULL)
+      free_batch_names(job, in_name, out_names, part_names);
+  }
+  return NULL;
+}
+
+/* Take groups of `key_interval' dates off of the shared counter and
+   convert each of them into a keyframe, the image of its first date
+   as usual, followed by delta frames, unless all of its images are
+   newer than their inputs.  A delta frame depends on all frames
+   before it in its group, so the group is always encoded from its
+   keyframe on, but only the images from its first out of date date on
+   are written.  A date whose statistics file is out of date counts as
+   out of date.  */
+void *keyed_worker(void *arg) {
+  BatchJob *job = (BatchJob*)arg;
+  unsigned int num_classes = job->num_classes;
+  unsigned int width = job->width, height = job->height;
+  size_t num_samples = (size_t)width * height;
+  char *out_names[MAX_CLASSES], *part_names[MAX_CLASSES];
+  unsigned int *codes[MAX_CLASSES];
+  float *grid = (float*)malloc(sizeof(float) * num_samples + 1);
+  unsigned char *image = (unsigned char*)malloc(num_samples * 3 + 1);
+  unsigned int num_codes, c;
+  int retval = (grid == NULL || image == NULL);
+
+  for (num_codes = 0; retval == 0 && num_codes < num_classes; num_codes++) {
+    codes[num_codes] = (unsigned int*)
+      malloc(sizeof(unsigned int) * num_samples + 1);
+    if (codes[num_codes] == NULL)
+      retval = 1;
+  }
+  if (retval != 0) {
+    fputs("Error: Out of memory.\n", stderr);
+    pthread_mutex_lock(&job->lock);
+    job->failed = 1;
+    pthread_mutex_unlock(&job->lock);
+  }
+
+  while (retval == 0) {
+    char *in_name;
+    unsigned int first, end, stale, i;
+    SampleStats group_stats;
+    FrameStats stats;
+    int failed = 0;
+
+    pthread_mutex_lock(&job->lock);
+    first = job->next_date;
+    job->next_date += job->key_interval;
+    pthread_mutex_unlock(&job->lock);
+    if (first >= job->num_dates)
+      break;
+    end = first + job->key_interval;
+    if (end > job->num_dates)
+      end = job->num_dates;
+
+    stats_init(&group_stats);
+    for (stale = first; failed == 0 && stale < end; stale++) {
+      int up_to_date;
+      if (batch_names(job, job->dates[stale], &in_name,
+		      out_names, part_names) != 0) {
+	failed = 1;
+	break;
+      }
+      up_to_date = batch_up_to_date(job, in_name, out_names, part_names);
+      if (up_to_date > 0 && job->stats_tmpl != NULL) {
+	if (read_date_stats(job, job->dates[stale], in_name,
+			    &stats.frame) != 0)
+	  up_to_date = 0;
+	else
+	  stats_merge(&group_stats, &stats.frame);
+      }
+      free_batch_names(job, in_name, out_names, part_names);
+      if (up_to_date < 0)
+	failed = 1;
+      if (up_to_date <= 0)
+	break;
+    }
+    if (failed == 0 && stale == end) {
+      pthread_mutex_lock(&job->lock);
+      job->num_skipped += end - first;
+      stats_merge(&job->all_stats, &group_stats);
+      pthread_mutex_unlock(&job->lock);
+      continue;
+    }
+    /* The statistics of the whole group are computed again below.  */
+    stats.num_tiles = 0;
+    stats.tiles = NULL;
+
+    for (i = first; failed == 0 && i < end; i++) {
+      const char *data;
+      size_t len, map_len;
+      void *map;
+      FILE *fin;
+      unsigned int y;
+
+      if (batch_names(job, job->dates[i], &in_name,
+		      out_names, part_names) != 0) {
+	failed = 1;
+	break;
+      }
+      fin = fopen(in_name, "rb");
+      if (fin == NULL) {
+	fprintf(stderr, "Error: Could not open %s: %s\n",
+		in_name, strerror(errno));
+	failed = 1;
+      } else {
+	failed = load_input(fin, &data, &len, &map, &map_len);
+	fclose(fin);
+	if (failed == 0) {
+	  stats_init(&stats.frame);
+	  failed = read_grid(job->input_format, data, len, width, height, 1,
+			     grid, (job->stats_tmpl != NULL) ?
+			     &stats.frame : NULL);
+	  free_input(data, map, map_len);
+	}
+      }
+
+      for (c = 0; failed == 0 && c < num_classes; c++) {
+	const EncClass *cls = &job->classes[c];
+	const EncKernel *k = &cls->kernel;
+	unsigned int bytes = (i == first) ? k->bytes : 1;
+	FILE *fp;
+	for (y = 0; y < height; y++) {
+	  const float *in = grid + (size_t)width * y;
+	  unsigned char *out = image + (size_t)width * bytes * (height - 1 - y);
+	  if (i == first) {
+	    quantize_row(k, in, width, codes[c] + (size_t)width * y);
+	    k->encode_row(k, in, width, out);
+	  } else
+	    encode_delta_row(k, cls->delta_quantum, in, width,
+			     codes[c] + (size_t)width * y, out);
+	}
+	if (i < stale)
+	  continue;
+
+	fp = fopen(part_names[c], "wb");
+	if (fp == NULL) {
+	  fprintf(stderr, "Error: Could not open %s: %s\n",
+		  part_names[c], strerror(errno));
+	  failed = 1;
+	  break;
+	}
+	failed = write_image(fp, cls, image, width, height, bytes, 1);
+	if (fclose(fp) != 0)
+	  failed = 1;
+	if (failed != 0)
+	  fprintf(stderr, "Error: Could not write %s.\n", part_names[c]);
+	else if (rename(part_names[c], out_names[c]) != 0) {
+	  fprintf(stderr, "Error: Could not rename %s: %s\n",
+		  part_names[c], strerror(errno));
+	  failed = 1;
+	}
+	if (failed != 0)
+	  remove(part_names[c]);
+      }
+
+      if (failed == 0 && job->stats_tmpl != NULL) {
+	if (i >= stale)
+	  failed = write_date_stats(job, job->dates[i], &stats);
+	else {
+	  pthread_mutex_lock(&job->lock);
+	  stats_merge(&job->all_stats, &stats.frame);
+	  pthread_mutex_unlock(&job->lock);
+	}
+      }
+      if (failed == 0 && i >= stale && job->verbose) {
+	pthread_mutex_lock(&job->lock);
+	printf("Finished date %s.\n", job->dates[i]);
+	fflush(stdout);
+	pthread_mutex_unlock(&job->lock);
+      }
+      free_batch_names(job, in_name, out_names, part_names);
+    }
+
+    if (failed) {
+      pthread_mutex_lock(&job->lock);
+      job->failed = 1;
+      pthread_mutex_unlock(&job->lock);
+    }
+  }
+
+  for (c = 0; c < num_codes; c++)
+    free(codes[c]);
+  free(grid);
+  free(image);
+  return NULL;
+}
+
+/* Take dates off of the shared counter and encode each of them into a
+   frame of the video, which is written to the standard output as soon
+   as all frames before it are.  Every worker holds at most one frame
+   that waits to be written.  Dates that cannot be converted are left
+   out of the video.  */
+void *video_worker(void *arg) {
+  BatchJob *job = (BatchJob*)arg;
+  const EncKernel *k = &job->classes[0].kernel;
+  unsigned int width = job->width, height = job->height;
+  size_t num_samples = (size_t)width * height;
+  float *grid = (float*)malloc(sizeof(float) * num_samples + 1);
+  unsigned char *frame = (unsigned char*)malloc(num_samples + 1);
+  int no_memory = (grid == NULL || frame == NULL);
+
+  if (no_memory)
+    fputs("Error: Out of memory.\n", stderr);
+  while (1) {
+    char *in_name;
+    unsigned int i, y;
+    FrameStats stats;
+    int failed = no_memory;
+
+    pthread_mutex_lock(&job->lock);
+    i = job->next_date++;
+    pthread_mutex_unlock(&job->lock);
+    if (i >= job->num_dates)
+      break;
+
+    in_name = failed ? NULL : expand_name(job->in_tmpl, job->dates[i]);
+    if (!failed && in_name == NULL) {
+      fputs("Error: Out of memory.\n", stderr);
+      failed = 1;
+    } else if (!failed) {
+      FILE *fin = fopen(in_name, "rb");
+      const char *data;
+      size_t len, map_len;
+      void *map;
+      if (fin == NULL) {
+	fprintf(stderr, "Error: Could not open %s: %s\n",
+		in_name, strerror(errno));
+	failed = 1;
+      } else {
+	failed = load_input(fin, &data, &len, &map, &map_len);
+	fclose(fin);
+	if (!failed) {
+	  stats_init(&stats.frame);
+	  failed = read_grid(job->input_format, data, len, width, height, 1,
+			     grid, (job->stats_tmpl != NULL) ?
+			     &stats.frame : NULL);
+	  free_input(data, map, map_len);
+	}
+      }
+      free(in_name);
+    }
+    for (y = 0; !failed && y < height; y++)
+      k->encode_row(k, grid + (size_t)width * y, width,
+		    frame + (size_t)width * y);
+    if (!failed && job->stats_tmpl != NULL) {
+      stats.num_tiles = 0;
+      stats.tiles = NULL;
+      failed = write_date_stats(job, job->dates[i], &stats);
+    }
+
+    /* Wait for the frames before this one.  */
+    pthread_mutex_lock(&job->lock);
+    while (job->next_frame != i)
+      pthread_cond_wait(&job->written, &job->lock);
+    if (!failed) {
+      fputs("FRAME\n", stdout);
+      fwrite(frame, 1, num_samples, stdout);
+      fwrite(job->chroma, 1, job->chroma_len, stdout);
+      if (ferror(stdout)) {
+	fputs("Error: Could not write the video.\n", stderr);
+	failed = 1;
+      }
+    }
+    if (failed)
+      job->failed = 1;
+    else if (job->verbose)
+      fprintf(stderr, "Finished date %s.\n", job->dates[i]);
+    job->next_frame++;
+    pthread_cond_broadcast(&job->written);
+    pthread_mutex_unlock(&job->lock);
+  }
+
+  if (no_memory) {
+    pthread_mutex_lock(&job->lock);
+    job->failed = 1;
+    pthread_mutex_unlock(&job->lock);
+  }
+  free(grid);
+  free(frame);
+  return NULL;
+}
+
+/* Convert every date that is listed in the file `dates_name' from the
+   input file named by `in_tmpl' into the images of every class, on
+   `num_threads' threads.  Dates that cannot be converted are reported
+   and skipped.  If `stats_tmpl' is not NULL, the statistics of every
+   date are written to it with `%s' for the date, and once all dates
+   are converted, those of all dates with `all' for the date.  The
+   "format.json" of every class records the parameters of its images,
+   and if they differ from those of the existing images, every date is
+   converted again, and the new "format.json" is only written once all
+   dates are.  Returns zero on success, one if any date failed.  */
+int conv_batch(const EncClass *classes, unsigned int num_classes,
+	       const char *dates_name, const char *in_tmpl,
+	       unsigned int input_format, unsigned int width,
+	       unsigned int height, unsigned int tile_size,
+	       unsigned int key_interval, unsigned int video_rate,
+	       const char *stats_tmpl, long num_threads, int verbose) {
+  BatchJob job;
+  FILE *fp;
+  const char *data;
+  size_t len, map_len;
+  void *map;
+  char *dates_buf, *p;
+  char *format_names[MAX_CLASSES];
+  char format_texts[MAX_CLASSES][FORMAT_TEXT_SIZE];
+  int format_changed[MAX_CLASSES];
+  unsigned int c, c2;
+  int retval = 0;
+
+  fp = fopen(dates_name, "rb");
+  if (fp == NULL) {
+    fprintf(stderr, "Error: Could not open %s: %s\n",
+	    dates_name, strerror(errno));
+    return 1;
+  }
+  if (load_input(fp, &data, &len, &map, &map_len) != 0) {
+    fclose(fp);
+    return 1;
+  }
+  fclose(fp);
+
+  /* Split the dates list into one string per date.  */
+  dates_buf = (char*)malloc(len + 1);
+  job.dates = (char**)malloc(sizeof(char*) * (len / 2 + 1));
+  if (dates_buf == NULL || job.dates == NULL) {
+    fputs("Error: Out of memory.\n", stderr);
+    free(dates_buf); free(job.dates);
+    free_input(data, map, map_len);
+    return 1;
+  }
+  memcpy(dates_buf, data, len);
+  dates_buf[len] = '\0';
+  free_input(data, map, map_len);
+  job.num_dates = 0;
+  for (p = strtok(dates_buf, " \t\r\n"); p != NULL;
+       p = strtok(NULL, " \t\r\n"))
+    job.dates[job.num_dates++] = p;
+
+  job.classes = classes;
+  job.num_classes = num_classes;
+  job.width = width;
+  job.height = height;
+  job.in_tmpl = in_tmpl;
+  job.input_format = input_format;
+  job.tile_size = tile_size;
+  job.key_interval = key_interval;
+  job.video_rate = video_rate;
+  job.stats_tmpl = stats_tmpl;
+  job.verbose = verbose;
+  job.force = 0;
+  job.next_date = 0;
+  job.num_skipped = 0;
+  stats_init(&job.all_stats);
+  job.failed = 0;
+
+  /* Every class needs a "format.json" of its own, unless the
+     directory of its images depends on the date.  */
+  for (c = 0; c < num_classes; c++) {
+    format_names[c] = NULL;
+    format_changed[c] = 0;
+    if (video_rate != 0 || retval != 0)
+      continue;
+    if (format_name(&classes[c], &format_names[c]) != 0) {
+      retval = 1;
+      continue;
+    }
+    for (c2 = 0; c2 < c && format_names[c] != NULL; c2++) {
+      if (format_names[c2] != NULL &&
+	  same_format_dir(format_names[c2], format_names[c])) {
+	fprintf(stderr, "Error: Images of several classes would share %s.\n",
+		format_names[c]);
+	retval = 1;
+	break;
+      }
+    }
+  }
+  if (retval != 0) {
+    for (c = 0; c < num_classes; c++)
+      free(format_names[c]);
+    free(job.dates);
+    free(dates_buf);
+    return 1;
+  }
+
+  /* Compare the format of every class with that of its existing
+     images, and remove it if it changed, so that an interrupted batch
+     leaves every date to be converted again.  */
+  for (c = 0; c < num_classes; c++) {
+    if (format_names[c] == NULL)
+      continue;
+    format_text(&classes[c], key_interval, width, height, tile_size,
+		format_texts[c]);
+    if (!format_matches(format_names[c], format_texts[c])) {
+      if (verbose)
+	printf("The format of %s changed, converting every date.\n",
+	       format_names[c]);
+      remove(format_names[c]);
+      format_changed[c] = 1;
+      job.force = 1;
+    }
+  }
+
+  pthread_mutex_init(&job.lock, NULL);
+  if (video_rate != 0) {  } else if (video_rate != 0) {
+    /* The chroma planes are neutral gray, at half the resolution of
+       the luma plane, rounded up.  */
+    unsigned char *chroma;
+    job.chroma_len = (size_t)((width + 1) / 2) * ((height + 1) / 2) * 2;
+    chroma = (unsigned char*)malloc(job.chroma_len + 1);
+    if (chroma == NULL) {
+      fputs("Error: Out of memory.\n", stderr);
+      job.failed = 1;
+    } else {
+      memset(chroma, 128, job.chroma_len);
+      job.chroma = chroma;
+      job.next_frame = 0;
+      pthread_cond_init(&job.written, NULL);
+      printf("YUV4MPEG2 W%u H%u F%u:1 Ip A1:1 C420jpeg XCOLORRANGE=FULL\n",
+	     width, height, video_rate);
+      if (num_threads > job.num_dates)
+	num_threads = (job.num_dates > 0) ? job.num_dates : 1;
+      run_threads(video_worker, &job, num_threads);
+      pthread_cond_destroy(&job.written);
+      free(chroma);
+      if (fflush(stdout) != 0) {
+	fputs("Error: Could not write the video.\n", stderr);
+	job.failed = 1;
+      }
+    }
+  } else if (key_interval != 0) {
+    unsigned int num_groups =
+      (job.num_dates + key_interval - 1) / key_interval;
+    if (num_threads > num_groups)
+      num_threads = (num_groups > 0) ? num_groups : 1;
+    run_threads(keyed_worker, &job, num_threads);
+  } else {
+    if (num_threads > job.num_dates)
+      num_threads = (job.num_dates > 0) ? job.num_dates : 1;
+    run_threads(batch_worker, &job, num_threads);
+  }
+  pthread_mutex_destroy(&job.lock);
+
+  if (verbose && video_rate == 0)
+    printf("Skipped %u dates that were up to date.\n", job.num_skipped);
+  if (stats_tmpl != NULL && !job.failed) {
+    FrameStats all;
+    char *stats_name = expand_name(stats_tmpl, "all");
+    all.frame = job.all_stats;
+    all.num_tiles = 0;
+    all.tiles = NULL;
+    if (stats_name == NULL) {
+      fputs("Error: Out of memory.\n", stderr);
+      job.failed = 1;
+    } else if (write_stats(stats_name, &all) != 0)
+      job.failed = 1;
+    free(stats_name);
+    if (verbose && all.frame.count > all.frame.nan_count)
+      fprintf((video_rate != 0) ? stderr : stdout,
+	      "SSH of all dates: min %g, max %g, mean %g cm.\n",
+	      all.frame.min, all.frame.max, all.frame.sum /
+	      (all.frame.count - all.frame.nan_count));
+  }
+  for (c = 0; c < num_classes; c++) {
+    if (format_changed[c] && !job.failed &&
+	write_format(format_names[c], format_texts[c]) != 0)
+      job.failed = 1;
+    free(format_names[c]);
+  }
+  if (job.failed) {
+    fputs("Error: Some dates could not be converted.\n", stderr);
+    retval = 1;
+  }
+  free(job.dates);
+  free(dates_buf);
+  return retval;
 }
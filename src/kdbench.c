@@ -0,0 +1,251 @@
+/* Measure the throughput of the native kd-tree potential visibility
+   traversal on random viewport queries.
+
+Copyright (C) 2014 University of Minnesota
+
+See the file "COPYING" in the top level directory for details.
+
+*/
+
+/* Usage: kdbench [-n NUM-QUERIES] [-s MAX-SPLITS] [-r REPEAT]
+                  [-seed SEED] [-q QUERY-FILE] [-k K [-e]] TRACKS-FILE
+
+   The queries are generated like the viewer generates them: a random
+   date, a random view center, and a random zoom level, clipped with
+   the same rules as `clipVBox()'.  With `-q', the queries are also
+   written to QUERY-FILE, one per line as "DATE MIN_LAT MIN_LON
+   MAX_LAT MAX_LON", so that "../tests/kdbench.js" can run the
+   JavaScript traversal on exactly the same queries.  Both print the
+   same checksum line when their results agree.
+
+   With `-k', nearest eddy picking queries at random points are
+   measured instead.  */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+
+#include "xmalloc.h"
+#include "wtxt.h"
+#include "kdpvs.h"
+#include "kdnn.h"
+
+void display_help(FILE *fout, const char *progname);
+void clip_vbox(double *vbox);
+double now_secs(void);
+int bench_pick(const WTracks *tracks, unsigned num_queries, unsigned repeat,
+	       unsigned k, int metric);
+
+void display_help(FILE *fout, const char *progname) {
+  fprintf(fout,
+"Usage: %s [-n NUM-QUERIES] [-s MAX-SPLITS] [-r REPEAT] [-seed SEED]\n"
+"          [-q QUERY-FILE] TRACKS-FILE\n\n", progname);
+  fputs(
+"Options:\n"
+"  -h, --help    Display this help message.\n"
+"  -n NUM-QUERIES    Number of random queries (default 100000).\n"
+"  -s MAX-SPLITS    Maximum number of viewport box splits, zero for no\n"
+"        limit (default 31, as used by the viewer).\n"
+"  -r REPEAT    Number of times to run the whole batch (default 10).\n"
+"  -seed SEED    Seed for the random number generator (default 1).\n"
+"  -q QUERY-FILE    Write the generated queries to QUERY-FILE.\n"
+"  -k K    Measure picking of the K nearest eddies instead.\n"
+"  -e    Use equirectangular rather than great-circle distance for\n"
+"        picking.\n",
+	fout);
+}
+
+/* Port of `clipVBox()' in "oevmath.js".  */
+void clip_vbox(double *vbox) {
+  if (vbox[0] < -90 && vbox[2] > 90)
+    { vbox[0] = -90; vbox[2] = 90; }
+  else if (vbox[0] < -90) {
+    double new_edge = -180 - vbox[0]; vbox[0] = -90;
+    if (new_edge > vbox[2]) vbox[2] = new_edge;
+    vbox[1] = -180; vbox[3] = 180;
+    return;
+  } else if (vbox[2] > 90) {
+    double new_edge = 180 - vbox[2]; vbox[2] = 90;
+    if (new_edge < vbox[0]) vbox[0] = new_edge;
+    vbox[1] = -180; vbox[3] = 180;
+    return;
+  }
+
+  if (vbox[1] < -360 || vbox[3] >= 360 ||
+      (vbox[1] < -180 && vbox[3] >= 180) ||
+      vbox[3] - vbox[1] >= 360)
+    { vbox[1] = -180; vbox[3] = 180; }
+  else if (vbox[1] < -180)
+    vbox[1] = 360 + vbox[1];
+  else if (vbox[3] > 180)
+    vbox[3] = -360 + vbox[3];
+}
+
+double now_secs(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main(int argc, char *argv[]) {
+  const char *progname = argv[0];
+  const char *tracks_file = NULL;
+  FILE *fquery = NULL;
+  unsigned num_queries = 100000, max_splits = 31, repeat = 10;
+  unsigned seed = 1, pick_k = 0;
+  int metric = KDNN_GREAT_CIRCLE;
+  WTracks tracks;
+  KdPVSQuery *queries;
+  KdPVSResult *results;
+  KdPVSRuns runs;
+  unsigned long tot_pvs = 0;
+  /* FNV-1a hash over the runs of each class, in order.  */
+  unsigned long hash = 2166136261ul;
+  double start_time, elapsed;
+  unsigned i;
+
+  while (*++argv != NULL) {
+    if (!strcmp(*argv, "-h") || !strcmp(*argv, "--help")) {
+      display_help(stdout, progname);
+      return 0;
+    } else if (!strcmp(*argv, "-n") && argv[1] != NULL)
+      num_queries = strtoul(*++argv, NULL, 0);
+    else if (!strcmp(*argv, "-s") && argv[1] != NULL)
+      max_splits = strtoul(*++argv, NULL, 0);
+    else if (!strcmp(*argv, "-r") && argv[1] != NULL)
+      repeat = strtoul(*++argv, NULL, 0);
+    else if (!strcmp(*argv, "-k") && argv[1] != NULL)
+      pick_k = strtoul(*++argv, NULL, 0);
+    else if (!strcmp(*argv, "-e"))
+      metric = KDNN_EQUIRECT;
+    else if (!strcmp(*argv, "-seed") && argv[1] != NULL)
+      seed = strtoul(*++argv, NULL, 0);
+    else if (!strcmp(*argv, "-q") && argv[1] != NULL) {
+      fquery = fopen(*++argv, "w");
+      if (fquery == NULL) {
+	fprintf(stderr, "Error: Could not open %s: %s\n",
+		*argv, strerror(errno));
+	return 1;
+      }
+    } else if (tracks_file == NULL)
+      tracks_file = *argv;
+    else {
+      fprintf(stderr, "Error: Unknown argument: %s\n", *argv);
+      display_help(stderr, progname);
+      return 1;
+    }
+  }
+  if (tracks_file == NULL || num_queries == 0 || repeat == 0) {
+    display_help(stderr, progname);
+    return 1;
+  }
+
+  if (wtxt_load(tracks_file, &tracks) != 0)
+    return 1;
+  if (tracks.num_dates == 0) {
+    fputs("Error: The tracks data file has no dates.\n", stderr);
+    wtxt_destroy(&tracks);
+    return 1;
+  }
+
+  srand(seed);
+  if (pick_k > 0) {
+    int retval = bench_pick(&tracks, num_queries, repeat, pick_k, metric);
+    wtxt_destroy(&tracks);
+    return retval;
+  }
+
+  /* Generate the queries.  The view width ranges from the whole map
+     down to about a degree, as at the viewer's zoom limits, and the
+     view has the aspect ratio of a typical window.  */
+  queries = (KdPVSQuery*)xmalloc(sizeof(KdPVSQuery) * num_queries);
+  results = (KdPVSResult*)xmalloc(sizeof(KdPVSResult) * num_queries);
+  for (i = 0; i < num_queries; i++) {
+    double *vbox = queries[i].vbox;
+    double width = 360 / pow(2, 8.0 * rand() / RAND_MAX);
+    double height = width / 1.6;
+    double x = -180 + 360.0 * rand() / RAND_MAX;
+    double y = -90 + 180.0 * rand() / RAND_MAX;
+    queries[i].date_index = rand() % tracks.num_dates;
+    vbox[0] = y - height / 2; vbox[1] = x - width / 2;
+    vbox[2] = y + height / 2; vbox[3] = x + width / 2;
+    clip_vbox(vbox);
+    if (fquery != NULL)
+      fprintf(fquery, "%u %.17g %.17g %.17g %.17g\n", queries[i].date_index,
+	      vbox[0], vbox[1], vbox[2], vbox[3]);
+  }
+  if (fquery != NULL && fclose(fquery) == EOF) {
+    fprintf(stderr, "Error closing query file: %s\n", strerror(errno));
+    return 1;
+  }
+
+  kdpvs_runs_init(&runs);
+  start_time = now_secs();
+  for (i = 0; i < repeat; i++)
+    tot_pvs = kdpvs_batch(&tracks, queries, num_queries, max_splits,
+			  &runs, results);
+  elapsed = now_secs() - start_time;
+  for (i = 0; i < KD_NUM_CLASSES; i++) {
+    unsigned j;
+    for (j = 0; j < runs.c[i].len; j++) {
+      hash = ((hash ^ runs.c[i].d[j].start) * 16777619ul) & 0xffffffff;
+      hash = ((hash ^ runs.c[i].d[j].length) * 16777619ul) & 0xffffffff;
+    }
+  }
+
+  printf("%u queries x %u: %.3f s, %.0f queries/s\n",
+	 num_queries, repeat, elapsed, (double)num_queries * repeat / elapsed);
+  printf("checksum: %lu %u %u %u %08lx\n", tot_pvs,
+	 runs.c[KD_DEF_VIS].len, runs.c[KD_POS_VIS].len,
+	 runs.c[KD_NOT_VIS].len, hash);
+
+  kdpvs_runs_destroy(&runs);
+  xfree(queries);
+  xfree(results);
+  wtxt_destroy(&tracks);
+  return 0;
+}
+
+int bench_pick(const WTracks *tracks, unsigned num_queries, unsigned repeat,
+	       unsigned k, int metric) {
+  KdPVSQuery *points; /* Only the date and the first two coordinates */
+  KdNeighbor *neighbors;
+  unsigned long tot_found = 0, max_date_len = 0;
+  double start_time, elapsed;
+  unsigned i, j;
+
+  for (i = 0; i < tracks->num_dates; i++) {
+    unsigned long len = tracks->date_chunk_starts[i+1] -
+      tracks->date_chunk_starts[i];
+    if (len > max_date_len)
+      max_date_len = len;
+  }
+
+  points = (KdPVSQuery*)xmalloc(sizeof(KdPVSQuery) * num_queries);
+  neighbors = (KdNeighbor*)xmalloc(sizeof(KdNeighbor) * k);
+  for (i = 0; i < num_queries; i++) {
+    points[i].date_index = rand() % tracks->num_dates;
+    points[i].vbox[0] = -90 + 180.0 * rand() / RAND_MAX;
+    points[i].vbox[1] = -180 + 360.0 * rand() / RAND_MAX;
+  }
+
+  start_time = now_secs();
+  for (j = 0; j < repeat; j++) {
+    for (i = 0; i < num_queries; i++)
+      tot_found += kdnn_query(tracks, points[i].date_index,
+			      points[i].vbox[0], points[i].vbox[1],
+			      k, metric, neighbors);
+  }
+  elapsed = now_secs() - start_time;
+
+  printf("%u picks x %u (k = %u, up to %lu eddies per date): "
+	 "%.3f s, %.2f us/pick\n", num_queries, repeat, k, max_date_len,
+	 elapsed, elapsed * 1e6 / ((double)num_queries * repeat));
+  printf("found: %lu\n", tot_found);
+  xfree(points);
+  xfree(neighbors);
+  return 0;
+}
@@ -0,0 +1,219 @@
+/* Nearest eddy search over the per-date kd-trees in the tracks data.
+
+   The eddies of each date are stored as an implicit kd-tree: the
+   median of a range [ start, start + length ) is at `start + (length
+   - 1) / 2', the eddies before it are on the less-than side and the
+   eddies after it are on the greater-than side, and the splitting
+   dimension alternates between latitude and longitude, starting with
+   latitude.  The search descends into the nearer side first, keeps
+   the `k' best candidates found so far, and skips any side whose
+   bounding box cannot contain anything closer than the current `k'th
+   best.
+
+   During the search, distances are compared by a key that increases
+   monotonically with the true distance: the squared distance for the
+   equirectangular metric and the haversine for the great-circle
+   metric.  The lower bound for a box uses the smallest latitude and
+   longitude differences to the box, together with the smallest cosine
+   of latitude in the box for the great-circle metric.  To avoid
+   trigonometric functions in the inner loop, the great-circle bounds
+   use the Taylor bounds sin(x) >= x - x^3/6 for x >= 0 and cos(x) >=
+   1 - x^2/2, which are nearly as tight for nearby boxes.  A box is
+   also never closer than the great circle through its nearest
+   bounding meridian, which keeps the bound useful for boxes that
+   extend toward the poles.
+
+Copyright (C) 2014 University of Minnesota
+
+See the file "COPYING" in the top level directory for details.
+
+*/
+
+#include <string.h>
+#include <math.h>
+
+#include "kdnn.h"
+
+#define DEG_TO_RAD (M_PI / 180)
+
+struct NNSearch_tag {
+  const WTracks *tracks;
+  double lat, lon;
+  double cos_lat;
+  int metric;
+  unsigned k;
+  unsigned num_found;
+  /* Candidates in order of increasing key, stored in `dist'.  */
+  KdNeighbor *best;
+};
+typedef struct NNSearch_tag NNSearch;
+
+/* Lower bound of sin(x/2) for an angle `x' in degrees within
+   [ -180, 180 ].  */
+static double sin_half_lb(double x) {
+  double y = fabs(x) * DEG_TO_RAD / 2;
+  return y - y * y * y / 6;
+}
+
+/* Longitude difference in degrees, wrapped to [ 0, 180 ].  */
+static double lon_diff(double a, double b) {
+  double d = fabs(a - b);
+  if (d > 180)
+    d = 360 - d;
+  return d;
+}
+
+static double worst_key(const NNSearch *s) {
+  if (s->num_found < s->k)
+    return HUGE_VAL;
+  return s->best[s->k-1].dist;
+}
+
+static double point_key(const NNSearch *s, double lat, double lon) {
+  double dlat = lat - s->lat;
+  double dlon = lon_diff(lon, s->lon);
+  if (s->metric == KDNN_EQUIRECT) {
+    dlon *= s->cos_lat;
+    return dlat * dlat + dlon * dlon;
+  } else {
+    double sin_dlat;
+    /* Skip the exact computation if the latitude difference alone
+       rules out this point.  */
+    double lb = sin_half_lb(dlat);
+    if (lb * lb >= worst_key(s))
+      return HUGE_VAL;
+    sin_dlat = sin(dlat * DEG_TO_RAD / 2);
+    double sin_dlon = sin(dlon * DEG_TO_RAD / 2);
+    return sin_dlat * sin_dlat +
+      s->cos_lat * cos(lat * DEG_TO_RAD) * sin_dlon * sin_dlon;
+  }
+}
+
+/* `box' is [ min_lat, min_lon, max_lat, max_lon ] in degrees.  Boxes
+   within the kd-tree never cross the antimeridian.  */
+static double box_key(const NNSearch *s, const double *box) {
+  double dlat = 0, dlon = 0;
+  if (s->lat < box[0])
+    dlat = box[0] - s->lat;
+  else if (s->lat > box[2])
+    dlat = s->lat - box[2];
+  if (s->lon < box[1] || s->lon > box[3]) {
+    double d1 = lon_diff(s->lon, box[1]);
+    double d2 = lon_diff(s->lon, box[3]);
+    dlon = (d1 < d2) ? d1 : d2;
+  }
+  if (s->metric == KDNN_EQUIRECT) {
+    dlon *= s->cos_lat;
+    return dlat * dlat + dlon * dlon;
+  } else {
+    double max_abs_lat = ((-box[0] > box[2]) ? -box[0] : box[2]) * DEG_TO_RAD;
+    double cos_min = 1 - max_abs_lat * max_abs_lat / 2;
+    double sin_dlat = sin_half_lb(dlat);
+    double sin_dlon = sin_half_lb(dlon);
+    double key, xt_key;
+    if (cos_min < 0)
+      cos_min = 0;
+    key = sin_dlat * sin_dlat + s->cos_lat * cos_min * sin_dlon * sin_dlon;
+    /* Distance to the great circle through the nearest bounding
+       meridian, regardless of the latitudes of the box.  */
+    if (dlon > 0) {
+      double sin_xt = s->cos_lat * ((dlon < 90) ? sin(dlon * DEG_TO_RAD) : 1);
+      xt_key = (1 - sqrt(1 - sin_xt * sin_xt)) / 2;
+      if (xt_key > key)
+	key = xt_key;
+    }
+    return key;
+  }
+}
+
+static void add_candidate(NNSearch *s, unsigned index, double key) {
+  unsigned i;
+  if (key >= worst_key(s))
+    return;
+  if (s->num_found < s->k)
+    s->num_found++;
+  for (i = s->num_found - 1; i > 0 && s->best[i-1].dist > key; i--)
+    s->best[i] = s->best[i-1];
+  s->best[i].index = index;
+  s->best[i].dist = key;
+}
+
+static void nn_search(NNSearch *s, unsigned start, unsigned length,
+		      unsigned depth, const double *box) {
+  unsigned curdim = depth % 2;
+  unsigned median = start + (length - 1) / 2;
+  unsigned end = start + length;
+  double median_val;
+  double lt_box[4], gt_box[4];
+  double lt_key, gt_key;
+
+  add_candidate(s, median, point_key(s, s->tracks->lat[median],
+				     s->tracks->lon[median]));
+  if (length <= 1)
+    return;
+
+  median_val = (curdim == 0) ? s->tracks->lat[median] :
+    s->tracks->lon[median];
+  memcpy(lt_box, box, sizeof(lt_box));
+  memcpy(gt_box, box, sizeof(gt_box));
+  lt_box[2+curdim] = median_val;
+  gt_box[curdim] = median_val;
+  lt_key = (median > start) ? box_key(s, lt_box) : HUGE_VAL;
+  gt_key = (end > median + 1) ? box_key(s, gt_box) : HUGE_VAL;
+
+  if (lt_key <= gt_key) {
+    if (lt_key < worst_key(s))
+      nn_search(s, start, median - start, depth + 1, lt_box);
+    if (gt_key < worst_key(s))
+      nn_search(s, median + 1, end - (median + 1), depth + 1, gt_box);
+  } else {
+    if (gt_key < worst_key(s))
+      nn_search(s, median + 1, end - (median + 1), depth + 1, gt_box);
+    if (lt_key < worst_key(s))
+      nn_search(s, start, median - start, depth + 1, lt_box);
+  }
+}
+
+/* Find the `k' eddies on the zero-based `date_index' that are nearest
+   to the given point in degrees.  `out' must have room for `k'
+   elements, and it is filled in order of increasing distance.
+   Returns the number of eddies found, which is less than `k' only if
+   the date has fewer eddies.  */
+unsigned kdnn_query(const WTracks *tracks, unsigned date_index,
+		    double lat, double lon, unsigned k, int metric,
+		    KdNeighbor *out) {
+  static const double world_box[4] = { -90, -180, 90, 180 };
+  NNSearch s;
+  unsigned start, length;
+  unsigned i;
+
+  if (date_index >= tracks->num_dates || k == 0)
+    return 0;
+  start = tracks->date_chunk_starts[date_index];
+  length = tracks->date_chunk_starts[date_index+1] - start;
+  if (length == 0)
+    return 0;
+
+  s.tracks = tracks;
+  s.lat = lat;
+  /* Normalize the longitude to [ -180, 180 ).  */
+  s.lon = fmod(lon + 180, 360);
+  if (s.lon < 0)
+    s.lon += 360;
+  s.lon -= 180;
+  s.cos_lat = cos(lat * DEG_TO_RAD);
+  s.metric = metric;
+  s.k = k;
+  s.num_found = 0;
+  s.best = out;
+  nn_search(&s, start, length, 0, world_box);
+
+  for (i = 0; i < s.num_found; i++) {
+    if (metric == KDNN_EQUIRECT)
+      out[i].dist = sqrt(out[i].dist);
+    else
+      out[i].dist = 2 * asin(sqrt((out[i].dist < 1) ? out[i].dist : 1)) /
+	DEG_TO_RAD;
+  }
+  return s.num_found;
+}
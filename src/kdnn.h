@@ -0,0 +1,34 @@
+/* Nearest eddy search over the per-date kd-trees in the tracks data,
+   used to identify the eddy that the user clicks on.
+
+Copyright (C) 2014 University of Minnesota
+
+See the file "COPYING" in the top level directory for details.
+
+*/
+
+#ifndef KDNN_H
+#define KDNN_H
+
+#include "wtxt.h"
+
+/* Distance metrics.  Both wrap around the antimeridian.  */
+/* Equirectangular approximation, with longitude differences scaled by
+   the cosine of the query latitude.  */
+#define KDNN_EQUIRECT 0
+/* Exact great-circle distance.  */
+#define KDNN_GREAT_CIRCLE 1
+
+struct KdNeighbor_tag {
+  /* Index of the eddy within the tracks data file.  */
+  unsigned index;
+  /* Distance in degrees of arc.  */
+  double dist;
+};
+typedef struct KdNeighbor_tag KdNeighbor;
+
+unsigned kdnn_query(const WTracks *tracks, unsigned date_index,
+		    double lat, double lon, unsigned k, int metric,
+		    KdNeighbor *out);
+
+#endif /* not KDNN_H */
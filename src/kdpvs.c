@@ -0,0 +1,219 @@
+/* Kd-tree potential visibility traversal of the per-date kd-trees in
+   the tracks data.
+
+   This is a direct port of `WCTracksLayer.kdPVS()' in
+   "trackslayer.js", and it must be kept in sync with it: for the same
+   tracks data, viewport bounding box, and `maxSplits', both produce
+   the same ranges in the same order.  See the JavaScript version for
+   a description of the traversal rules.  The only differences are
+   that many queries can be answered in a single call, and the ranges
+   of all queries are appended to shared arrays rather than allocated
+   per query.
+
+Copyright (C) 2014 University of Minnesota
+
+See the file "COPYING" in the top level directory for details.
+
+*/
+
+#include <math.h>
+
+#include "kdpvs.h"
+
+/* Stack frames are only pushed when the traversal descends one level,
+   so the stack can never be deeper than the kd-tree.  */
+#define KD_MAX_STACK 64
+
+struct KdFrame_tag {
+  double kdvbox[4];
+  unsigned start;
+  unsigned length;
+  unsigned depth;
+};
+typedef struct KdFrame_tag KdFrame;
+
+#define PUSH_RUN(cls, run_start, run_length)		\
+  do {							\
+    KdRun_array *ra = &runs->c[cls];			\
+    ra->d[ra->len].start = (run_start);		\
+    ra->d[ra->len].length = (run_length);		\
+    EA_ADD(*ra);					\
+    result->count[cls]++;				\
+  } while (0)
+
+void kdpvs_runs_init(KdPVSRuns *runs) {
+  unsigned i;
+  for (i = 0; i < KD_NUM_CLASSES; i++)
+    EA_INIT(KdRun, runs->c[i], 64);
+}
+
+void kdpvs_runs_destroy(KdPVSRuns *runs) {
+  unsigned i;
+  for (i = 0; i < KD_NUM_CLASSES; i++)
+    EA_DESTROY(runs->c[i]);
+}
+
+/* Check if a single eddy is within the viewport box.  */
+static int eddy_in_vbox(const double *vbox, double vbox_latsz,
+			double vbox_lonsz, double lat, double lon) {
+  int is_lat_in =
+    (vbox_latsz > 0 && vbox[0] < lat && lat < vbox[2]) ||
+    (vbox_latsz < 0 && (vbox[0] < lat || lat < vbox[2]));
+  int is_lon_in =
+    (vbox_lonsz > 0 && vbox[1] < lon && lon < vbox[3]) ||
+    (vbox_lonsz < 0 && (vbox[1] < lon || lon < vbox[3]));
+  return is_lat_in && is_lon_in;
+}
+
+/* Append the ranges for a single query to `runs' and record where
+   they are in `result'.  */
+void kdpvs_query(const WTracks *tracks, const KdPVSQuery *query,
+		 unsigned max_splits, KdPVSRuns *runs, KdPVSResult *result) {
+  int max_depth = max_splits ? (int)(log(max_splits) / log(2)) - 1 : 0;
+  const double *vbox = query->vbox;
+  /* These serve both as size and order metrics.  */
+  double vbox_latsz = vbox[2] - vbox[0];
+  double vbox_lonsz = vbox[3] - vbox[1];
+  KdFrame stack[KD_MAX_STACK];
+  unsigned stack_len = 0;
+  double kdvbox[4] = { -90, -180, 90, 180 };
+  unsigned start, length, depth = 0;
+  unsigned i;
+
+  for (i = 0; i < KD_NUM_CLASSES; i++) {
+    result->first[i] = runs->c[i].len;
+    result->count[i] = 0;
+  }
+  result->tot_pvs = 0;
+  result->num_splits = 0;
+  result->num_trims = 0;
+
+  if (query->date_index >= tracks->num_dates)
+    return;
+  start = tracks->date_chunk_starts[query->date_index];
+  length = tracks->date_chunk_starts[query->date_index+1] - start;
+
+  while (length > 0) {
+    /* Current dimension (latitude (0) or longitude (1)) */
+    unsigned curdim = depth % 2;
+    unsigned median = start + (length - 1) / 2;
+    unsigned end = start + length;
+    double lat = tracks->lat[median];
+    double lon = tracks->lon[median];
+    double median_val = (curdim == 0) ? lat : lon;
+    double vbox_min = vbox[curdim];
+    double vbox_max = vbox[2+curdim];
+    /* Is the max edge less than the min edge?  */
+    double vbox_order = vbox_max - vbox_min;
+
+    if (length <= 1) {
+      /* Cannot split a partition of minimum size.  Traversal will
+	 continue by popping from the stack.  */
+      if (eddy_in_vbox(vbox, vbox_latsz, vbox_lonsz, lat, lon)) {
+	PUSH_RUN(KD_DEF_VIS, median, 1);
+	result->tot_pvs++;
+      } else
+	PUSH_RUN(KD_NOT_VIS, median, 1);
+      length = 0; /* Force popping from the stack.  */
+    }
+    else if ((vbox_order > 0 &&
+	      vbox_min < median_val && vbox_max < median_val) ||
+	     (vbox_order < 0 &&
+	      kdvbox[2+curdim] < vbox_min && median_val > vbox_max)) {
+      /* Choose the less-than side.  */
+      kdvbox[2+curdim] = median_val;
+      PUSH_RUN(KD_NOT_VIS, median, end - median);
+      result->num_trims++;
+      length = median - start; depth++;
+    }
+    else if ((vbox_order > 0 &&
+	      vbox_min > median_val && vbox_max > median_val) ||
+	     (vbox_order < 0 &&
+	      kdvbox[curdim] > vbox_max && median_val < vbox_min)) {
+      /* Choose the greater-than side.  */
+      kdvbox[curdim] = median_val;
+      PUSH_RUN(KD_NOT_VIS, start, (median + 1) - start);
+      result->num_trims++;
+      start = median + 1; length = end - start; depth++;
+    }
+    else {
+      /* Split the traversal box into two boxes since neither of the
+	 boxes entirely contain the viewport box, subject to the same
+	 limits as the JavaScript version.  */
+      int split_okay = !max_splits ||
+	(result->num_splits < max_splits && (int)stack_len < max_depth);
+      int invbox =
+	(vbox_latsz > 0 && kdvbox[0] >= vbox[0] && kdvbox[2] <= vbox[2]) &&
+	((vbox_lonsz > 0 && kdvbox[1] >= vbox[1] && kdvbox[3] <= vbox[3]) ||
+	 (vbox_lonsz < 0 &&
+	  ((kdvbox[1] <= vbox[3] && kdvbox[3] <= vbox[3]) ||
+	   (kdvbox[1] >= vbox[1] && kdvbox[3] >= vbox[1]))));
+      int huge_num = length > 128;
+      int oversized =
+	(vbox_latsz > 0 &&
+	 (vbox[0] - kdvbox[0] > vbox_latsz ||
+	  kdvbox[2] - vbox[2] > vbox_latsz)) ||
+	(vbox_lonsz > 0 &&
+	 (vbox[1] - kdvbox[1] > vbox_lonsz ||
+	  kdvbox[3] - vbox[3] > vbox_lonsz)) ||
+	(vbox_lonsz < 0 &&
+	 (kdvbox[3] - kdvbox[1] > vbox_lonsz ||
+	  vbox[1] - kdvbox[1] < vbox_lonsz ||
+	  kdvbox[3] - vbox[3] < vbox_lonsz));
+
+      if (split_okay && stack_len < KD_MAX_STACK &&
+	  !invbox && (huge_num || oversized)) {
+	KdFrame *frame;
+	/* Include the median if it is within the viewport box.  */
+	if (eddy_in_vbox(vbox, vbox_latsz, vbox_lonsz, lat, lon)) {
+	  PUSH_RUN(KD_DEF_VIS, median, 1);
+	  result->tot_pvs++;
+	} else
+	  PUSH_RUN(KD_NOT_VIS, median, 1);
+
+	result->num_splits++; depth++;
+	/* Push the (sometimes) larger right partition onto the stack
+	   first.  */
+	frame = &stack[stack_len++];
+	memcpy(frame->kdvbox, kdvbox, sizeof(kdvbox));
+	frame->kdvbox[curdim] = median_val;
+	frame->start = median + 1;
+	frame->length = end - (median + 1);
+	frame->depth = depth;
+
+	kdvbox[2+curdim] = median_val;
+	length = median - start;
+      } else {
+	PUSH_RUN(invbox ? KD_DEF_VIS : KD_POS_VIS, start, length);
+	result->tot_pvs += length;
+	length = 0; /* Force popping from the stack.  */
+      }
+    }
+
+    /* Process any entries remaining on the stack.  */
+    while (length == 0 && stack_len > 0) {
+      KdFrame *frame = &stack[--stack_len];
+      memcpy(kdvbox, frame->kdvbox, sizeof(kdvbox));
+      start = frame->start; length = frame->length; depth = frame->depth;
+    }
+  }
+}
+
+/* Answer `num_queries' queries, storing their results in the
+   corresponding elements of `results'.  The previous contents of
+   `runs' are discarded.  Returns the total number of potentially
+   visible eddies over all queries.  */
+unsigned long kdpvs_batch(const WTracks *tracks,
+			  const KdPVSQuery *queries, unsigned num_queries,
+			  unsigned max_splits,
+			  KdPVSRuns *runs, KdPVSResult *results) {
+  unsigned long tot_pvs = 0;
+  unsigned i;
+  for (i = 0; i < KD_NUM_CLASSES; i++)
+    EA_CLEAR(runs->c[i]);
+  for (i = 0; i < num_queries; i++) {
+    kdpvs_query(tracks, &queries[i], max_splits, runs, &results[i]);
+    tot_pvs += results[i].tot_pvs;
+  }
+  return tot_pvs;
+}
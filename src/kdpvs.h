@@ -0,0 +1,71 @@
+/* Kd-tree potential visibility traversal of the per-date kd-trees in
+   the tracks data, ported from `WCTracksLayer.kdPVS()' in
+   "trackslayer.js" so that viewport queries can be answered and
+   measured outside of the browser.
+
+Copyright (C) 2014 University of Minnesota
+
+See the file "COPYING" in the top level directory for details.
+
+*/
+
+#ifndef KDPVS_H
+#define KDPVS_H
+
+#include "exparray.h"
+#include "wtxt.h"
+
+/* Classification of the ranges of eddies, in the same order as the
+   arrays returned by `WCTracksLayer.kdPVS()'.  */
+#define KD_DEF_VIS 0 /* Definitely visible */
+#define KD_POS_VIS 1 /* Possibly visible */
+#define KD_NOT_VIS 2 /* Not visible */
+#define KD_NUM_CLASSES 3
+
+/* A range of eddy indexes [ start, start + length ).  */
+struct KdRun_tag {
+  unsigned start;
+  unsigned length;
+};
+typedef struct KdRun_tag KdRun;
+EA_TYPE(KdRun);
+
+/* `date_index' is zero-based.  `vbox' is [ min_lat, min_lon, max_lat,
+   max_lon ] in degrees, and it must have been clipped as by
+   `clipVBox()' in "oevmath.js".  A longitude range that crosses the
+   antimeridian has `max_lon' less than `min_lon'.  */
+struct KdPVSQuery_tag {
+  unsigned date_index;
+  double vbox[4];
+};
+typedef struct KdPVSQuery_tag KdPVSQuery;
+
+/* The runs of one query are `runs->c[k].d[first[k]]' through
+   `runs->c[k].d[first[k] + count[k] - 1]' for every class `k'.  */
+struct KdPVSResult_tag {
+  unsigned first[KD_NUM_CLASSES];
+  unsigned count[KD_NUM_CLASSES];
+  /* Total number of potentially visible eddies.  */
+  unsigned tot_pvs;
+  /* Diagnostics, as `kdNumSplits' and `kdNumTrims' in JavaScript.  */
+  unsigned num_splits;
+  unsigned num_trims;
+};
+typedef struct KdPVSResult_tag KdPVSResult;
+
+/* Run storage shared by all queries of a batch.  */
+struct KdPVSRuns_tag {
+  KdRun_array c[KD_NUM_CLASSES];
+};
+typedef struct KdPVSRuns_tag KdPVSRuns;
+
+void kdpvs_runs_init(KdPVSRuns *runs);
+void kdpvs_runs_destroy(KdPVSRuns *runs);
+void kdpvs_query(const WTracks *tracks, const KdPVSQuery *query,
+		 unsigned max_splits, KdPVSRuns *runs, KdPVSResult *result);
+unsigned long kdpvs_batch(const WTracks *tracks,
+			  const KdPVSQuery *queries, unsigned num_queries,
+			  unsigned max_splits,
+			  KdPVSRuns *runs, KdPVSResult *results);
+
+#endif /* not KDPVS_H */
@@ -0,0 +1,290 @@
+/* Thread-safe, sharded, byte-budgeted LRU cache of response bodies.
+
+   Keys are hashed to one of several shards, each with its own lock,
+   hash table, recency list, and an equal share of the byte budget, so
+   that threads storing and looking up unrelated keys rarely contend.
+   An entry is charged for its data, its key, and its bookkeeping.  An
+   entry larger than a shard's budget is never cached, but `lru_put()'
+   still returns it so that the caller can send it.
+
+Copyright (C) 2014 University of Minnesota
+
+See the file "COPYING" in the top level directory for details.
+
+*/
+
+#include <string.h>
+#include <pthread.h>
+
+#include "xmalloc.h"
+#include "lrucache.h"
+
+#define MIN_BUCKETS 64
+
+struct LRUShard_tag {
+  pthread_mutex_t lock;
+  LRUEntry **buckets;
+  unsigned long num_buckets; /* Always a power of two */
+  unsigned long num_entries;
+  /* Most recently used first */
+  LRUEntry *head, *tail;
+  size_t bytes;
+  size_t byte_budget;
+  unsigned long hits, misses, insertions, evictions;
+};
+typedef struct LRUShard_tag LRUShard;
+
+struct LRUCache_tag {
+  LRUShard *shards;
+  unsigned num_shards;
+  size_t byte_budget;
+};
+
+/* The shard is chosen by higher bits of the hash than the buckets
+   within a shard.  */
+#define SHARD_OF(cache, hash) \
+  (&(cache)->shards[((hash) >> 24) % (cache)->num_shards])
+
+static size_t entry_cost(const LRUEntry *entry) {
+  return sizeof(LRUEntry) + strlen(entry->key) + 1 + entry->len;
+}
+
+static void entry_free(LRUEntry *entry) {
+  xfree(entry->key);
+  xfree(entry->data);
+  xfree(entry);
+}
+
+static void lru_unlink(LRUShard *shard, LRUEntry *entry) {
+  if (entry->lru_prev != NULL)
+    entry->lru_prev->lru_next = entry->lru_next;
+  else
+    shard->head = entry->lru_next;
+  if (entry->lru_next != NULL)
+    entry->lru_next->lru_prev = entry->lru_prev;
+  else
+    shard->tail = entry->lru_prev;
+  entry->lru_prev = entry->lru_next = NULL;
+}
+
+static void lru_push_front(LRUShard *shard, LRUEntry *entry) {
+  entry->lru_prev = NULL;
+  entry->lru_next = shard->head;
+  if (shard->head != NULL)
+    shard->head->lru_prev = entry;
+  else
+    shard->tail = entry;
+  shard->head = entry;
+}
+
+/* Remove an entry from its shard, and free it unless it is still
+   referenced.  The shard must be locked.  */
+static void shard_remove(LRUShard *shard, LRUEntry *entry) {
+  LRUEntry **link = &shard->buckets[entry->hash & (shard->num_buckets - 1)];
+  while (*link != entry)
+    link = &(*link)->chain_next;
+  *link = entry->chain_next;
+  lru_unlink(shard, entry);
+  shard->num_entries--;
+  shard->bytes -= entry_cost(entry);
+  entry->cached = 0;
+  if (entry->refs == 0)
+    entry_free(entry);
+}
+
+static void shard_grow(LRUShard *shard) {
+  unsigned long new_num = shard->num_buckets * 2;
+  LRUEntry **new_buckets = (LRUEntry**)xmalloc(sizeof(LRUEntry*) * new_num);
+  unsigned long i;
+  memset(new_buckets, 0, sizeof(LRUEntry*) * new_num);
+  for (i = 0; i < shard->num_buckets; i++) {
+    LRUEntry *entry = shard->buckets[i];
+    while (entry != NULL) {
+      LRUEntry *next = entry->chain_next;
+      LRUEntry **bucket = &new_buckets[entry->hash & (new_num - 1)];
+      entry->chain_next = *bucket;
+      *bucket = entry;
+      entry = next;
+    }
+  }
+  xfree(shard->buckets);
+  shard->buckets = new_buckets;
+  shard->num_buckets = new_num;
+}
+
+static LRUEntry *shard_find(LRUShard *shard, const char *key,
+			    unsigned long hash) {
+  LRUEntry *entry = shard->buckets[hash & (shard->num_buckets - 1)];
+  while (entry != NULL &&
+	 (entry->hash != hash || strcmp(entry->key, key)))
+    entry = entry->chain_next;
+  return entry;
+}
+
+/* 64-bit FNV-1a, truncated to `unsigned long' where that is
+   shorter.  */
+unsigned long lru_hash(const void *data, size_t len) {
+  const unsigned char *p = (const unsigned char*)data;
+  unsigned long long h = 14695981039346656037ULL;
+  size_t i;
+  for (i = 0; i < len; i++) {
+    h ^= p[i];
+    h *= 1099511628211ULL;
+  }
+  return (unsigned long)(h ^ (h >> 32));
+}
+
+/* Create a cache that holds at most `byte_budget' bytes, split evenly
+   between `num_shards' shards.  */
+LRUCache *lru_new(size_t byte_budget, unsigned num_shards) {
+  LRUCache *cache = (LRUCache*)xmalloc(sizeof(LRUCache));
+  unsigned i;
+  if (num_shards == 0)
+    num_shards = 1;
+  cache->num_shards = num_shards;
+  cache->byte_budget = byte_budget;
+  cache->shards = (LRUShard*)xmalloc(sizeof(LRUShard) * num_shards);
+  for (i = 0; i < num_shards; i++) {
+    LRUShard *shard = &cache->shards[i];
+    pthread_mutex_init(&shard->lock, NULL);
+    shard->num_buckets = MIN_BUCKETS;
+    shard->buckets = (LRUEntry**)xmalloc(sizeof(LRUEntry*) * MIN_BUCKETS);
+    memset(shard->buckets, 0, sizeof(LRUEntry*) * MIN_BUCKETS);
+    shard->num_entries = 0;
+    shard->head = shard->tail = NULL;
+    shard->bytes = 0;
+    shard->byte_budget = byte_budget / num_shards;
+    shard->hits = shard->misses = 0;
+    shard->insertions = shard->evictions = 0;
+  }
+  return cache;
+}
+
+/* Free the cache.  Entries that are still referenced are freed when
+   they are released.  */
+void lru_destroy(LRUCache *cache) {
+  unsigned i;
+  for (i = 0; i < cache->num_shards; i++) {
+    LRUShard *shard = &cache->shards[i];
+    while (shard->head != NULL)
+      shard_remove(shard, shard->head);
+    xfree(shard->buckets);
+    pthread_mutex_destroy(&shard->lock);
+  }
+  xfree(cache->shards);
+  xfree(cache);
+}
+
+/* Look up `key' and mark it as most recently used.  Returns a
+   reference that must be released with `lru_release()', or NULL if
+   the key is not cached.  */
+LRUEntry *lru_get(LRUCache *cache, const char *key) {
+  unsigned long hash = lru_hash(key, strlen(key));
+  LRUShard *shard = SHARD_OF(cache, hash);
+  LRUEntry *entry;
+  pthread_mutex_lock(&shard->lock);
+  entry = shard_find(shard, key, hash);
+  if (entry != NULL) {
+    shard->hits++;
+    entry->refs++;
+    if (entry != shard->head) {
+      lru_unlink(shard, entry);
+      lru_push_front(shard, entry);
+    }
+  } else
+    shard->misses++;
+  pthread_mutex_unlock(&shard->lock);
+  return entry;
+}
+
+/* Store `len' bytes of `data' under `key', replacing any existing
+   entry, and evict least recently used entries until the shard is
+   within its budget.  The cache takes ownership of `data', which must
+   have been allocated with `xmalloc()'.  `etag' is copied and may be
+   NULL.  Returns a reference to the new entry that must be released
+   with `lru_release()'.  */
+LRUEntry *lru_put(LRUCache *cache, const char *key,
+		  void *data, size_t len, const char *etag) {
+  unsigned long hash = lru_hash(key, strlen(key));
+  LRUShard *shard = SHARD_OF(cache, hash);
+  LRUEntry *entry = (LRUEntry*)xmalloc(sizeof(LRUEntry));
+  LRUEntry *old;
+  size_t cost;
+
+  entry->key = xstrdup(key);
+  entry->hash = hash;
+  entry->data = data;
+  entry->len = len;
+  entry->etag[0] = '\0';
+  if (etag != NULL) {
+    strncpy(entry->etag, etag, LRU_ETAG_SIZE - 1);
+    entry->etag[LRU_ETAG_SIZE-1] = '\0';
+  }
+  entry->refs = 1;
+  entry->cached = 0;
+  entry->lru_prev = entry->lru_next = NULL;
+  entry->chain_next = NULL;
+  entry->shard = shard;
+  cost = entry_cost(entry);
+
+  pthread_mutex_lock(&shard->lock);
+  old = shard_find(shard, key, hash);
+  if (old != NULL)
+    shard_remove(shard, old);
+  if (cost <= shard->byte_budget) {
+    LRUEntry **bucket;
+    while (shard->bytes + cost > shard->byte_budget) {
+      shard_remove(shard, shard->tail);
+      shard->evictions++;
+    }
+    if (shard->num_entries >= shard->num_buckets)
+      shard_grow(shard);
+    bucket = &shard->buckets[hash & (shard->num_buckets - 1)];
+    entry->chain_next = *bucket;
+    *bucket = entry;
+    lru_push_front(shard, entry);
+    entry->cached = 1;
+    shard->num_entries++;
+    shard->bytes += cost;
+    shard->insertions++;
+  }
+  pthread_mutex_unlock(&shard->lock);
+  return entry;
+}
+
+/* Add a reference to an entry that is already referenced.  */
+void lru_retain(LRUEntry *entry) {
+  LRUShard *shard = entry->shard;
+  pthread_mutex_lock(&shard->lock);
+  entry->refs++;
+  pthread_mutex_unlock(&shard->lock);
+}
+
+void lru_release(LRUEntry *entry) {
+  LRUShard *shard = entry->shard;
+  int unused;
+  pthread_mutex_lock(&shard->lock);
+  entry->refs--;
+  unused = (entry->refs == 0 && !entry->cached);
+  pthread_mutex_unlock(&shard->lock);
+  if (unused)
+    entry_free(entry);
+}
+
+/* Sum the counters of all shards.  */
+void lru_stats(LRUCache *cache, LRUStats *stats) {
+  unsigned i;
+  memset(stats, 0, sizeof(LRUStats));
+  stats->byte_budget = cache->byte_budget;
+  for (i = 0; i < cache->num_shards; i++) {
+    LRUShard *shard = &cache->shards[i];
+    pthread_mutex_lock(&shard->lock);
+    stats->hits += shard->hits;
+    stats->misses += shard->misses;
+    stats->insertions += shard->insertions;
+    stats->evictions += shard->evictions;
+    stats->entries += shard->num_entries;
+    stats->bytes += shard->bytes;
+    pthread_mutex_unlock(&shard->lock);
+  }
+}
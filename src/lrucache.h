@@ -0,0 +1,58 @@
+/* Thread-safe, sharded, byte-budgeted LRU cache of response bodies.
+
+Copyright (C) 2014 University of Minnesota
+
+See the file "COPYING" in the top level directory for details.
+
+*/
+
+#ifndef LRUCACHE_H
+#define LRUCACHE_H
+
+#include <stddef.h>
+
+#define LRU_ETAG_SIZE 48
+
+/* Entries are reference counted, so an entry that is evicted while a
+   response is still being sent from it stays valid until it is
+   released.  All fields are read-only to users of the cache.  */
+struct LRUEntry_tag {
+  char *key;
+  unsigned long hash;
+  void *data;
+  size_t len;
+  /* Strong entity tag, including the quotes.  */
+  char etag[LRU_ETAG_SIZE];
+  unsigned refs;
+  /* Whether the entry is still owned by the cache.  */
+  int cached;
+  struct LRUEntry_tag *lru_prev, *lru_next;
+  struct LRUEntry_tag *chain_next;
+  struct LRUShard_tag *shard;
+};
+typedef struct LRUEntry_tag LRUEntry;
+
+struct LRUStats_tag {
+  unsigned long hits;
+  unsigned long misses;
+  unsigned long insertions;
+  unsigned long evictions;
+  unsigned long entries;
+  size_t bytes;
+  size_t byte_budget;
+};
+typedef struct LRUStats_tag LRUStats;
+
+typedef struct LRUCache_tag LRUCache;
+
+LRUCache *lru_new(size_t byte_budget, unsigned num_shards);
+void lru_destroy(LRUCache *cache);
+LRUEntry *lru_get(LRUCache *cache, const char *key);
+LRUEntry *lru_put(LRUCache *cache, const char *key,
+		  void *data, size_t len, const char *etag);
+void lru_retain(LRUEntry *entry);
+void lru_release(LRUEntry *entry);
+void lru_stats(LRUCache *cache, LRUStats *stats);
+unsigned long lru_hash(const void *data, size_t len);
+
+#endif /* not LRUCACHE_H */
@@ -0,0 +1,299 @@
+/* HTTP load generator for measuring the throughput and latency of
+   oevserve, or of any other server with persistent connections.
+
+Copyright (C) 2014 University of Minnesota
+
+See the file "COPYING" in the top level directory for details.
+
+*/
+
+/* Usage: oevload [-c CONNECTIONS] [-n REQUESTS] [-a ADDRESS] [-p PORT]
+                  [-r RANGE] [-z] PATH...
+
+   Opens CONNECTIONS persistent connections and keeps one request
+   outstanding on each until REQUESTS requests have completed, cycling
+   through the given PATHs.  Reports the request rate, the transfer
+   rate, and the latency distribution.  Any response other than 200 or
+   206 is counted as an error.  */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <time.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "xmalloc.h"
+
+enum bool_tag { false, true };
+typedef enum bool_tag bool;
+
+#define RESP_BUF_SIZE 65536
+#define MAX_EVENTS 256
+
+struct Client_tag {
+  int fd;
+  /* Request being sent */
+  char req[1024];
+  size_t req_len, req_off;
+  /* Response being received.  Only the header is kept.  */
+  char buf[RESP_BUF_SIZE];
+  size_t buf_len;
+  bool in_body;
+  long long body_left;
+  double start_time;
+};
+typedef struct Client_tag Client;
+
+static const char *address = "127.0.0.1";
+static unsigned port = 8080;
+static const char *range = NULL;
+static bool compressed = false;
+static char **paths;
+static unsigned num_paths;
+static unsigned long num_issued = 0;
+
+void display_help(FILE *fout, const char *progname);
+double now_secs(void);
+int open_client(void);
+void start_request(Client *cl);
+int cmp_double(const void *a, const void *b);
+
+void display_help(FILE *fout, const char *progname) {
+  fprintf(fout,
+"Usage: %s [-c CONNECTIONS] [-n REQUESTS] [-a ADDRESS] [-p PORT]\n"
+"          [-r RANGE] [-z] PATH...\n\n", progname);
+  fputs(
+"Options:\n"
+"  -h, --help    Display this help message.\n"
+"  -c CONNECTIONS    Number of concurrent connections (default 32).\n"
+"  -n REQUESTS    Total number of requests (default 100000).\n"
+"  -a ADDRESS    IPv4 address of the server (default 127.0.0.1).\n"
+"  -p PORT    Port of the server (default 8080).\n"
+"  -r RANGE    Send \"Range: RANGE\" with every request, for example\n"
+"        \"bytes=0-65535\".\n"
+"  -z    Accept pre-compressed responses.\n",
+	fout);
+}
+
+double now_secs(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int open_client(void) {
+  struct sockaddr_in addr;
+  int one = 1;
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd == -1) {
+    fprintf(stderr, "Error: socket: %s\n", strerror(errno));
+    return -1;
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  if (inet_pton(AF_INET, address, &addr.sin_addr) != 1) {
+    fprintf(stderr, "Error: Invalid address: %s\n", address);
+    close(fd);
+    return -1;
+  }
+  if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+    fprintf(stderr, "Error: Could not connect to %s:%u: %s\n",
+	    address, port, strerror(errno));
+    close(fd);
+    return -1;
+  }
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+  return fd;
+}
+
+void start_request(Client *cl) {
+  const char *path = paths[num_issued++ % num_paths];
+  cl->req_len = snprintf(cl->req, sizeof(cl->req),
+			 "GET %s HTTP/1.1\r\n"
+			 "Host: %s:%u\r\n"
+			 "%s%s%s"
+			 "%s"
+			 "\r\n",
+			 path, address, port,
+			 (range != NULL) ? "Range: " : "",
+			 (range != NULL) ? range : "",
+			 (range != NULL) ? "\r\n" : "",
+			 compressed ? "Accept-Encoding: br, gzip\r\n" : "");
+  cl->req_off = 0;
+  cl->buf_len = 0;
+  cl->in_body = false;
+  cl->start_time = now_secs();
+}
+
+int cmp_double(const void *a, const void *b) {
+  double da = *(const double*)a, db = *(const double*)b;
+  return (da < db) ? -1 : (da > db);
+}
+
+int main(int argc, char *argv[]) {
+  const char *progname = argv[0];
+  unsigned num_conns = 32;
+  unsigned long num_requests = 100000;
+  unsigned long num_done = 0, num_errors = 0;
+  unsigned long long bytes = 0;
+  double *latencies;
+  Client *clients;
+  struct epoll_event ev, events[MAX_EVENTS];
+  double start_time, elapsed;
+  int epfd;
+  unsigned i;
+
+  paths = (char**)xmalloc(sizeof(char*) * argc);
+  num_paths = 0;
+  while (*++argv != NULL) {
+    if (!strcmp(*argv, "-h") || !strcmp(*argv, "--help")) {
+      display_help(stdout, progname);
+      return 0;
+    } else if (!strcmp(*argv, "-c") && argv[1] != NULL)
+      num_conns = strtoul(*++argv, NULL, 0);
+    else if (!strcmp(*argv, "-n") && argv[1] != NULL)
+      num_requests = strtoul(*++argv, NULL, 0);
+    else if (!strcmp(*argv, "-a") && argv[1] != NULL)
+      address = *++argv;
+    else if (!strcmp(*argv, "-p") && argv[1] != NULL)
+      port = strtoul(*++argv, NULL, 0);
+    else if (!strcmp(*argv, "-r") && argv[1] != NULL)
+      range = *++argv;
+    else if (!strcmp(*argv, "-z"))
+      compressed = true;
+    else
+      paths[num_paths++] = *argv;
+  }
+  if (num_paths == 0 || num_conns == 0 || num_requests == 0) {
+    display_help(stderr, progname);
+    return 1;
+  }
+  if (num_conns > num_requests)
+    num_conns = num_requests;
+
+  signal(SIGPIPE, SIG_IGN);
+  epfd = epoll_create1(0);
+  latencies = (double*)xmalloc(sizeof(double) * num_requests);
+  clients = (Client*)xmalloc(sizeof(Client) * num_conns);
+  start_time = now_secs();
+  for (i = 0; i < num_conns; i++) {
+    Client *cl = &clients[i];
+    cl->fd = open_client();
+    if (cl->fd == -1)
+      return 1;
+    start_request(cl);
+    ev.events = EPOLLOUT;
+    ev.data.ptr = cl;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, cl->fd, &ev);
+  }
+
+  while (num_done < num_requests) {
+    int num_events = epoll_wait(epfd, events, MAX_EVENTS, 10000);
+    int j;
+    if (num_events == 0) {
+      fputs("Error: Timed out waiting for the server.\n", stderr);
+      return 1;
+    }
+    for (j = 0; j < num_events; j++) {
+      Client *cl = (Client*)events[j].data.ptr;
+      ssize_t n;
+
+      if (cl->req_off < cl->req_len) {
+	n = write(cl->fd, cl->req + cl->req_off, cl->req_len - cl->req_off);
+	if (n == -1 && errno == EAGAIN)
+	  continue;
+	if (n <= 0) {
+	  fprintf(stderr, "Error: write: %s\n", strerror(errno));
+	  return 1;
+	}
+	cl->req_off += n;
+	if (cl->req_off == cl->req_len) {
+	  ev.events = EPOLLIN;
+	  ev.data.ptr = cl;
+	  epoll_ctl(epfd, EPOLL_CTL_MOD, cl->fd, &ev);
+	}
+	continue;
+      }
+
+      n = read(cl->fd, cl->buf + cl->buf_len, RESP_BUF_SIZE - cl->buf_len);
+      if (n == -1 && errno == EAGAIN)
+	continue;
+      if (n <= 0) {
+	fputs("Error: The server closed the connection.\n", stderr);
+	return 1;
+      }
+      bytes += n;
+      if (cl->in_body)
+	cl->body_left -= n;
+      else {
+	char *end;
+	cl->buf_len += n;
+	end = memmem(cl->buf, cl->buf_len, "\r\n\r\n", 4);
+	if (end == NULL) {
+	  if (cl->buf_len == RESP_BUF_SIZE) {
+	    fputs("Error: Response header too large.\n", stderr);
+	    return 1;
+	  }
+	  continue;
+	} else {
+	  size_t head_len = end + 4 - cl->buf;
+	  const char *cl_hdr;
+	  unsigned status = 0;
+	  *end = '\0';
+	  sscanf(cl->buf, "HTTP/1.%*u %u", &status);
+	  if (status != 200 && status != 206)
+	    num_errors++;
+	  cl_hdr = strcasestr(cl->buf, "\r\nContent-Length:");
+	  cl->body_left = (cl_hdr != NULL) ? strtoll(cl_hdr + 17, NULL, 10) : 0;
+	  cl->body_left -= cl->buf_len - head_len;
+	  cl->buf_len = head_len; /* Discard the body.  */
+	  cl->in_body = true;
+	}
+      }
+
+      if (cl->body_left <= 0) {
+	/* The response is complete.  */
+	latencies[num_done++] = now_secs() - cl->start_time;
+	if (num_issued < num_requests) {
+	  start_request(cl);
+	  ev.events = EPOLLOUT;
+	  ev.data.ptr = cl;
+	  epoll_ctl(epfd, EPOLL_CTL_MOD, cl->fd, &ev);
+	}
+      }
+    }
+  }
+  elapsed = now_secs() - start_time;
+
+  qsort(latencies, num_done, sizeof(double), cmp_double);
+  printf("%lu requests over %u connections in %.3f s\n",
+	 num_done, num_conns, elapsed);
+  printf("Requests/s: %.0f\n", num_done / elapsed);
+  printf("Transfer: %.1f MB/s\n", bytes / elapsed / 1e6);
+  printf("Latency (ms): p50 %.3f  p90 %.3f  p99 %.3f  max %.3f\n",
+	 latencies[num_done / 2] * 1e3,
+	 latencies[num_done * 9 / 10] * 1e3,
+	 latencies[num_done * 99 / 100] * 1e3,
+	 latencies[num_done - 1] * 1e3);
+  printf("Errors: %lu\n", num_errors);
+
+  for (i = 0; i < num_conns; i++)
+    close(clients[i].fd);
+  xfree(clients);
+  xfree(latencies);
+  xfree(paths);
+  return (num_errors > 0) ? 1 : 0;
+}
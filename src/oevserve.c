@@ -0,0 +1,1421 @@
+/* Small static file server for local testing of the viewer, standing
+   in for the production web server, which can also answer tracks
+   queries natively.
+
+Copyright (C) 2014 University of Minnesota
+
+See the file "COPYING" in the top level directory for details.
+
+*/
+
+/* Usage: oevserve [-p PORT] [-a ADDRESS] [-v] [-t TRACKS-FILE]
+                   [-w WORKERS] [-m CACHE-MB] DOCROOT
+
+   Only GET and HEAD are supported.  Everything the viewer's loaders
+   depend on is implemented:
+
+   * Persistent connections, including pipelined requests.
+
+   * Byte range requests, both single ranges (sent with `sendfile()')
+     and multiple ranges (sent as "multipart/byteranges" with
+     `writev()' directly from a memory mapping of the file).
+
+   * Pre-compressed sidecar files: if "FILE.br" or "FILE.gz" exists
+     and the client accepts that encoding, it is sent in place of
+     "FILE" with the corresponding Content-Encoding.  Range requests
+     always get the identity encoding, since `ChunkLoader' computes
+     byte offsets into the uncompressed data.
+
+   * Strong entity tags on every response, and conditional GET with
+     If-None-Match.
+
+   All sockets are non-blocking and are serviced by a single `epoll'
+   event loop.  Responses are never copied through user space except
+   for their headers.
+
+   When a tracks data file is given, the following computed responses
+   are also available.  Dates are zero-based, as `curDate' in the
+   viewer.
+
+   * "/query/pvs?date=D&vbox=MINLAT,MINLON,MAXLAT,MAXLON&splits=N":
+     the potentially visible eddies as from `WCTracksLayer.kdPVS()',
+     as JSON.  The viewport box must already be clipped.
+
+   * "/query/pick?date=D&lat=LAT&lon=LON&k=K&metric=gc|equirect": the
+     K nearest eddies to a point, as JSON.
+
+   * "/stats": cache and request counters, as JSON.
+
+   Computed responses are produced by a pool of worker threads and
+   kept in a sharded LRU cache with a byte budget, keyed by the
+   version of the tracks data file and the normalized query
+   parameters, so that the requests repeated as the user animates
+   through the dates are answered from memory.  Identical requests
+   that arrive while a response is being computed wait for that
+   computation rather than starting their own.  */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/sendfile.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/eventfd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "xmalloc.h"
+#include "exparray.h"
+#include "wtxt.h"
+#include "kdpvs.h"
+#include "kdnn.h"
+#include "lrucache.h"
+
+enum bool_tag { false, true };
+typedef enum bool_tag bool;
+
+#define REQ_BUF_SIZE 8192
+#define HEAD_BUF_SIZE 2048
+#define PART_BUF_SIZE 192
+#define MAX_RANGES 16
+#define MAX_EVENTS 256
+#define KEY_SIZE 256
+#define INM_SIZE 256
+#define ETAG_SIZE LRU_ETAG_SIZE
+#define NUM_INFLIGHT_BUCKETS 256
+#define NUM_CACHE_SHARDS 16
+#define MAX_PICK 64
+
+EA_TYPE(char);
+
+struct ByteRange_tag {
+  off_t first;
+  off_t last; /* Inclusive */
+};
+typedef struct ByteRange_tag ByteRange;
+
+/* Kinds of computed responses */
+#define JOB_PVS 0
+#define JOB_PICK 1
+
+/* A computed response in progress.  */
+struct Job_tag {
+  /* Normalized request, which is also the cache key */
+  char key[KEY_SIZE];
+  unsigned long hash;
+  int kind;
+  KdPVSQuery pvs;
+  unsigned max_splits;
+  unsigned date_index;
+  double lat, lon;
+  unsigned k;
+  int metric;
+  /* Set by the worker that computes the response.  */
+  LRUEntry *result;
+  /* Connections waiting for the response, linked through
+     `next_waiter'.  */
+  struct Conn_tag *waiters;
+  /* Link in the work queue or the done queue */
+  struct Job_tag *next;
+  /* Link in the table of jobs in progress */
+  struct Job_tag *chain_next;
+};
+typedef struct Job_tag Job;
+
+struct Conn_tag {
+  int fd;
+  char req[REQ_BUF_SIZE];
+  size_t req_len;
+  bool keep_alive;
+  bool writing;
+  unsigned events; /* Events currently requested from `epoll' */
+
+  /* A computed response is in progress when `waiting'.  */
+  bool waiting;
+  bool head_only;
+  Job *job;
+  struct Conn_tag *next_waiter;
+  char inm[INM_SIZE]; /* If-None-Match, or empty */
+
+  /* The response is written in two phases: first the memory buffers
+     in `iov', then `file_left' bytes of `file_fd' with
+     `sendfile()'.  */
+  char head[HEAD_BUF_SIZE];
+  char parts[MAX_RANGES+1][PART_BUF_SIZE];
+  struct iovec iov[2 * MAX_RANGES + 2];
+  unsigned iov_cnt, iov_idx;
+  int file_fd;
+  off_t file_off;
+  size_t file_left;
+  void *map;
+  size_t map_len;
+  /* Cached body being sent */
+  LRUEntry *entry;
+};
+typedef struct Conn_tag Conn;
+
+struct ContentType_tag {
+  const char *ext;
+  const char *type;
+};
+typedef struct ContentType_tag ContentType;
+
+static const ContentType content_types[] = {
+  { ".html", "text/html; charset=utf-8" },
+  { ".xhtml", "application/xhtml+xml" },
+  { ".js", "application/javascript" },
+  { ".css", "text/css" },
+  { ".json", "application/json" },
+  { ".txt", "text/plain; charset=utf-8" },
+  { ".csv", "text/csv" },
+  /* Tracks data is UTF-16 with a byte order mark.  */
+  { ".wtxt", "text/plain; charset=utf-16le" },
+  { ".png", "image/png" },
+  { ".jpg", "image/jpeg" },
+  { ".jpeg", "image/jpeg" },
+  { ".gif", "image/gif" },
+  { ".svg", "image/svg+xml" },
+  { ".ogv", "video/ogg" },
+  { ".webm", "video/webm" },
+  { ".pdf", "application/pdf" },
+  { NULL, NULL }
+};
+
+/* Pre-compressed sidecar encodings, in order of preference.  */
+static const char *const sidecar_encodings[] = { "br", "gzip", NULL };
+static const char *const sidecar_exts[] = { ".br", ".gz", NULL };
+
+static const char *docroot;
+static bool verbose = false;
+static unsigned long boundary_count = 0;
+
+/* Computed responses.  The tracks data is read-only once loaded, so
+   the workers share it without locking.  */
+static WTracks tracks;
+static bool have_tracks = false;
+static char dataset_version[24];
+static LRUCache *cache;
+static Job *inflight[NUM_INFLIGHT_BUCKETS];
+static pthread_mutex_t work_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work_cond = PTHREAD_COND_INITIALIZER;
+static Job *work_head = NULL, *work_tail = NULL;
+static pthread_mutex_t done_lock = PTHREAD_MUTEX_INITIALIZER;
+static Job *done_head = NULL;
+/* Signaled by the workers when a job is done */
+static int done_fd;
+/* `epoll' tag of `done_fd' */
+static char done_tag;
+static unsigned long num_computed = 0;
+static unsigned long num_coalesced = 0;
+static unsigned long num_not_modified = 0;
+
+void display_help(FILE *fout, const char *progname);
+int open_listener(const char *address, unsigned port);
+Conn *conn_new(int fd);
+void conn_close(int epfd, Conn *c);
+void conn_finish_response(Conn *c);
+void conn_set_events(int epfd, Conn *c, unsigned events);
+int conn_write(Conn *c);
+bool conn_send(int epfd, Conn *c);
+void process_requests(int epfd, Conn *c);
+void handle_request(Conn *c, char *req, size_t len);
+void handle_query(Conn *c, const char *target, char *query);
+bool parse_job(const char *target, char *query, Job *job);
+void set_cached_response(Conn *c, LRUEntry *entry);
+void set_stats(Conn *c);
+void set_not_modified(Conn *c, const char *etag);
+void set_error(Conn *c, unsigned status, const char *reason,
+	       const char *extra_headers);
+bool etag_matches(const char *inm, const char *etag);
+int load_tracks(const char *filename);
+int start_workers(unsigned num_workers);
+void *worker_main(void *arg);
+void compute_job(Job *job, KdPVSRuns *runs, KdNeighbor *neighbors,
+		 char_array *body);
+void finish_jobs(int epfd);
+Job *inflight_find(const char *key, unsigned long hash);
+void inflight_remove(Job *job);
+void buf_printf(char_array *buf, const char *format, ...);
+const char *content_type(const char *path);
+bool accepts_encoding(const char *accept, const char *coding);
+int parse_ranges(const char *spec, off_t size,
+		 ByteRange *ranges, unsigned *num_ranges);
+bool url_decode_path(char *path);
+void http_date(char *buf, size_t size, time_t t);
+
+void display_help(FILE *fout, const char *progname) {
+  fprintf(fout,
+"Usage: %s [-p PORT] [-a ADDRESS] [-v] [-t TRACKS-FILE]\n"
+"          [-w WORKERS] [-m CACHE-MB] DOCROOT\n\n", progname);
+  fputs(
+"Serve the files under DOCROOT over HTTP for local testing.\n\n"
+"Options:\n"
+"  -h, --help    Display this help message.\n"
+"  -p PORT    Port to listen on (default 8080).\n"
+"  -a ADDRESS    IPv4 address to listen on (default 127.0.0.1).\n"
+"  -v    Log every request to standard error.\n"
+"  -t TRACKS-FILE    Answer tracks queries under \"/query/\" from the\n"
+"        given tracks data file.\n"
+"  -w WORKERS    Number of threads computing query responses (default 4).\n"
+"  -m CACHE-MB    Memory budget of the query response cache in megabytes\n"
+"        (default 64).\n",
+	fout);
+}
+
+int main(int argc, char *argv[]) {
+  const char *progname = argv[0];
+  const char *address = "127.0.0.1";
+  unsigned port = 8080;
+  const char *tracks_file = NULL;
+  unsigned num_workers = 4;
+  unsigned long cache_mb = 64;
+  struct epoll_event ev, events[MAX_EVENTS];
+  int lfd, epfd;
+
+  docroot = NULL;
+  while (*++argv != NULL) {
+    if (!strcmp(*argv, "-h") || !strcmp(*argv, "--help")) {
+      display_help(stdout, progname);
+      return 0;
+    } else if (!strcmp(*argv, "-p") && argv[1] != NULL)
+      port = strtoul(*++argv, NULL, 0);
+    else if (!strcmp(*argv, "-a") && argv[1] != NULL)
+      address = *++argv;
+    else if (!strcmp(*argv, "-v"))
+      verbose = true;
+    else if (!strcmp(*argv, "-t") && argv[1] != NULL)
+      tracks_file = *++argv;
+    else if (!strcmp(*argv, "-w") && argv[1] != NULL)
+      num_workers = strtoul(*++argv, NULL, 0);
+    else if (!strcmp(*argv, "-m") && argv[1] != NULL)
+      cache_mb = strtoul(*++argv, NULL, 0);
+    else if (docroot == NULL)
+      docroot = *argv;
+    else {
+      fprintf(stderr, "Error: Unknown argument: %s\n", *argv);
+      display_help(stderr, progname);
+      return 1;
+    }
+  }
+  if (docroot == NULL || num_workers == 0) {
+    display_help(stderr, progname);
+    return 1;
+  }
+  if (tracks_file != NULL && load_tracks(tracks_file) != 0)
+    return 1;
+
+  signal(SIGPIPE, SIG_IGN);
+  lfd = open_listener(address, port);
+  if (lfd == -1)
+    return 1;
+  epfd = epoll_create1(0);
+  if (epfd == -1) {
+    fprintf(stderr, "Error: epoll_create1: %s\n", strerror(errno));
+    return 1;
+  }
+  /* The listening socket is identified by a NULL pointer.  */
+  ev.events = EPOLLIN;
+  ev.data.ptr = NULL;
+  epoll_ctl(epfd, EPOLL_CTL_ADD, lfd, &ev);
+  cache = lru_new(cache_mb << 20, NUM_CACHE_SHARDS);
+  if (have_tracks) {
+    done_fd = eventfd(0, EFD_NONBLOCK);
+    if (done_fd == -1) {
+      fprintf(stderr, "Error: eventfd: %s\n", strerror(errno));
+      return 1;
+    }
+    ev.events = EPOLLIN;
+    ev.data.ptr = &done_tag;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, done_fd, &ev);
+    if (start_workers(num_workers) != 0)
+      return 1;
+  }
+  if (verbose)
+    fprintf(stderr, "Serving %s on http://%s:%u/\n", docroot, address, port);
+
+  for (;;) {
+    int num_events = epoll_wait(epfd, events, MAX_EVENTS, -1);
+    int i;
+    bool jobs_done = false;
+    if (num_events == -1) {
+      if (errno == EINTR)
+	continue;
+      fprintf(stderr, "Error: epoll_wait: %s\n", strerror(errno));
+      return 1;
+    }
+
+    for (i = 0; i < num_events; i++) {
+      Conn *c = (Conn*)events[i].data.ptr;
+      if (events[i].data.ptr == &done_tag) {
+	/* Sending the computed responses may close connections that
+	   later events of this batch still point to, so that waits
+	   until all of them are handled.  */
+	jobs_done = true;
+	continue;
+      }
+      if (c == NULL) {
+	/* Accept all pending connections.  */
+	int fd;
+	while ((fd = accept4(lfd, NULL, NULL, SOCK_NONBLOCK)) != -1) {
+	  int one = 1;
+	  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	  c = conn_new(fd);
+	  ev.events = c->events;
+	  ev.data.ptr = c;
+	  epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+	}
+	continue;
+      }
+
+      if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+	conn_close(epfd, c);
+	continue;
+      }
+
+      if (c->writing) {
+	/* Serve any pipelined requests that are already buffered.  */
+	if (conn_send(epfd, c))
+	  process_requests(epfd, c);
+	continue;
+      }
+
+      /* Read as much of the request as is available.  */
+      for (;;) {
+	ssize_t n;
+	if (c->req_len == REQ_BUF_SIZE)
+	  break;
+	n = read(c->fd, c->req + c->req_len, REQ_BUF_SIZE - c->req_len);
+	if (n > 0)
+	  { c->req_len += n; continue; }
+	if (n == -1 && errno == EINTR)
+	  continue;
+	if (n == -1 && errno == EAGAIN)
+	  break;
+	/* End of stream or error */
+	conn_close(epfd, c); c = NULL;
+	break;
+      }
+      if (c != NULL)
+	process_requests(epfd, c);
+    }
+    if (jobs_done)
+      finish_jobs(epfd);
+  }
+  return 0;
+}
+
+int open_listener(const char *address, unsigned port) {
+  struct sockaddr_in addr;
+  int one = 1;
+  int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+  if (fd == -1) {
+    fprintf(stderr, "Error: socket: %s\n", strerror(errno));
+    return -1;
+  }
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  if (inet_pton(AF_INET, address, &addr.sin_addr) != 1) {
+    fprintf(stderr, "Error: Invalid address: %s\n", address);
+    close(fd);
+    return -1;
+  }
+  if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) == -1 ||
+      listen(fd, SOMAXCONN) == -1) {
+    fprintf(stderr, "Error: Could not listen on %s:%u: %s\n",
+	    address, port, strerror(errno));
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+Conn *conn_new(int fd) {
+  Conn *c = (Conn*)xmalloc(sizeof(Conn));
+  c->fd = fd;
+  c->req_len = 0;
+  c->keep_alive = true;
+  c->writing = false;
+  c->events = EPOLLIN;
+  c->waiting = false;
+  c->job = NULL;
+  c->iov_cnt = 0; c->iov_idx = 0;
+  c->file_fd = -1;
+  c->file_left = 0;
+  c->map = NULL;
+  c->entry = NULL;
+  return c;
+}
+
+void conn_close(int epfd, Conn *c) {
+  if (c->job != NULL) {
+    /* Stop waiting for the computed response.  */
+    Conn **link = &c->job->waiters;
+    while (*link != c)
+      link = &(*link)->next_waiter;
+    *link = c->next_waiter;
+    c->job = NULL;
+  }
+  epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, NULL);
+  close(c->fd);
+  conn_finish_response(c);
+  xfree(c);
+}
+
+/* Release the resources held by the response.  */
+void conn_finish_response(Conn *c) {
+  if (c->file_fd != -1)
+    { close(c->file_fd); c->file_fd = -1; }
+  if (c->map != NULL)
+    { munmap(c->map, c->map_len); c->map = NULL; }
+  if (c->entry != NULL)
+    { lru_release(c->entry); c->entry = NULL; }
+  c->iov_cnt = 0; c->iov_idx = 0;
+  c->file_left = 0;
+  c->writing = false;
+}
+
+void conn_set_events(int epfd, Conn *c, unsigned events) {
+  struct epoll_event ev;
+  if (c->events == events)
+    return;
+  c->events = events;
+  ev.events = events;
+  ev.data.ptr = c;
+  epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd, &ev);
+}
+
+/* Continue writing the response.  Returns one when it is finished,
+   zero if the socket would block, and -1 on error.  */
+int conn_write(Conn *c) {
+  while (c->iov_idx < c->iov_cnt) {
+    ssize_t n = writev(c->fd, c->iov + c->iov_idx, c->iov_cnt - c->iov_idx);
+    if (n == -1) {
+      if (errno == EINTR)
+	continue;
+      return (errno == EAGAIN) ? 0 : -1;
+    }
+    while (n > 0 && c->iov_idx < c->iov_cnt) {
+      struct iovec *v = &c->iov[c->iov_idx];
+      if ((size_t)n >= v->iov_len)
+	{ n -= v->iov_len; c->iov_idx++; }
+      else {
+	v->iov_base = (char*)v->iov_base + n;
+	v->iov_len -= n;
+	n = 0;
+      }
+    }
+  }
+  while (c->file_left > 0) {
+    ssize_t n = sendfile(c->fd, c->file_fd, &c->file_off, c->file_left);
+    if (n == -1) {
+      if (errno == EINTR)
+	continue;
+      return (errno == EAGAIN) ? 0 : -1;
+    }
+    if (n == 0)
+      return -1; /* The file was truncated.  */
+    c->file_left -= n;
+  }
+  return 1;
+}
+
+/* Write as much of the response as possible.  Returns true if the
+   response is finished and the connection remains open for further
+   requests.  */
+bool conn_send(int epfd, Conn *c) {
+  int result;
+  c->writing = true;
+  result = conn_write(c);
+  if (result < 0)
+    { conn_close(epfd, c); return false; }
+  if (result == 0)
+    { conn_set_events(epfd, c, EPOLLOUT); return false; }
+  conn_finish_response(c);
+  if (!c->keep_alive)
+    { conn_close(epfd, c); return false; }
+  conn_set_events(epfd, c, EPOLLIN);
+  return true;
+}
+
+/* Serve all complete requests in the request buffer, stopping if a
+   response cannot be written without blocking or has to be
+   computed.  */
+void process_requests(int epfd, Conn *c) {
+  while (!c->writing) {
+    char *end = memmem(c->req, c->req_len, "\r\n\r\n", 4);
+    size_t head_len;
+
+    if (end == NULL) {
+      if (c->req_len < REQ_BUF_SIZE)
+	return; /* Wait for more data.  */
+      set_error(c, 431, "Request Header Fields Too Large", "");
+      c->keep_alive = false;
+      c->req_len = 0;
+    } else {
+      head_len = end + 4 - c->req;
+      handle_request(c, c->req, head_len);
+      /* The request has been fully parsed, so discard it.  */
+      memmove(c->req, c->req + head_len, c->req_len - head_len);
+      c->req_len -= head_len;
+    }
+
+    if (c->waiting) {
+      /* Stop reading until the response has been computed.  Hangups
+	 are still reported.  */
+      conn_set_events(epfd, c, 0);
+      return;
+    }
+    if (!conn_send(epfd, c))
+      return;
+  }
+}
+
+/* Parse the request in the first `len' bytes of `req' and set up the
+   response.  The request is modified in place.  */
+void handle_request(Conn *c, char *req, size_t len) {
+  char *line, *next, *method, *target, *version;
+  const char *range = NULL, *accept = NULL, *connection = NULL;
+  const char *inm = NULL;
+  char *query;
+  bool head_only;
+  char path[4096], date[64], mtime[64], etag[ETAG_SIZE];
+  const char *type, *encoding = NULL;
+  bool vary = false;
+  struct stat st;
+  ByteRange ranges[MAX_RANGES];
+  unsigned num_ranges = 0;
+  int fd, range_result = -1;
+  unsigned i;
+  size_t hl;
+
+  req[len-2] = '\0';
+  line = req;
+  next = strstr(line, "\r\n");
+  *next = '\0'; next += 2;
+
+  /* Request line */
+  method = strtok(line, " ");
+  target = strtok(NULL, " ");
+  version = strtok(NULL, " ");
+  if (method == NULL || target == NULL || version == NULL ||
+      strncmp(version, "HTTP/1.", 7)) {
+    c->keep_alive = false;
+    set_error(c, 400, "Bad Request", "");
+    return;
+  }
+  c->keep_alive = strcmp(version, "HTTP/1.0") != 0;
+
+  /* Headers */
+  while (*next != '\0') {
+    char *value;
+    line = next;
+    next = strstr(line, "\r\n");
+    if (next == NULL)
+      next = line + strlen(line);
+    else
+      { *next = '\0'; next += 2; }
+    value = strchr(line, ':');
+    if (value == NULL)
+      continue;
+    *value++ = '\0';
+    while (*value == ' ' || *value == '\t')
+      value++;
+    if (!strcasecmp(line, "Range"))
+      range = value;
+    else if (!strcasecmp(line, "Accept-Encoding"))
+      accept = value;
+    else if (!strcasecmp(line, "Connection"))
+      connection = value;
+    else if (!strcasecmp(line, "If-None-Match"))
+      inm = value;
+  }
+  if (connection != NULL) {
+    if (!strcasecmp(connection, "close"))
+      c->keep_alive = false;
+    else if (!strcasecmp(connection, "keep-alive"))
+      c->keep_alive = true;
+  }
+
+  if (strcmp(method, "GET") && strcmp(method, "HEAD")) {
+    set_error(c, 405, "Method Not Allowed",
+	      "Allow: GET, HEAD\r\n");
+    return;
+  }
+  head_only = !strcmp(method, "HEAD");
+  c->head_only = head_only;
+  c->inm[0] = '\0';
+  if (inm != NULL) {
+    strncpy(c->inm, inm, INM_SIZE - 1);
+    c->inm[INM_SIZE-1] = '\0';
+  }
+
+  query = strchr(target, '?');
+  if (query != NULL)
+    *query++ = '\0';
+  if (target[0] != '/' || !url_decode_path(target)) {
+    set_error(c, 400, "Bad Request", "");
+    return;
+  }
+  if (!strcmp(target, "/stats") || !strncmp(target, "/query/", 7)) {
+    handle_query(c, target, query);
+    return;
+  }
+
+  /* Map the target to a file.  */
+  if (snprintf(path, sizeof(path) - 8, "%s%s%s", docroot, target,
+	       (target[strlen(target)-1] == '/') ? "index.html" : "") >=
+      (int)sizeof(path) - 8) {
+    set_error(c, 414, "URI Too Long", "");
+    return;
+  }
+  type = content_type(path);
+
+  fd = -1;
+  hl = strlen(path);
+  for (i = 0; sidecar_exts[i] != NULL; i++) {
+    strcpy(path + hl, sidecar_exts[i]);
+    if (access(path, R_OK) != 0)
+      continue;
+    vary = true;
+    if (range == NULL && accept != NULL &&
+	accepts_encoding(accept, sidecar_encodings[i])) {
+      fd = open(path, O_RDONLY);
+      if (fd != -1 && (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)))
+	{ close(fd); fd = -1; }
+      if (fd != -1)
+	{ encoding = sidecar_encodings[i]; break; }
+    }
+  }
+  path[hl] = '\0';
+  if (fd == -1) {
+    fd = open(path, O_RDONLY);
+    if (fd == -1) {
+      if (errno == EACCES)
+	set_error(c, 403, "Forbidden", "");
+      else
+	set_error(c, 404, "Not Found", "");
+      return;
+    }
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+      close(fd);
+      set_error(c, 404, "Not Found", "");
+      return;
+    }
+  }
+  c->file_fd = fd;
+
+  /* The file is assumed to be replaced rather than modified in place,
+     so its identity, size, and modification time change whenever its
+     contents do.  */
+  snprintf(etag, sizeof(etag), "\"%lx-%llx-%lx%s%s\"",
+	   (unsigned long)st.st_ino, (unsigned long long)st.st_size,
+	   (unsigned long)st.st_mtime,
+	   (encoding != NULL) ? "-" : "", (encoding != NULL) ? encoding : "");
+  if (inm != NULL && etag_matches(inm, etag)) {
+    close(fd); c->file_fd = -1;
+    set_not_modified(c, etag);
+    return;
+  }
+
+  if (range != NULL)
+    range_result = parse_ranges(range, st.st_size, ranges, &num_ranges);
+  if (range_result == 0) {
+    close(fd); c->file_fd = -1;
+    snprintf(path, sizeof(path), "Content-Range: bytes */%lld\r\n",
+	     (long long)st.st_size);
+    set_error(c, 416, "Range Not Satisfiable", path);
+    return;
+  }
+
+  http_date(date, sizeof(date), time(NULL));
+  http_date(mtime, sizeof(mtime), st.st_mtime);
+  hl = snprintf(c->head, HEAD_BUF_SIZE,
+		"HTTP/1.1 %s\r\n"
+		"Server: oevserve\r\n"
+		"Date: %s\r\n"
+		"Last-Modified: %s\r\n"
+		"ETag: %s\r\n"
+		"Accept-Ranges: bytes\r\n"
+		"%s%s%s"
+		"%s"
+		"Connection: %s\r\n",
+		(range_result > 0) ? "206 Partial Content" : "200 OK",
+		date, mtime, etag,
+		(encoding != NULL) ? "Content-Encoding: " : "",
+		(encoding != NULL) ? encoding : "",
+		(encoding != NULL) ? "\r\n" : "",
+		vary ? "Vary: Accept-Encoding\r\n" : "",
+		c->keep_alive ? "keep-alive" : "close");
+
+  if (range_result < 0 || num_ranges == 1) {
+    off_t first = 0, last = st.st_size - 1;
+    if (range_result > 0) {
+      first = ranges[0].first; last = ranges[0].last;
+      hl += snprintf(c->head + hl, HEAD_BUF_SIZE - hl,
+		     "Content-Range: bytes %lld-%lld/%lld\r\n",
+		     (long long)first, (long long)last,
+		     (long long)st.st_size);
+    }
+    hl += snprintf(c->head + hl, HEAD_BUF_SIZE - hl,
+		   "Content-Type: %s\r\n"
+		   "Content-Length: %lld\r\n\r\n",
+		   type, (long long)(last + 1 - first));
+    c->iov[0].iov_base = c->head;
+    c->iov[0].iov_len = hl;
+    c->iov_cnt = 1;
+    c->file_off = first;
+    c->file_left = head_only ? 0 : (size_t)(last + 1 - first);
+  } else {
+    /* Multiple ranges are sent from a memory mapping of the file,
+       interleaved with the part headers.  */
+    char boundary[32];
+    off_t body_len = 0;
+    unsigned num_iov = 1;
+    snprintf(boundary, sizeof(boundary), "OEV_BYTERANGES_%08lx",
+	     boundary_count++);
+    for (i = 0; i < num_ranges; i++) {
+      int n = snprintf(c->parts[i], PART_BUF_SIZE,
+		       "\r\n--%s\r\n"
+		       "Content-Type: %s\r\n"
+		       "Content-Range: bytes %lld-%lld/%lld\r\n\r\n",
+		       boundary, type, (long long)ranges[i].first,
+		       (long long)ranges[i].last, (long long)st.st_size);
+      c->iov[num_iov].iov_base = c->parts[i];
+      c->iov[num_iov++].iov_len = n;
+      c->iov[num_iov].iov_len = ranges[i].last + 1 - ranges[i].first;
+      body_len += n + c->iov[num_iov++].iov_len;
+    }
+    c->iov[num_iov].iov_base = c->parts[num_ranges];
+    c->iov[num_iov].iov_len =
+      snprintf(c->parts[num_ranges], PART_BUF_SIZE, "\r\n--%s--\r\n",
+	       boundary);
+    body_len += c->iov[num_iov++].iov_len;
+
+    hl += snprintf(c->head + hl, HEAD_BUF_SIZE - hl,
+		   "Content-Type: multipart/byteranges; boundary=%s\r\n"
+		   "Content-Length: %lld\r\n\r\n",
+		   boundary, (long long)body_len);
+    c->iov[0].iov_base = c->head;
+    c->iov[0].iov_len = hl;
+    c->iov_cnt = 1;
+    if (!head_only) {
+      c->map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+      if (c->map == MAP_FAILED) {
+	c->map = NULL;
+	close(fd); c->file_fd = -1;
+	set_error(c, 500, "Internal Server Error", "");
+	return;
+      }
+      c->map_len = st.st_size;
+      for (i = 0; i < num_ranges; i++)
+	c->iov[2+2*i].iov_base = (char*)c->map + ranges[i].first;
+      c->iov_cnt = num_iov;
+    }
+  }
+
+  if (verbose)
+    fprintf(stderr, "%s %s %s%s\n", method, target,
+	    (range_result > 0) ? "206" : "200",
+	    (encoding != NULL) ? " (pre-compressed)" : "");
+}
+
+/* Set up the response to a computed request: from the cache if
+   possible, otherwise by joining or starting a computation.  */
+void handle_query(Conn *c, const char *target, char *query) {
+  Job spec, *job;
+  LRUEntry *entry;
+
+  if (!strcmp(target, "/stats")) {
+    set_stats(c);
+    return;
+  }
+  if (!have_tracks) {
+    set_error(c, 404, "Not Found", "");
+    return;
+  }
+  if (query == NULL || !url_decode_path(query) ||
+      !parse_job(target, query, &spec)) {
+    set_error(c, 400, "Bad Request", "");
+    return;
+  }
+
+  entry = lru_get(cache, spec.key);
+  if (entry != NULL) {
+    set_cached_response(c, entry);
+    if (verbose)
+      fprintf(stderr, "GET %s (cached)\n", spec.key);
+    return;
+  }
+
+  job = inflight_find(spec.key, spec.hash);
+  if (job != NULL)
+    num_coalesced++;
+  else {
+    job = (Job*)xmalloc(sizeof(Job));
+    *job = spec;
+    job->result = NULL;
+    job->waiters = NULL;
+    job->next = NULL;
+    job->chain_next = inflight[job->hash % NUM_INFLIGHT_BUCKETS];
+    inflight[job->hash % NUM_INFLIGHT_BUCKETS] = job;
+    pthread_mutex_lock(&work_lock);
+    if (work_tail != NULL)
+      work_tail->next = job;
+    else
+      work_head = job;
+    work_tail = job;
+    pthread_cond_signal(&work_cond);
+    pthread_mutex_unlock(&work_lock);
+    num_computed++;
+  }
+  c->waiting = true;
+  c->job = job;
+  c->next_waiter = job->waiters;
+  job->waiters = c;
+  if (verbose)
+    fprintf(stderr, "GET %s (%s)\n", spec.key,
+	    (job->waiters->next_waiter != NULL) ? "coalesced" : "computing");
+}
+
+/* Parse the query parameters of a computed request into `job', and
+   build its cache key.  The key starts with the version of the tracks
+   data, and numbers are formatted so that equal values always give
+   the same key.  Returns false if the request is invalid.  */
+bool parse_job(const char *target, char *query, Job *job) {
+  char *param, *save;
+  bool have_date = false, have_vbox = false;
+  bool have_lat = false, have_lon = false;
+  int n;
+
+  memset(job, 0, sizeof(Job));
+  if (!strcmp(target, "/query/pvs")) {
+    job->kind = JOB_PVS;
+    job->max_splits = 31;
+  } else if (!strcmp(target, "/query/pick")) {
+    job->kind = JOB_PICK;
+    job->k = 1;
+    job->metric = KDNN_GREAT_CIRCLE;
+  } else
+    return false;
+
+  for (param = strtok_r(query, "&", &save); param != NULL;
+       param = strtok_r(NULL, "&", &save)) {
+    char *value = strchr(param, '=');
+    char *end;
+    if (value == NULL)
+      return false;
+    *value++ = '\0';
+    if (!strcmp(param, "date")) {
+      job->date_index = strtoul(value, &end, 10);
+      have_date = (end != value && *end == '\0');
+    } else if (!strcmp(param, "splits") && job->kind == JOB_PVS) {
+      job->max_splits = strtoul(value, &end, 10);
+      if (end == value || *end != '\0')
+	return false;
+    } else if (!strcmp(param, "vbox") && job->kind == JOB_PVS) {
+      double *vbox = job->pvs.vbox;
+      n = -1;
+      sscanf(value, "%lf,%lf,%lf,%lf%n",
+	     &vbox[0], &vbox[1], &vbox[2], &vbox[3], &n);
+      have_vbox = (n > 0 && value[n] == '\0');
+    } else if (!strcmp(param, "lat") && job->kind == JOB_PICK) {
+      job->lat = strtod(value, &end);
+      have_lat = (end != value && *end == '\0');
+    } else if (!strcmp(param, "lon") && job->kind == JOB_PICK) {
+      job->lon = strtod(value, &end);
+      have_lon = (end != value && *end == '\0');
+    } else if (!strcmp(param, "k") && job->kind == JOB_PICK) {
+      job->k = strtoul(value, &end, 10);
+      if (end == value || *end != '\0' || job->k == 0 || job->k > MAX_PICK)
+	return false;
+    } else if (!strcmp(param, "metric") && job->kind == JOB_PICK) {
+      if (!strcmp(value, "gc"))
+	job->metric = KDNN_GREAT_CIRCLE;
+      else if (!strcmp(value, "equirect"))
+	job->metric = KDNN_EQUIRECT;
+      else
+	return false;
+    } else
+      return false;
+  }
+  if (!have_date || job->date_index >= tracks.num_dates)
+    return false;
+
+  if (job->kind == JOB_PVS) {
+    const double *vbox = job->pvs.vbox;
+    if (!have_vbox || !isfinite(vbox[0]) || !isfinite(vbox[1]) ||
+	!isfinite(vbox[2]) || !isfinite(vbox[3]))
+      return false;
+    job->pvs.date_index = job->date_index;
+    n = snprintf(job->key, KEY_SIZE, "pvs %s %u %.17g %.17g %.17g %.17g %u",
+		 dataset_version, job->date_index, vbox[0], vbox[1],
+		 vbox[2], vbox[3], job->max_splits);
+  } else {
+    if (!have_lat || !have_lon || !isfinite(job->lat) || !isfinite(job->lon))
+      return false;
+    n = snprintf(job->key, KEY_SIZE, "pick %s %u %.17g %.17g %u %d",
+		 dataset_version, job->date_index, job->lat, job->lon,
+		 job->k, job->metric);
+  }
+  if (n >= KEY_SIZE)
+    return false;
+  job->hash = lru_hash(job->key, n);
+  return true;
+}
+
+/* Set up a response with the body of a cache entry.  The connection
+   takes over the reference to the entry.  */
+void set_cached_response(Conn *c, LRUEntry *entry) {
+  char date[64];
+  int n;
+  if (c->inm[0] != '\0' && etag_matches(c->inm, entry->etag)) {
+    set_not_modified(c, entry->etag);
+    lru_release(entry);
+    return;
+  }
+  http_date(date, sizeof(date), time(NULL));
+  n = snprintf(c->head, HEAD_BUF_SIZE,
+	       "HTTP/1.1 200 OK\r\n"
+	       "Server: oevserve\r\n"
+	       "Date: %s\r\n"
+	       "ETag: %s\r\n"
+	       "Content-Type: application/json\r\n"
+	       "Content-Length: %lu\r\n"
+	       "Connection: %s\r\n\r\n",
+	       date, entry->etag, (unsigned long)entry->len,
+	       c->keep_alive ? "keep-alive" : "close");
+  c->iov[0].iov_base = c->head;
+  c->iov[0].iov_len = n;
+  c->iov[1].iov_base = entry->data;
+  c->iov[1].iov_len = entry->len;
+  c->iov_cnt = c->head_only ? 1 : 2;
+  c->file_left = 0;
+  c->entry = entry;
+}
+
+/* Set up a response with the server counters.  These are never
+   cached.  */
+void set_stats(Conn *c) {
+  LRUStats stats;
+  char body[1024];
+  int body_len, n;
+  lru_stats(cache, &stats);
+  body_len = snprintf(body, sizeof(body),
+		      "{\"hits\":%lu,\"misses\":%lu,\"computed\":%lu,"
+		      "\"coalesced\":%lu,\"notModified\":%lu,"
+		      "\"entries\":%lu,\"bytes\":%lu,\"byteBudget\":%lu,"
+		      "\"insertions\":%lu,\"evictions\":%lu}\n",
+		      stats.hits, stats.misses, num_computed,
+		      num_coalesced, num_not_modified,
+		      stats.entries, (unsigned long)stats.bytes,
+		      (unsigned long)stats.byte_budget,
+		      stats.insertions, stats.evictions);
+  n = snprintf(c->head, HEAD_BUF_SIZE,
+	       "HTTP/1.1 200 OK\r\n"
+	       "Server: oevserve\r\n"
+	       "Cache-Control: no-store\r\n"
+	       "Content-Type: application/json\r\n"
+	       "Content-Length: %d\r\n"
+	       "Connection: %s\r\n\r\n%s",
+	       body_len, c->keep_alive ? "keep-alive" : "close",
+	       c->head_only ? "" : body);
+  c->iov[0].iov_base = c->head;
+  c->iov[0].iov_len = n;
+  c->iov_cnt = 1;
+  c->file_left = 0;
+}
+
+void set_not_modified(Conn *c, const char *etag) {
+  char date[64];
+  http_date(date, sizeof(date), time(NULL));
+  c->iov[0].iov_base = c->head;
+  c->iov[0].iov_len =
+    snprintf(c->head, HEAD_BUF_SIZE,
+	     "HTTP/1.1 304 Not Modified\r\n"
+	     "Server: oevserve\r\n"
+	     "Date: %s\r\n"
+	     "ETag: %s\r\n"
+	     "Connection: %s\r\n\r\n",
+	     date, etag, c->keep_alive ? "keep-alive" : "close");
+  c->iov_cnt = 1;
+  c->file_left = 0;
+  num_not_modified++;
+  if (verbose)
+    fprintf(stderr, "304 Not Modified\n");
+}
+
+/* Set up a complete error response in the header buffer.
+   `extra_headers' must be empty or end with CRLF.  */
+void set_error(Conn *c, unsigned status, const char *reason,
+	       const char *extra_headers) {
+  char body[256];
+  int body_len = snprintf(body, sizeof(body),
+			  "<html><head><title>%u %s</title></head>"
+			  "<body><h1>%u %s</h1></body></html>\n",
+			  status, reason, status, reason);
+  int n = snprintf(c->head, HEAD_BUF_SIZE,
+		   "HTTP/1.1 %u %s\r\n"
+		   "Server: oevserve\r\n"
+		   "%s"
+		   "Content-Type: text/html; charset=utf-8\r\n"
+		   "Content-Length: %d\r\n"
+		   "Connection: %s\r\n\r\n%s",
+		   status, reason,
+		   extra_headers,
+		   body_len, c->keep_alive ? "keep-alive" : "close", body);
+  c->iov[0].iov_base = c->head;
+  c->iov[0].iov_len = n;
+  c->iov_cnt = 1;
+  c->file_left = 0;
+  if (verbose)
+    fprintf(stderr, "%u %s\n", status, reason);
+}
+
+/* Check if an entity tag is listed in an If-None-Match header, using
+   the weak comparison that the header calls for.  */
+bool etag_matches(const char *inm, const char *etag) {
+  size_t elen = strlen(etag);
+  const char *p = inm;
+  for (;;) {
+    while (*p == ' ' || *p == '\t' || *p == ',')
+      p++;
+    if (*p == '\0')
+      return false;
+    if (*p == '*')
+      return true;
+    if (!strncmp(p, "W/", 2))
+      p += 2;
+    if (!strncmp(p, etag, elen) &&
+	(p[elen] == '\0' || p[elen] == ',' ||
+	 p[elen] == ' ' || p[elen] == '\t'))
+      return true;
+    p = strchr(p, ',');
+    if (p == NULL)
+      return false;
+  }
+}
+
+const char *content_type(const char *path) {
+  const char *ext = strrchr(path, '.');
+  unsigned i;
+  if (ext != NULL && strchr(ext, '/') == NULL) {
+    for (i = 0; content_types[i].ext != NULL; i++) {
+      if (!strcasecmp(ext, content_types[i].ext))
+	return content_types[i].type;
+    }
+  }
+  return "application/octet-stream";
+}
+
+/* Check if a content coding is listed in an Accept-Encoding header
+   without "q=0".  */
+bool accepts_encoding(const char *accept, const char *coding) {
+  size_t clen = strlen(coding);
+  const char *p = accept;
+  while (*p != '\0') {
+    const char *end = strchr(p, ',');
+    const char *params;
+    if (end == NULL)
+      end = p + strlen(p);
+    while (p < end && (*p == ' ' || *p == '\t'))
+      p++;
+    params = p;
+    while (params < end && *params != ';' && *params != ' ')
+      params++;
+    if ((size_t)(params - p) == clen && !strncasecmp(p, coding, clen)) {
+      const char *q = strstr(params, "q=");
+      if (q == NULL || q > end || strtod(q + 2, NULL) > 0)
+	return true;
+      return false;
+    }
+    p = (*end == ',') ? end + 1 : end;
+  }
+  return false;
+}
+
+/* Parse a Range header.  Returns -1 if the header should be ignored,
+   zero if none of the ranges can be satisfied, and one otherwise.  */
+int parse_ranges(const char *spec, off_t size,
+		 ByteRange *ranges, unsigned *num_ranges) {
+  const char *p;
+  *num_ranges = 0;
+  if (strncmp(spec, "bytes=", 6))
+    return -1;
+  p = spec + 6;
+  for (;;) {
+    long long first = -1, last = -1;
+    char *end;
+    while (*p == ' ' || *p == '\t')
+      p++;
+    if (*p >= '0' && *p <= '9') {
+      first = strtoll(p, &end, 10); p = end;
+    }
+    if (*p++ != '-')
+      return -1;
+    if (*p >= '0' && *p <= '9') {
+      last = strtoll(p, &end, 10); p = end;
+    }
+    if (first == -1 && last == -1)
+      return -1;
+    if (first == -1) {
+      /* Suffix range: the last `last' bytes */
+      if (last > 0 && size > 0) {
+	first = (last < size) ? size - last : 0;
+	last = size - 1;
+      } else
+	first = size; /* Unsatisfiable */
+    } else if (last == -1 || last >= size)
+      last = size - 1;
+    if (first <= last && first < size) {
+      if (*num_ranges == MAX_RANGES)
+	return -1;
+      ranges[*num_ranges].first = first;
+      ranges[*num_ranges].last = last;
+      (*num_ranges)++;
+    } else if (last != -1 && first > last && first < size)
+      return -1; /* Syntactically invalid */
+    while (*p == ' ' || *p == '\t')
+      p++;
+    if (*p == '\0')
+      break;
+    if (*p++ != ',')
+      return -1;
+  }
+  return (*num_ranges > 0) ? 1 : 0;
+}
+
+/* Decode percent escapes in place, and reject paths that could
+   escape the document root.  */
+bool url_decode_path(char *path) {
+  char *in = path, *out = path;
+  while (*in != '\0') {
+    if (*in == '%') {
+      unsigned value;
+      if (!isxdigit((unsigned char)in[1]) || !isxdigit((unsigned char)in[2]))
+	return false;
+      sscanf(in + 1, "%2x", &value);
+      if (value == 0)
+	return false;
+      *out++ = (char)value;
+      in += 3;
+    } else
+      *out++ = *in++;
+  }
+  *out = '\0';
+  return strstr(path, "/../") == NULL &&
+    (out - path < 3 || strcmp(out - 3, "/..") != 0);
+}
+
+void http_date(char *buf, size_t size, time_t t) {
+  static const char *const days[] =
+    { "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat" };
+  static const char *const months[] =
+    { "Jan", "Feb", "Mar", "Apr", "May", "Jun",
+      "Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
+  struct tm tm;
+  gmtime_r(&t, &tm);
+  snprintf(buf, size, "%s, %02d %s %04d %02d:%02d:%02d GMT",
+	   days[tm.tm_wday], tm.tm_mday, months[tm.tm_mon],
+	   tm.tm_year + 1900, tm.tm_hour, tm.tm_min, tm.tm_sec);
+}
+
+/* Load the tracks data for computed responses, and derive its
+   version from the identity, size, and modification time of the
+   file.  */
+int load_tracks(const char *filename) {
+  struct stat st;
+  unsigned long long id[4];
+  if (stat(filename, &st) != 0) {
+    fprintf(stderr, "Error: %s: %s\n", filename, strerror(errno));
+    return 1;
+  }
+  if (wtxt_load(filename, &tracks) != 0)
+    return 1;
+  id[0] = st.st_ino;
+  id[1] = st.st_size;
+  id[2] = st.st_mtim.tv_sec;
+  id[3] = st.st_mtim.tv_nsec;
+  snprintf(dataset_version, sizeof(dataset_version), "%016lx",
+	   lru_hash(id, sizeof(id)));
+  have_tracks = true;
+  if (verbose)
+    fprintf(stderr, "Loaded %u eddies on %u dates from %s, version %s\n",
+	    tracks.num_eddies, tracks.num_dates, filename, dataset_version);
+  return 0;
+}
+
+int start_workers(unsigned num_workers) {
+  unsigned i;
+  for (i = 0; i < num_workers; i++) {
+    pthread_t thread;
+    int error = pthread_create(&thread, NULL, worker_main, NULL);
+    if (error != 0) {
+      fprintf(stderr, "Error: pthread_create: %s\n", strerror(error));
+      return 1;
+    }
+    pthread_detach(thread);
+  }
+  return 0;
+}
+
+/* Compute jobs from the work queue, store their responses in the
+   cache, and pass them back to the event loop.  */
+void *worker_main(void *arg) {
+  KdPVSRuns runs;
+  KdNeighbor neighbors[MAX_PICK];
+  char_array body;
+  const uint64_t one = 1;
+
+  kdpvs_runs_init(&runs);
+  for (;;) {
+    Job *job;
+    char etag[ETAG_SIZE];
+
+    pthread_mutex_lock(&work_lock);
+    while (work_head == NULL)
+      pthread_cond_wait(&work_cond, &work_lock);
+    job = work_head;
+    work_head = job->next;
+    if (work_head == NULL)
+      work_tail = NULL;
+    pthread_mutex_unlock(&work_lock);
+
+    /* The cache takes ownership of the body.  */
+    EA_INIT(char, body, 1024);
+    compute_job(job, &runs, neighbors, &body);
+    snprintf(etag, sizeof(etag), "\"%s-%016lx\"", dataset_version,
+	     lru_hash(body.d, body.len));
+    job->result = lru_put(cache, job->key, body.d, body.len, etag);
+
+    pthread_mutex_lock(&done_lock);
+    job->next = done_head;
+    done_head = job;
+    pthread_mutex_unlock(&done_lock);
+    if (write(done_fd, &one, sizeof(one)) == -1 && errno != EAGAIN)
+      fprintf(stderr, "Error: write: %s\n", strerror(errno));
+  }
+  return arg;
+}
+
+void compute_job(Job *job, KdPVSRuns *runs, KdNeighbor *neighbors,
+		 char_array *body) {
+  unsigned i, j;
+  if (job->kind == JOB_PVS) {
+    /* The same classes in the same order as `kdPVS()'.  */
+    static const char *const names[KD_NUM_CLASSES] =
+      { "defVis", "posVis", "notVis" };
+    KdPVSResult result;
+    for (i = 0; i < KD_NUM_CLASSES; i++)
+      EA_CLEAR(runs->c[i]);
+    kdpvs_query(&tracks, &job->pvs, job->max_splits, runs, &result);
+    buf_printf(body, "{\"totPVS\":%u", result.tot_pvs);
+    for (i = 0; i < KD_NUM_CLASSES; i++) {
+      buf_printf(body, ",\"%s\":[", names[i]);
+      for (j = 0; j < result.count[i]; j++) {
+	const KdRun *run = &runs->c[i].d[result.first[i]+j];
+	buf_printf(body, "%s[%u,%u]", (j > 0) ? "," : "",
+		   run->start, run->length);
+      }
+      buf_printf(body, "]");
+    }
+    buf_printf(body, "}\n");
+  } else {
+    unsigned num_found = kdnn_query(&tracks, job->date_index,
+				    job->lat, job->lon, job->k, job->metric,
+				    neighbors);
+    buf_printf(body, "[");
+    for (i = 0; i < num_found; i++) {
+      unsigned index = neighbors[i].index;
+      buf_printf(body, "%s{\"index\":%u,\"dist\":%.6f,"
+		 "\"lat\":%.6f,\"lon\":%.6f}",
+		 (i > 0) ? "," : "", index, neighbors[i].dist,
+		 tracks.lat[index], tracks.lon[index]);
+    }
+    buf_printf(body, "]\n");
+  }
+}
+
+/* Send the responses of all finished jobs to the connections waiting
+   for them.  */
+void finish_jobs(int epfd) {
+  uint64_t count;
+  Job *job;
+  if (read(done_fd, &count, sizeof(count)) == -1 && errno != EAGAIN)
+    fprintf(stderr, "Error: read: %s\n", strerror(errno));
+  pthread_mutex_lock(&done_lock);
+  job = done_head;
+  done_head = NULL;
+  pthread_mutex_unlock(&done_lock);
+
+  while (job != NULL) {
+    Job *next = job->next;
+    Conn *c;
+    inflight_remove(job);
+    while ((c = job->waiters) != NULL) {
+      job->waiters = c->next_waiter;
+      c->job = NULL;
+      c->waiting = false;
+      lru_retain(job->result);
+      set_cached_response(c, job->result);
+      conn_set_events(epfd, c, EPOLLIN);
+      if (conn_send(epfd, c))
+	process_requests(epfd, c);
+    }
+    lru_release(job->result);
+    xfree(job);
+    job = next;
+  }
+}
+
+Job *inflight_find(const char *key, unsigned long hash) {
+  Job *job = inflight[hash % NUM_INFLIGHT_BUCKETS];
+  while (job != NULL && (job->hash != hash || strcmp(job->key, key)))
+    job = job->chain_next;
+  return job;
+}
+
+void inflight_remove(Job *job) {
+  Job **link = &inflight[job->hash % NUM_INFLIGHT_BUCKETS];
+  while (*link != job)
+    link = &(*link)->chain_next;
+  *link = job->chain_next;
+}
+
+/* Append formatted text to a buffer, without a terminating null
+   character.  */
+void buf_printf(char_array *buf, const char *format, ...) {
+  va_list ap;
+  int n;
+  va_start(ap, format);
+  n = vsnprintf(NULL, 0, format, ap);
+  va_end(ap);
+  if (buf->len + n + 1 > buf->ea_len_alloc) {
+    unsigned len = buf->len;
+    buf->len += n + 1;
+    EA_NORMALIZE(*buf);
+    buf->len = len;
+  }
+  va_start(ap, format);
+  vsnprintf(buf->d + buf->len, n + 1, format, ap);
+  va_end(ap);
+  buf->len += n;
+}
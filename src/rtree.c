@@ -0,0 +1,422 @@
+/* Whole-track bounding box R-tree, used to quickly find all tracks
+   that ever pass through a geographic region.
+
+   The tree is bulk-loaded with the Sort-Tile-Recursive (STR)
+   algorithm: the boxes of one level are sorted by the longitude of
+   their centers and cut into vertical slices, each slice is sorted by
+   the latitude of the centers, and then consecutive runs of
+   `node_cap' boxes are packed into the nodes of the next level up.
+   This yields nearly full nodes with little overlap, and it keeps the
+   children of every node contiguous so that a node only needs to
+   store a start index and a count.
+
+   File format (all integers are 32-bit little endian):
+
+   "OEVRTRE1"    8-byte signature
+   node_cap, num_dates, height, num_entries, num_nodes, leaf_start
+   entries[num_entries]:
+     lat_min, lon_min, lat_max, lon_max, date_first, date_last,
+     track_id, head_index
+   nodes[num_nodes]:
+     lat_min, lon_min, lat_max, lon_max, date_first, date_last,
+     first, count
+
+Copyright (C) 2014 University of Minnesota
+
+See the file "COPYING" in the top level directory for details.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "xmalloc.h"
+#include "rtree.h"
+
+static const char rt_signature[8] =
+  { 'O', 'E', 'V', 'R', 'T', 'R', 'E', '1' };
+
+static int rt_lon_cmp(const void *p1, const void *p2);
+static int rt_lat_cmp(const void *p1, const void *p2);
+static unsigned str_pack(void *items, unsigned num_items, size_t size,
+			 unsigned node_cap, RTNode *out_nodes);
+static int box_overlaps(const RTBox *b, const int qbox[4],
+			unsigned date_first, unsigned date_last);
+static unsigned rt_query_node(const RTree *tree, unsigned node_idx,
+			      const int qbox[4],
+			      unsigned date_first, unsigned date_last,
+			      rtree_visit_fn visit, void *arg);
+
+/* Start accumulating the bounding box of a track at its first
+   eddy.  */
+void rtree_track_begin(RTBox *box, int lat, int lon, unsigned date_index) {
+  box->lat_min = box->lat_max = lat;
+  box->lon_min = box->lon_max = lon;
+  box->date_first = box->date_last = date_index;
+}
+
+/* Add the next eddy of a track to its bounding box.  `cur_lon' holds
+   the unwrapped longitude of the previous eddy, and it must be
+   initialized to the longitude of the first eddy.  Each step is taken
+   in the shorter direction around the globe, so a track that crosses
+   the antimeridian keeps growing continuously past +/-180 degrees
+   rather than jumping to the opposite side of the box.  */
+void rtree_track_add(RTBox *box, int *cur_lon,
+		     int lat, int lon, unsigned date_index) {
+  const int half_turn = RT_FULL_TURN / 2;
+  int delta = (lon - *cur_lon + half_turn) % RT_FULL_TURN;
+  if (delta < 0)
+    delta += RT_FULL_TURN;
+  *cur_lon += delta - half_turn;
+
+  if (lat < box->lat_min) box->lat_min = lat;
+  if (lat > box->lat_max) box->lat_max = lat;
+  if (*cur_lon < box->lon_min) box->lon_min = *cur_lon;
+  if (*cur_lon > box->lon_max) box->lon_max = *cur_lon;
+  if (date_index < box->date_first) box->date_first = date_index;
+  if (date_index > box->date_last) box->date_last = date_index;
+}
+
+/* Normalize the unwrapped longitude range of a finished track box so
+   that `lon_min' lies within [ -180, 180 ).  */
+void rtree_track_end(RTBox *box) {
+  int span = box->lon_max - box->lon_min;
+  int lon_min;
+  if (span >= RT_FULL_TURN) {
+    box->lon_min = -RT_FULL_TURN / 2;
+    box->lon_max = RT_FULL_TURN / 2;
+    return;
+  }
+  lon_min = (box->lon_min + RT_FULL_TURN / 2) % RT_FULL_TURN;
+  if (lon_min < 0)
+    lon_min += RT_FULL_TURN;
+  box->lon_min = lon_min - RT_FULL_TURN / 2;
+  box->lon_max = box->lon_min + span;
+}
+
+/* `qsort()' comparison function on the longitude of box centers.  */
+static int rt_lon_cmp(const void *p1, const void *p2) {
+  const RTBox *b1 = (const RTBox*)p1;
+  const RTBox *b2 = (const RTBox*)p2;
+  int c1 = b1->lon_min + b1->lon_max;
+  int c2 = b2->lon_min + b2->lon_max;
+  return (c1 > c2) - (c1 < c2);
+}
+
+/* `qsort()' comparison function on the latitude of box centers.  */
+static int rt_lat_cmp(const void *p1, const void *p2) {
+  const RTBox *b1 = (const RTBox*)p1;
+  const RTBox *b2 = (const RTBox*)p2;
+  int c1 = b1->lat_min + b1->lat_max;
+  int c2 = b2->lat_min + b2->lat_max;
+  return (c1 > c2) - (c1 < c2);
+}
+
+/* Sort one level of boxes into STR order and pack it into the nodes
+   of the next level up.  `items' is an array of either `TrackBox' or
+   `RTNode' structures, each of `size' bytes.  `out_nodes' must have
+   room for `ceil(num_items / node_cap)' nodes.  Returns the number of
+   nodes written.  */
+static unsigned str_pack(void *items, unsigned num_items, size_t size,
+			 unsigned node_cap, RTNode *out_nodes) {
+  char *base = (char*)items;
+  unsigned num_nodes = (num_items + node_cap - 1) / node_cap;
+  unsigned num_slices = (unsigned)ceil(sqrt((double)num_nodes));
+  unsigned slice_len = num_slices * node_cap;
+  unsigned i, j;
+
+  qsort(base, num_items, size, rt_lon_cmp);
+  for (i = 0; i < num_items; i += slice_len) {
+    unsigned len = num_items - i;
+    if (len > slice_len) len = slice_len;
+    qsort(base + size * i, len, size, rt_lat_cmp);
+  }
+
+  for (i = 0; i < num_nodes; i++) {
+    RTNode *node = &out_nodes[i];
+    node->first = i * node_cap;
+    node->count = num_items - node->first;
+    if (node->count > node_cap) node->count = node_cap;
+    memcpy(&node->b, base + size * node->first, sizeof(RTBox));
+    for (j = 1; j < node->count; j++) {
+      const RTBox *b = (const RTBox*)(base + size * (node->first + j));
+      if (b->lat_min < node->b.lat_min) node->b.lat_min = b->lat_min;
+      if (b->lon_min < node->b.lon_min) node->b.lon_min = b->lon_min;
+      if (b->lat_max > node->b.lat_max) node->b.lat_max = b->lat_max;
+      if (b->lon_max > node->b.lon_max) node->b.lon_max = b->lon_max;
+      if (b->date_first < node->b.date_first)
+	node->b.date_first = b->date_first;
+      if (b->date_last > node->b.date_last)
+	node->b.date_last = b->date_last;
+    }
+  }
+  return num_nodes;
+}
+
+/* Bulk-load an R-tree from the given track boxes.  The entries are
+   reordered in place, and ownership of the `entries' array passes to
+   the tree.  Returns zero on success, one on failure.  */
+int rtree_build(RTree *tree, TrackBox *entries, unsigned num_entries,
+		unsigned node_cap, unsigned num_dates) {
+  /* Nodes of each level, bottom-up.  */
+  RTNode *levels[32];
+  unsigned level_lens[32];
+  unsigned height = 0;
+  unsigned i;
+
+  tree->node_cap = node_cap;
+  tree->num_dates = num_dates;
+  tree->num_entries = num_entries;
+  tree->entries = entries;
+  tree->num_nodes = 0;
+  tree->leaf_start = 0;
+  tree->nodes = NULL;
+  tree->height = 0;
+  if (node_cap < 2) {
+    fputs("Error: R-tree nodes must have at least two children.\n", stderr);
+    return 1;
+  }
+  if (num_entries == 0)
+    return 0;
+
+  levels[0] = (RTNode*)xmalloc(sizeof(RTNode) *
+			       ((num_entries + node_cap - 1) / node_cap));
+  level_lens[0] = str_pack(entries, num_entries, sizeof(TrackBox),
+			   node_cap, levels[0]);
+  height = 1;
+  while (level_lens[height-1] > 1) {
+    unsigned len = level_lens[height-1];
+    levels[height] = (RTNode*)xmalloc(sizeof(RTNode) *
+				      ((len + node_cap - 1) / node_cap));
+    level_lens[height] = str_pack(levels[height-1], len, sizeof(RTNode),
+				  node_cap, levels[height]);
+    height++;
+  }
+
+  /* Lay out the levels top-down, rebasing the child indexes of the
+     internal nodes onto the combined node array.  */
+  for (i = 0; i < height; i++)
+    tree->num_nodes += level_lens[i];
+  tree->nodes = (RTNode*)xmalloc(sizeof(RTNode) * tree->num_nodes);
+  {
+    unsigned offset = 0;
+    for (i = height; i-- > 0; ) {
+      unsigned child_offset = offset + level_lens[i];
+      unsigned j;
+      memcpy(tree->nodes + offset, levels[i], sizeof(RTNode) * level_lens[i]);
+      if (i > 0) {
+	for (j = 0; j < level_lens[i]; j++)
+	  tree->nodes[offset+j].first += child_offset;
+      } else
+	tree->leaf_start = offset;
+      offset = child_offset;
+      xfree(levels[i]);
+    }
+  }
+  tree->height = height;
+  return 0;
+}
+
+/* Little endian is used for this encoding.  */
+static void put_u32(FILE *fp, unsigned value) {
+  putc(value & 0xff, fp);
+  putc((value >> 8) & 0xff, fp);
+  putc((value >> 16) & 0xff, fp);
+  putc((value >> 24) & 0xff, fp);
+}
+
+static unsigned get_u32(const unsigned char *p) {
+  return (unsigned)p[0] | ((unsigned)p[1] << 8) |
+    ((unsigned)p[2] << 16) | ((unsigned)p[3] << 24);
+}
+
+static void put_box(FILE *fp, const RTBox *b) {
+  put_u32(fp, (unsigned)b->lat_min);
+  put_u32(fp, (unsigned)b->lon_min);
+  put_u32(fp, (unsigned)b->lat_max);
+  put_u32(fp, (unsigned)b->lon_max);
+  put_u32(fp, b->date_first);
+  put_u32(fp, b->date_last);
+}
+
+static void get_box(const unsigned char *p, RTBox *b) {
+  b->lat_min = (int)get_u32(p);
+  b->lon_min = (int)get_u32(p + 4);
+  b->lat_max = (int)get_u32(p + 8);
+  b->lon_max = (int)get_u32(p + 12);
+  b->date_first = get_u32(p + 16);
+  b->date_last = get_u32(p + 20);
+}
+
+/* Write the R-tree to the given file.  Returns zero on success, one on
+   failure.  */
+int rtree_write(FILE *fp, const RTree *tree) {
+  unsigned i;
+  fwrite(rt_signature, sizeof(rt_signature), 1, fp);
+  put_u32(fp, tree->node_cap);
+  put_u32(fp, tree->num_dates);
+  put_u32(fp, tree->height);
+  put_u32(fp, tree->num_entries);
+  put_u32(fp, tree->num_nodes);
+  put_u32(fp, tree->leaf_start);
+  for (i = 0; i < tree->num_entries; i++) {
+    put_box(fp, &tree->entries[i].b);
+    put_u32(fp, tree->entries[i].track_id);
+    put_u32(fp, tree->entries[i].head_index);
+  }
+  for (i = 0; i < tree->num_nodes; i++) {
+    put_box(fp, &tree->nodes[i].b);
+    put_u32(fp, tree->nodes[i].first);
+    put_u32(fp, tree->nodes[i].count);
+  }
+  if (ferror(fp)) {
+    fputs("Error: Could not write the R-tree.\n", stderr);
+    return 1;
+  }
+  return 0;
+}
+
+/* Read an R-tree that was written by `rtree_write()'.  Returns zero
+   on success, one on failure.  */
+int rtree_read(FILE *fp, RTree *tree) {
+  unsigned char header[8 + 6 * 4];
+  unsigned char rec[32];
+  unsigned i;
+
+  tree->entries = NULL; tree->nodes = NULL;
+  tree->num_entries = 0; tree->num_nodes = 0;
+  if (fread(header, sizeof(header), 1, fp) != 1 ||
+      memcmp(header, rt_signature, sizeof(rt_signature))) {
+    fputs("Error: Not an R-tree file.\n", stderr);
+    return 1;
+  }
+  tree->node_cap = get_u32(header + 8);
+  tree->num_dates = get_u32(header + 12);
+  tree->height = get_u32(header + 16);
+  tree->num_entries = get_u32(header + 20);
+  tree->num_nodes = get_u32(header + 24);
+  tree->leaf_start = get_u32(header + 28);
+
+  tree->entries = (TrackBox*)xmalloc(sizeof(TrackBox) * tree->num_entries);
+  tree->nodes = (RTNode*)xmalloc(sizeof(RTNode) * tree->num_nodes);
+  for (i = 0; i < tree->num_entries; i++) {
+    if (fread(rec, sizeof(rec), 1, fp) != 1)
+      goto truncated;
+    get_box(rec, &tree->entries[i].b);
+    tree->entries[i].track_id = get_u32(rec + 24);
+    tree->entries[i].head_index = get_u32(rec + 28);
+  }
+  for (i = 0; i < tree->num_nodes; i++) {
+    RTNode *node = &tree->nodes[i];
+    unsigned limit = (i < tree->leaf_start) ?
+      tree->num_nodes : tree->num_entries;
+    if (fread(rec, sizeof(rec), 1, fp) != 1)
+      goto truncated;
+    get_box(rec, &node->b);
+    node->first = get_u32(rec + 24);
+    node->count = get_u32(rec + 28);
+    if (node->first > limit || node->count > limit - node->first ||
+	(i < tree->leaf_start && node->first <= i)) {
+      fputs("Error: Corrupt R-tree file.\n", stderr);
+      rtree_destroy(tree);
+      return 1;
+    }
+  }
+  return 0;
+
+ truncated:
+  fputs("Error: Unexpected end of R-tree file.\n", stderr);
+  rtree_destroy(tree);
+  return 1;
+}
+
+void rtree_destroy(RTree *tree) {
+  EFREE(tree->entries);
+  EFREE(tree->nodes);
+  tree->num_entries = 0;
+  tree->num_nodes = 0;
+}
+
+/* Test if a box overlaps the query box.  The query longitude range is
+   tested at its original position and shifted one full turn in either
+   direction, so that unwrapped boxes match on both sides of the
+   antimeridian.  */
+static int box_overlaps(const RTBox *b, const int qbox[4],
+			unsigned date_first, unsigned date_last) {
+  int shift;
+  if (b->date_last < date_first || b->date_first > date_last)
+    return 0;
+  if (b->lat_max < qbox[0] || b->lat_min > qbox[2])
+    return 0;
+  for (shift = -RT_FULL_TURN; shift <= RT_FULL_TURN; shift += RT_FULL_TURN) {
+    if (b->lon_max >= qbox[1] + shift && b->lon_min <= qbox[3] + shift)
+      return 1;
+  }
+  return 0;
+}
+
+static unsigned rt_query_node(const RTree *tree, unsigned node_idx,
+			      const int qbox[4],
+			      unsigned date_first, unsigned date_last,
+			      rtree_visit_fn visit, void *arg) {
+  const RTNode *node = &tree->nodes[node_idx];
+  unsigned num_found = 0;
+  unsigned i;
+  if (node_idx >= tree->leaf_start) {
+    for (i = node->first; i < node->first + node->count; i++) {
+      const TrackBox *track = &tree->entries[i];
+      if (box_overlaps(&track->b, qbox, date_first, date_last)) {
+	if (visit != NULL)
+	  visit(track, arg);
+	num_found++;
+      }
+    }
+    return num_found;
+  }
+  for (i = node->first; i < node->first + node->count; i++) {
+    if (box_overlaps(&tree->nodes[i].b, qbox, date_first, date_last))
+      num_found += rt_query_node(tree, i, qbox, date_first, date_last,
+				 visit, arg);
+  }
+  return num_found;
+}
+
+/* Find all tracks whose bounding box intersects the given region and
+   whose lifetime overlaps the date index range [ date_first,
+   date_last ].  Pass zero and `~0u' for the date range to match
+   tracks on any date.  As in the web viewer, a region crosses the
+   antimeridian when `max_lon' is less than `min_lon'.  Units are
+   degrees.  `visit' is called once for every matching track, and it
+   may be NULL if only a count is desired.  Returns the number of
+   matching tracks.  */
+unsigned rtree_query(const RTree *tree,
+		     float min_lat, float min_lon,
+		     float max_lat, float max_lon,
+		     unsigned date_first, unsigned date_last,
+		     rtree_visit_fn visit, void *arg) {
+  int qbox[4];
+  if (tree->num_nodes == 0)
+    return 0;
+  qbox[0] = (int)floor(min_lat * RT_DEG);
+  qbox[1] = (int)floor(min_lon * RT_DEG);
+  qbox[2] = (int)ceil(max_lat * RT_DEG);
+  qbox[3] = (int)ceil(max_lon * RT_DEG);
+  /* Normalize the query longitude range the same way as the track
+     boxes.  */
+  if (qbox[3] < qbox[1])
+    qbox[3] += RT_FULL_TURN;
+  if (qbox[3] - qbox[1] >= RT_FULL_TURN) {
+    qbox[1] = -RT_FULL_TURN / 2;
+    qbox[3] = RT_FULL_TURN / 2;
+  } else {
+    int span = qbox[3] - qbox[1];
+    int lon_min = (qbox[1] + RT_FULL_TURN / 2) % RT_FULL_TURN;
+    if (lon_min < 0)
+      lon_min += RT_FULL_TURN;
+    qbox[1] = lon_min - RT_FULL_TURN / 2;
+    qbox[3] = qbox[1] + span;
+  }
+  return rt_query_node(tree, 0, qbox, date_first, date_last, visit, arg);
+}
@@ -0,0 +1,89 @@
+/* Whole-track bounding box R-tree, used to quickly find all tracks
+   that ever pass through a geographic region.
+
+Copyright (C) 2014 University of Minnesota
+
+See the file "COPYING" in the top level directory for details.
+
+*/
+
+#ifndef RTREE_H
+#define RTREE_H
+
+#include <stdio.h>
+
+/* All coordinates are stored in the same 1/64 degree fixed-point
+   units that tracksconv uses for eddy positions, but centered on
+   zero.  Latitudes therefore range from -5760 to 5760 and longitudes
+   from -11520 to 11520.
+
+   Longitudes are "unwrapped" so that boxes which cross the
+   antimeridian can be represented without splitting them: `lon_min'
+   is always within [ -11520, 11520 ), and `lon_max' may extend up to
+   one full turn (23040) beyond `lon_min'.  */
+#define RT_DEG (1 << 6)
+#define RT_FULL_TURN (360 * RT_DEG)
+
+/* Default number of children per R-tree node.  */
+#define RT_NODE_CAP 16
+
+/* Bounding box and time span common to both tracks and nodes.  This
+   must be the first member of the structures below so that the
+   packing code can treat them uniformly.  */
+struct RTBox_tag {
+  int lat_min, lon_min, lat_max, lon_max;
+  unsigned date_first, date_last;
+};
+typedef struct RTBox_tag RTBox;
+
+struct TrackBox_tag {
+  RTBox b;
+  /* Ordinal of the track when all tracks are ordered by the position
+     of their first eddy within the tracks data file.  */
+  unsigned track_id;
+  /* Index of the track's first eddy within the tracks data file.  */
+  unsigned head_index;
+};
+typedef struct TrackBox_tag TrackBox;
+
+/* `first' and `count' refer to child nodes for internal nodes and to
+   `TrackBox' entries for leaf nodes.  */
+struct RTNode_tag {
+  RTBox b;
+  unsigned first;
+  unsigned count;
+};
+typedef struct RTNode_tag RTNode;
+
+/* Nodes are stored top-down, level by level, with the root node at
+   index zero.  All nodes at or beyond `leaf_start' are leaves.  */
+struct RTree_tag {
+  unsigned node_cap;
+  unsigned num_dates;
+  unsigned height;
+  unsigned num_entries;
+  TrackBox *entries;
+  unsigned num_nodes;
+  unsigned leaf_start;
+  RTNode *nodes;
+};
+typedef struct RTree_tag RTree;
+
+typedef void (*rtree_visit_fn)(const TrackBox *track, void *arg);
+
+void rtree_track_begin(RTBox *box, int lat, int lon, unsigned date_index);
+void rtree_track_add(RTBox *box, int *cur_lon,
+		     int lat, int lon, unsigned date_index);
+void rtree_track_end(RTBox *box);
+int rtree_build(RTree *tree, TrackBox *entries, unsigned num_entries,
+		unsigned node_cap, unsigned num_dates);
+int rtree_write(FILE *fp, const RTree *tree);
+int rtree_read(FILE *fp, RTree *tree);
+void rtree_destroy(RTree *tree);
+unsigned rtree_query(const RTree *tree,
+		     float min_lat, float min_lon,
+		     float max_lat, float max_lon,
+		     unsigned date_first, unsigned date_last,
+		     rtree_visit_fn visit, void *arg);
+
+#endif /* not RTREE_H */
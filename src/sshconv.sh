@@ -37,8 +37,9 @@ setclass()
   esac
 }
 
-cc -O3 csvtotga.c -o csvtotga
-trap "rm csvtotga" EXIT
+cc -O3 -pthread csvtotga.c -lz -lm -o csvtotga
+TGADIR=`mktemp -d`
+trap "rm -rf csvtotga $TGADIR" EXIT
 
 if [ "$1" = "-v" ]; then
   VERBOSE=yes
@@ -54,13 +55,23 @@ else
   DATES=`cat ../data/dates.dat`
 fi
 
-# Write out the format files for each SSH conversion class.
+# Sort the SSH conversion classes into the ones that csvtotga writes by
+# itself, PNG images and their format files, and the ones that go
+# through a TGA image and `convert'.
+PNGSPECS=
+TGACLASSES=
 for CLASS in $CLASSES; do
   setclass
   mkdir -p ../data/${CLASS}
+  if [ "$FMT" = png ]; then
+    PNGSPECS="$PNGSPECS $BITS_BEF_DEC.$BITS_AFT_DEC -m$NOISE_MARGIN"
+    PNGSPECS="$PNGSPECS -f../data/${CLASS}/ssh_%s.png"
+    continue
+  fi
+  TGACLASSES="$TGACLASSES $CLASS"
   cat >../data/${CLASS}/format.json <<EOF
 {
-  "format": ${FMT},
+  "format": "${FMT}",
   "bitsBefDec": ${BITS_BEF_DEC},
   "bitsAftDec": ${BITS_AFT_DEC},
   "noiseMargin": ${NOISE_MARGIN}
@@ -68,13 +79,33 @@ for CLASS in $CLASSES; do
 EOF
 done
 
-# Convert each SSH frame for each conversion class.
+# Convert the PNG classes of all dates at once, several dates at a
+# time.  Dates whose images are newer than their SSH data are skipped.
+# The statistics of every date go into `sshstats', along with those of
+# all dates in `ssh_all.sta'.
+if [ -n "$PNGSPECS" ]; then
+  echo "$DATES" >$TGADIR/dates.dat
+  mkdir -p ../data/sshstats
+  ./csvtotga ${VERBOSE:+-v} -d$TGADIR/dates.dat -r../data/SSH/ssh_%s.dat \
+    -a../data/sshstats/ssh_%s.sta $PNGSPECS || exit 1
+fi
+
+# Convert each SSH frame for all other classes at once, so that every
+# frame is only parsed once.
 for date in $DATES; do
-  for CLASS in $CLASSES; do
+  if [ -z "$TGACLASSES" ]; then
+    break
+  fi
+  SPECS=
+  for CLASS in $TGACLASSES; do
+    setclass
+    SPECS="$SPECS $BITS_BEF_DEC.$BITS_AFT_DEC -m$NOISE_MARGIN"
+    SPECS="$SPECS -f$TGADIR/${CLASS}.tga"
+  done
+  ./csvtotga $SPECS <../data/SSH/ssh_${date}.dat || exit 1
+  for CLASS in $TGACLASSES; do
     setclass
-    ./csvtotga $BITS_BEF_DEC.$BITS_AFT_DEC -m$NOISE_MARGIN \
-      <../data/SSH/ssh_${date}.dat | \
-      convert tga:- ../data/${CLASS}/ssh_${date}.${FMT}
+    convert $TGADIR/${CLASS}.tga ../data/${CLASS}/ssh_${date}.${FMT}
   done
   if [ -n "$VERBOSE" ]; then
     echo Finished date ${date}.
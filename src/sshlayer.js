@@ -1040,6 +1040,115 @@ EquiGrayVidCanvSSHLayer.render = EquiGraySSHLayer.render;
 
 /********************************************************************/
 
+/**
+ * Reference decoder for SSH frames written in keyframe mode by
+ * "csvtotga -kN": every `keyInterval`th date is a keyframe in the
+ * format of its class, and the dates in between are 8-bit delta
+ * frames that each hold the change from the date before.  The decoder
+ * keeps the fixed-point codes of the last decoded frame, zero for NaN,
+ * and must be given every frame from a keyframe on, in date order.
+ *
+ * Keyframes must have been written with the default channel options
+ * of "csvtotga".
+ *
+ * @constructor
+ * @param {Object} format - The contents of the "format.json" of the
+ * frames.
+ * @memberof SSHLayerJS
+ */
+var SSHDeltaDecoder = function(format) {
+  var bits = format.bitsBefDec + format.bitsAftDec;
+  this.bits = bits;
+  this.scale = 1 << format.bitsAftDec;
+  this.zero = 1 << (bits - 1);
+  this.noiseHalf = format.noiseMargin >> 1;
+  /* Limits of the codes of samples that are not NaN.  */
+  this.minCode = 1 + format.noiseMargin;
+  this.maxCode = (1 << bits) - 1;
+  this.keyInterval = format.keyInterval;
+  this.quantum = format.deltaQuantum;
+  this.codes = null;
+};
+OEV.SSHDeltaDecoder = SSHDeltaDecoder;
+
+/**
+ * Decode a keyframe.
+ * @param {Array} pixels - The pixels of the frame, red channel first.
+ * @param {integer} stride - The number of channels of each pixel in
+ * `pixels`, for example 4 for canvas image data.
+ */
+SSHDeltaDecoder.prototype.keyFrame = function(pixels, stride) {
+  var numPixels = pixels.length / stride;
+  var codes = this.codes = new Int32Array(numPixels);
+  var bits = this.bits;
+  for (var i = 0, j = 0; i < numPixels; i++, j += stride) {
+    if (bits <= 8) {
+      codes[i] = pixels[j] >> (8 - bits);
+      continue;
+    }
+    var red = pixels[j], green = pixels[j+1], blue = pixels[j+2];
+    /* Undo the bounce-back wrap of the lower channels.  */
+    if (red & 1) green ^= 0xff;
+    if (green & 1) blue ^= 0xff;
+    codes[i] = ((red << 16) | (green << 8) | blue) >> (24 - bits);
+  }
+};
+
+/**
+ * Decode a delta frame against the last decoded frame.  Every pixel
+ * is 128 plus the number of steps of `deltaQuantum` by which a code
+ * changes, or 0 for NaN.  Codes that were NaN change from the code of
+ * zero.
+ * @param {Array} pixels - The pixels of the frame.
+ * @param {integer} stride - The number of channels of each pixel in
+ * `pixels`.
+ */
+SSHDeltaDecoder.prototype.deltaFrame = function(pixels, stride) {
+  var codes = this.codes, numPixels = codes.length;
+  var zero = this.zero, quantum = this.quantum;
+  var minCode = this.minCode, maxCode = this.maxCode;
+  for (var i = 0, j = 0; i < numPixels; i++, j += stride) {
+    var step = pixels[j];
+    if (step == 0) {
+      codes[i] = 0;
+      continue;
+    }
+    var code = (codes[i] || zero) + (step - 128) * quantum;
+    if (code > maxCode) code = maxCode;
+    if (code < minCode) code = minCode;
+    codes[i] = code;
+  }
+};
+
+/**
+ * Decode the frame of the date with index `dateIndex` in the dates
+ * list, which is a keyframe or a delta frame depending on the index.
+ * @param {integer} dateIndex - The index of the date of the frame.
+ * @param {Array} pixels - The pixels of the frame.
+ * @param {integer} stride - The number of channels of each pixel in
+ * `pixels`.
+ */
+SSHDeltaDecoder.prototype.decode = function(dateIndex, pixels, stride) {
+  if (dateIndex % this.keyInterval == 0)
+    this.keyFrame(pixels, stride);
+  else
+    this.deltaFrame(pixels, stride);
+};
+
+/**
+ * Convert the last decoded frame into SSH values in centimeters,
+ * with -128 for NaN as in `backBuf.data` of the SSH layers.
+ * @param {Array} out - The array to store the values into.
+ */
+SSHDeltaDecoder.prototype.getSSH = function(out) {
+  var codes = this.codes, numPixels = codes.length;
+  var offset = this.zero + this.noiseHalf, scale = this.scale;
+  for (var i = 0; i < numPixels; i++)
+    out[i] = (codes[i] == 0) ? -128 : (codes[i] - offset) / scale;
+};
+
+/********************************************************************/
+
 /**
  * Pointer to the current SSHLayer implementation.
  * @memberof SSHLayerJS
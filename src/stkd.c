@@ -0,0 +1,348 @@
+/* Spatio-temporal kd-tree over the latitude, longitude, and date index
+   of every eddy, used to find all eddies within a region over a range
+   of dates in a single traversal.
+
+   Unlike the per-date kd-trees in the tracks data file, this tree
+   spans all dates at once, and its leaves are buckets of up to
+   `leaf_size' eddies rather than single eddies.  Each node is split
+   at its median along whichever dimension has the largest extent
+   relative to the extent of the whole data set, and each node stores
+   its exact bounding box so that whole subtrees that lie within the
+   query region can be reported as a single run of points.
+
+   File format (all integers are 32-bit little endian):
+
+   "OEVSTKD1"    8-byte signature
+   leaf_size, num_dates, num_points, num_nodes
+   points[num_points]:
+     latitude, longitude, date_index, eddy_index
+   nodes[num_nodes]:
+     lo[3], hi[3], first, count
+
+Copyright (C) 2014 University of Minnesota
+
+See the file "COPYING" in the top level directory for details.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+
+#include "xmalloc.h"
+#include "stkd.h"
+
+static const char st_signature[8] =
+  { 'O', 'E', 'V', 'S', 'T', 'K', 'D', '1' };
+
+/* Query region, in fixed-point units.  A longitude range that crosses
+   the antimeridian is split into two ranges.  */
+struct STQuery_tag {
+  int lo[STKD_DIMS];
+  int hi[STKD_DIMS];
+  int lon2_lo, lon2_hi; /* Second longitude range, if `lon2_lo <= lon2_hi' */
+  stkd_visit_fn visit;
+  void *arg;
+};
+typedef struct STQuery_tag STQuery;
+
+static void st_select(STPoint *p, unsigned n, unsigned k, int dim);
+static void st_bound(STNode *node, const STPoint *points);
+static unsigned st_query_node(const STKdTree *tree, unsigned node_idx,
+			      const STQuery *q);
+
+/* Partially sort `p' so that the element at index `k' is the one that
+   would be there if the array was fully sorted on dimension `dim',
+   with no greater elements before it and no lesser elements after
+   it.  */
+static void st_select(STPoint *p, unsigned n, unsigned k, int dim) {
+  long lo = 0, hi = (long)n - 1;
+  while (hi > lo) {
+    long i = lo, j = hi;
+    int a = p[lo].c[dim], b = p[lo+(hi-lo)/2].c[dim], c = p[hi].c[dim];
+    int pivot = (a < b) ? ((b < c) ? b : ((a < c) ? c : a)) :
+      ((a < c) ? a : ((b < c) ? c : b));
+    while (i <= j) {
+      while (p[i].c[dim] < pivot) i++;
+      while (p[j].c[dim] > pivot) j--;
+      if (i <= j) {
+	STPoint temp = p[i]; p[i] = p[j]; p[j] = temp;
+	i++; j--;
+      }
+    }
+    if ((long)k <= j) hi = j;
+    else if ((long)k >= i) lo = i;
+    else break;
+  }
+}
+
+/* Compute the bounding box of the points of a node.  */
+static void st_bound(STNode *node, const STPoint *points) {
+  unsigned i, d;
+  for (d = 0; d < STKD_DIMS; d++)
+    { node->lo[d] = INT_MAX; node->hi[d] = INT_MIN; }
+  for (i = node->first; i < node->first + node->count; i++) {
+    for (d = 0; d < STKD_DIMS; d++) {
+      if (points[i].c[d] < node->lo[d]) node->lo[d] = points[i].c[d];
+      if (points[i].c[d] > node->hi[d]) node->hi[d] = points[i].c[d];
+    }
+  }
+}
+
+/* Build a spatio-temporal kd-tree from the given points.  The points
+   are reordered in place, and ownership of the `points' array passes
+   to the tree.  Returns zero on success, one on failure.  */
+int stkd_build(STKdTree *tree, STPoint *points, unsigned num_points,
+	       unsigned leaf_size, unsigned num_dates) {
+  unsigned num_leaves = 1;
+  unsigned i;
+
+  tree->leaf_size = leaf_size;
+  tree->num_dates = num_dates;
+  tree->num_points = num_points;
+  tree->points = points;
+  tree->num_nodes = 0;
+  tree->nodes = NULL;
+  if (leaf_size < 2) {
+    fputs("Error: kd-tree leaf buckets must hold at least two eddies.\n",
+	  stderr);
+    return 1;
+  }
+  if (num_points == 0)
+    return 0;
+
+  while ((double)num_leaves * leaf_size < num_points)
+    num_leaves *= 2;
+  tree->num_nodes = 2 * num_leaves - 1;
+  tree->nodes = (STNode*)xmalloc(sizeof(STNode) * tree->num_nodes);
+  tree->nodes[0].first = 0;
+  tree->nodes[0].count = num_points;
+
+  /* Nodes are visited in breadth-first order, so every node's range
+     has already been assigned by its parent.  */
+  for (i = 0; i < tree->num_nodes; i++) {
+    STNode *node = &tree->nodes[i];
+    STNode *left, *right;
+    unsigned split_dim = 0, d;
+    double max_extent = -1;
+
+    st_bound(node, points);
+    if (2 * i + 1 >= tree->num_nodes)
+      continue; /* Leaf bucket */
+
+    for (d = 0; d < STKD_DIMS; d++) {
+      double full = (double)tree->nodes[0].hi[d] - tree->nodes[0].lo[d];
+      double extent = (node->count == 0 || full <= 0) ? 0 :
+	((double)node->hi[d] - node->lo[d]) / full;
+      if (extent > max_extent)
+	{ max_extent = extent; split_dim = d; }
+    }
+
+    left = &tree->nodes[2*i+1]; right = &tree->nodes[2*i+2];
+    left->first = node->first;
+    left->count = node->count / 2;
+    right->first = left->first + left->count;
+    right->count = node->count - left->count;
+    if (node->count > 1)
+      st_select(points + node->first, node->count, left->count, split_dim);
+  }
+  return 0;
+}
+
+/* Little endian is used for this encoding.  */
+static void put_u32(FILE *fp, unsigned value) {
+  putc(value & 0xff, fp);
+  putc((value >> 8) & 0xff, fp);
+  putc((value >> 16) & 0xff, fp);
+  putc((value >> 24) & 0xff, fp);
+}
+
+static unsigned get_u32(const unsigned char *p) {
+  return (unsigned)p[0] | ((unsigned)p[1] << 8) |
+    ((unsigned)p[2] << 16) | ((unsigned)p[3] << 24);
+}
+
+/* Write the kd-tree to the given file.  Returns zero on success, one
+   on failure.  */
+int stkd_write(FILE *fp, const STKdTree *tree) {
+  unsigned i, d;
+  fwrite(st_signature, sizeof(st_signature), 1, fp);
+  put_u32(fp, tree->leaf_size);
+  put_u32(fp, tree->num_dates);
+  put_u32(fp, tree->num_points);
+  put_u32(fp, tree->num_nodes);
+  for (i = 0; i < tree->num_points; i++) {
+    for (d = 0; d < STKD_DIMS; d++)
+      put_u32(fp, (unsigned)tree->points[i].c[d]);
+    put_u32(fp, tree->points[i].eddy_index);
+  }
+  for (i = 0; i < tree->num_nodes; i++) {
+    for (d = 0; d < STKD_DIMS; d++)
+      put_u32(fp, (unsigned)tree->nodes[i].lo[d]);
+    for (d = 0; d < STKD_DIMS; d++)
+      put_u32(fp, (unsigned)tree->nodes[i].hi[d]);
+    put_u32(fp, tree->nodes[i].first);
+    put_u32(fp, tree->nodes[i].count);
+  }
+  if (ferror(fp)) {
+    fputs("Error: Could not write the spatio-temporal kd-tree.\n", stderr);
+    return 1;
+  }
+  return 0;
+}
+
+/* Read a kd-tree that was written by `stkd_write()'.  Returns zero on
+   success, one on failure.  */
+int stkd_read(FILE *fp, STKdTree *tree) {
+  unsigned char header[8 + 4 * 4];
+  unsigned char rec[32];
+  unsigned i, d;
+
+  tree->points = NULL; tree->nodes = NULL;
+  tree->num_points = 0; tree->num_nodes = 0;
+  if (fread(header, sizeof(header), 1, fp) != 1 ||
+      memcmp(header, st_signature, sizeof(st_signature))) {
+    fputs("Error: Not a spatio-temporal kd-tree file.\n", stderr);
+    return 1;
+  }
+  tree->leaf_size = get_u32(header + 8);
+  tree->num_dates = get_u32(header + 12);
+  tree->num_points = get_u32(header + 16);
+  tree->num_nodes = get_u32(header + 20);
+  /* The node count of a complete binary tree is one less than a power
+     of two.  */
+  if ((tree->num_nodes & (tree->num_nodes + 1)) != 0) {
+    fputs("Error: Corrupt spatio-temporal kd-tree file.\n", stderr);
+    tree->num_points = 0; tree->num_nodes = 0;
+    return 1;
+  }
+
+  tree->points = (STPoint*)xmalloc(sizeof(STPoint) * tree->num_points);
+  tree->nodes = (STNode*)xmalloc(sizeof(STNode) * tree->num_nodes);
+  for (i = 0; i < tree->num_points; i++) {
+    if (fread(rec, 16, 1, fp) != 1)
+      goto truncated;
+    for (d = 0; d < STKD_DIMS; d++)
+      tree->points[i].c[d] = (int)get_u32(rec + 4 * d);
+    tree->points[i].eddy_index = get_u32(rec + 12);
+  }
+  for (i = 0; i < tree->num_nodes; i++) {
+    STNode *node = &tree->nodes[i];
+    if (fread(rec, 32, 1, fp) != 1)
+      goto truncated;
+    for (d = 0; d < STKD_DIMS; d++) {
+      node->lo[d] = (int)get_u32(rec + 4 * d);
+      node->hi[d] = (int)get_u32(rec + 12 + 4 * d);
+    }
+    node->first = get_u32(rec + 24);
+    node->count = get_u32(rec + 28);
+    if (node->first > tree->num_points ||
+	node->count > tree->num_points - node->first) {
+      fputs("Error: Corrupt spatio-temporal kd-tree file.\n", stderr);
+      stkd_destroy(tree);
+      return 1;
+    }
+  }
+  return 0;
+
+ truncated:
+  fputs("Error: Unexpected end of spatio-temporal kd-tree file.\n", stderr);
+  stkd_destroy(tree);
+  return 1;
+}
+
+void stkd_destroy(STKdTree *tree) {
+  EFREE(tree->points);
+  EFREE(tree->nodes);
+  tree->num_points = 0;
+  tree->num_nodes = 0;
+}
+
+static unsigned st_query_node(const STKdTree *tree, unsigned node_idx,
+			      const STQuery *q) {
+  const STNode *node = &tree->nodes[node_idx];
+  int lat_in, date_in, lon_in, lon_over;
+  unsigned num_found, i, run_start;
+
+  if (node->count == 0 ||
+      node->hi[0] < q->lo[0] || node->lo[0] > q->hi[0] ||
+      node->hi[2] < q->lo[2] || node->lo[2] > q->hi[2])
+    return 0;
+  lon_over = (node->hi[1] >= q->lo[1] && node->lo[1] <= q->hi[1]) ||
+    (node->hi[1] >= q->lon2_lo && node->lo[1] <= q->lon2_hi);
+  if (!lon_over)
+    return 0;
+
+  /* Report whole subtrees that lie within the query region.  */
+  lat_in = node->lo[0] >= q->lo[0] && node->hi[0] <= q->hi[0];
+  date_in = node->lo[2] >= q->lo[2] && node->hi[2] <= q->hi[2];
+  lon_in = (node->lo[1] >= q->lo[1] && node->hi[1] <= q->hi[1]) ||
+    (node->lo[1] >= q->lon2_lo && node->hi[1] <= q->lon2_hi);
+  if (lat_in && date_in && lon_in) {
+    if (q->visit != NULL)
+      q->visit(tree->points + node->first, node->count, q->arg);
+    return node->count;
+  }
+
+  if (2 * node_idx + 1 < tree->num_nodes)
+    return st_query_node(tree, 2 * node_idx + 1, q) +
+      st_query_node(tree, 2 * node_idx + 2, q);
+
+  /* Scan the leaf bucket, coalescing consecutive matches into
+     runs.  */
+  num_found = 0; run_start = node->first;
+  for (i = node->first; i <= node->first + node->count; i++) {
+    const STPoint *p = &tree->points[i];
+    int match = i < node->first + node->count &&
+      p->c[0] >= q->lo[0] && p->c[0] <= q->hi[0] &&
+      p->c[2] >= q->lo[2] && p->c[2] <= q->hi[2] &&
+      ((p->c[1] >= q->lo[1] && p->c[1] <= q->hi[1]) ||
+       (p->c[1] >= q->lon2_lo && p->c[1] <= q->lon2_hi));
+    if (match)
+      continue;
+    if (i > run_start) {
+      if (q->visit != NULL)
+	q->visit(tree->points + run_start, i - run_start, q->arg);
+      num_found += i - run_start;
+    }
+    run_start = i + 1;
+  }
+  return num_found;
+}
+
+/* Find all eddies within the given region on the date indexes
+   [ date_first, date_last ].  As in the web viewer, the region
+   crosses the antimeridian when `max_lon' is less than `min_lon'.
+   Units are degrees, and the region boundaries are inclusive.
+   `visit' is called with runs of matching points, and it may be NULL
+   if only a count is desired.  Returns the number of matching
+   eddies.  */
+unsigned stkd_query(const STKdTree *tree,
+		    float min_lat, float min_lon,
+		    float max_lat, float max_lon,
+		    unsigned date_first, unsigned date_last,
+		    stkd_visit_fn visit, void *arg) {
+  STQuery q;
+  if (tree->num_nodes == 0 || date_first > date_last)
+    return 0;
+  if (date_first > INT_MAX) return 0;
+  if (date_last > INT_MAX) date_last = INT_MAX;
+
+  q.lo[0] = (int)ceil(min_lat * STKD_DEG);
+  q.hi[0] = (int)floor(max_lat * STKD_DEG);
+  q.lo[1] = (int)ceil(min_lon * STKD_DEG);
+  q.hi[1] = (int)floor(max_lon * STKD_DEG);
+  q.lo[2] = (int)date_first;
+  q.hi[2] = (int)date_last;
+  q.lon2_lo = 1; q.lon2_hi = 0;
+  if (max_lon < min_lon) {
+    /* Split a range that crosses the antimeridian.  */
+    q.lon2_lo = -180 * STKD_DEG;
+    q.lon2_hi = q.hi[1];
+    q.hi[1] = 180 * STKD_DEG;
+  }
+  q.visit = visit; q.arg = arg;
+  return st_query_node(tree, 0, &q);
+}
@@ -0,0 +1,71 @@
+/* Spatio-temporal kd-tree over the latitude, longitude, and date index
+   of every eddy, used to find all eddies within a region over a range
+   of dates in a single traversal.
+
+Copyright (C) 2014 University of Minnesota
+
+See the file "COPYING" in the top level directory for details.
+
+*/
+
+#ifndef STKD_H
+#define STKD_H
+
+#include <stdio.h>
+
+/* Coordinates use the same zero-centered 1/64 degree fixed-point
+   units as the R-tree (see "rtree.h").  */
+#define STKD_DEG (1 << 6)
+
+/* Default maximum number of eddies in a leaf bucket.  */
+#define STKD_LEAF_SIZE 32
+
+#define STKD_DIMS 3
+
+/* `c' holds the latitude (0), longitude (1), and date index (2).  */
+struct STPoint_tag {
+  int c[STKD_DIMS];
+  /* Index of the eddy within the tracks data file.  */
+  unsigned eddy_index;
+};
+typedef struct STPoint_tag STPoint;
+
+/* Bounding box of the points in the range [ first, first + count ).  */
+struct STNode_tag {
+  int lo[STKD_DIMS];
+  int hi[STKD_DIMS];
+  unsigned first;
+  unsigned count;
+};
+typedef struct STNode_tag STNode;
+
+/* The tree is stored implicitly: the children of node `i' are nodes
+   `2 * i + 1' and `2 * i + 2', and a node is a leaf bucket when it
+   has no children.  All leaves are at the same depth.  */
+struct STKdTree_tag {
+  unsigned leaf_size;
+  unsigned num_dates;
+  unsigned num_points;
+  STPoint *points;
+  unsigned num_nodes;
+  STNode *nodes;
+};
+typedef struct STKdTree_tag STKdTree;
+
+/* Called with a run of consecutive points that all lie within the
+   query region.  */
+typedef void (*stkd_visit_fn)(const STPoint *points, unsigned count,
+			      void *arg);
+
+int stkd_build(STKdTree *tree, STPoint *points, unsigned num_points,
+	       unsigned leaf_size, unsigned num_dates);
+int stkd_write(FILE *fp, const STKdTree *tree);
+int stkd_read(FILE *fp, STKdTree *tree);
+void stkd_destroy(STKdTree *tree);
+unsigned stkd_query(const STKdTree *tree,
+		    float min_lat, float min_lon,
+		    float max_lat, float max_lon,
+		    unsigned date_first, unsigned date_last,
+		    stkd_visit_fn visit, void *arg);
+
+#endif /* not STKD_H */
@@ -42,10 +42,20 @@ WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #include <wchar.h>
 #include <ctype.h>
 #include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "xmalloc.h"
 #include "exparray.h"
 #include "qsorts.h"
+#include "rtree.h"
+#include "stkd.h"
+#include "tstats.h"
+#include "wtxt.h"
 
 #ifndef __cplusplus
 enum bool_tag { false, true };
@@ -72,6 +82,10 @@ struct SortedEddy_tag {
      an eddy points to itself.  */
   SortedEddy *next;
   SortedEddy *prev;
+  /* When appending to existing tracks data, one plus the index of the
+     previous eddy within the existing data, or zero if there is
+     none.  */
+  unsigned append_prev;
 };
 
 EA_TYPE(SortedEddy);
@@ -92,6 +106,44 @@ unsigned_array date_chunk_starts;
 /* Maximum number of eddies on a single date index.  */
 unsigned max_frame_eddies;
 
+/* Existing tracks data being appended to, and the decoded eddies on
+   its last date index, which are the only ones that new eddies can
+   continue from.  An eddy whose `next' is not `WTXT_NONE' cannot be
+   continued, so it is set once a new eddy continues from it.  */
+bool appending = false;
+WFile append_wf;
+unsigned append_tail_first, append_tail_count;
+unsigned char *append_tail_type;
+float *append_tail_lat, *append_tail_lon;
+unsigned *append_tail_next, *append_tail_prev;
+
+/* The SSH grids to sample under every eddy, one per date index.  A
+   grid is in equirectangular projection with the rows going from
+   latitude -90 to 90 inclusive, and the columns starting at longitude
+   zero, as the input of csvtotga.  The grids either come from CSV
+   files named after the dates in the dates file, or from a cube of
+   native float32 grids for consecutive date indexes.  */
+struct SSHSource_tag {
+  const char *csv_dir;
+  char **dates;
+  unsigned num_dates;
+  const float *cube;
+  size_t cube_size;
+  unsigned width, height;
+  /* The rest is shared by the worker threads.  */
+  pthread_mutex_t lock;
+  unsigned next_date;
+  unsigned short *values;
+  unsigned num_nan;
+  int retval;
+};
+typedef struct SSHSource_tag SSHSource;
+
+/* SSH values are stored in 1/64 cm units, offset so that -400 cm is
+   one.  Zero is stored for no data.  */
+#define SSH_ZERO 25601
+#define SSH_MAX (2 * SSH_ZERO - 1)
+
 /* [0] "Relative dimension 0"
    [1] "Relative dimension 1"
    [2] Temporary copy of relative dimension 0.
@@ -102,7 +154,11 @@ unsigned max_frame_eddies;
 SortedEddy *kd_reldim[KD_DIMS+1];
 
 void display_help(FILE *fout, const char *progname);
+unsigned encode_short(unsigned value);
 bool put_short_in_range(FILE *fout, unsigned value);
+int open_append(const char *filename);
+void close_append(void);
+unsigned find_append_prev(const InputEddy *ieddy, unsigned eddy_type);
 int parse_json(FILE *fp, unsigned eddy_type);
 int add_eddy(InputEddy *ieddy, unsigned eddy_type,
 	     bool start_of_track);
@@ -112,6 +168,31 @@ int qs_lon_cmp(const void *p1, const void *p2);
 void qs_eddy_swap(void *p1, void *p2, void *arg);
 void kd_eddy_move(SortedEddy *dest, SortedEddy *src);
 int kd_tree_build(unsigned begin_start, unsigned begin_length);
+void rebase_links(void);
+int build_date_chunks(void);
+int build_kd_trees(void);
+int write_tracks(FILE *fout, FILE *fdiag, const wchar_t_array *user_info,
+		 const char *extra_header);
+int write_eddy(FILE *fout, FILE *fdiag, unsigned index, unsigned base);
+int write_appended_tracks(FILE *fout, FILE *fdiag);
+int write_track_rtree(FILE *fp);
+int write_stkd_index(FILE *fp);
+int write_track_lod(FILE *fp, bool diag_proc);
+int write_track_stats(FILE *fp);
+int write_density_grids(const char *dir, float res, unsigned window);
+int write_overview(FILE *fp, const wchar_t_array *user_info,
+		   unsigned date_step, unsigned min_len, bool build_kd);
+int open_ssh_source(SSHSource *src, const char *csv_dir,
+		    const char *dates_name, const char *cube_name,
+		    unsigned num_dates);
+void close_ssh_source(SSHSource *src);
+int read_ssh_csv(const char *filename, float *grid, size_t grid_len);
+float sample_ssh(const float *grid, unsigned width, unsigned height,
+		 const SortedEddy *seddy);
+unsigned encode_ssh(float ssh);
+void *ssh_worker(void *arg);
+int write_ssh_column(FILE *fp, SSHSource *src, unsigned num_threads,
+		     bool diag_proc);
 
 void display_help(FILE *fout, const char *progname) {
     fprintf(fout, "Usage: %s [OPTIONS] [-o OUTPUT]\n"
@@ -126,6 +207,50 @@ void display_help(FILE *fout, const char *progname) {
 "  -x    Enable extended output range (0x0000 to 0xf7fe).\n"
 "  -nk   Disable kd-tree construction.\n"
 "  -np   Disable padding the output data with newlines.\n"
+"  -rt RTREE-FILE    Write a whole-track bounding box R-tree to the given\n"
+"        file, for quickly finding the tracks that cross a region.\n"
+"  -st STKD-FILE    Write a spatio-temporal kd-tree over the latitude,\n"
+"        longitude, and date index of every eddy to the given file, for\n"
+"        finding the eddies in a region over a range of dates.\n"
+"  -lod LOD-FILE    Write the level of detail of every eddy's track vertex\n"
+"        to the given file, for simplifying tracks at low zoom levels.\n"
+"  -ts STATS-FILE    Write the lifetime, net displacement, mean speed,\n"
+"        genesis latitude, and other statistics of every track to the\n"
+"        given file, for filtering and coloring tracks.\n"
+"  -dg DIR    Write eddy density grids as TGA images into the given\n"
+"        directory, one per date index.\n"
+"  -dgr RES    Density grid resolution in degrees (default 1).\n"
+"  -dgw N    Also write density grids aggregated over consecutive\n"
+"        windows of N date indexes.\n"
+"  -ov OVERVIEW-FILE    Also write a small overview of the tracks data in\n"
+"        the same format, for the viewer to display while it loads the\n"
+"        full data.\n"
+"  -ovd N    Only keep every Nth date index in the overview (default 4).\n"
+"  -ovl N    Only keep tracks at least N date indexes long in the\n"
+"        overview (default 16).\n"
+"  -ssh SSH-FILE    Sample the sea surface height under every eddy from\n"
+"        the SSH grids given by -sshcsv or -sshcube, and write it to the\n"
+"        given file in the order of the eddies in the output.\n"
+"  -sshcsv DIR    Read the SSH grids from the CSV files DIR/ssh_DATE.dat,\n"
+"        as csvtotga does, where DATE is the corresponding line of the\n"
+"        dates file.\n"
+"  -sshdates DATES-FILE    Dates file for -sshcsv (default\n"
+"        DIR/../dates.dat).\n"
+"  -sshcube CUBE-FILE    Read the SSH grids from a file of consecutive\n"
+"        float32 grids in native byte order, one per date index.\n"
+"  -sshgrid WxH    Dimensions of the SSH grids (default 1440x721).\n"
+"  -j N    Number of threads for sampling SSH (default: one per\n"
+"        processor).\n"
+"  -a PREV-TRACKS-FILE    Append to tracks data previously written by this\n"
+"        program.  The input only needs the new tracks, and the eddies of\n"
+"        tracks that continue past the last date index of PREV-TRACKS-FILE.\n"
+"        Such a track must include its eddy on that last date index, which\n"
+"        is matched to an eddy that ends a track in PREV-TRACKS-FILE by its\n"
+"        type and coordinates.  Eddies on earlier date indexes are ignored.\n"
+"        Only the new date indexes are converted, and the existing data is\n"
+"        copied.  The output may be PREV-TRACKS-FILE itself, which is only\n"
+"        replaced once the output is complete.  Cannot be combined with -u\n"
+"        or any of the other output files.\n"
 "  -u    Write the contents of the given text file into the header of\n"
 "        the output data.  The text file must be encoded as UTF-16 little\n"
 "        endian with BOM.\n"
@@ -139,7 +264,24 @@ int main(int argc, char *argv[]) {
   bool build_kd = true;
   FILE *fdiag = NULL;
   FILE *fout = stdout;
+  const char *out_name = NULL;
+  char *out_part_name = NULL;
   FILE *fuser = NULL;
+  FILE *frtree = NULL;
+  FILE *fstkd = NULL;
+  FILE *flod = NULL;
+  FILE *fstats = NULL;
+  const char *dens_dir = NULL;
+  float dens_res = 1;
+  unsigned dens_window = 0;
+  FILE *fov = NULL;
+  const char *append_name = NULL;
+  FILE *fssh = NULL;
+  const char *ssh_csv_dir = NULL, *ssh_dates_name = NULL;
+  const char *ssh_cube_name = NULL;
+  unsigned ssh_width = 1440, ssh_height = 721;
+  long num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+  unsigned ov_date_step = 4, ov_min_len = 16;
   wchar_t_array user_info;
 
   if (argc < 2) {
@@ -170,14 +312,65 @@ int main(int argc, char *argv[]) {
       FOPEN_ARGV_OR_ERROR(fdiag, "wt");
     else if (!strcmp(*argv, "-x"))
       max_utf_range = true;
-    else if (!strcmp(*argv, "-o"))
-      FOPEN_ARGV_OR_ERROR(fout, "wb");
+    else if (!strcmp(*argv, "-o") && argv[1] != NULL)
+      out_name = *++argv;
     else if (!strcmp(*argv, "-nk"))
       build_kd = false;
     else if (!strcmp(*argv, "-np"))
       pad_newlines = false;
     else if (!strcmp(*argv, "-u"))
       FOPEN_ARGV_OR_ERROR(fuser, "rb");
+    else if (!strcmp(*argv, "-rt"))
+      FOPEN_ARGV_OR_ERROR(frtree, "wb");
+    else if (!strcmp(*argv, "-st"))
+      FOPEN_ARGV_OR_ERROR(fstkd, "wb");
+    else if (!strcmp(*argv, "-lod"))
+      FOPEN_ARGV_OR_ERROR(flod, "wb");
+    else if (!strcmp(*argv, "-ts"))
+      FOPEN_ARGV_OR_ERROR(fstats, "wb");
+    else if (!strcmp(*argv, "-dg") && argv[1] != NULL)
+      dens_dir = *++argv;
+    else if (!strcmp(*argv, "-dgr") && argv[1] != NULL) {
+      dens_res = strtod(*++argv, NULL);
+      if (!(dens_res > 0 && dens_res <= 90)) {
+	fputs("Error: Invalid density grid resolution.\n", stderr);
+	return 1;
+      }
+    } else if (!strcmp(*argv, "-dgw") && argv[1] != NULL)
+      dens_window = strtoul(*++argv, NULL, 0);
+    else if (!strcmp(*argv, "-ov"))
+      FOPEN_ARGV_OR_ERROR(fov, "wb");
+    else if (!strcmp(*argv, "-ovd") && argv[1] != NULL) {
+      ov_date_step = strtoul(*++argv, NULL, 0);
+      if (ov_date_step == 0) {
+	fputs("Error: Invalid overview date step.\n", stderr);
+	return 1;
+      }
+    } else if (!strcmp(*argv, "-ovl") && argv[1] != NULL)
+      ov_min_len = strtoul(*++argv, NULL, 0);
+    else if (!strcmp(*argv, "-a") && argv[1] != NULL)
+      append_name = *++argv;
+    else if (!strcmp(*argv, "-ssh"))
+      FOPEN_ARGV_OR_ERROR(fssh, "wb");
+    else if (!strcmp(*argv, "-sshcsv") && argv[1] != NULL)
+      ssh_csv_dir = *++argv;
+    else if (!strcmp(*argv, "-sshdates") && argv[1] != NULL)
+      ssh_dates_name = *++argv;
+    else if (!strcmp(*argv, "-sshcube") && argv[1] != NULL)
+      ssh_cube_name = *++argv;
+    else if (!strcmp(*argv, "-sshgrid") && argv[1] != NULL) {
+      if (sscanf(*++argv, "%ux%u", &ssh_width, &ssh_height) != 2 ||
+	  ssh_width == 0 || ssh_height < 2) {
+	fputs("Error: Invalid SSH grid dimensions.\n", stderr);
+	return 1;
+      }
+    } else if (!strcmp(*argv, "-j") && argv[1] != NULL) {
+      num_threads = strtol(*++argv, NULL, 0);
+      if (num_threads <= 0) {
+	fputs("Error: Invalid number of threads.\n", stderr);
+	return 1;
+      }
+    }
     else
       break;
     argv++;
@@ -188,6 +381,50 @@ int main(int argc, char *argv[]) {
     return 1;
   }
 
+  if (fssh != NULL && (ssh_csv_dir == NULL) == (ssh_cube_name == NULL)) {
+    fputs("Error: -ssh requires exactly one of -sshcsv or -sshcube.\n",
+	  stderr);
+    return 1;
+  }
+  if (num_threads <= 0)
+    num_threads = 1;
+
+  if (append_name != NULL) {
+    if (fuser != NULL || frtree != NULL || fstkd != NULL || flod != NULL ||
+	dens_dir != NULL || fov != NULL || fssh != NULL || fstats != NULL) {
+      fputs("Error: -a cannot be combined with -u, -rt, -st, -lod, -ts, "
+	    "-dg, -ssh, or -ov.\n", stderr);
+      return 1;
+    }
+    if (!pad_newlines) {
+      fputs("Error: -a cannot be combined with -np.\n", stderr);
+      return 1;
+    }
+    if (open_append(append_name) != 0)
+      return 1;
+  }
+
+  if (out_name != NULL) {
+    /* When appending, the output may be the file being appended to,
+       so it is written under a temporary name and only renamed over
+       the output once it is complete.  */
+    const char *open_name = out_name;
+    if (appending) {
+      out_part_name = (char*)xmalloc(strlen(out_name) + 6);
+      sprintf(out_part_name, "%s.part", out_name);
+      open_name = out_part_name;
+    }
+    fout = fopen(open_name, "wb");
+    if (fout == NULL) {
+      fprintf(stderr, "Error: Could not open %s: %s\n",
+	      open_name, strerror(errno));
+      if (appending)
+	close_append();
+      xfree(out_part_name);
+      return 1;
+    }
+  }
+
   if (fuser != NULL) {
     /* Read and sanity check the user header info.  */
     const wchar_t *header_endsig = L"\n# BEGIN_DATA\n";
@@ -276,17 +513,19 @@ int main(int argc, char *argv[]) {
       { retval = 1; goto cleanup; }
   }
 
-  { /* Now that array construction is finished, the `next' and `prev'
-       pointers can be rebased to the actual base address.  */
+  rebase_links();
+
+  if (appending) {
+    /* Number the new date indexes from one, as though they were all
+       of the data, until they are written.  */
     unsigned i;
-    for (i = 0; i < sorted_eddies.len; i++) {
-      unsigned next_idx = sorted_eddies.d[i].next - (SortedEddy*)0;
-      unsigned prev_idx = sorted_eddies.d[i].prev - (SortedEddy*)0;
-      if (next_idx == i) sorted_eddies.d[i].next = NULL;
-      else sorted_eddies.d[i].next = sorted_eddies.d + next_idx;
-      if (prev_idx == i) sorted_eddies.d[i].prev = NULL;
-      else sorted_eddies.d[i].prev = sorted_eddies.d + prev_idx;
+    if (sorted_eddies.len == 0) {
+      fprintf(stderr, "Error: No eddies after the last date index of %s.\n",
+	      append_name);
+      retval = 1; goto cleanup;
     }
+    for (i = 0; i < sorted_eddies.len; i++)
+      sorted_eddies.d[i].date_index -= append_wf.num_dates;
   }
 
   if (diag_proc) {
@@ -306,263 +545,568 @@ int main(int argc, char *argv[]) {
   if (diag_proc)
     fprintf(stderr, "Building date index list...\n");
 
-  { /* The eddies are now grouped into series of contiguous chunks
-       where each date index in the chunk is identical.  Find the
-       indexes that correspond to the start of each such chunk.  */
-    unsigned i;
-    /* NOTE: Since the first date index should be one, setting
-       `last_date_index' to zero will guarantee that the first
-       iteration adds a chunk start index.  */
-    unsigned last_date_index = 0;
-    unsigned last_chunk_start = 0;
-    if (sorted_eddies.d[0].date_index == 0) {
-      fputs("Error: Date indexes must not equal zero.\n", stderr);
-      EA_APPEND(date_chunk_starts, 0);
-      retval = 1; /* goto cleanup; */
-    }
-    for (i = 0; i < sorted_eddies.len; i++) {
-      unsigned date_index_diff =
-	sorted_eddies.d[i].date_index - last_date_index;
-      if (date_index_diff == 1) {
-	unsigned num_eddies = i - last_chunk_start;
-	EA_APPEND(date_chunk_starts, i);
-	if (num_eddies > max_frame_eddies)
-	  max_frame_eddies = num_eddies;
-	last_date_index = sorted_eddies.d[i].date_index;
-	last_chunk_start = i;
-      } else if (date_index_diff != 0) {
-	fputs("Error: Every date index must be occupied by eddies.\n", stderr);
-	fprintf(stderr, "The eddies skip from date index %u to %u.\n",
-		last_date_index, sorted_eddies.d[i].date_index);
-	retval = 1; /* goto cleanup; */
-      }
-    }
-    /* For convenience, append one last entry equal to the total
-       number of eddies.  */
-    EA_APPEND(date_chunk_starts, i);
-  }
+  if (build_date_chunks() != 0)
+    retval = 1; /* goto cleanup; */
 
   if (diag_proc)
     fprintf(stderr, "Done: %u date indexes.\n", date_chunk_starts.len - 1);
 
   if (build_kd) {
-    /* Build kd-trees for each date index.  */
-    unsigned i;
-
     if (diag_proc)
       fprintf(stderr, "Building kd-trees...\n");
+    if (build_kd_trees() != 0)
+      { retval = 1; goto cleanup; }
+  }
 
-#define CLEANUP_KD_RELDIM() \
-    for (i = 0; i < KD_DIMS + 1; i++) xfree(kd_reldim[i])
-
-    for (i = 0; i < KD_DIMS + 1; i++)
-      kd_reldim[i] = (SortedEddy*)xmalloc(sizeof(SortedEddy) *
-					  max_frame_eddies);
-
-    for (i = 0; i < date_chunk_starts.len - 1; i++) {
-      SortedEddy *start = sorted_eddies.d + date_chunk_starts.d[i];
-      unsigned length = date_chunk_starts.d[i+1] - date_chunk_starts.d[i];
-
-      /* Sort the eddies by latitude and longitude.  */
-      memcpy(kd_reldim[0], start, sizeof(SortedEddy) * length);
-      qsort(kd_reldim[0], length, sizeof(SortedEddy), qs_lat_cmp);
-      memcpy(kd_reldim[1], start, sizeof(SortedEddy) * length);
-      qsort(kd_reldim[1], length, sizeof(SortedEddy), qs_lon_cmp);
-
-      /* Build the actual kd-tree for this date range.  */
-      if (kd_tree_build(0, length) != 0)
-	{ CLEANUP_KD_RELDIM(); retval = 1; goto cleanup; }
-
-      { /* Copy the finished kd-tree back to the official location
-	   within `sorted_eddies', rebasing the pointers as
-	   necessary.  */
-	unsigned j;
-	for (j = 0; j < length; j++)
-	  kd_eddy_move(start + j, &kd_reldim[0][j]);
-      }
+  if (frtree != NULL) {
+    /* Track head indexes are only final once the kd-trees are built,
+       so the R-tree must be built after them.  */
+    if (diag_proc)
+      fprintf(stderr, "Building track R-tree...\n");
+    if (write_track_rtree(frtree) != 0)
+      retval = 1; /* goto cleanup; */
+  }
+
+  if (fstats != NULL) {
+    /* Track IDs follow the track heads, as in the R-tree.  */
+    if (diag_proc)
+      fprintf(stderr, "Computing track statistics...\n");
+    if (write_track_stats(fstats) != 0)
+      retval = 1; /* goto cleanup; */
+  }
+
+  if (fstkd != NULL) {
+    if (diag_proc)
+      fprintf(stderr, "Building spatio-temporal kd-tree...\n");
+    if (write_stkd_index(fstkd) != 0)
+      retval = 1; /* goto cleanup; */
+  }
+
+  if (dens_dir != NULL) {
+    if (diag_proc)
+      fprintf(stderr, "Writing density grids...\n");
+    if (write_density_grids(dens_dir, dens_res, dens_window) != 0)
+      retval = 1; /* goto cleanup; */
+  }
+
+  if (flod != NULL) {
+    if (diag_proc)
+      fprintf(stderr, "Simplifying tracks...\n");
+    if (write_track_lod(flod, diag_proc) != 0)
+      retval = 1; /* goto cleanup; */
+  }
+
+  if (fssh != NULL) {
+    SSHSource src;
+    if (diag_proc)
+      fprintf(stderr, "Sampling SSH under every eddy...\n");
+    src.width = ssh_width; src.height = ssh_height;
+    if (open_ssh_source(&src, ssh_csv_dir, ssh_dates_name, ssh_cube_name,
+			date_chunk_starts.len - 1) != 0)
+      retval = 1; /* goto cleanup; */
+    else {
+      if (write_ssh_column(fssh, &src, num_threads, diag_proc) != 0)
+	retval = 1; /* goto cleanup; */
+      close_ssh_source(&src);
     }
-    CLEANUP_KD_RELDIM();
   }
 
   if (diag_proc)
     fprintf(stderr, "Writing output...\n");
 
-  { /* Output the new JSON data as UTF-16 characters.  Each character
-       will be treated as an unsigned integer on input.  (Additional
-       decoding is applied for fixed-point numbers and bit-packed
-       fields.)  Newlines are written out at regular intervals for
-       safety.  Null characters must never be stored in the output
-       stream.  */
-    unsigned i = 0;
+  if (appending) {
+    if (write_appended_tracks(fout, fdiag) != 0)
+      retval = 1; /* goto cleanup; */
+  } else if (write_tracks(fout, fdiag, &user_info, NULL) != 0)
+    retval = 1; /* goto cleanup; */
+
+  /* NOTE: Building the overview replaces the full data in
+     `sorted_eddies', so this must be the last step.  */
+  if (fov != NULL) {
+    if (diag_proc)
+      fprintf(stderr, "Writing overview...\n");
+    if (write_overview(fov, &user_info, ov_date_step, ov_min_len,
+		       build_kd) != 0)
+      retval = 1; /* goto cleanup; */
+  }
+
+  /* retval = 0; */
+ cleanup:
+  EA_DESTROY(user_info);
+  EA_DESTROY(sorted_eddies);
+  EA_DESTROY(date_chunk_starts);
+  if (appending)
+    close_append();
+  if (fdiag != NULL && fclose(fdiag) == EOF) {
+    fprintf(stderr, "Error closing diagnostics file: %s\n", strerror(errno));
+    retval = 1;
+  }
+  if (frtree != NULL && fclose(frtree) == EOF) {
+    fprintf(stderr, "Error closing R-tree file: %s\n", strerror(errno));
+    retval = 1;
+  }
+  if (fstkd != NULL && fclose(fstkd) == EOF) {
+    fprintf(stderr, "Error closing kd-tree file: %s\n", strerror(errno));
+    retval = 1;
+  }
+  if (flod != NULL && fclose(flod) == EOF) {
+    fprintf(stderr, "Error closing level of detail file: %s\n",
+	    strerror(errno));
+    retval = 1;
+  }
+  if (fstats != NULL && fclose(fstats) == EOF) {
+    fprintf(stderr, "Error closing track statistics file: %s\n",
+	    strerror(errno));
+    retval = 1;
+  }
+  if (fssh != NULL && fclose(fssh) == EOF) {
+    fprintf(stderr, "Error closing SSH file: %s\n", strerror(errno));
+    retval = 1;
+  }
+  if (fov != NULL && fclose(fov) == EOF) {
+    fprintf(stderr, "Error closing overview file: %s\n", strerror(errno));
+    retval = 1;
+  }
+  if (fclose(fout) == EOF) {
+    fprintf(stderr, "Error closing output file: %s\n", strerror(errno));
+    retval = 1;
+  }
+  if (out_part_name != NULL) {
+    if (retval == 0 && rename(out_part_name, out_name) != 0) {
+      fprintf(stderr, "Error: Could not rename %s: %s\n",
+	      out_part_name, strerror(errno));
+      retval = 1;
+    }
+    if (retval != 0)
+      remove(out_part_name);
+    xfree(out_part_name);
+  }
+  return retval;
+}
+
+/* Now that array construction is finished, the `next' and `prev'
+   pointers can be rebased to the actual base address.  */
+void rebase_links(void) {
+  unsigned i;
+  for (i = 0; i < sorted_eddies.len; i++) {
+    unsigned next_idx = sorted_eddies.d[i].next - (SortedEddy*)0;
+    unsigned prev_idx = sorted_eddies.d[i].prev - (SortedEddy*)0;
+    if (next_idx == i) sorted_eddies.d[i].next = NULL;
+    else sorted_eddies.d[i].next = sorted_eddies.d + next_idx;
+    if (prev_idx == i) sorted_eddies.d[i].prev = NULL;
+    else sorted_eddies.d[i].prev = sorted_eddies.d + prev_idx;
+  }
+}
+
+/* The eddies are now grouped into series of contiguous chunks where
+   each date index in the chunk is identical.  Find the indexes that
+   correspond to the start of each such chunk.  Returns zero on
+   success, one on failure.  */
+int build_date_chunks(void) {
+  int retval = 0;
+  unsigned i;
+  /* NOTE: Since the first date index should be one, setting
+     `last_date_index' to zero will guarantee that the first
+     iteration adds a chunk start index.  */
+  unsigned last_date_index = 0;
+  unsigned last_chunk_start = 0;
+  if (sorted_eddies.d[0].date_index == 0) {
+    fputs("Error: Date indexes must not equal zero.\n", stderr);
+    EA_APPEND(date_chunk_starts, 0);
+    retval = 1;
+  }
+  for (i = 0; i < sorted_eddies.len; i++) {
+    unsigned date_index_diff =
+      sorted_eddies.d[i].date_index - last_date_index;
+    if (date_index_diff == 1) {
+      unsigned num_eddies = i - last_chunk_start;
+      EA_APPEND(date_chunk_starts, i);
+      if (num_eddies > max_frame_eddies)
+	max_frame_eddies = num_eddies;
+      last_date_index = sorted_eddies.d[i].date_index;
+      last_chunk_start = i;
+    } else if (date_index_diff != 0) {
+      fputs("Error: Every date index must be occupied by eddies.\n", stderr);
+      fprintf(stderr, "The eddies skip from date index %u to %u.\n",
+	      last_date_index, sorted_eddies.d[i].date_index);
+      retval = 1;
+    }
+  }
+  /* The last chunk has no date after it to count it above.  */
+  if (i - last_chunk_start > max_frame_eddies)
+    max_frame_eddies = i - last_chunk_start;
+  /* For convenience, append one last entry equal to the total
+     number of eddies.  */
+  EA_APPEND(date_chunk_starts, i);
+  return retval;
+}
+
+/* Build kd-trees for each date index.  Returns zero on success, one
+   on failure.  */
+int build_kd_trees(void) {
+  unsigned i;
+
+#define CLEANUP_KD_RELDIM() \
+  for (i = 0; i < KD_DIMS + 1; i++) xfree(kd_reldim[i])
+
+  for (i = 0; i < KD_DIMS + 1; i++)
+    kd_reldim[i] = (SortedEddy*)xmalloc(sizeof(SortedEddy) *
+					max_frame_eddies);
+
+  for (i = 0; i < date_chunk_starts.len - 1; i++) {
+    SortedEddy *start = sorted_eddies.d + date_chunk_starts.d[i];
+    unsigned length = date_chunk_starts.d[i+1] - date_chunk_starts.d[i];
+
+    /* Sort the eddies by latitude and longitude.  */
+    memcpy(kd_reldim[0], start, sizeof(SortedEddy) * length);
+    qsort(kd_reldim[0], length, sizeof(SortedEddy), qs_lat_cmp);
+    memcpy(kd_reldim[1], start, sizeof(SortedEddy) * length);
+    qsort(kd_reldim[1], length, sizeof(SortedEddy), qs_lon_cmp);
+
+    /* Build the actual kd-tree for this date range.  */
+    if (kd_tree_build(0, length) != 0)
+      { CLEANUP_KD_RELDIM(); return 1; }
+
+    { /* Copy the finished kd-tree back to the official location
+	 within `sorted_eddies', rebasing the pointers as
+	 necessary.  */
+      unsigned j;
+      for (j = 0; j < length; j++)
+	kd_eddy_move(start + j, &kd_reldim[0][j]);
+    }
+  }
+  CLEANUP_KD_RELDIM();
+  return 0;
+}
+
+/* Output the new JSON data as UTF-16 characters.  Each character will
+   be treated as an unsigned integer on input.  (Additional decoding
+   is applied for fixed-point numbers and bit-packed fields.)
+   Newlines are written out at regular intervals for safety.  Null
+   characters must never be stored in the output stream.
+
+   `extra_header', if not NULL, is ASCII text that is written into the
+   header of the output data after the user header information.
+   Returns zero on success, one on failure.  */
+int write_tracks(FILE *fout, FILE *fdiag, const wchar_t_array *user_info,
+		 const char *extra_header) {
+  int retval = 0;
+  unsigned i = 0;
 
-    /* Little endian will be used for this encoding.  */
+  /* Little endian will be used for this encoding.  */
 #define PUT_SHORT(value) \
-    putc((value) & 0xff, fout); \
-    putc(((value) >> 8) & 0xff, fout)
+  putc((value) & 0xff, fout); \
+  putc(((value) >> 8) & 0xff, fout)
 #define ERROR_OR_PUT_SHORT(value, errmsg) \
-    if (!put_short_in_range(fout, (unsigned)value)) { \
-      fprintf(stderr, errmsg, i, value); \
-      retval = 1; /* goto cleanup; */ \
-    }
+  if (!put_short_in_range(fout, (unsigned)value)) { \
+    fprintf(stderr, errmsg, i, value); \
+    retval = 1; /* goto cleanup; */ \
+  }
 
-    PUT_SHORT(0xfeff); /* BOM (Byte Order Mask) */
+  PUT_SHORT(0xfeff); /* BOM (Byte Order Mask) */
 
-    { /* Start by writing a human-friendly information message that also
-	 serves as a file type.  */
-      const char *header_start =
+  { /* Start by writing a human-friendly information message that also
+       serves as a file type.  */
+    const char *header_start =
 "# Binary eddy tracks data for the Ocean Eddies Web Viewer.\n"
 "# For more information on this file format, see the following webpage:\n"
 "# <http://example.com/dev_url>\n";
-      const char *header_end = "#\n# BEGIN_DATA\n";
-
-      const char *cur_pos = header_start;
+    const char *header_end = "#\n# BEGIN_DATA\n";
+
+    const char *cur_pos = header_start;
+    while (*cur_pos != '\0')
+      { PUT_SHORT(*cur_pos); cur_pos++; }
+
+    if (user_info->len > 0) {
+      /* Write out additional user header information into this
+	 area.  */
+      unsigned j;
+      const char *spacer = "#\n";
+      cur_pos = spacer;
       while (*cur_pos != '\0')
 	{ PUT_SHORT(*cur_pos); cur_pos++; }
+      for (j = 0; j < user_info->len - 1; j++)
+	{ PUT_SHORT(user_info->d[j]); }
+    }
 
-      if (user_info.len > 0) {
-	/* Write out additional user header information into this
-	   area.  */
-	unsigned j;
-	const char *spacer = "#\n";
-	cur_pos = spacer;
-	while (*cur_pos != '\0')
-	  { PUT_SHORT(*cur_pos); cur_pos++; }
-	for (j = 0; j < user_info.len - 1; j++)
-	  { PUT_SHORT(user_info.d[j]); }
-	EA_DESTROY(user_info);
-      }
-
-      cur_pos = header_end;
+    if (extra_header != NULL) {
+      cur_pos = "#\n";
+      while (*cur_pos != '\0')
+	{ PUT_SHORT(*cur_pos); cur_pos++; }
+      cur_pos = extra_header;
       while (*cur_pos != '\0')
 	{ PUT_SHORT(*cur_pos); cur_pos++; }
     }
 
-    { /* Write the format header.  */
-      unsigned short format_bits = 0x01;
-      if (max_utf_range)
-	format_bits |= 0x02;
-      if (tracks_keyed)
-	format_bits |= 0x04;
-      if (pad_newlines)
-	format_bits |= 0x08;
-      PUT_SHORT(format_bits);
-    }
-
-    /* Convert the date chunk start indexes structure to an eddies per
-       date index structure, and output that structure.  */
-    ERROR_OR_PUT_SHORT(date_chunk_starts.len - 1,
-		       "Error: i = %u: Too many date indexes: %u\n");
-    if (pad_newlines) { PUT_SHORT('\n'); }
-    for (i = 1; i < date_chunk_starts.len; i++) {
-      unsigned num_eddies = date_chunk_starts.d[i] - date_chunk_starts.d[i-1];
-      ERROR_OR_PUT_SHORT(num_eddies,
-		 "Error: i = %u: Too many eddies on a date index: %u.\n");
-      if (pad_newlines && i % 32 == 0)
-	{ PUT_SHORT('\n'); }
-    }
+    cur_pos = header_end;
+    while (*cur_pos != '\0')
+      { PUT_SHORT(*cur_pos); cur_pos++; }
+  }
 
-    /* Output the optimized eddy entries.  `next' and `prev' pointers
-       are converted to indexes relative to the current index.  */
-    for (i = 0; i < sorted_eddies.len; i++) {
-      SortedEddy *seddy = &sorted_eddies.d[i];
-      unsigned int_lat = seddy->coords[0];
-      unsigned int_lon = seddy->coords[1];
-      unsigned rel_next = (seddy->next == NULL) ? 0 :
-	((seddy->next - sorted_eddies.d) - i);
-      unsigned rel_prev = (seddy->prev == NULL) ? 0 :
-	(i - (seddy->prev - sorted_eddies.d));
-
-      if (seddy->eddy_index == 0) {
-	fprintf(stderr,
-		"Error: i = %u: Eddy indexes must never equal zero.\n", i);
-	retval = 1; /* goto cleanup; */
-      }
+  { /* Write the format header.  */
+    unsigned short format_bits = 0x01;
+    if (max_utf_range)
+      format_bits |= 0x02;
+    if (tracks_keyed)
+      format_bits |= 0x04;
+    if (pad_newlines)
+      format_bits |= 0x08;
+    PUT_SHORT(format_bits);
+  }
 
-      /* Since latitudes only range from -90 to 90, the encoding
-	 method (located in the `add_eddy()' function) for latitude
-	 only needs 14 bits.  This leaves room for storing one extra
-	 bit of information in the same character.  */
-      /* The type information, which is only a zero or a one, can be
-	 stored in the latitude field.  */
-      int_lat |= seddy->type << 14;
+  /* Convert the date chunk start indexes structure to an eddies per
+     date index structure, and output that structure.  */
+  ERROR_OR_PUT_SHORT(date_chunk_starts.len - 1,
+		     "Error: i = %u: Too many date indexes: %u\n");
+  if (pad_newlines) { PUT_SHORT('\n'); }
+  for (i = 1; i < date_chunk_starts.len; i++) {
+    unsigned num_eddies = date_chunk_starts.d[i] - date_chunk_starts.d[i-1];
+    ERROR_OR_PUT_SHORT(num_eddies,
+	       "Error: i = %u: Too many eddies on a date index: %u.\n");
+    if (pad_newlines && i % 32 == 0)
+      { PUT_SHORT('\n'); }
+  }
 
-      if (pad_newlines && i % 32 == 0)
-	{ PUT_SHORT('\n'); }
-
-      PUT_SHORT(int_lat);
-      PUT_SHORT(int_lon);
-      /* Eddy ID is only of relevance to the MATLAB viewer.  No future
-	 data or encoding mechanism in the web viewer will ever have a
-	 justified need for an Eddy ID: kd-trees and image storage
-	 formats render it redundant.
-
-      ERROR_OR_PUT_SHORT(seddy->eddy_index,
-			 "Error: i = %u: Eddy index too large: %u\n"); */
-      /* NOTE: Some errors may cause the next or previous eddy offsets
-	 to be negative, so we use %d instead of %u for diagnostic
-	 convenience.  */
-      ERROR_OR_PUT_SHORT(rel_next,
-			 "Error: i = %u: Next eddy offset too large: %d\n");
-      ERROR_OR_PUT_SHORT(rel_prev,
-		 "Error: i = %u: Previous eddy offset too large: %d\n");
-
-      if (fdiag != NULL) {
-	float latitude = (float)((int)(seddy->coords[0] -
-				       (1 << 13))) / (1 << 6);
-	float longitude = (float)((int)(seddy->coords[1] -
-					(1 << 14))) / (1 << 6);
-	unsigned next_idx = (seddy->next == NULL) ? i :
-	  (seddy->next - sorted_eddies.d);
-	unsigned prev_idx = (seddy->prev == NULL) ? i :
-	  (seddy->prev - sorted_eddies.d);
-	fprintf(fdiag,
-		"i = %-5u            Type: %-5u\n"
-		"Latitude: %-7.2f    Longitude: %-7.2f\n"
-		"Date index: %-5u    Eddy index: %-5u\n"
-		"Next index: %-5u    Previous index: %-5u\n\n",
-		i, seddy->type,
-		latitude, longitude,
-		seddy->date_index, seddy->eddy_index,
-		next_idx, prev_idx);
-      }
-    }
+  /* Output the optimized eddy entries.  */
+  for (i = 0; i < sorted_eddies.len; i++) {
+    if (write_eddy(fout, fdiag, i, 0) != 0)
+      retval = 1; /* goto cleanup; */
+  }
+
+  /* Put a newline at the end of the data for good measure.  */
+  if (pad_newlines) { PUT_SHORT('\n'); }
+  return retval;
+}
 
-    /* Put a newline at the end of the data for good measure.  */
-    if (pad_newlines) { PUT_SHORT('\n'); }
+/* Write the record of the eddy `sorted_eddies.d[index]', which is the
+   eddy `base + index' of the output.  `next' and `prev' pointers are
+   converted to indexes relative to the eddy's index.  Returns zero on
+   success, one on failure.  */
+int write_eddy(FILE *fout, FILE *fdiag, unsigned index, unsigned base) {
+  int retval = 0;
+  unsigned i = base + index;
+  SortedEddy *seddy = &sorted_eddies.d[index];
+  unsigned int_lat = seddy->coords[0];
+  unsigned int_lon = seddy->coords[1];
+  unsigned rel_next = (seddy->next == NULL) ? 0 :
+    ((seddy->next - sorted_eddies.d) - index);
+  unsigned rel_prev = (seddy->prev == NULL) ? 0 :
+    (index - (seddy->prev - sorted_eddies.d));
+  if (seddy->prev == NULL && seddy->append_prev != 0)
+    rel_prev = i - (seddy->append_prev - 1);
+
+  if (seddy->eddy_index == 0) {
+    fprintf(stderr,
+	    "Error: i = %u: Eddy indexes must never equal zero.\n", i);
+    retval = 1; /* goto cleanup; */
   }
 
-  /* retval = 0; */
- cleanup:
-  EA_DESTROY(sorted_eddies);
-  EA_DESTROY(date_chunk_starts);
-  if (fdiag != NULL && fclose(fdiag) == EOF) {
-    fprintf(stderr, "Error closing diagnostics file: %s\n", strerror(errno));
-    retval = 1;
+  /* Since latitudes only range from -90 to 90, the encoding
+     method (located in the `add_eddy()' function) for latitude
+     only needs 14 bits.  This leaves room for storing one extra
+     bit of information in the same character.  */
+  /* The type information, which is only a zero or a one, can be
+     stored in the latitude field.  */
+  int_lat |= seddy->type << 14;
+
+  if (pad_newlines && i % 32 == 0)
+    { PUT_SHORT('\n'); }
+
+  PUT_SHORT(int_lat);
+  PUT_SHORT(int_lon);
+  /* Eddy ID is only of relevance to the MATLAB viewer.  No future
+     data or encoding mechanism in the web viewer will ever have a
+     justified need for an Eddy ID: kd-trees and image storage
+     formats render it redundant.
+
+  ERROR_OR_PUT_SHORT(seddy->eddy_index,
+		     "Error: i = %u: Eddy index too large: %u\n"); */
+  /* NOTE: Some errors may cause the next or previous eddy offsets
+     to be negative, so we use %d instead of %u for diagnostic
+     convenience.  */
+  ERROR_OR_PUT_SHORT(rel_next,
+		     "Error: i = %u: Next eddy offset too large: %d\n");
+  ERROR_OR_PUT_SHORT(rel_prev,
+	     "Error: i = %u: Previous eddy offset too large: %d\n");
+
+  if (fdiag != NULL) {
+    float latitude = (float)((int)(seddy->coords[0] -
+				   (1 << 13))) / (1 << 6);
+    float longitude = (float)((int)(seddy->coords[1] -
+				    (1 << 14))) / (1 << 6);
+    unsigned next_idx = i + rel_next;
+    unsigned prev_idx = i - rel_prev;
+    fprintf(fdiag,
+	    "i = %-5u            Type: %-5u\n"
+	    "Latitude: %-7.2f    Longitude: %-7.2f\n"
+	    "Date index: %-5u    Eddy index: %-5u\n"
+	    "Next index: %-5u    Previous index: %-5u\n\n",
+	    i, seddy->type,
+	    latitude, longitude,
+	    seddy->date_index, seddy->eddy_index,
+	    next_idx, prev_idx);
   }
-  if (fclose(fout) == EOF) {
-    fprintf(stderr, "Error closing output file: %s\n", strerror(errno));
-    retval = 1;
+  return retval;
+}
+
+/* Write the existing tracks data of `append_wf' followed by the new
+   date indexes.  The header, the date counts, and the eddy records of
+   the existing data are copied as they are, except for the `next'
+   offsets of the eddies on its last date index that new tracks
+   continue from.  Only the records of that date are patched, so
+   little more than the new data is processed.  Returns zero on
+   success, one on failure.  */
+int write_appended_tracks(FILE *fout, FILE *fdiag) {
+  int retval = 0;
+  const WFile *wf = &append_wf;
+  unsigned old_dates = wf->num_dates;
+  unsigned old_eddies = wf->num_eddies;
+  /* Offset of the first date count, after the format bits, the
+     number of dates, and a newline */
+  size_t counts_off = wf->header_len + 3 * 2;
+  size_t tail_off = WFILE_RECORD_OFF(wf, append_tail_first);
+  size_t tail_len = WFILE_RECORD_OFF(wf, old_eddies - 1) + 4 * 2 - tail_off;
+  unsigned char *tail;
+  unsigned i = 0;
+
+  /* The header and the format bits are unchanged.  */
+  fwrite(wf->map, 1, wf->header_len + 2, fout);
+  ERROR_OR_PUT_SHORT(old_dates + date_chunk_starts.len - 1,
+		     "Error: i = %u: Too many date indexes: %u\n");
+  PUT_SHORT('\n');
+  fwrite(wf->map + counts_off, 1, (old_dates + old_dates / 32) * 2, fout);
+  for (i = 1; i < date_chunk_starts.len; i++) {
+    unsigned num_eddies = date_chunk_starts.d[i] - date_chunk_starts.d[i-1];
+    ERROR_OR_PUT_SHORT(num_eddies,
+	       "Error: i = %u: Too many eddies on a date index: %u.\n");
+    if ((old_dates + i) % 32 == 0)
+      { PUT_SHORT('\n'); }
+  }
+
+  /* Copy the existing eddy records, starting with the newline before
+     the first one, and link the tracks that continue into the new
+     data.  Offsets that are out of range are reported when the new
+     eddy's `prev' offset is written.  */
+  fwrite(wf->map + wf->data_off - 2, 1, tail_off - (wf->data_off - 2), fout);
+  tail = (unsigned char*)xmalloc(tail_len);
+  memcpy(tail, wf->map + tail_off, tail_len);
+  for (i = 0; i < sorted_eddies.len; i++) {
+    SortedEddy *seddy = &sorted_eddies.d[i];
+    if (seddy->prev == NULL && seddy->append_prev != 0) {
+      unsigned prev_idx = seddy->append_prev - 1;
+      unsigned rel_next = encode_short(old_eddies + i - prev_idx);
+      unsigned char *rec = tail + (WFILE_RECORD_OFF(wf, prev_idx) - tail_off);
+      if (rel_next != 0)
+	{ rec[4] = rel_next & 0xff; rec[5] = (rel_next >> 8) & 0xff; }
+    }
   }
+  fwrite(tail, 1, tail_len, fout);
+  xfree(tail);
+
+  for (i = 0; i < sorted_eddies.len; i++) {
+    if (write_eddy(fout, fdiag, i, old_eddies) != 0)
+      retval = 1; /* goto cleanup; */
+  }
+  PUT_SHORT('\n');
   return retval;
 }
 
-/* Write a UTF-16 character, but only if the value is within the valid
-   range for unsigned integer encoding.  Returns `true' on success,
-   `false' on failure.  */
-bool put_short_in_range(FILE *fout, unsigned value) {
+/* Encode an unsigned integer as a UTF-16 character.  Returns zero if
+   the value is not within the valid range for unsigned integer
+   encoding.  */
+unsigned encode_short(unsigned value) {
   unsigned max = 0xd7fe;
   if (max_utf_range)
     max = 0xf7fe;
   if (value > max)
-    return false;
+    return 0;
   if (value == 0)
     value = max + 1;
   if (value > 0xd7ff)
     value += 0x0800;
+  return value;
+}
+
+/* Write a UTF-16 character, but only if the value is within the valid
+   range for unsigned integer encoding.  Returns `true' on success,
+   `false' on failure.  */
+bool put_short_in_range(FILE *fout, unsigned value) {
+  value = encode_short(value);
+  if (value == 0)
+    return false;
   PUT_SHORT(value);
   return true;
 }
 
+/* Open the existing tracks data to append to, and decode the eddies
+   on its last date index.  The output format follows that of the
+   existing data.  Returns zero on success, one on failure.  */
+int open_append(const char *filename) {
+  WDateView view;
+  if (wfile_open(filename, &append_wf) != 0)
+    return 1;
+  if (!(append_wf.format_bits & WTXT_FMT_PAD_NLS)) {
+    fputs("Error: Appending to tracks data without newlines "
+	  "is not supported.\n", stderr);
+    wfile_close(&append_wf);
+    return 1;
+  }
+  if (wfile_date(&append_wf, append_wf.num_dates - 1, &view) != 0 ||
+      view.count == 0) {
+    fprintf(stderr, "Error: %s has no eddies to append to.\n", filename);
+    wfile_close(&append_wf);
+    return 1;
+  }
+  max_utf_range = (append_wf.format_bits & WTXT_FMT_EXT_RANGE) != 0;
+  append_tail_first = view.first;
+  append_tail_count = view.count;
+  append_tail_type = (unsigned char*)xmalloc(view.count);
+  append_tail_lat = (float*)xmalloc(sizeof(float) * view.count);
+  append_tail_lon = (float*)xmalloc(sizeof(float) * view.count);
+  append_tail_next = (unsigned*)xmalloc(sizeof(unsigned) * view.count);
+  append_tail_prev = (unsigned*)xmalloc(sizeof(unsigned) * view.count);
+  wfile_decode(&append_wf, view.first, view.count, append_tail_type,
+	       append_tail_lat, append_tail_lon,
+	       append_tail_next, append_tail_prev);
+  appending = true;
+  return 0;
+}
+
+void close_append(void) {
+  xfree(append_tail_type);
+  xfree(append_tail_lat);
+  xfree(append_tail_lon);
+  xfree(append_tail_next);
+  xfree(append_tail_prev);
+  wfile_close(&append_wf);
+  appending = false;
+}
+
+/* Find the eddy on the last date index of the existing data that ends
+   a track and has the same type and coordinates as `ieddy', after
+   they are converted as in `add_eddy()'.  Returns one plus its index,
+   or zero if there is no such eddy.  */
+unsigned find_append_prev(const InputEddy *ieddy, unsigned eddy_type) {
+  unsigned int_lat = ((unsigned)(ieddy->lat * (1 << 6)) +
+		      (1 << 13)) & 0x3fff;
+  unsigned int_lon = ((unsigned)(ieddy->lon * (1 << 6)) +
+		      (1 << 14)) & 0x7fff;
+  unsigned j;
+  for (j = 0; j < append_tail_count; j++) {
+    /* The decoded coordinates are exact multiples of 1/64.  */
+    if (append_tail_next[j] == WTXT_NONE &&
+	append_tail_type[j] == eddy_type &&
+	(unsigned)((int)(append_tail_lat[j] * (1 << 6)) + (1 << 13)) ==
+	  int_lat &&
+	(unsigned)((int)(append_tail_lon[j] * (1 << 6)) + (1 << 14)) ==
+	  int_lon) {
+      append_tail_next[j] = 0;
+      return append_tail_first + j + 1;
+    }
+  }
+  return 0;
+}
+
 /* Parse a JSON file from the given file pointer and append its
    contents to the input data structure.  Returns zero on success, one
    on failure.  */
@@ -571,6 +1115,7 @@ int parse_json(FILE *fp, unsigned eddy_type) {
   int nest_level = 0;
   bool start_of_track = false;
   unsigned track_len = 0, last_date_idx;
+  unsigned append_prev = 0;
   /* nest_level == 1: Top-level tracks array
      nest_level == 2: Eddies array within one track
      nest_level == 3: Parameters of one eddy */
@@ -624,6 +1169,7 @@ int parse_json(FILE *fp, unsigned eddy_type) {
 	tot_num_tracks++;
 	start_of_track = true;
 	track_len = 0;
+	append_prev = 0;
       } else if (nest_level == 3)
 	eddy_param_index = 0;
       break;
@@ -635,7 +1181,7 @@ int parse_json(FILE *fp, unsigned eddy_type) {
 		  tot_num_tracks - 1);
 	  return 1;
 	}
-	if (!start_of_track && cur_eddy.date_index - last_date_idx != 1) {
+	if (track_len > 0 && cur_eddy.date_index - last_date_idx != 1) {
 	  fprintf(stderr,
 	"Error: In track %u: All date indexes in a track must strictly be\n"
 	"increasing consecutive integers.  The viewer uses this assumption\n"
@@ -643,9 +1189,25 @@ int parse_json(FILE *fp, unsigned eddy_type) {
 		  tot_num_tracks - 1);
 	  return 1;
 	}
-	if (add_eddy(&cur_eddy, eddy_type, start_of_track) != 0)
-	  return 1;
-	start_of_track = false;
+	if (appending && cur_eddy.date_index <= append_wf.num_dates) {
+	  /* The eddy is already in the data being appended to.  Only
+	     the eddy on its last date index is needed, to link the new
+	     eddies of the track to.  */
+	  if (cur_eddy.date_index == append_wf.num_dates &&
+	      (append_prev = find_append_prev(&cur_eddy, eddy_type)) == 0) {
+	    fprintf(stderr,
+	"Error: In track %u: The eddy on date index %u does not end a track\n"
+	"in the data being appended to.\n",
+		    tot_num_tracks - 1, cur_eddy.date_index);
+	    return 1;
+	  }
+	} else {
+	  if (add_eddy(&cur_eddy, eddy_type, start_of_track) != 0)
+	    return 1;
+	  sorted_eddies.d[sorted_eddies.len-1].append_prev = append_prev;
+	  append_prev = 0;
+	  start_of_track = false;
+	}
 	track_len++;
 	last_date_idx = cur_eddy.date_index;
       } else if (nest_level == 2) {
@@ -695,6 +1257,7 @@ int add_eddy(InputEddy *ieddy, unsigned eddy_type, bool start_of_track) {
 
   seddy->date_index = ieddy->date_index;
   seddy->eddy_index = ieddy->eddy_index;
+  seddy->append_prev = 0;
   /* seddy->unsorted_index = sorted_eddies.len; */
   seddy->prev = (SortedEddy*)0 + sorted_eddies.len;
   if (!start_of_track)
@@ -920,3 +1483,757 @@ int kd_tree_build(unsigned begin_start, unsigned begin_length) {
 
   return 0;
 }
+
+/* Compute the bounding box and time span of every track, bulk-load
+   them into an R-tree, and write the R-tree to the given file.  Track
+   IDs are assigned in the order of the first eddy of each track
+   within `sorted_eddies', so they can be recomputed from the output
+   data alone.  Returns zero on success, one on failure.  */
+int write_track_rtree(FILE *fp) {
+  TrackBox *tracks = (TrackBox*)xmalloc(sizeof(TrackBox) * tot_num_tracks);
+  unsigned num_tracks = 0;
+  RTree tree;
+  unsigned i;
+  int retval;
+
+  for (i = 0; i < sorted_eddies.len; i++) {
+    SortedEddy *seddy = &sorted_eddies.d[i];
+    TrackBox *track;
+    int cur_lon;
+    if (seddy->prev != NULL)
+      continue; /* Not the start of a track.  */
+    if (num_tracks >= tot_num_tracks) {
+      fputs("Error: Found more tracks than were parsed.\n", stderr);
+      xfree(tracks); return 1;
+    }
+    track = &tracks[num_tracks];
+    track->track_id = num_tracks++;
+    track->head_index = i;
+    cur_lon = (int)seddy->coords[1] - (1 << 14);
+    rtree_track_begin(&track->b, (int)seddy->coords[0] - (1 << 13),
+		      cur_lon, seddy->date_index);
+    while ((seddy = seddy->next) != NULL)
+      rtree_track_add(&track->b, &cur_lon,
+		      (int)seddy->coords[0] - (1 << 13),
+		      (int)seddy->coords[1] - (1 << 14), seddy->date_index);
+    rtree_track_end(&track->b);
+  }
+
+  if (rtree_build(&tree, tracks, num_tracks, RT_NODE_CAP,
+		  date_chunk_starts.len - 1) != 0)
+    { rtree_destroy(&tree); return 1; }
+  retval = rtree_write(fp, &tree);
+  rtree_destroy(&tree);
+  return retval;
+}
+
+/* Compute the statistics of every track and write them as described
+   in "tstats.c".  Returns zero on success, one on failure.  */
+int write_track_stats(FILE *fp) {
+  TrackStats ts;
+  unsigned num_tracks = 0;
+  unsigned i;
+  int retval;
+
+  tstats_init(&ts, tot_num_tracks, date_chunk_starts.len - 1);
+  for (i = 0; i < sorted_eddies.len; i++) {
+    SortedEddy *seddy = &sorted_eddies.d[i];
+    TSAccum acc;
+    if (seddy->prev != NULL)
+      continue; /* Not the start of a track.  */
+    if (num_tracks >= tot_num_tracks) {
+      fputs("Error: Found more tracks than were parsed.\n", stderr);
+      tstats_destroy(&ts); return 1;
+    }
+    tstats_track_begin(&acc, seddy->type,
+		       (int)seddy->coords[0] - (1 << 13),
+		       (int)seddy->coords[1] - (1 << 14),
+		       seddy->date_index);
+    for (seddy = seddy->next; seddy != NULL; seddy = seddy->next)
+      tstats_track_add(&acc, (int)seddy->coords[0] - (1 << 13),
+		       (int)seddy->coords[1] - (1 << 14));
+    tstats_track_end(&acc, &ts, num_tracks++);
+  }
+  ts.num_tracks = num_tracks;
+
+  retval = tstats_write(fp, &ts);
+  tstats_destroy(&ts);
+  return retval;
+}
+
+/* Build a spatio-temporal kd-tree over all eddies and write it to the
+   given file.  Returns zero on success, one on failure.  */
+int write_stkd_index(FILE *fp) {
+  STPoint *points = (STPoint*)xmalloc(sizeof(STPoint) * sorted_eddies.len);
+  STKdTree tree;
+  unsigned i;
+  int retval;
+
+  for (i = 0; i < sorted_eddies.len; i++) {
+    points[i].c[0] = (int)sorted_eddies.d[i].coords[0] - (1 << 13);
+    points[i].c[1] = (int)sorted_eddies.d[i].coords[1] - (1 << 14);
+    points[i].c[2] = (int)sorted_eddies.d[i].date_index;
+    points[i].eddy_index = i;
+  }
+
+  if (stkd_build(&tree, points, sorted_eddies.len, STKD_LEAF_SIZE,
+		 date_chunk_starts.len - 1) != 0)
+    { stkd_destroy(&tree); return 1; }
+  retval = stkd_write(fp, &tree);
+  stkd_destroy(&tree);
+  return retval;
+}
+
+/* Douglas-Peucker significance of a track vertex: the distance from
+   the vertex to the segment between two other vertices, in
+   fixed-point units.  Longitudes must already be unwrapped.  */
+static double seg_dist(const int *lat, const int *lon,
+		       unsigned a, unsigned b, unsigned k) {
+  double dx = lon[b] - lon[a], dy = lat[b] - lat[a];
+  double px = lon[k] - lon[a], py = lat[k] - lat[a];
+  double len2 = dx * dx + dy * dy;
+  if (len2 > 0) {
+    double t = (px * dx + py * dy) / len2;
+    if (t < 0) t = 0;
+    if (t > 1) t = 1;
+    px -= t * dx; py -= t * dy;
+  }
+  return sqrt(px * px + py * py);
+}
+
+/* Compute the level of detail of every eddy and write it to the given
+   file.
+
+   Each track is simplified with the Douglas-Peucker algorithm on the
+   fixed-point coordinates.  The significance of a vertex is the
+   distance at which it would be selected, capped by the significance
+   of the vertex that split its parent segment, so that the
+   significance never increases with recursion depth.  A vertex with
+   significance `d' gets level `floor(log2(d))', clamped to [ 0, 14 ],
+   and the two end points of every track get level 15.  Therefore, a
+   client drawing at a resolution of R degrees per pixel can skip
+   every eddy whose level is less than `log2(R * 64)' and still stay
+   within one pixel of the full-detail track.
+
+   Output format: UTF-16 little endian with BOM, a human-readable
+   header ending with "# BEGIN_DATA\n", and a format header character
+   with the same newline padding bit as the tracks data file.  Then
+   the levels follow in the same eddy order as the tracks data file,
+   three 4-bit levels per character, the first eddy in the least
+   significant bits, with 0x1000 added to every character so that it
+   is never zero.  When padding is enabled, a newline precedes every
+   32nd character.
+
+   Returns zero on success, one on failure.  */
+int write_track_lod(FILE *fp, bool diag_proc) {
+  unsigned char *levels = (unsigned char*)xmalloc(sizeof(unsigned char) *
+						  sorted_eddies.len);
+  unsigned *track = (unsigned*)xmalloc(sizeof(unsigned) * max_track_len);
+  int *lat = (int*)xmalloc(sizeof(int) * max_track_len);
+  int *lon = (int*)xmalloc(sizeof(int) * max_track_len);
+  double *sig = (double*)xmalloc(sizeof(double) * max_track_len);
+  /* Douglas-Peucker segment stack: start, end, significance cap.  */
+  unsigned *stack = (unsigned*)xmalloc(sizeof(unsigned) * 2 * max_track_len);
+  double *stack_cap = (double*)xmalloc(sizeof(double) * max_track_len);
+  unsigned level_counts[16];
+  unsigned i, j;
+
+  memset(level_counts, 0, sizeof(level_counts));
+  for (i = 0; i < sorted_eddies.len; i++) {
+    SortedEddy *seddy = &sorted_eddies.d[i];
+    unsigned len = 0, top = 0;
+    if (seddy->prev != NULL)
+      continue; /* Not the start of a track.  */
+
+    /* Gather the track, unwrapping longitudes across the
+       antimeridian.  */
+    for (; seddy != NULL; seddy = seddy->next) {
+      int cur_lon = (int)seddy->coords[1] - (1 << 14);
+      track[len] = seddy - sorted_eddies.d;
+      lat[len] = (int)seddy->coords[0] - (1 << 13);
+      if (len > 0) {
+	int delta = cur_lon - lon[len-1];
+	while (delta > RT_FULL_TURN / 2) delta -= RT_FULL_TURN;
+	while (delta < -RT_FULL_TURN / 2) delta += RT_FULL_TURN;
+	cur_lon = lon[len-1] + delta;
+      }
+      lon[len++] = cur_lon;
+    }
+
+    sig[0] = sig[len-1] = HUGE_VAL;
+    if (len > 2) {
+      stack[0] = 0; stack[1] = len - 1; stack_cap[0] = HUGE_VAL; top = 1;
+    }
+    while (top > 0) {
+      unsigned a, b, k = 0;
+      double cap, max_dist = -1;
+      top--;
+      a = stack[2*top]; b = stack[2*top+1]; cap = stack_cap[top];
+      for (j = a + 1; j < b; j++) {
+	double dist = seg_dist(lat, lon, a, b, j);
+	if (dist > max_dist) { max_dist = dist; k = j; }
+      }
+      sig[k] = (max_dist < cap) ? max_dist : cap;
+      if (k - a > 1) {
+	stack[2*top] = a; stack[2*top+1] = k; stack_cap[top++] = sig[k];
+      }
+      if (b - k > 1) {
+	stack[2*top] = k; stack[2*top+1] = b; stack_cap[top++] = sig[k];
+      }
+    }
+
+    for (j = 0; j < len; j++) {
+      unsigned level;
+      if (j == 0 || j == len - 1)
+	level = 15;
+      else if (sig[j] < 1)
+	level = 0;
+      else {
+	level = (unsigned)floor(log2(sig[j]));
+	if (level > 14) level = 14;
+      }
+      levels[track[j]] = level;
+      level_counts[level]++;
+    }
+  }
+
+  { /* Write the output.  */
+    const char *header =
+"# Eddy track level of detail data for the Ocean Eddies Web Viewer.\n"
+"#\n# BEGIN_DATA\n";
+    const char *cur_pos;
+    unsigned num_chars = (sorted_eddies.len + 2) / 3;
+#define LOD_PUT_SHORT(value) \
+    putc((value) & 0xff, fp); \
+    putc(((value) >> 8) & 0xff, fp)
+
+    LOD_PUT_SHORT(0xfeff);
+    for (cur_pos = header; *cur_pos != '\0'; cur_pos++)
+      { LOD_PUT_SHORT(*cur_pos); }
+    LOD_PUT_SHORT(pad_newlines ? 0x09 : 0x01);
+    for (i = 0; i < num_chars; i++) {
+      unsigned value = 0x1000;
+      for (j = 0; j < 3 && 3 * i + j < sorted_eddies.len; j++)
+	value |= levels[3*i+j] << (4 * j);
+      if (pad_newlines && i % 32 == 0)
+	{ LOD_PUT_SHORT('\n'); }
+      LOD_PUT_SHORT(value);
+    }
+    if (pad_newlines) { LOD_PUT_SHORT('\n'); }
+  }
+
+  if (diag_proc) {
+    unsigned kept = 0;
+    for (i = 16; i-- > 0; ) {
+      kept += level_counts[i];
+      fprintf(stderr, "Level %2u and above: %u eddies\n", i, kept);
+    }
+  }
+
+  xfree(levels); xfree(track); xfree(lat); xfree(lon); xfree(sig);
+  xfree(stack); xfree(stack_cap);
+  if (ferror(fp)) {
+    fputs("Error: Could not write the level of detail data.\n", stderr);
+    return 1;
+  }
+  return 0;
+}
+
+/* Write one density grid as a bottom-up 24-bit TGA image, in the same
+   layout as the SSH images written by csvtotga: equirectangular,
+   longitude zero at the center, latitude -90 at the bottom.  The
+   anticyclonic eddy count of each cell goes into the red channel and
+   the cyclonic eddy count into the blue channel, to match the track
+   colors in the viewer.  Counts saturate at 255.  */
+static int write_density_tga(const char *filename, unsigned width,
+			     unsigned height, const unsigned *counts) {
+  FILE *fp = fopen(filename, "wb");
+  unsigned i;
+  if (fp == NULL) {
+    fprintf(stderr, "Error: Could not open %s: %s\n",
+	    filename, strerror(errno));
+    return 1;
+  }
+#define TGA_PUT_SHORT(value) \
+  putc((value) & 0xff, fp); putc(((value) >> 8) & 0xff, fp)
+  putc(0, fp); /* ID length */
+  putc(0, fp); /* Color map type (none) */
+  putc(2, fp); /* Image type (True Color) */
+  for (i = 0; i < 5; i++) putc(0, fp); /* No color map specification */
+  TGA_PUT_SHORT(0); TGA_PUT_SHORT(0); /* Origin */
+  TGA_PUT_SHORT(width); TGA_PUT_SHORT(height);
+  putc(24, fp); /* Bits per pixel */
+  putc(0, fp); /* Image descriptor: bottom-up */
+  for (i = 0; i < width * height; i++) {
+    unsigned acyc = counts[2*i], cyc = counts[2*i+1];
+    putc((cyc > 255) ? 255 : cyc, fp);
+    putc(0, fp);
+    putc((acyc > 255) ? 255 : acyc, fp);
+  }
+  if (ferror(fp) | (fclose(fp) == EOF)) {
+    fprintf(stderr, "Error: Could not write %s.\n", filename);
+    return 1;
+  }
+  return 0;
+}
+
+/* Count the eddies of each type within every grid cell on every date
+   index and write the counts as TGA images into the directory `dir',
+   named "dens_NNNNN.tga" after the date index.  If `window' is
+   nonzero, the counts are also summed over consecutive windows of
+   that many date indexes and written as "densW_NNNNN.tga", named
+   after the window length and the first date index of the window.
+   The images can be converted to PNG in the same way as the SSH
+   images.  The grid dimensions and window length are written to
+   "format.json" in the same directory.  Returns zero on success, one
+   on failure.  */
+int write_density_grids(const char *dir, float res, unsigned window) {
+  unsigned width = (unsigned)(360 / res + 0.5);
+  unsigned height = (unsigned)(180 / res + 0.5);
+  unsigned grid_len;
+  unsigned *counts;
+  unsigned *win_counts = NULL;
+  char *filename = (char*)xmalloc(strlen(dir) + 32);
+  unsigned num_dates = date_chunk_starts.len - 1;
+  unsigned i, j;
+  int retval = 0;
+
+  if (height == 0) height = 1;
+  grid_len = 2 * width * height;
+  counts = (unsigned*)xmalloc(sizeof(unsigned) * grid_len);
+  if (window > 0) {
+    win_counts = (unsigned*)xmalloc(sizeof(unsigned) * grid_len);
+    memset(win_counts, 0, sizeof(unsigned) * grid_len);
+  }
+
+  for (i = 0; i < num_dates && retval == 0; i++) {
+    memset(counts, 0, sizeof(unsigned) * grid_len);
+    for (j = date_chunk_starts.d[i]; j < date_chunk_starts.d[i+1]; j++) {
+      SortedEddy *seddy = &sorted_eddies.d[j];
+      unsigned lat = seddy->coords[0] - ((1 << 13) - 90 * (1 << 6));
+      unsigned lon = seddy->coords[1] - ((1 << 14) - 180 * (1 << 6));
+      unsigned y = lat * height / (180 * (1 << 6));
+      unsigned x = lon * width / (360 * (1 << 6));
+      if (y >= height) y = height - 1;
+      x %= width; /* Longitude 180 wraps around to -180.  */
+      counts[2*(y*width+x)+seddy->type]++;
+    }
+
+    sprintf(filename, "%s/dens_%05u.tga", dir, i + 1);
+    retval = write_density_tga(filename, width, height, counts);
+
+    if (window > 0) {
+      for (j = 0; j < grid_len; j++)
+	win_counts[j] += counts[j];
+      if ((i + 1) % window == 0 || i + 1 == num_dates) {
+	sprintf(filename, "%s/dens%u_%05u.tga", dir, window,
+		i / window * window + 1);
+	if (retval == 0)
+	  retval = write_density_tga(filename, width, height, win_counts);
+	memset(win_counts, 0, sizeof(unsigned) * grid_len);
+      }
+    }
+  }
+
+  if (retval == 0) {
+    /* Describe the grids for the viewer.  */
+    FILE *fp;
+    sprintf(filename, "%s/format.json", dir);
+    fp = fopen(filename, "wt");
+    if (fp == NULL) {
+      fprintf(stderr, "Error: Could not open %s: %s\n",
+	      filename, strerror(errno));
+      retval = 1;
+    } else {
+      fprintf(fp, "{\n"
+	      "  \"width\": %u,\n"
+	      "  \"height\": %u,\n"
+	      "  \"numDates\": %u,\n"
+	      "  \"window\": %u\n"
+	      "}\n", width, height, num_dates, window);
+      if (fclose(fp) == EOF) {
+	fprintf(stderr, "Error: Could not write %s.\n", filename);
+	retval = 1;
+      }
+    }
+  }
+
+  xfree(counts); xfree(win_counts); xfree(filename);
+  return retval;
+}
+
+/* Decimate the tracks data and write it as a complete tracks data
+   file of its own.  Only every `date_step'th date index is kept,
+   starting with the first, and the kept date indexes are renumbered
+   to be consecutive.  Only tracks that are at least `min_len' date
+   indexes long are kept.  The links of the kept eddies are rebuilt to
+   skip over the removed eddies, and kd-trees are rebuilt for the new
+   date indexes, if requested.
+
+   This replaces the contents of `sorted_eddies' and
+   `date_chunk_starts' with the overview data.  Returns zero on
+   success, one on failure.  */
+int write_overview(FILE *fp, const wchar_t_array *user_info,
+		   unsigned date_step, unsigned min_len, bool build_kd) {
+  SortedEddy_array ov_eddies;
+  char extra_header[160];
+  unsigned i;
+
+  EA_INIT(SortedEddy, ov_eddies, 16);
+  for (i = 0; i < sorted_eddies.len; i++) {
+    SortedEddy *seddy = &sorted_eddies.d[i];
+    unsigned track_len = 0;
+    bool start_of_track = true;
+    if (seddy->prev != NULL)
+      continue; /* Not the start of a track.  */
+    for (; seddy != NULL; seddy = seddy->next)
+      track_len++;
+    if (track_len < min_len)
+      continue;
+
+    /* As in `add_eddy()', the links use zero as their base address
+       until construction is finished.  */
+    for (seddy = &sorted_eddies.d[i]; seddy != NULL; seddy = seddy->next) {
+      SortedEddy *ov_eddy;
+      if ((seddy->date_index - 1) % date_step != 0)
+	continue;
+      EA_ADD(ov_eddies);
+      ov_eddy = &ov_eddies.d[ov_eddies.len-1];
+      memcpy(ov_eddy, seddy, sizeof(SortedEddy));
+      ov_eddy->date_index = (seddy->date_index - 1) / date_step + 1;
+      ov_eddy->prev = (SortedEddy*)0 + (ov_eddies.len - 1);
+      if (!start_of_track)
+	{ ov_eddy->prev--; ov_eddies.d[ov_eddies.len-2].next++; }
+      ov_eddy->next = (SortedEddy*)0 + (ov_eddies.len - 1);
+      start_of_track = false;
+    }
+  }
+
+  if (ov_eddies.len == 0) {
+    fputs("Error: The overview does not contain any eddies.\n", stderr);
+    EA_DESTROY(ov_eddies);
+    return 1;
+  }
+
+  EA_DESTROY(sorted_eddies);
+  sorted_eddies = ov_eddies;
+  EA_DESTROY(date_chunk_starts);
+  EA_INIT(unsigned, date_chunk_starts, 16);
+  max_frame_eddies = 0;
+
+  rebase_links();
+  qsorts_r(sorted_eddies.d, sorted_eddies.len, sizeof(SortedEddy),
+	   qs_date_cmp, qs_eddy_swap, NULL);
+  if (build_date_chunks() != 0) {
+    fputs("Error: Try a smaller overview date step or track length.\n",
+	  stderr);
+    return 1;
+  }
+  if (build_kd && build_kd_trees() != 0)
+    return 1;
+
+  sprintf(extra_header,
+	  "# Overview: every %u date indexes, "
+	  "tracks at least %u date indexes long.\n",
+	  date_step, min_len);
+  return write_tracks(fp, NULL, user_info, extra_header);
+}
+
+/* Open the SSH grids for the first `num_dates' date indexes.  Either
+   `csv_dir' or `cube_name' is given.  `dates_name' may be NULL for
+   the default dates file.  The grid dimensions must already be set in
+   `src'.  Returns zero on success, one on failure.  */
+int open_ssh_source(SSHSource *src, const char *csv_dir,
+		    const char *dates_name, const char *cube_name,
+		    unsigned num_dates) {
+  size_t grid_size = sizeof(float) * src->width * src->height;
+  src->csv_dir = csv_dir;
+  src->dates = NULL;
+  src->num_dates = num_dates;
+  src->cube = NULL;
+  src->cube_size = 0;
+
+  if (cube_name != NULL) {
+    struct stat st;
+    void *map;
+    int fd = open(cube_name, O_RDONLY);
+    if (fd == -1 || fstat(fd, &st) != 0) {
+      fprintf(stderr, "Error: Could not open %s: %s\n",
+	      cube_name, strerror(errno));
+      if (fd != -1) close(fd);
+      return 1;
+    }
+    if ((size_t)st.st_size < grid_size * num_dates) {
+      fprintf(stderr, "Error: %s has fewer than %u SSH grids.\n",
+	      cube_name, num_dates);
+      close(fd);
+      return 1;
+    }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+      fprintf(stderr, "Error: Could not map %s: %s\n",
+	      cube_name, strerror(errno));
+      return 1;
+    }
+    src->cube = (const float*)map;
+    src->cube_size = st.st_size;
+  } else {
+    char default_name[4096];
+    char date[64];
+    FILE *fp;
+    unsigned i = 0;
+    if (dates_name == NULL) {
+      snprintf(default_name, sizeof(default_name),
+	       "%s/../dates.dat", csv_dir);
+      dates_name = default_name;
+    }
+    fp = fopen(dates_name, "rt");
+    if (fp == NULL) {
+      fprintf(stderr, "Error: Could not open %s: %s\n",
+	      dates_name, strerror(errno));
+      return 1;
+    }
+    src->dates = (char**)xmalloc(sizeof(char*) * (num_dates + 1));
+    while (i < num_dates && fscanf(fp, "%63s", date) == 1)
+      src->dates[i++] = xstrdup(date);
+    fclose(fp);
+    if (i < num_dates) {
+      fprintf(stderr, "Error: %s has only %u of %u dates.\n",
+	      dates_name, i, num_dates);
+      src->num_dates = i;
+      close_ssh_source(src);
+      return 1;
+    }
+  }
+  return 0;
+}
+
+void close_ssh_source(SSHSource *src) {
+  if (src->cube != NULL)
+    munmap((void*)src->cube, src->cube_size);
+  src->cube = NULL;
+  if (src->dates != NULL) {
+    unsigned i;
+    for (i = 0; i < src->num_dates; i++)
+      xfree(src->dates[i]);
+    EFREE(src->dates);
+  }
+}
+
+/* Read `grid_len' comma or newline separated SSH values from a CSV
+   file.  "NaN" is accepted for no data.  Returns zero on success, one
+   on failure.  */
+int read_ssh_csv(const char *filename, float *grid, size_t grid_len) {
+  FILE *fp = fopen(filename, "rb");
+  char *buf, *pos;
+  long size;
+  size_t i;
+  if (fp == NULL) {
+    fprintf(stderr, "Error: Could not open %s: %s\n",
+	    filename, strerror(errno));
+    return 1;
+  }
+  if (fseek(fp, 0, SEEK_END) != 0 || (size = ftell(fp)) < 0 ||
+      fseek(fp, 0, SEEK_SET) != 0) {
+    fprintf(stderr, "Error: Could not read %s: %s\n",
+	    filename, strerror(errno));
+    fclose(fp);
+    return 1;
+  }
+  buf = (char*)xmalloc(size + 1);
+  if (fread(buf, 1, size, fp) != (size_t)size) {
+    fprintf(stderr, "Error: Could not read %s: %s\n",
+	    filename, strerror(errno));
+    xfree(buf); fclose(fp);
+    return 1;
+  }
+  fclose(fp);
+  buf[size] = '\0';
+
+  pos = buf;
+  for (i = 0; i < grid_len; i++) {
+    char *end;
+    grid[i] = strtof(pos, &end);
+    if (end == pos) {
+      fprintf(stderr, "Error: %s: Expected %lu SSH values, found %lu.\n",
+	      filename, (unsigned long)grid_len, (unsigned long)i);
+      xfree(buf);
+      return 1;
+    }
+    pos = end;
+    if (*pos == ',' || *pos == '\n')
+      pos++;
+  }
+  xfree(buf);
+  return 0;
+}
+
+/* Bilinearly interpolate the SSH grid at an eddy's position.  Corners
+   without data are left out and the weights of the rest are
+   renormalized, so that eddies near coastlines still get a value.
+   Returns NaN if none of the corners have data.  */
+float sample_ssh(const float *grid, unsigned width, unsigned height,
+		 const SortedEddy *seddy) {
+  double lat = (double)((int)seddy->coords[0] - (1 << 13)) / (1 << 6);
+  double lon = (double)((int)seddy->coords[1] - (1 << 14)) / (1 << 6);
+  double y = (lat + 90) * (height - 1) / 180;
+  double x = ((lon < 0) ? lon + 360 : lon) * width / 360;
+  unsigned x0 = (unsigned)x, y0 = (unsigned)y;
+  unsigned x1, y1;
+  double fx, fy, sum = 0, weight_sum = 0;
+  float corners[4];
+  double weights[4];
+  unsigned k;
+
+  if (y0 >= height - 1) y0 = height - 2;
+  if (x0 >= width) x0 = width - 1;
+  fy = y - y0; fx = x - x0;
+  y1 = y0 + 1;
+  x1 = (x0 + 1) % width; /* Wrap around the antimeridian.  */
+
+  corners[0] = grid[y0*width+x0]; weights[0] = (1 - fx) * (1 - fy);
+  corners[1] = grid[y0*width+x1]; weights[1] = fx * (1 - fy);
+  corners[2] = grid[y1*width+x0]; weights[2] = (1 - fx) * fy;
+  corners[3] = grid[y1*width+x1]; weights[3] = fx * fy;
+  for (k = 0; k < 4; k++) {
+    if (corners[k] != corners[k])
+      continue;
+    sum += corners[k] * weights[k];
+    weight_sum += weights[k];
+  }
+  if (weight_sum <= 0)
+    return NAN;
+  return (float)(sum / weight_sum);
+}
+
+/* Encode an SSH value in centimeters as described at `SSH_ZERO',
+   saturating at the ends of the range.  */
+unsigned encode_ssh(float ssh) {
+  long value;
+  if (ssh != ssh)
+    return 0;
+  value = lrintf(ssh * (1 << 6)) + SSH_ZERO;
+  if (value < 1) value = 1;
+  if (value > SSH_MAX) value = SSH_MAX;
+  return (unsigned)value;
+}
+
+/* Take date indexes off of the shared counter and sample SSH for all
+   of the eddies on them, until all date indexes are done or any
+   worker fails.  */
+void *ssh_worker(void *arg) {
+  SSHSource *src = (SSHSource*)arg;
+  size_t grid_len = (size_t)src->width * src->height;
+  float *grid = NULL;
+  unsigned num_nan = 0;
+  if (src->cube == NULL)
+    grid = (float*)xmalloc(sizeof(float) * grid_len);
+
+  while (true) {
+    const float *date_grid;
+    unsigned d, i;
+    pthread_mutex_lock(&src->lock);
+    d = src->next_date++;
+    if (src->retval != 0)
+      d = src->num_dates;
+    pthread_mutex_unlock(&src->lock);
+    if (d >= src->num_dates)
+      break;
+
+    if (src->cube != NULL)
+      date_grid = src->cube + grid_len * d;
+    else {
+      char filename[4096];
+      snprintf(filename, sizeof(filename), "%s/ssh_%s.dat",
+	       src->csv_dir, src->dates[d]);
+      if (read_ssh_csv(filename, grid, grid_len) != 0) {
+	pthread_mutex_lock(&src->lock);
+	src->retval = 1;
+	pthread_mutex_unlock(&src->lock);
+	break;
+      }
+      date_grid = grid;
+    }
+
+    for (i = date_chunk_starts.d[d]; i < date_chunk_starts.d[d+1]; i++) {
+      unsigned value = encode_ssh(sample_ssh(date_grid, src->width,
+					     src->height,
+					     &sorted_eddies.d[i]));
+      if (value == 0)
+	num_nan++;
+      src->values[i] = value;
+    }
+  }
+
+  pthread_mutex_lock(&src->lock);
+  src->num_nan += num_nan;
+  pthread_mutex_unlock(&src->lock);
+  xfree(grid);
+  return NULL;
+}
+
+/* Sample the SSH under every eddy with `num_threads' threads working
+   on separate date indexes, then write one character per eddy in the
+   same order as the eddies of the tracks data, encoded as described
+   at `SSH_ZERO'.  The layout otherwise follows the level of detail
+   file.  Returns zero on success, one on failure.  */
+int write_ssh_column(FILE *fp, SSHSource *src, unsigned num_threads,
+		     bool diag_proc) {
+  pthread_t *threads = (pthread_t*)xmalloc(sizeof(pthread_t) * num_threads);
+  unsigned num_started = 0;
+  unsigned i;
+
+  pthread_mutex_init(&src->lock, NULL);
+  src->next_date = 0;
+  src->values = (unsigned short*)xmalloc(sizeof(unsigned short) *
+					 sorted_eddies.len);
+  src->num_nan = 0;
+  src->retval = 0;
+  if (num_threads > src->num_dates)
+    num_threads = (src->num_dates > 0) ? src->num_dates : 1;
+  for (i = 0; i < num_threads; i++) {
+    int error = pthread_create(&threads[i], NULL, ssh_worker, src);
+    if (error != 0) {
+      fprintf(stderr, "Error: pthread_create: %s\n", strerror(error));
+      break;
+    }
+    num_started++;
+  }
+  if (num_started == 0)
+    ssh_worker(src);
+  for (i = 0; i < num_started; i++)
+    pthread_join(threads[i], NULL);
+  xfree(threads);
+  pthread_mutex_destroy(&src->lock);
+
+  if (src->retval == 0) {
+    const char *header =
+"# Sea surface height under every eddy for the Ocean Eddies Web Viewer.\n"
+"#\n# BEGIN_DATA\n";
+    const char *cur_pos;
+    unsigned short format_bits = 0x01;
+    if (max_utf_range)
+      format_bits |= 0x02;
+    if (pad_newlines)
+      format_bits |= 0x08;
+
+    LOD_PUT_SHORT(0xfeff);
+    for (cur_pos = header; *cur_pos != '\0'; cur_pos++)
+      { LOD_PUT_SHORT(*cur_pos); }
+    LOD_PUT_SHORT(format_bits);
+    for (i = 0; i < sorted_eddies.len; i++) {
+      if (pad_newlines && i % 32 == 0)
+	{ LOD_PUT_SHORT('\n'); }
+      put_short_in_range(fp, src->values[i]);
+    }
+    if (pad_newlines) { LOD_PUT_SHORT('\n'); }
+
+    if (diag_proc)
+      fprintf(stderr, "Sampled SSH on %u date indexes with %u threads, "
+	      "%u eddies without data.\n",
+	      src->num_dates, num_started, src->num_nan);
+  }
+  xfree(src->values);
+  return src->retval;
+}
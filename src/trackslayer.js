@@ -533,6 +533,10 @@ WCTracksLayer.loadData.procData = function(httpRequest, responseText) {
 	lastCumDates += numEddies;
 	dateChunkStarts[++i] = lastCumDates;
       }
+      // tracksconv also ends a full line of date counts with a
+      // newline, before the newline that starts the eddy records.
+      if (numDates > 0 && numDates % 32 == 0)
+	curPos++;
       curPos++; // Skip the newline immediately at the end of the header.
       this.dateChunkStarts = dateChunkStarts;
       this.startOfData = curPos;
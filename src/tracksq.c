@@ -0,0 +1,328 @@
+/* Query the sidecar indexes written by tracksconv.
+
+Copyright (C) 2014 University of Minnesota
+
+See the file "COPYING" in the top level directory for details.
+
+*/
+
+/* Usage: tracksq region RTREE-FILE MIN_LAT MIN_LON MAX_LAT MAX_LON
+                  [DATE_FIRST DATE_LAST]
+
+   Prints one line per matching track: track ID, index of the track's
+   first eddy in the tracks data file, and the first and last date
+   indexes of the track.
+
+   Usage: tracksq range STKD-FILE MIN_LAT MIN_LON MAX_LAT MAX_LON
+                  DATE_FIRST DATE_LAST
+
+   Prints one line per matching eddy: index of the eddy in the tracks
+   data file, date index, latitude, and longitude.
+
+   Usage: tracksq pick [-e] TRACKS-FILE DATE LAT LON [K]
+
+   Prints one line per nearest eddy, nearest first: index of the eddy
+   in the tracks data file, distance in degrees of arc, latitude,
+   longitude, and index of the first eddy of the eddy's track.
+
+   Usage: tracksq date TRACKS-FILE DATE
+
+   Prints one line per eddy on the date, in kd-tree order: index of
+   the eddy in the tracks data file, type, latitude, longitude, and
+   the indexes of the next and previous eddies of the track, or "-"
+   at the ends of the track.  Only the given date is decoded.
+
+   Usage: tracksq stats STATS-FILE [COLUMN MIN MAX]...
+
+   Prints one line per track whose statistics are within all of the
+   given ranges: track ID, lifetime, first date index, displacement,
+   mean speed, genesis latitude, and type.  */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "xmalloc.h"
+#include "rtree.h"
+#include "stkd.h"
+#include "wtxt.h"
+#include "kdnn.h"
+#include "tstats.h"
+
+void display_help(FILE *fout, const char *progname);
+int cmd_region(int argc, char *argv[]);
+int cmd_range(int argc, char *argv[]);
+int cmd_pick(int argc, char *argv[]);
+int cmd_date(int argc, char *argv[]);
+int cmd_stats(int argc, char *argv[]);
+void print_track(const TrackBox *track, void *arg);
+void print_points(const STPoint *points, unsigned count, void *arg);
+
+void display_help(FILE *fout, const char *progname) {
+  fprintf(fout, "Usage: %s COMMAND ARGS...\n\n", progname);
+  fputs(
+"Commands:\n"
+"  region RTREE-FILE MIN_LAT MIN_LON MAX_LAT MAX_LON [DATE_FIRST DATE_LAST]\n"
+"        List the tracks that pass through the given region, optionally\n"
+"        limited to tracks alive within the given date index range.  The\n"
+"        region crosses the antimeridian if MAX_LON is less than MIN_LON.\n"
+"  range STKD-FILE MIN_LAT MIN_LON MAX_LAT MAX_LON DATE_FIRST DATE_LAST\n"
+"        List the eddies within the given region on the given date index\n"
+"        range.\n"
+"  pick [-e] TRACKS-FILE DATE LAT LON [K]\n"
+"        List the K nearest eddies (default 1) to the given point on the\n"
+"        given date index, by great-circle distance, or equirectangular\n"
+"        distance with `-e'.\n"
+"  date TRACKS-FILE DATE\n"
+"        List the eddies on the given date index.\n"
+"  stats STATS-FILE [COLUMN MIN MAX]...\n"
+"        List the tracks with statistics in all of the given ranges.\n"
+"        COLUMN is one of lifetime, first (date index), disp (km), speed\n"
+"        (km per date index), lat (genesis latitude), or type.\n",
+	fout);
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    display_help(stderr, argv[0]);
+    return 1;
+  } else if (!strcmp(argv[1], "-h") || !strcmp(argv[1], "--help")) {
+    display_help(stdout, argv[0]);
+    return 0;
+  }
+
+  if (!strcmp(argv[1], "region"))
+    return cmd_region(argc - 2, argv + 2);
+  if (!strcmp(argv[1], "range"))
+    return cmd_range(argc - 2, argv + 2);
+  if (!strcmp(argv[1], "pick"))
+    return cmd_pick(argc - 2, argv + 2);
+  if (!strcmp(argv[1], "date"))
+    return cmd_date(argc - 2, argv + 2);
+  if (!strcmp(argv[1], "stats"))
+    return cmd_stats(argc - 2, argv + 2);
+
+  fprintf(stderr, "Error: Unknown command: %s\n", argv[1]);
+  return 1;
+}
+
+void print_track(const TrackBox *track, void *arg) {
+  printf("%u %u %u %u\n", track->track_id, track->head_index,
+	 track->b.date_first, track->b.date_last);
+}
+
+int cmd_region(int argc, char *argv[]) {
+  RTree tree;
+  FILE *fp;
+  unsigned date_first = 0, date_last = ~0u;
+  int retval;
+
+  if (argc != 5 && argc != 7) {
+    fputs("Error: Invalid command line.\n", stderr);
+    return 1;
+  }
+  if (argc == 7) {
+    date_first = strtoul(argv[5], NULL, 0);
+    date_last = strtoul(argv[6], NULL, 0);
+  }
+
+  fp = fopen(argv[0], "rb");
+  if (fp == NULL) {
+    fprintf(stderr, "Error: Could not open %s: %s\n",
+	    argv[0], strerror(errno));
+    return 1;
+  }
+  retval = rtree_read(fp, &tree);
+  fclose(fp);
+  if (retval != 0)
+    return 1;
+
+  rtree_query(&tree, strtod(argv[1], NULL), strtod(argv[2], NULL),
+	      strtod(argv[3], NULL), strtod(argv[4], NULL),
+	      date_first, date_last, print_track, NULL);
+  rtree_destroy(&tree);
+  return 0;
+}
+
+void print_points(const STPoint *points, unsigned count, void *arg) {
+  unsigned i;
+  for (i = 0; i < count; i++) {
+    printf("%u %d %.4f %.4f\n", points[i].eddy_index, points[i].c[2],
+	   (double)points[i].c[0] / STKD_DEG,
+	   (double)points[i].c[1] / STKD_DEG);
+  }
+}
+
+int cmd_range(int argc, char *argv[]) {
+  STKdTree tree;
+  FILE *fp;
+  int retval;
+
+  if (argc != 7) {
+    fputs("Error: Invalid command line.\n", stderr);
+    return 1;
+  }
+
+  fp = fopen(argv[0], "rb");
+  if (fp == NULL) {
+    fprintf(stderr, "Error: Could not open %s: %s\n",
+	    argv[0], strerror(errno));
+    return 1;
+  }
+  retval = stkd_read(fp, &tree);
+  fclose(fp);
+  if (retval != 0)
+    return 1;
+
+  stkd_query(&tree, strtod(argv[1], NULL), strtod(argv[2], NULL),
+	     strtod(argv[3], NULL), strtod(argv[4], NULL),
+	     strtoul(argv[5], NULL, 0), strtoul(argv[6], NULL, 0),
+	     print_points, NULL);
+  stkd_destroy(&tree);
+  return 0;
+}
+
+int cmd_pick(int argc, char *argv[]) {
+  WTracks tracks;
+  KdNeighbor *neighbors;
+  int metric = KDNN_GREAT_CIRCLE;
+  unsigned date_index, k = 1;
+  unsigned num_found, i;
+
+  if (argc > 0 && !strcmp(argv[0], "-e")) {
+    metric = KDNN_EQUIRECT;
+    argc--; argv++;
+  }
+  if (argc != 4 && argc != 5) {
+    fputs("Error: Invalid command line.\n", stderr);
+    return 1;
+  }
+  date_index = strtoul(argv[1], NULL, 0);
+  if (argc == 5)
+    k = strtoul(argv[4], NULL, 0);
+  if (date_index == 0 || k == 0) {
+    fputs("Error: Invalid command line.\n", stderr);
+    return 1;
+  }
+
+  if (wtxt_load(argv[0], &tracks) != 0)
+    return 1;
+  neighbors = (KdNeighbor*)xmalloc(sizeof(KdNeighbor) * k);
+  /* The kd-tree functions use zero-based date indexes.  */
+  num_found = kdnn_query(&tracks, date_index - 1,
+			 strtod(argv[2], NULL), strtod(argv[3], NULL),
+			 k, metric, neighbors);
+  for (i = 0; i < num_found; i++) {
+    unsigned index = neighbors[i].index;
+    unsigned head = index;
+    while (tracks.prev[head] != WTXT_NONE)
+      head = tracks.prev[head];
+    printf("%u %.4f %.4f %.4f %u\n", index, neighbors[i].dist,
+	   tracks.lat[index], tracks.lon[index], head);
+  }
+  xfree(neighbors);
+  wtxt_destroy(&tracks);
+  return 0;
+}
+
+int cmd_date(int argc, char *argv[]) {
+  WFile wf;
+  WDateView view;
+  unsigned char *type;
+  float *lat, *lon;
+  unsigned *next, *prev;
+  unsigned date_index, i;
+
+  if (argc != 2 || (date_index = strtoul(argv[1], NULL, 0)) == 0) {
+    fputs("Error: Invalid command line.\n", stderr);
+    return 1;
+  }
+  if (wfile_open(argv[0], &wf) != 0)
+    return 1;
+  if (wfile_date(&wf, date_index - 1, &view) != 0) {
+    fprintf(stderr, "Error: The date index must be at most %u.\n",
+	    wf.num_dates);
+    wfile_close(&wf);
+    return 1;
+  }
+
+  type = (unsigned char*)xmalloc(view.count);
+  lat = (float*)xmalloc(sizeof(float) * view.count);
+  lon = (float*)xmalloc(sizeof(float) * view.count);
+  next = (unsigned*)xmalloc(sizeof(unsigned) * view.count);
+  prev = (unsigned*)xmalloc(sizeof(unsigned) * view.count);
+  wfile_decode(&wf, view.first, view.count, type, lat, lon, next, prev);
+  for (i = 0; i < view.count; i++) {
+    printf("%u %u %.4f %.4f ", view.first + i, type[i], lat[i], lon[i]);
+    if (next[i] != WTXT_NONE)
+      printf("%u ", next[i]);
+    else
+      fputs("- ", stdout);
+    if (prev[i] != WTXT_NONE)
+      printf("%u\n", prev[i]);
+    else
+      fputs("-\n", stdout);
+  }
+
+  xfree(type); xfree(lat); xfree(lon); xfree(next); xfree(prev);
+  wfile_close(&wf);
+  return 0;
+}
+
+int cmd_stats(int argc, char *argv[]) {
+  TrackStats ts;
+  TSRange ranges[16];
+  unsigned num_ranges = 0;
+  unsigned *ids;
+  unsigned num_ids, i;
+  FILE *fp;
+  int retval;
+
+  if (argc < 1 || (argc - 1) % 3 != 0 || (argc - 1) / 3 > 16) {
+    fputs("Error: Invalid command line.\n", stderr);
+    return 1;
+  }
+  for (i = 1; i < (unsigned)argc; i += 3) {
+    unsigned c;
+    for (c = 0; c < TS_NUM_COLS; c++) {
+      if (!strcmp(argv[i], tstats_names[c]))
+	break;
+    }
+    if (c == TS_NUM_COLS) {
+      fprintf(stderr, "Error: Unknown column: %s\n", argv[i]);
+      return 1;
+    }
+    ranges[num_ranges].column = c;
+    ranges[num_ranges].min = strtod(argv[i+1], NULL);
+    ranges[num_ranges].max = strtod(argv[i+2], NULL);
+    num_ranges++;
+  }
+
+  fp = fopen(argv[0], "rb");
+  if (fp == NULL) {
+    fprintf(stderr, "Error: Could not open %s: %s\n",
+	    argv[0], strerror(errno));
+    return 1;
+  }
+  retval = tstats_read(fp, &ts);
+  fclose(fp);
+  if (retval != 0)
+    return 1;
+
+  ids = (unsigned*)xmalloc(sizeof(unsigned) * (ts.num_tracks + 1));
+  num_ids = tstats_filter(&ts, ranges, num_ranges, ids);
+  for (i = 0; i < num_ids; i++) {
+    unsigned id = ids[i];
+    printf("%u %.0f %.0f %.0f %.2f %.4f %.0f\n", id,
+	   tstats_get(&ts, TS_LIFETIME, id),
+	   tstats_get(&ts, TS_FIRST_DATE, id),
+	   tstats_get(&ts, TS_DISPLACEMENT, id),
+	   tstats_get(&ts, TS_SPEED, id),
+	   tstats_get(&ts, TS_GENESIS_LAT, id),
+	   tstats_get(&ts, TS_TYPE, id));
+  }
+  xfree(ids);
+  tstats_destroy(&ts);
+  return 0;
+}
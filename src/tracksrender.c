@@ -0,0 +1,607 @@
+/* Render the eddy tracks of one date into anti-aliased map tiles, so
+   that clients that cannot draw the tracks themselves can show them as
+   images.
+
+Copyright (C) 2014 University of Minnesota
+
+See the file "COPYING" in the top level directory for details.
+
+*/
+
+/* Usage: tracksrender [options] TRACKS-FILE DATE OUTPUT-DIR
+
+   Every eddy on the date index DATE (one-based) is drawn as the
+   viewer's tracks layer draws it: a ring at the eddy and a line along
+   its track, red for anticyclonic and blue for cyclonic eddies.  By
+   default the whole track up to the eddy is drawn, and the tail can be
+   limited to a number of date index steps.
+
+   The tiles are 256 by 256 RGBA TGA images of an equirectangular map.
+   Zoom level Z has 2^(Z+1) by 2^Z tiles, and tile (X, Y) of zoom level
+   Z is written to "OUTPUT-DIR/Z_X_Y.tga", where X counts east from the
+   antimeridian and Y counts south from the North Pole.  Tiles that
+   nothing is drawn on are not written.  The tile layout is written to
+   "format.json" in the same directory.
+
+   The candidate eddies of a tile are found with the kd-tree of the
+   date, queried with the box of the tile widened by the farthest that
+   any drawn track reaches from its eddy, so the tracks data must have
+   been written with kd-trees.  Worker threads take the tiles of all
+   zoom levels off a shared counter.  */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "xmalloc.h"
+#include "wtxt.h"
+#include "kdpvs.h"
+
+enum bool_tag { false, true };
+typedef enum bool_tag bool;
+
+#define TILE_SIZE 256
+
+/* Colors of anticyclonic and cyclonic tracks, as in "trackslayer.js" */
+static const float track_colors[2][3] = { { 1, 0, 0 }, { 0, 0, 1 } };
+
+/* State shared by the worker threads.  */
+struct RenderJob_tag {
+  const WTracks *tracks;
+  unsigned date_index; /* zero-based */
+  unsigned tail; /* Tail length in date index steps */
+  bool future; /* Also draw the tracks after the date */
+  float line_width; /* Pixels */
+  /* Farthest that any drawn track reaches from its eddy, in degrees */
+  double reach_lat, reach_lon;
+  const char *out_dir;
+  unsigned num_tiles;
+
+  pthread_mutex_t lock;
+  unsigned next_tile;
+  unsigned num_written;
+  unsigned long num_drawn;
+  int retval;
+};
+typedef struct RenderJob_tag RenderJob;
+
+/* Drawing surface of one tile.  `cov' holds the coverage of the track
+   being drawn, within the box [ x0, x1 ) by [ y0, y1 ), so that the
+   segments of a track do not blend over each other at the joints.
+   `rgba' is the tile with premultiplied alpha.  */
+struct Tile_tag {
+  float *cov;
+  float *rgba;
+  int x0, y0, x1, y1;
+  bool used;
+};
+typedef struct Tile_tag Tile;
+
+void display_help(FILE *fout, const char *progname);
+double now_secs(void);
+void clip_vbox(double *vbox);
+void tile_coords(unsigned tile, unsigned *z, unsigned *x, unsigned *y);
+void track_reach(const RenderJob *job, unsigned index,
+		 double *reach_lat, double *reach_lon);
+bool clip_box(Tile *t, int *x0, int *y0, int *x1, int *y1);
+void draw_segment(Tile *t, float ax, float ay, float bx, float by, float hw);
+void draw_ring(Tile *t, float cx, float cy, float r, float hw);
+void fill_track(Tile *t, const float *color);
+void draw_eddy(const RenderJob *job, Tile *t, unsigned index,
+	       double ppd, double x_off, double y_off);
+int write_tile_tga(const char *filename, const float *rgba);
+int cmp_unsigned(const void *a, const void *b);
+void *render_worker(void *arg);
+int write_format(const char *dir, unsigned max_zoom, unsigned date,
+		 const RenderJob *job);
+
+void display_help(FILE *fout, const char *progname) {
+  fprintf(fout,
+"Usage: %s [options] TRACKS-FILE DATE OUTPUT-DIR\n\n", progname);
+  fputs(
+"Draw the tracks of the eddies on the date index DATE into map tiles.\n\n"
+"Options:\n"
+"  -h, --help    Display this help message.\n"
+"  -z MAX-ZOOM    Highest zoom level to render (default 3).\n"
+"  -t TAIL    Only draw TAIL date index steps of each track before DATE.\n"
+"        By default, the whole track up to DATE is drawn.\n"
+"  -f    Also draw the tracks after DATE, as the viewer does.\n"
+"  -w WIDTH    Line width in pixels (default 1.5).\n"
+"  -j N    Number of threads (default: the number of processors).\n"
+"  -v    Print statistics when done.\n",
+	fout);
+}
+
+int main(int argc, char *argv[]) {
+  const char *progname = argv[0];
+  const char *args[3];
+  unsigned num_args = 0;
+  bool verbose = false;
+  unsigned max_zoom = 3;
+  long num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+  unsigned date;
+  WTracks tracks;
+  RenderJob job;
+  pthread_t *threads;
+  unsigned num_started = 0;
+  double start_time;
+  unsigned i;
+
+  memset(&job, 0, sizeof(job));
+  job.tail = ~0u;
+  job.future = false;
+  job.line_width = 1.5;
+  while (*++argv != NULL) {
+    if (!strcmp(*argv, "-h") || !strcmp(*argv, "--help")) {
+      display_help(stdout, progname);
+      return 0;
+    } else if (!strcmp(*argv, "-v"))
+      verbose = true;
+    else if (!strcmp(*argv, "-f"))
+      job.future = true;
+    else if (!strcmp(*argv, "-z") && argv[1] != NULL) {
+      max_zoom = strtoul(*++argv, NULL, 0);
+      if (max_zoom > 10) {
+	fputs("Error: Invalid maximum zoom level.\n", stderr);
+	return 1;
+      }
+    } else if (!strcmp(*argv, "-t") && argv[1] != NULL)
+      job.tail = strtoul(*++argv, NULL, 0);
+    else if (!strcmp(*argv, "-w") && argv[1] != NULL) {
+      job.line_width = strtod(*++argv, NULL);
+      if (!(job.line_width > 0 && job.line_width <= 32)) {
+	fputs("Error: Invalid line width.\n", stderr);
+	return 1;
+      }
+    } else if (!strcmp(*argv, "-j") && argv[1] != NULL) {
+      num_threads = strtol(*++argv, NULL, 0);
+      if (num_threads <= 0) {
+	fputs("Error: Invalid number of threads.\n", stderr);
+	return 1;
+      }
+    } else if (num_args < 3)
+      args[num_args++] = *argv;
+    else {
+      fprintf(stderr, "Error: Unknown argument: %s\n", *argv);
+      display_help(stderr, progname);
+      return 1;
+    }
+  }
+  if (num_args != 3) {
+    display_help(stderr, progname);
+    return 1;
+  }
+  if (num_threads <= 0)
+    num_threads = 1;
+  date = strtoul(args[1], NULL, 0);
+
+  start_time = now_secs();
+  if (wtxt_load(args[0], &tracks) != 0)
+    return 1;
+  if (date == 0 || date > tracks.num_dates) {
+    fprintf(stderr, "Error: Invalid date index, "
+	    "the file has %u date indexes.\n", tracks.num_dates);
+    wtxt_destroy(&tracks);
+    return 1;
+  }
+
+  job.tracks = &tracks;
+  job.date_index = date - 1;
+  job.out_dir = args[2];
+  /* Zoom level `z' has 2 * 4^z tiles.  */
+  job.num_tiles = 2 * (((1u << (2 * (max_zoom + 1))) - 1) / 3);
+  for (i = tracks.date_chunk_starts[date-1];
+       i < tracks.date_chunk_starts[date]; i++) {
+    double reach_lat, reach_lon;
+    track_reach(&job, i, &reach_lat, &reach_lon);
+    if (reach_lat > job.reach_lat) job.reach_lat = reach_lat;
+    if (reach_lon > job.reach_lon) job.reach_lon = reach_lon;
+  }
+
+  pthread_mutex_init(&job.lock, NULL);
+  if (num_threads > job.num_tiles)
+    num_threads = job.num_tiles;
+  threads = (pthread_t*)xmalloc(sizeof(pthread_t) * num_threads);
+  for (i = 0; i < num_threads; i++) {
+    int error = pthread_create(&threads[i], NULL, render_worker, &job);
+    if (error != 0) {
+      fprintf(stderr, "Error: pthread_create: %s\n", strerror(error));
+      break;
+    }
+    num_started++;
+  }
+  if (num_started == 0)
+    render_worker(&job);
+  for (i = 0; i < num_started; i++)
+    pthread_join(threads[i], NULL);
+  xfree(threads);
+  pthread_mutex_destroy(&job.lock);
+
+  if (job.retval == 0)
+    job.retval = write_format(job.out_dir, max_zoom, date, &job);
+  if (job.retval == 0 && verbose) {
+    fprintf(stderr, "Wrote %u of %u tiles, %lu eddies drawn, "
+	    "reach %.2f by %.2f degrees, in %.3f s\n",
+	    job.num_written, job.num_tiles, job.num_drawn,
+	    job.reach_lat, job.reach_lon, now_secs() - start_time);
+  }
+  wtxt_destroy(&tracks);
+  return job.retval;
+}
+
+double now_secs(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* Port of `clipVBox()' in "oevmath.js".  */
+void clip_vbox(double *vbox) {
+  if (vbox[0] < -90 && vbox[2] > 90)
+    { vbox[0] = -90; vbox[2] = 90; }
+  else if (vbox[0] < -90) {
+    double new_edge = -180 - vbox[0]; vbox[0] = -90;
+    if (new_edge > vbox[2]) vbox[2] = new_edge;
+    vbox[1] = -180; vbox[3] = 180;
+    return;
+  } else if (vbox[2] > 90) {
+    double new_edge = 180 - vbox[2]; vbox[2] = 90;
+    if (new_edge < vbox[0]) vbox[0] = new_edge;
+    vbox[1] = -180; vbox[3] = 180;
+    return;
+  }
+
+  if (vbox[1] < -360 || vbox[3] >= 360 ||
+      (vbox[1] < -180 && vbox[3] >= 180) ||
+      vbox[3] - vbox[1] >= 360)
+    { vbox[1] = -180; vbox[3] = 180; }
+  else if (vbox[1] < -180)
+    vbox[1] = 360 + vbox[1];
+  else if (vbox[3] > 180)
+    vbox[3] = -360 + vbox[3];
+}
+
+/* Find the zoom level and position of a tile from its ordinal, with
+   the tiles of each zoom level numbered in rows from the top left
+   after those of the lower zoom levels.  */
+void tile_coords(unsigned tile, unsigned *z, unsigned *x, unsigned *y) {
+  unsigned level = 0;
+  while (tile >= 2u << (2 * level)) {
+    tile -= 2u << (2 * level);
+    level++;
+  }
+  *z = level;
+  *x = tile % (2u << level);
+  *y = tile / (2u << level);
+}
+
+/* Find how far the drawn part of the track of eddy `index' reaches
+   from the eddy, in degrees of latitude and longitude.  Longitudes are
+   unwrapped along the track, so that tracks across the antimeridian
+   only reach as far as they actually move.  */
+void track_reach(const RenderJob *job, unsigned index,
+		 double *reach_lat, double *reach_lon) {
+  const WTracks *tracks = job->tracks;
+  unsigned k;
+  *reach_lat = *reach_lon = 0;
+  for (k = 0; k < 2; k++) {
+    const unsigned *link = (k == 0) ? tracks->prev : tracks->next;
+    unsigned steps = (k == 0) ? job->tail : ~0u;
+    double lon = tracks->lon[index];
+    unsigned i = index;
+    if (k == 1 && !job->future)
+      break;
+    while (steps-- > 0 && link[i] != WTXT_NONE) {
+      double dlat, dlon;
+      unsigned j = link[i];
+      dlon = tracks->lon[j] - tracks->lon[i];
+      if (dlon > 180) dlon -= 360;
+      else if (dlon < -180) dlon += 360;
+      lon += dlon;
+      dlat = fabs(tracks->lat[j] - tracks->lat[index]);
+      dlon = fabs(lon - tracks->lon[index]);
+      if (dlat > *reach_lat) *reach_lat = dlat;
+      if (dlon > *reach_lon) *reach_lon = dlon;
+      i = j;
+    }
+  }
+}
+
+/* Clip the box [ *x0, *x1 ) by [ *y0, *y1 ) to the tile and widen the
+   box of the current track to cover it.  Returns false if nothing is
+   left of the box.  */
+bool clip_box(Tile *t, int *x0, int *y0, int *x1, int *y1) {
+  if (*x0 < 0) *x0 = 0;
+  if (*y0 < 0) *y0 = 0;
+  if (*x1 > TILE_SIZE) *x1 = TILE_SIZE;
+  if (*y1 > TILE_SIZE) *y1 = TILE_SIZE;
+  if (*x0 >= *x1 || *y0 >= *y1)
+    return false;
+  if (*x0 < t->x0) t->x0 = *x0;
+  if (*y0 < t->y0) t->y0 = *y0;
+  if (*x1 > t->x1) t->x1 = *x1;
+  if (*y1 > t->y1) t->y1 = *y1;
+  return true;
+}
+
+/* Draw a line segment with round caps and half width `hw', as the
+   coverage of every pixel center by the line widened by half a pixel,
+   into the coverage of the current track.  */
+void draw_segment(Tile *t, float ax, float ay, float bx, float by,
+		  float hw) {
+  float vx = bx - ax, vy = by - ay;
+  float len2 = vx * vx + vy * vy;
+  float inv_len2 = (len2 > 0) ? 1 / len2 : 0;
+  int x0 = (int)floorf(((ax < bx) ? ax : bx) - hw - 1);
+  int y0 = (int)floorf(((ay < by) ? ay : by) - hw - 1);
+  int x1 = (int)ceilf(((ax > bx) ? ax : bx) + hw + 1);
+  int y1 = (int)ceilf(((ay > by) ? ay : by) + hw + 1);
+  int x, y;
+  if (!clip_box(t, &x0, &y0, &x1, &y1))
+    return;
+  for (y = y0; y < y1; y++) {
+    float *row = t->cov + (size_t)y * TILE_SIZE;
+    float py = y + 0.5f - ay;
+    for (x = x0; x < x1; x++) {
+      float px = x + 0.5f - ax;
+      float s = (px * vx + py * vy) * inv_len2;
+      float dx, dy, c;
+      if (s < 0) s = 0;
+      else if (s > 1) s = 1;
+      dx = px - s * vx; dy = py - s * vy;
+      c = hw + 0.5f - sqrtf(dx * dx + dy * dy);
+      if (c > 1) c = 1;
+      if (c > row[x]) row[x] = c;
+    }
+  }
+}
+
+/* Draw a circle of radius `r' stroked with half width `hw', as
+   `draw_segment()' draws lines.  */
+void draw_ring(Tile *t, float cx, float cy, float r, float hw) {
+  int x0 = (int)floorf(cx - r - hw - 1), y0 = (int)floorf(cy - r - hw - 1);
+  int x1 = (int)ceilf(cx + r + hw + 1), y1 = (int)ceilf(cy + r + hw + 1);
+  int x, y;
+  if (!clip_box(t, &x0, &y0, &x1, &y1))
+    return;
+  for (y = y0; y < y1; y++) {
+    float *row = t->cov + (size_t)y * TILE_SIZE;
+    float py = y + 0.5f - cy;
+    for (x = x0; x < x1; x++) {
+      float px = x + 0.5f - cx;
+      float c = hw + 0.5f - fabsf(sqrtf(px * px + py * py) - r);
+      if (c > 1) c = 1;
+      if (c > row[x]) row[x] = c;
+    }
+  }
+}
+
+/* Blend the current track over the tile in `color', and clear its
+   coverage for the next track.  */
+void fill_track(Tile *t, const float *color) {
+  int x, y;
+  for (y = t->y0; y < t->y1; y++) {
+    float *row = t->cov + (size_t)y * TILE_SIZE;
+    float *dst = t->rgba + (size_t)y * TILE_SIZE * 4;
+    for (x = t->x0; x < t->x1; x++) {
+      float a = row[x];
+      if (a > 0) {
+	float keep = 1 - a;
+	dst[4*x] = color[0] * a + dst[4*x] * keep;
+	dst[4*x+1] = color[1] * a + dst[4*x+1] * keep;
+	dst[4*x+2] = color[2] * a + dst[4*x+2] * keep;
+	dst[4*x+3] = a + dst[4*x+3] * keep;
+	row[x] = 0;
+	t->used = true;
+      }
+    }
+  }
+  t->x0 = t->y0 = TILE_SIZE;
+  t->x1 = t->y1 = 0;
+}
+
+/* Draw eddy `index' and its track, as `WCTracksLayer.render()' does.
+   Pixel coordinates are `ppd' pixels per degree from the North Pole
+   and the antimeridian, less `x_off' and `y_off'.  Line segments that
+   cross the antimeridian are skipped.  */
+void draw_eddy(const RenderJob *job, Tile *t, unsigned index,
+	       double ppd, double x_off, double y_off) {
+  const WTracks *tracks = job->tracks;
+  float hw = job->line_width / 2;
+  unsigned k;
+#define PX(i) ((float)((tracks->lon[i] + 180) * ppd - x_off))
+#define PY(i) ((float)((90 - tracks->lat[i]) * ppd - y_off))
+
+  draw_ring(t, PX(index), PY(index), 2 * job->line_width, hw);
+  for (k = 0; k < 2; k++) {
+    const unsigned *link = (k == 0) ? tracks->prev : tracks->next;
+    unsigned steps = (k == 0) ? job->tail : ~0u;
+    unsigned i = index;
+    if (k == 1 && !job->future)
+      break;
+    while (steps-- > 0 && link[i] != WTXT_NONE) {
+      unsigned j = link[i];
+      if (fabsf(tracks->lon[j] - tracks->lon[i]) <= 180)
+	draw_segment(t, PX(i), PY(i), PX(j), PY(j), hw);
+      i = j;
+    }
+  }
+#undef PX
+#undef PY
+  fill_track(t, track_colors[tracks->type[index]]);
+}
+
+/* Write a tile as an uncompressed 32-bit TGA image with straight
+   alpha, top row first.  Returns zero on success, one on failure.  */
+int write_tile_tga(const char *filename, const float *rgba) {
+  unsigned char *buf = (unsigned char*)xmalloc(18 + TILE_SIZE * TILE_SIZE * 4);
+  unsigned char *p = buf + 18;
+  FILE *fp;
+  unsigned i;
+
+  memset(buf, 0, 18);
+  buf[2] = 2; /* Uncompressed true-color image */
+  buf[12] = TILE_SIZE & 0xff; buf[13] = TILE_SIZE >> 8;
+  buf[14] = TILE_SIZE & 0xff; buf[15] = TILE_SIZE >> 8;
+  buf[16] = 32; /* Bits per pixel */
+  buf[17] = 0x28; /* Image descriptor: top-down, 8 alpha bits */
+  for (i = 0; i < TILE_SIZE * TILE_SIZE; i++) {
+    float a = rgba[4*i+3];
+    float scale = (a > 0) ? 255 / a : 0;
+    *p++ = (unsigned char)(rgba[4*i+2] * scale + 0.5f);
+    *p++ = (unsigned char)(rgba[4*i+1] * scale + 0.5f);
+    *p++ = (unsigned char)(rgba[4*i] * scale + 0.5f);
+    *p++ = (unsigned char)(a * 255 + 0.5f);
+  }
+
+  fp = fopen(filename, "wb");
+  if (fp == NULL) {
+    fprintf(stderr, "Error: Could not open %s: %s\n",
+	    filename, strerror(errno));
+    xfree(buf);
+    return 1;
+  }
+  fwrite(buf, 1, p - buf, fp);
+  xfree(buf);
+  if (ferror(fp) | (fclose(fp) == EOF)) {
+    fprintf(stderr, "Error: Could not write %s.\n", filename);
+    return 1;
+  }
+  return 0;
+}
+
+int cmp_unsigned(const void *a, const void *b) {
+  unsigned ua = *(const unsigned*)a, ub = *(const unsigned*)b;
+  return (ua > ub) - (ua < ub);
+}
+
+/* Take tiles off of the shared counter and render them, until all
+   tiles are done or any worker fails.  */
+void *render_worker(void *arg) {
+  RenderJob *job = (RenderJob*)arg;
+  const WTracks *tracks = job->tracks;
+  unsigned date_len = tracks->date_chunk_starts[job->date_index+1] -
+    tracks->date_chunk_starts[job->date_index];
+  unsigned *cands = (unsigned*)xmalloc(sizeof(unsigned) * (date_len + 1));
+  size_t filename_len = strlen(job->out_dir) + 64;
+  char *filename = (char*)xmalloc(filename_len);
+  unsigned num_written = 0;
+  unsigned long num_drawn = 0;
+  KdPVSRuns runs;
+  Tile t;
+
+  kdpvs_runs_init(&runs);
+  t.cov = (float*)xmalloc(sizeof(float) * TILE_SIZE * TILE_SIZE);
+  t.rgba = (float*)xmalloc(sizeof(float) * TILE_SIZE * TILE_SIZE * 4);
+  memset(t.cov, 0, sizeof(float) * TILE_SIZE * TILE_SIZE);
+
+  while (true) {
+    unsigned tile, z, x, y;
+    double span, ppd, margin;
+    unsigned num_cands = 0;
+    KdPVSQuery query;
+    KdPVSResult result;
+    unsigned c, r, i;
+
+    pthread_mutex_lock(&job->lock);
+    tile = job->next_tile++;
+    if (job->retval != 0)
+      tile = job->num_tiles;
+    pthread_mutex_unlock(&job->lock);
+    if (tile >= job->num_tiles)
+      break;
+
+    tile_coords(tile, &z, &x, &y);
+    span = 180.0 / (1u << z);
+    ppd = TILE_SIZE / span;
+    /* Room for the rings and anti-aliasing around the eddies */
+    margin = (2.5 * job->line_width + 1) / ppd;
+    query.date_index = job->date_index;
+    query.vbox[0] = 90 - span * (y + 1) - job->reach_lat - margin;
+    query.vbox[1] = -180 + span * x - job->reach_lon - margin;
+    query.vbox[2] = 90 - span * y + job->reach_lat + margin;
+    query.vbox[3] = -180 + span * (x + 1) + job->reach_lon + margin;
+    clip_vbox(query.vbox);
+    for (c = 0; c < KD_NUM_CLASSES; c++)
+      EA_CLEAR(runs.c[c]);
+    kdpvs_query(tracks, &query, 0, &runs, &result);
+    for (c = KD_DEF_VIS; c <= KD_POS_VIS; c++) {
+      for (r = 0; r < result.count[c]; r++) {
+	const KdRun *run = &runs.c[c].d[result.first[c] + r];
+	for (i = 0; i < run->length; i++)
+	  cands[num_cands++] = run->start + i;
+      }
+    }
+    /* Draw in file order, so that overlapping tracks are stacked the
+       same way on neighboring tiles.  */
+    qsort(cands, num_cands, sizeof(unsigned), cmp_unsigned);
+
+    memset(t.rgba, 0, sizeof(float) * TILE_SIZE * TILE_SIZE * 4);
+    t.x0 = t.y0 = TILE_SIZE;
+    t.x1 = t.y1 = 0;
+    t.used = false;
+    for (i = 0; i < num_cands; i++)
+      draw_eddy(job, &t, cands[i], ppd, (double)x * TILE_SIZE,
+		(double)y * TILE_SIZE);
+    num_drawn += num_cands;
+    if (!t.used)
+      continue;
+
+    snprintf(filename, filename_len, "%s/%u_%u_%u.tga",
+	     job->out_dir, z, x, y);
+    if (write_tile_tga(filename, t.rgba) != 0) {
+      pthread_mutex_lock(&job->lock);
+      job->retval = 1;
+      pthread_mutex_unlock(&job->lock);
+      break;
+    }
+    num_written++;
+  }
+
+  pthread_mutex_lock(&job->lock);
+  job->num_written += num_written;
+  job->num_drawn += num_drawn;
+  pthread_mutex_unlock(&job->lock);
+  kdpvs_runs_destroy(&runs);
+  xfree(t.cov); xfree(t.rgba);
+  xfree(cands); xfree(filename);
+  return NULL;
+}
+
+/* Describe the tiles for the viewer.  Returns zero on success, one on
+   failure.  */
+int write_format(const char *dir, unsigned max_zoom, unsigned date,
+		 const RenderJob *job) {
+  size_t filename_len = strlen(dir) + 16;
+  char *filename = (char*)xmalloc(filename_len);
+  FILE *fp;
+  snprintf(filename, filename_len, "%s/format.json", dir);
+  fp = fopen(filename, "wt");
+  if (fp == NULL) {
+    fprintf(stderr, "Error: Could not open %s: %s\n",
+	    filename, strerror(errno));
+    xfree(filename);
+    return 1;
+  }
+  fprintf(fp, "{\n"
+	  "  \"tileSize\": %u,\n"
+	  "  \"maxZoom\": %u,\n"
+	  "  \"date\": %u,\n"
+	  "  \"tail\": %d,\n"
+	  "  \"future\": %s\n"
+	  "}\n", TILE_SIZE, max_zoom, date,
+	  (job->tail == ~0u) ? -1 : (int)job->tail,
+	  job->future ? "true" : "false");
+  if (fclose(fp) == EOF) {
+    fprintf(stderr, "Error: Could not write %s.\n", filename);
+    xfree(filename);
+    return 1;
+  }
+  xfree(filename);
+  return 0;
+}
@@ -0,0 +1,251 @@
+/* Cut a range of dates out of a tracks data file written by
+   tracksconv, without converting the source data again.
+
+Copyright (C) 2014 University of Minnesota
+
+See the file "COPYING" in the top level directory for details.
+
+*/
+
+/* Usage: tracksslice [-v] TRACKS-FILE FIRST-DATE LAST-DATE OUTPUT-FILE
+
+   Writes a tracks data file with the eddies on the date indexes
+   FIRST-DATE through LAST-DATE, inclusive.  As elsewhere, date
+   indexes are one-based.  The date indexes of the output start over
+   at one.
+
+   Eddy records encode their coordinates directly and their track
+   links as offsets relative to themselves, and the eddies of each
+   date stay in the same kd-tree order, so records are copied
+   unchanged in large blocks.  Only the links that would leave the
+   range are cleared, so tracks that cross the edges of the range end
+   there.  Since link offsets fit in 16 bits, only the records near
+   the edges of the range need to be checked.  */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "xmalloc.h"
+#include "wtxt.h"
+
+enum bool_tag { false, true };
+typedef enum bool_tag bool;
+
+/* Largest possible link offset, plus one */
+#define MAX_LINK 0x10000
+
+void display_help(FILE *fout, const char *progname);
+double now_secs(void);
+size_t put_char(unsigned char *p, unsigned value);
+unsigned decode_char(const WFile *wf, const unsigned char *p);
+int write_slice(const WFile *wf, const char *src_name,
+		unsigned first_date, unsigned last_date,
+		FILE *fout, unsigned *num_clipped);
+
+void display_help(FILE *fout, const char *progname) {
+  fprintf(fout,
+"Usage: %s [-v] TRACKS-FILE FIRST-DATE LAST-DATE OUTPUT-FILE\n\n",
+	  progname);
+  fputs(
+"Write the eddies on the date index range FIRST-DATE through LAST-DATE\n"
+"of TRACKS-FILE to a new tracks data file.\n\n"
+"Options:\n"
+"  -h, --help    Display this help message.\n"
+"  -v    Print statistics when done.\n",
+	fout);
+}
+
+int main(int argc, char *argv[]) {
+  const char *progname = argv[0];
+  const char *args[4];
+  unsigned num_args = 0;
+  bool verbose = false;
+  unsigned first_date, last_date, num_clipped;
+  WFile wf;
+  FILE *fout;
+  double start_time;
+  int retval;
+
+  while (*++argv != NULL) {
+    if (!strcmp(*argv, "-h") || !strcmp(*argv, "--help")) {
+      display_help(stdout, progname);
+      return 0;
+    } else if (!strcmp(*argv, "-v"))
+      verbose = true;
+    else if (num_args < 4)
+      args[num_args++] = *argv;
+    else {
+      fprintf(stderr, "Error: Unknown argument: %s\n", *argv);
+      display_help(stderr, progname);
+      return 1;
+    }
+  }
+  if (num_args != 4) {
+    display_help(stderr, progname);
+    return 1;
+  }
+  first_date = strtoul(args[1], NULL, 0);
+  last_date = strtoul(args[2], NULL, 0);
+
+  start_time = now_secs();
+  if (wfile_open(args[0], &wf) != 0)
+    return 1;
+  if (!(wf.format_bits & WTXT_FMT_PAD_NLS)) {
+    fputs("Error: Tracks data without newlines is not supported.\n", stderr);
+    wfile_close(&wf);
+    return 1;
+  }
+  if (first_date == 0 || last_date < first_date ||
+      last_date > wf.num_dates) {
+    fprintf(stderr, "Error: Invalid date index range, "
+	    "the file has %u date indexes.\n", wf.num_dates);
+    wfile_close(&wf);
+    return 1;
+  }
+  fout = fopen(args[3], "wb");
+  if (fout == NULL) {
+    fprintf(stderr, "Error: Could not open %s: %s\n",
+	    args[3], strerror(errno));
+    wfile_close(&wf);
+    return 1;
+  }
+
+  retval = write_slice(&wf, args[0], first_date, last_date,
+		       fout, &num_clipped);
+  if (fclose(fout) != 0 && retval == 0) {
+    fprintf(stderr, "Error: Could not write %s: %s\n",
+	    args[3], strerror(errno));
+    retval = 1;
+  }
+  if (retval == 0 && verbose) {
+    unsigned num_eddies = wf.date_chunk_starts[last_date] -
+      wf.date_chunk_starts[first_date-1];
+    double elapsed = now_secs() - start_time;
+    fprintf(stderr, "Wrote %u date indexes, %u eddies, "
+	    "%u links clipped, in %.3f s (%.0f MB/s)\n",
+	    last_date - first_date + 1, num_eddies, num_clipped, elapsed,
+	    WFILE_RECORD_OFF(&wf, num_eddies) / elapsed / 1e6);
+  }
+  wfile_close(&wf);
+  return retval;
+}
+
+double now_secs(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* Store a UTF-16 little endian character and return its size.  */
+size_t put_char(unsigned char *p, unsigned value) {
+  p[0] = value & 0xff;
+  p[1] = (value >> 8) & 0xff;
+  return 2;
+}
+
+/* Read an encoded number as `get_short()' in "wtxt.c".  */
+unsigned decode_char(const WFile *wf, const unsigned char *p) {
+  unsigned value = p[0] | (p[1] << 8);
+  if (value == wf->zero_sym)
+    return 0;
+  if (value > 0xd7ff)
+    return value - 0x0800;
+  return value;
+}
+
+/* Write the slice of date indexes `first_date' through `last_date'
+   (one-based) of `wf' to `fout', laid out as `write_tracks()' in
+   "tracksconv.c" does.  Returns zero on success, one on failure.  */
+int write_slice(const WFile *wf, const char *src_name,
+		unsigned first_date, unsigned last_date,
+		FILE *fout, unsigned *num_clipped) {
+  const char *begin_data = "# BEGIN_DATA\n";
+  unsigned num_dates = last_date - first_date + 1;
+  unsigned first = wf->date_chunk_starts[first_date-1];
+  unsigned n = wf->date_chunk_starts[last_date] - first;
+  unsigned char *buf, *p, *data;
+  size_t head_len, note_len;
+  char note[512];
+  unsigned i, o;
+
+  /* The header of the source is kept up to its "# BEGIN_DATA" line,
+     and a note on the slice is added as `extra_header' is in
+     tracksconv.  */
+  head_len = wf->header_len - strlen(begin_data) * 2;
+  note_len = snprintf(note, sizeof(note),
+		      "# Date indexes %u through %u of %s.\n#\n%s",
+		      first_date, last_date, src_name, begin_data);
+  if (note_len >= sizeof(note))
+    note_len = snprintf(note, sizeof(note),
+			"# Date indexes %u through %u.\n#\n%s",
+			first_date, last_date, begin_data);
+  buf = (unsigned char*)xmalloc(head_len + note_len * 2 +
+				(2 + num_dates + num_dates / 32 + 1) * 2 +
+				((size_t)n * 4 + n / 32 + 2) * 2);
+  memcpy(buf, wf->map, head_len);
+  p = buf + head_len;
+  for (i = 0; i < note_len; i++)
+    p += put_char(p, note[i]);
+
+  /* Format bits, number of dates, and the encoded counts, which can
+     be copied as they are.  */
+  p += put_char(p, wf->format_bits);
+  p += put_char(p, (num_dates == 0) ? wf->zero_sym :
+		(num_dates > 0xd7ff) ? num_dates + 0x0800 : num_dates);
+  p += put_char(p, '\n');
+  for (i = 1; i <= num_dates; i++) {
+    unsigned d = first_date - 1 + i - 1;
+    /* Offset of the count of date `d' in the source */
+    size_t src = wf->header_len + (2 + d + d / 32 + 1) * 2;
+    p[0] = wf->map[src]; p[1] = wf->map[src+1];
+    p += 2;
+    if (i % 32 == 0)
+      p += put_char(p, '\n');
+  }
+
+  /* Copy the eddy records in runs that are contiguous in both the
+     source and the output.  Record `o' of the output ends up at `data
+     + (o * 4 + o / 32 + 1) * 2'.  */
+  data = p;
+  for (o = 0; o < n; ) {
+    unsigned i = first + o;
+    unsigned run = 32 - i % 32;
+    if (run > 32 - o % 32)
+      run = 32 - o % 32;
+    if (run > n - o)
+      run = n - o;
+    if (o % 32 == 0)
+      p += put_char(p, '\n');
+    memcpy(p, wf->map + WFILE_RECORD_OFF(wf, i), (size_t)run * 8);
+    p += (size_t)run * 8;
+    o += run;
+  }
+  p += put_char(p, '\n');
+
+  /* Clear the links that leave the range.  */
+  *num_clipped = 0;
+  for (o = 0; o < n && o < MAX_LINK; o++) {
+    unsigned char *rec = data + ((size_t)o * 4 + o / 32 + 1) * 2;
+    unsigned rel_prev = decode_char(wf, rec + 6);
+    if (rel_prev != 0 && rel_prev > o)
+      { put_char(rec + 6, wf->zero_sym); (*num_clipped)++; }
+  }
+  for (o = (n > MAX_LINK) ? n - MAX_LINK : 0; o < n; o++) {
+    unsigned char *rec = data + ((size_t)o * 4 + o / 32 + 1) * 2;
+    unsigned rel_next = decode_char(wf, rec + 4);
+    if (rel_next != 0 && rel_next >= n - o)
+      { put_char(rec + 4, wf->zero_sym); (*num_clipped)++; }
+  }
+
+  if (fwrite(buf, 1, p - buf, fout) != (size_t)(p - buf)) {
+    fprintf(stderr, "Error: Could not write the output: %s\n",
+	    strerror(errno));
+    xfree(buf);
+    return 1;
+  }
+  xfree(buf);
+  return 0;
+}
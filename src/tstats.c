@@ -0,0 +1,277 @@
+/* Per-track statistics, stored in quantized columns indexed by track
+   ID, for filtering and coloring tracks without walking them.
+
+   Track IDs are the same as in the R-tree: the ordinal of the track
+   when all tracks are ordered by the position of their first eddy
+   within the tracks data file.
+
+   File format (all integers are little endian):
+
+   "OEVTSTA1"    8-byte signature
+   num_tracks, num_dates, num_cols    32-bit
+   cols[num_cols][num_tracks]    16-bit
+
+   The range filter compares eight tracks at once with SSE2 where
+   available.  The scalar version can be forced by defining
+   `TSTATS_NO_SIMD'.
+
+Copyright (C) 2014 University of Minnesota
+
+See the file "COPYING" in the top level directory for details.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#if defined(__SSE2__) && !defined(TSTATS_NO_SIMD)
+#define TSTATS_SSE2
+#include <emmintrin.h>
+#endif
+
+#include "xmalloc.h"
+#include "rtree.h"
+#include "tstats.h"
+
+#define EARTH_RADIUS_KM 6371.0
+
+static const char ts_signature[8] =
+  { 'O', 'E', 'V', 'T', 'S', 'T', 'A', '1' };
+
+const char *const tstats_names[TS_NUM_COLS] =
+  { "lifetime", "first", "disp", "speed", "lat", "type" };
+const double tstats_scale[TS_NUM_COLS] = { 1, 1, 1, 100, RT_DEG, 1 };
+const double tstats_bias[TS_NUM_COLS] = { 0, 0, 0, 0, 90 * RT_DEG, 0 };
+
+static double gc_km(int lat1, int lon1, int lat2, int lon2);
+static unsigned quantize(unsigned column, double value);
+static unsigned padded_len(unsigned num_tracks);
+
+/* Allocate zeroed columns for `num_tracks' tracks.  */
+void tstats_init(TrackStats *ts, unsigned num_tracks, unsigned num_dates) {
+  unsigned len = padded_len(num_tracks);
+  unsigned c;
+  ts->num_tracks = num_tracks;
+  ts->num_dates = num_dates;
+  for (c = 0; c < TS_NUM_COLS; c++) {
+    ts->cols[c] = (unsigned short*)xmalloc(sizeof(unsigned short) * len);
+    memset(ts->cols[c], 0, sizeof(unsigned short) * len);
+  }
+}
+
+void tstats_destroy(TrackStats *ts) {
+  unsigned c;
+  for (c = 0; c < TS_NUM_COLS; c++)
+    EFREE(ts->cols[c]);
+  ts->num_tracks = 0;
+}
+
+static unsigned padded_len(unsigned num_tracks) {
+  return (num_tracks + TS_BLOCK - 1) / TS_BLOCK * TS_BLOCK;
+}
+
+/* Great-circle distance between two points in 1/64 degree units, by
+   the haversine formula.  */
+static double gc_km(int lat1, int lon1, int lat2, int lon2) {
+  double rad = M_PI / 180 / RT_DEG;
+  double dlat = (lat2 - lat1) * rad, dlon = (lon2 - lon1) * rad;
+  double a = sin(dlat / 2) * sin(dlat / 2) +
+    cos(lat1 * rad) * cos(lat2 * rad) * sin(dlon / 2) * sin(dlon / 2);
+  if (a > 1) a = 1;
+  return 2 * EARTH_RADIUS_KM * asin(sqrt(a));
+}
+
+static unsigned quantize(unsigned column, double value) {
+  double q = floor(value * tstats_scale[column] + tstats_bias[column] + 0.5);
+  if (q < 0) return 0;
+  if (q > 0xffff) return 0xffff;
+  return (unsigned)q;
+}
+
+/* Start accumulating the statistics of a track at its first eddy.  */
+void tstats_track_begin(TSAccum *acc, unsigned type, int lat, int lon,
+			unsigned date_index) {
+  acc->type = type;
+  acc->date_first = date_index;
+  acc->length = 1;
+  acc->first_lat = acc->last_lat = lat;
+  acc->first_lon = acc->last_lon = lon;
+  acc->path_km = 0;
+}
+
+/* Add the next eddy of a track.  */
+void tstats_track_add(TSAccum *acc, int lat, int lon) {
+  acc->path_km += gc_km(acc->last_lat, acc->last_lon, lat, lon);
+  acc->last_lat = lat;
+  acc->last_lon = lon;
+  acc->length++;
+}
+
+/* Store the accumulated statistics of a track.  */
+void tstats_track_end(const TSAccum *acc, TrackStats *ts,
+		      unsigned track_id) {
+  double speed = (acc->length > 1) ? acc->path_km / (acc->length - 1) : 0;
+  ts->cols[TS_LIFETIME][track_id] = quantize(TS_LIFETIME, acc->length);
+  ts->cols[TS_FIRST_DATE][track_id] =
+    quantize(TS_FIRST_DATE, acc->date_first);
+  ts->cols[TS_DISPLACEMENT][track_id] =
+    quantize(TS_DISPLACEMENT, gc_km(acc->first_lat, acc->first_lon,
+				    acc->last_lat, acc->last_lon));
+  ts->cols[TS_SPEED][track_id] = quantize(TS_SPEED, speed);
+  ts->cols[TS_GENESIS_LAT][track_id] =
+    quantize(TS_GENESIS_LAT, (double)acc->first_lat / RT_DEG);
+  ts->cols[TS_TYPE][track_id] = quantize(TS_TYPE, acc->type);
+}
+
+/* Get a column value of a track in the units of the column.  */
+double tstats_get(const TrackStats *ts, unsigned column, unsigned track_id) {
+  return (ts->cols[column][track_id] - tstats_bias[column]) /
+    tstats_scale[column];
+}
+
+/* Write the statistics in the format described at the top of this
+   file.  Returns zero on success, one on failure.  */
+int tstats_write(FILE *fp, const TrackStats *ts) {
+  unsigned char header[12];
+  unsigned values[3];
+  unsigned c, i;
+  values[0] = ts->num_tracks;
+  values[1] = ts->num_dates;
+  values[2] = TS_NUM_COLS;
+  for (i = 0; i < 3; i++) {
+    header[4*i] = values[i] & 0xff;
+    header[4*i+1] = (values[i] >> 8) & 0xff;
+    header[4*i+2] = (values[i] >> 16) & 0xff;
+    header[4*i+3] = (values[i] >> 24) & 0xff;
+  }
+  fwrite(ts_signature, sizeof(ts_signature), 1, fp);
+  fwrite(header, sizeof(header), 1, fp);
+  for (c = 0; c < TS_NUM_COLS; c++) {
+    for (i = 0; i < ts->num_tracks; i++) {
+      putc(ts->cols[c][i] & 0xff, fp);
+      putc((ts->cols[c][i] >> 8) & 0xff, fp);
+    }
+  }
+  if (ferror(fp)) {
+    fputs("Error: Could not write the track statistics.\n", stderr);
+    return 1;
+  }
+  return 0;
+}
+
+/* Read statistics that were written by `tstats_write()'.  Returns zero
+   on success, one on failure.  */
+int tstats_read(FILE *fp, TrackStats *ts) {
+  unsigned char header[8 + 3 * 4];
+  unsigned char *buf;
+  unsigned num_cols, c, i;
+
+  memset(ts, 0, sizeof(TrackStats));
+  if (fread(header, sizeof(header), 1, fp) != 1 ||
+      memcmp(header, ts_signature, sizeof(ts_signature))) {
+    fputs("Error: Not a track statistics file.\n", stderr);
+    return 1;
+  }
+#define GET_U32(p) ((unsigned)(p)[0] | ((unsigned)(p)[1] << 8) | \
+		    ((unsigned)(p)[2] << 16) | ((unsigned)(p)[3] << 24))
+  num_cols = GET_U32(header + 16);
+  if (num_cols != TS_NUM_COLS) {
+    fputs("Error: Unsupported track statistics columns.\n", stderr);
+    return 1;
+  }
+  tstats_init(ts, GET_U32(header + 8), GET_U32(header + 12));
+  buf = (unsigned char*)xmalloc(2 * (size_t)ts->num_tracks + 1);
+  for (c = 0; c < TS_NUM_COLS; c++) {
+    if (fread(buf, 2, ts->num_tracks, fp) != ts->num_tracks) {
+      fputs("Error: Truncated track statistics file.\n", stderr);
+      xfree(buf);
+      tstats_destroy(ts);
+      return 1;
+    }
+    for (i = 0; i < ts->num_tracks; i++)
+      ts->cols[c][i] = buf[2*i] | (buf[2*i+1] << 8);
+  }
+  xfree(buf);
+  return 0;
+}
+
+/* Store the IDs of the tracks whose values are within all of the
+   given ranges into `out', which must have room for all tracks, in
+   increasing order.  Returns the number of matching tracks.  */
+unsigned tstats_filter(const TrackStats *ts, const TSRange *ranges,
+		       unsigned num_ranges, unsigned *out) {
+  unsigned lo[TS_NUM_COLS], hi[TS_NUM_COLS];
+  const unsigned short *cols[TS_NUM_COLS];
+  unsigned num_conds = 0;
+  unsigned num_out = 0;
+  unsigned b, k;
+
+  /* Convert the ranges to inclusive ranges of quantized values.  */
+  for (k = 0; k < num_ranges; k++) {
+    unsigned c = ranges[k].column;
+    double qlo = ceil(ranges[k].min * tstats_scale[c] + tstats_bias[c]);
+    double qhi = floor(ranges[k].max * tstats_scale[c] + tstats_bias[c]);
+    if (qlo < 0) qlo = 0;
+    if (qhi > 0xffff) qhi = 0xffff;
+    if (qlo > qhi)
+      return 0;
+    /* Combine multiple ranges on the same column.  */
+    for (b = 0; b < num_conds; b++) {
+      if (cols[b] == ts->cols[c])
+	break;
+    }
+    if (b == num_conds) {
+      cols[num_conds] = ts->cols[c];
+      lo[num_conds] = (unsigned)qlo; hi[num_conds] = (unsigned)qhi;
+      num_conds++;
+    } else {
+      if ((unsigned)qlo > lo[b]) lo[b] = (unsigned)qlo;
+      if ((unsigned)qhi < hi[b]) hi[b] = (unsigned)qhi;
+      if (lo[b] > hi[b])
+	return 0;
+    }
+  }
+
+#ifdef TSTATS_SSE2
+  {
+    /* SSE2 only compares signed 16-bit integers, so flip the sign
+       bits of both sides.  */
+    const __m128i sign = _mm_set1_epi16((short)0x8000);
+    __m128i vlo[TS_NUM_COLS], vhi[TS_NUM_COLS];
+    for (k = 0; k < num_conds; k++) {
+      vlo[k] = _mm_xor_si128(_mm_set1_epi16((short)lo[k]), sign);
+      vhi[k] = _mm_xor_si128(_mm_set1_epi16((short)hi[k]), sign);
+    }
+    for (b = 0; b < ts->num_tracks; b += TS_BLOCK) {
+      __m128i outside = _mm_setzero_si128();
+      unsigned mask;
+      for (k = 0; k < num_conds; k++) {
+	__m128i v = _mm_xor_si128(_mm_loadu_si128((const __m128i*)
+						  (cols[k] + b)), sign);
+	outside = _mm_or_si128(outside, _mm_cmplt_epi16(v, vlo[k]));
+	outside = _mm_or_si128(outside, _mm_cmpgt_epi16(v, vhi[k]));
+      }
+      mask = ~_mm_movemask_epi8(_mm_packs_epi16(outside,
+						_mm_setzero_si128())) & 0xff;
+      if (ts->num_tracks - b < TS_BLOCK)
+	mask &= (1u << (ts->num_tracks - b)) - 1;
+      while (mask != 0) {
+	out[num_out++] = b + __builtin_ctz(mask);
+	mask &= mask - 1;
+      }
+    }
+  }
+#else
+  for (b = 0; b < ts->num_tracks; b++) {
+    for (k = 0; k < num_conds; k++) {
+      if (cols[k][b] < lo[k] || cols[k][b] > hi[k])
+	break;
+    }
+    if (k == num_conds)
+      out[num_out++] = b;
+  }
+#endif
+  return num_out;
+}
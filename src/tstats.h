@@ -0,0 +1,83 @@
+/* Per-track statistics, stored in quantized columns indexed by track
+   ID, for filtering and coloring tracks without walking them.
+
+Copyright (C) 2014 University of Minnesota
+
+See the file "COPYING" in the top level directory for details.
+
+*/
+
+#ifndef TSTATS_H
+#define TSTATS_H
+
+#include <stdio.h>
+
+/* Columns.  Every column holds one unsigned 16-bit value per track.
+   A value `q' stands for `(q - bias) / scale' of the units below, see
+   `tstats_scale' and `tstats_bias'.  Values that are out of range
+   saturate.  */
+/* Number of date indexes the track spans */
+#define TS_LIFETIME 0
+/* Date index of the first eddy */
+#define TS_FIRST_DATE 1
+/* Great-circle distance between the first and last eddies, in km */
+#define TS_DISPLACEMENT 2
+/* Length of the track path divided by the number of date index
+   steps, in km per date index, or zero for single-eddy tracks */
+#define TS_SPEED 3
+/* Latitude of the first eddy, in degrees */
+#define TS_GENESIS_LAT 4
+/* 0 for anticyclonic, 1 for cyclonic */
+#define TS_TYPE 5
+#define TS_NUM_COLS 6
+
+/* Columns are allocated in whole blocks of this many tracks, padded
+   with zeros, so that the filter can always load whole vectors.  */
+#define TS_BLOCK 8
+
+struct TrackStats_tag {
+  unsigned num_tracks;
+  unsigned num_dates;
+  unsigned short *cols[TS_NUM_COLS];
+};
+typedef struct TrackStats_tag TrackStats;
+
+/* Accumulates the statistics of one track, one eddy at a time.
+   Coordinates are in the zero-centered 1/64 degree fixed-point units
+   of the R-tree (see "rtree.h").  */
+struct TSAccum_tag {
+  unsigned type;
+  unsigned date_first;
+  unsigned length;
+  int first_lat, first_lon;
+  int last_lat, last_lon;
+  double path_km;
+};
+typedef struct TSAccum_tag TSAccum;
+
+/* An inclusive range of values of one column, in the units of the
+   column.  */
+struct TSRange_tag {
+  unsigned column;
+  double min, max;
+};
+typedef struct TSRange_tag TSRange;
+
+extern const char *const tstats_names[TS_NUM_COLS];
+extern const double tstats_scale[TS_NUM_COLS];
+extern const double tstats_bias[TS_NUM_COLS];
+
+void tstats_init(TrackStats *ts, unsigned num_tracks, unsigned num_dates);
+void tstats_destroy(TrackStats *ts);
+void tstats_track_begin(TSAccum *acc, unsigned type, int lat, int lon,
+			unsigned date_index);
+void tstats_track_add(TSAccum *acc, int lat, int lon);
+void tstats_track_end(const TSAccum *acc, TrackStats *ts,
+		      unsigned track_id);
+double tstats_get(const TrackStats *ts, unsigned column, unsigned track_id);
+int tstats_write(FILE *fp, const TrackStats *ts);
+int tstats_read(FILE *fp, TrackStats *ts);
+unsigned tstats_filter(const TrackStats *ts, const TSRange *ranges,
+		       unsigned num_ranges, unsigned *out);
+
+#endif /* not TSTATS_H */
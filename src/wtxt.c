@@ -0,0 +1,344 @@
+/* Reader for the eddy tracks data files written by tracksconv.
+
+   The file is UTF-16 little endian text.  A human-readable header is
+   terminated by a line "# BEGIN_DATA", followed by the format bits,
+   the number of dates, the number of eddies on each date, and finally
+   four characters per eddy: latitude and type, longitude, and the
+   relative offsets to the next and previous eddies of the track.  A
+   newline is inserted before every 32 date counts and every 32 eddies
+   so that the data can still be viewed with a text editor.  See
+   "tracksconv.c" for the details of the encoding.
+
+   Since every eddy record has the same size, the position of any
+   eddy follows directly from its index, and the prefix sums of the
+   date counts give the first eddy of any date.  The file is therefore
+   only memory mapped when it is opened, and records are decoded on
+   demand, either one at a time or in batches.  Batches are decoded
+   four eddies at a time with SSE2 where it is available, which can be
+   disabled by defining `WTXT_NO_SIMD'.
+
+Copyright (C) 2014 University of Minnesota
+
+See the file "COPYING" in the top level directory for details.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#if defined(__SSE2__) && !defined(WTXT_NO_SIMD)
+#define WTXT_SSE2
+#include <emmintrin.h>
+#endif
+
+#include "xmalloc.h"
+#include "wtxt.h"
+
+static const char begin_data[] = "# BEGIN_DATA\n";
+
+/* Read one UTF-16 little endian character.  */
+static unsigned get_char(const unsigned char *p) {
+  return p[0] | (p[1] << 8);
+}
+
+/* Undo the zero and surrogate gap remapping of `put_short_in_range()'
+   in "tracksconv.c".  */
+static unsigned get_short(unsigned value, unsigned zero_sym) {
+  if (value == zero_sym)
+    return 0;
+  if (value > 0xd7ff)
+    return value - 0x0800;
+  return value;
+}
+
+/* Find the character position just past the "# BEGIN_DATA" line, or
+   zero if there is none.  Position zero holds the byte order mark, so
+   it can never be a valid result.  */
+static size_t find_data(const unsigned char *text, size_t len) {
+  size_t blen = sizeof(begin_data) - 1;
+  size_t pos;
+  for (pos = 1; pos + blen <= len; pos++) {
+    size_t i;
+    if (pos > 1 && get_char(text + (pos - 1) * 2) != '\n')
+      continue;
+    for (i = 0; i < blen &&
+	   get_char(text + (pos + i) * 2) == (unsigned char)begin_data[i]; i++);
+    if (i == blen)
+      return pos + blen;
+  }
+  return 0;
+}
+
+/* Decode the record of eddy `i' at `rec'.  */
+static void decode_record(const WFile *wf, unsigned i,
+			  const unsigned char *rec, WEddy *eddy) {
+  unsigned lat = get_short(get_char(rec), wf->zero_sym);
+  unsigned lon = get_short(get_char(rec + 2), wf->zero_sym);
+  unsigned rel_next = get_short(get_char(rec + 4), wf->zero_sym);
+  unsigned rel_prev = get_short(get_char(rec + 6), wf->zero_sym);
+  eddy->type = (lat >> 14) & 1;
+  eddy->lat = (float)((int)(lat & 0x3fff) - (1 << 13)) / (1 << 6);
+  eddy->lon = (float)((int)(lon & 0x7fff) - (1 << 14)) / (1 << 6);
+  if (rel_next == 0 || rel_next >= wf->num_eddies - i)
+    eddy->next = WTXT_NONE;
+  else
+    eddy->next = i + rel_next;
+  if (rel_prev == 0 || rel_prev > i)
+    eddy->prev = WTXT_NONE;
+  else
+    eddy->prev = i - rel_prev;
+}
+
+#ifdef WTXT_SSE2
+/* Vector version of `get_short()' for eight characters.  */
+static __m128i get_short8(__m128i v, __m128i zero_sym) {
+  const __m128i sign = _mm_set1_epi16((short)0x8000);
+  /* There is no unsigned comparison, so compare with the sign bits
+     flipped instead.  */
+  __m128i above_gap = _mm_cmpgt_epi16(_mm_xor_si128(v, sign),
+				      _mm_set1_epi16((short)(0xd7ff ^ 0x8000)));
+  __m128i is_zero = _mm_cmpeq_epi16(v, zero_sym);
+  v = _mm_sub_epi16(v, _mm_and_si128(above_gap, _mm_set1_epi16(0x0800)));
+  return _mm_andnot_si128(is_zero, v);
+}
+
+/* Decode the four consecutive records of eddies `i' through `i + 3'
+   at `rec', which must all be on the same line, into element zero
+   through three of the output arrays.  The results are identical to
+   `decode_record()'.  */
+static void decode4(const WFile *wf, unsigned i, const unsigned char *rec,
+		    unsigned char *type, float *lat, float *lon,
+		    unsigned *next, unsigned *prev) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i ones = _mm_set1_epi32(-1);
+  const __m128i zero_sym = _mm_set1_epi16((short)wf->zero_sym);
+  const __m128 scale = _mm_set1_ps(1.0f / (1 << 6));
+  __m128i a, b, t0, t1, u0, u1;
+  __m128i lat32, lon32, next32, prev32, idx, valid, invalid, types;
+  int packed_types;
+
+  /* a = lat0 lon0 next0 prev0 lat1 lon1 next1 prev1, b likewise for
+     eddies 2 and 3 */
+  a = get_short8(_mm_loadu_si128((const __m128i*)rec), zero_sym);
+  b = get_short8(_mm_loadu_si128((const __m128i*)(rec + 16)), zero_sym);
+  /* Transpose into u0 = lat0..3 lon0..3, u1 = next0..3 prev0..3 */
+  t0 = _mm_unpacklo_epi16(a, b);
+  t1 = _mm_unpackhi_epi16(a, b);
+  u0 = _mm_unpacklo_epi16(t0, t1);
+  u1 = _mm_unpackhi_epi16(t0, t1);
+  lat32 = _mm_unpacklo_epi16(u0, zero);
+  lon32 = _mm_unpackhi_epi16(u0, zero);
+  next32 = _mm_unpacklo_epi16(u1, zero);
+  prev32 = _mm_unpackhi_epi16(u1, zero);
+
+  types = _mm_and_si128(_mm_srli_epi32(lat32, 14), _mm_set1_epi32(1));
+  types = _mm_packs_epi32(types, types);
+  packed_types = _mm_cvtsi128_si32(_mm_packus_epi16(types, types));
+  memcpy(type, &packed_types, 4);
+
+  lat32 = _mm_sub_epi32(_mm_and_si128(lat32, _mm_set1_epi32(0x3fff)),
+			_mm_set1_epi32(1 << 13));
+  lon32 = _mm_sub_epi32(_mm_and_si128(lon32, _mm_set1_epi32(0x7fff)),
+			_mm_set1_epi32(1 << 14));
+  _mm_storeu_ps(lat, _mm_mul_ps(_mm_cvtepi32_ps(lat32), scale));
+  _mm_storeu_ps(lon, _mm_mul_ps(_mm_cvtepi32_ps(lon32), scale));
+
+  /* Links, with the same range checks as `decode_record()'.  All
+     values fit comfortably in a signed 32-bit integer.  */
+  idx = _mm_add_epi32(_mm_set1_epi32((int)i), _mm_set_epi32(3, 2, 1, 0));
+  valid = _mm_andnot_si128(_mm_cmpeq_epi32(next32, zero),
+			   _mm_cmplt_epi32(next32,
+			     _mm_sub_epi32(_mm_set1_epi32((int)wf->num_eddies),
+					   idx)));
+  _mm_storeu_si128((__m128i*)next,
+		   _mm_or_si128(_mm_add_epi32(idx, next32),
+				_mm_andnot_si128(valid, ones)));
+  invalid = _mm_or_si128(_mm_cmpeq_epi32(prev32, zero),
+			 _mm_cmpgt_epi32(prev32, idx));
+  _mm_storeu_si128((__m128i*)prev,
+		   _mm_or_si128(_mm_sub_epi32(idx, prev32), invalid));
+}
+#endif /* WTXT_SSE2 */
+
+/* Map a tracks data file into memory and read its date counts.
+   Returns zero on success, or prints an error message and returns
+   one.  */
+int wfile_open(const char *filename, WFile *wf) {
+  struct stat st;
+  void *map;
+  size_t len, pos;
+  unsigned i;
+  int fd;
+
+  memset(wf, 0, sizeof(WFile));
+  fd = open(filename, O_RDONLY);
+  if (fd == -1) {
+    fprintf(stderr, "Error: Could not open %s: %s\n",
+	    filename, strerror(errno));
+    return 1;
+  }
+  if (fstat(fd, &st) != 0) {
+    fprintf(stderr, "Error: Could not read %s: %s\n",
+	    filename, strerror(errno));
+    close(fd);
+    return 1;
+  }
+  if (st.st_size < 2) {
+    close(fd);
+    goto invalid;
+  }
+  map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    fprintf(stderr, "Error: Could not map %s: %s\n",
+	    filename, strerror(errno));
+    return 1;
+  }
+  wf->map = (const unsigned char*)map;
+  wf->map_len = st.st_size;
+  len = wf->map_len / 2;
+
+  if (get_char(wf->map) != 0xfeff || (pos = find_data(wf->map, len)) == 0)
+    goto invalid;
+  wf->header_len = pos * 2;
+
+  /* Read the format header.  */
+  if (pos + 2 > len)
+    goto invalid;
+  wf->format_bits = get_char(wf->map + pos++ * 2);
+  if (wf->format_bits & WTXT_FMT_TRACK_KEYED) {
+    fputs("Error: Track-keyed tracks data is not supported.\n", stderr);
+    wfile_close(wf);
+    return 1;
+  }
+  wf->zero_sym = (wf->format_bits & WTXT_FMT_EXT_RANGE) ? 0xffff : 0xd7ff;
+  wf->num_dates = get_short(get_char(wf->map + pos++ * 2), wf->zero_sym);
+
+  /* Read the dates header.  */
+  wf->date_chunk_starts =
+    (unsigned*)xmalloc(sizeof(unsigned) * (wf->num_dates + 1));
+  wf->date_chunk_starts[0] = 0;
+  for (i = 0; i < wf->num_dates; i++) {
+    if (i % WTXT_PER_LINE == 0)
+      pos++; /* Skip the newline character.  */
+    if (pos >= len)
+      goto invalid;
+    wf->date_chunk_starts[i+1] = wf->date_chunk_starts[i] +
+      get_short(get_char(wf->map + pos++ * 2), wf->zero_sym);
+  }
+  /* tracksconv also ends a full line of date counts with a newline,
+     before the newline that starts the eddy records.  */
+  if (wf->num_dates > 0 && wf->num_dates % WTXT_PER_LINE == 0)
+    pos++;
+  pos++; /* Skip the newline immediately at the end of the header.  */
+  wf->num_eddies = wf->date_chunk_starts[wf->num_dates];
+  wf->data_off = pos * 2;
+  if (WFILE_RECORD_OFF(wf, wf->num_eddies) > wf->map_len)
+    goto invalid;
+  return 0;
+
+ invalid:
+  fprintf(stderr, "Error: %s: Invalid tracks data file.\n", filename);
+  wfile_close(wf);
+  return 1;
+}
+
+void wfile_close(WFile *wf) {
+  if (wf->map != NULL)
+    munmap((void*)wf->map, wf->map_len);
+  wf->map = NULL;
+  wf->map_len = 0;
+  EFREE(wf->date_chunk_starts);
+  wf->num_dates = 0;
+  wf->num_eddies = 0;
+}
+
+/* Get a view of the eddies on the zero-based `date_index'.  Returns
+   zero on success, or one if there is no such date.  */
+int wfile_date(const WFile *wf, unsigned date_index, WDateView *view) {
+  if (date_index >= wf->num_dates)
+    return 1;
+  view->file = wf;
+  view->date_index = date_index;
+  view->first = wf->date_chunk_starts[date_index];
+  view->count = wf->date_chunk_starts[date_index+1] - view->first;
+  return 0;
+}
+
+/* Decode the eddy at the absolute `index', which must be less than
+   the number of eddies.  */
+void wfile_get_eddy(const WFile *wf, unsigned index, WEddy *eddy) {
+  decode_record(wf, index, wf->map + WFILE_RECORD_OFF(wf, index), eddy);
+}
+
+/* Decode `count' eddies starting at the absolute index `first' into
+   element zero and onward of the given parallel arrays, which are
+   laid out as in `WTracks'.  */
+void wfile_decode(const WFile *wf, unsigned first, unsigned count,
+		  unsigned char *type, float *lat, float *lon,
+		  unsigned *next, unsigned *prev) {
+  unsigned j = 0;
+  while (j < count) {
+    unsigned i = first + j;
+    const unsigned char *rec = wf->map + WFILE_RECORD_OFF(wf, i);
+    WEddy eddy;
+#ifdef WTXT_SSE2
+    if (count - j >= 4 && i % WTXT_PER_LINE <= WTXT_PER_LINE - 4) {
+      decode4(wf, i, rec, type + j, lat + j, lon + j, next + j, prev + j);
+      j += 4;
+      continue;
+    }
+#endif
+    decode_record(wf, i, rec, &eddy);
+    type[j] = eddy.type;
+    lat[j] = eddy.lat;
+    lon[j] = eddy.lon;
+    next[j] = eddy.next;
+    prev[j] = eddy.prev;
+    j++;
+  }
+}
+
+/* Read and decode a whole tracks data file.  Returns zero on success,
+   or prints an error message and returns one.  */
+int wtxt_load(const char *filename, WTracks *tracks) {
+  WFile wf;
+  unsigned n;
+
+  memset(tracks, 0, sizeof(WTracks));
+  if (wfile_open(filename, &wf) != 0)
+    return 1;
+  tracks->format_bits = wf.format_bits;
+  tracks->num_dates = wf.num_dates;
+  tracks->num_eddies = n = wf.num_eddies;
+  tracks->date_chunk_starts = wf.date_chunk_starts;
+  wf.date_chunk_starts = NULL;
+
+  tracks->type = (unsigned char*)xmalloc(n);
+  tracks->lat = (float*)xmalloc(sizeof(float) * n);
+  tracks->lon = (float*)xmalloc(sizeof(float) * n);
+  tracks->next = (unsigned*)xmalloc(sizeof(unsigned) * n);
+  tracks->prev = (unsigned*)xmalloc(sizeof(unsigned) * n);
+  wfile_decode(&wf, 0, n, tracks->type, tracks->lat, tracks->lon,
+	       tracks->next, tracks->prev);
+  wfile_close(&wf);
+  return 0;
+}
+
+void wtxt_destroy(WTracks *tracks) {
+  EFREE(tracks->date_chunk_starts);
+  EFREE(tracks->type);
+  EFREE(tracks->lat);
+  EFREE(tracks->lon);
+  EFREE(tracks->next);
+  EFREE(tracks->prev);
+  tracks->num_dates = 0;
+  tracks->num_eddies = 0;
+}
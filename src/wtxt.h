@@ -0,0 +1,107 @@
+/* Reader for the eddy tracks data files written by tracksconv.
+
+Copyright (C) 2014 University of Minnesota
+
+See the file "COPYING" in the top level directory for details.
+
+*/
+
+#ifndef WTXT_H
+#define WTXT_H
+
+#include <stddef.h>
+
+/* Format bits from the start of the data section.  */
+#define WTXT_FMT_BASE 0x01
+#define WTXT_FMT_EXT_RANGE 0x02
+#define WTXT_FMT_TRACK_KEYED 0x04
+#define WTXT_FMT_PAD_NLS 0x08
+
+/* Value of `next' or `prev' for the end of a track.  */
+#define WTXT_NONE (~0u)
+
+/* Number of eddies, or date counts, per line of the data section.  */
+#define WTXT_PER_LINE 32
+
+/* A tracks data file mapped into memory.  Nothing but the date
+   counts is decoded when the file is opened, so any eddy can be
+   accessed at random without reading the rest of the file.  All
+   offsets are in bytes from the start of the file.  */
+struct WFile_tag {
+  const unsigned char *map;
+  size_t map_len;
+  /* Length of the header, up to and including the "# BEGIN_DATA"
+     line, including the byte order mark.  */
+  size_t header_len;
+  /* Offset of the first eddy record */
+  size_t data_off;
+  unsigned format_bits;
+  /* Character that encodes zero */
+  unsigned zero_sym;
+  unsigned num_dates;
+  unsigned num_eddies;
+  /* Prefix sums of the per-date counts, as `date_chunk_starts' in
+     `WTracks'.  */
+  unsigned *date_chunk_starts;
+};
+typedef struct WFile_tag WFile;
+
+/* A decoded eddy record.  */
+struct WEddy_tag {
+  unsigned char type; /* 0 for anticyclonic, 1 for cyclonic */
+  float lat, lon;
+  unsigned next, prev; /* Absolute eddy indexes */
+};
+typedef struct WEddy_tag WEddy;
+
+/* A view of the eddies of one date, directly in the file mapping.
+   The eddies are ordered as the date's kd-tree.  */
+struct WDateView_tag {
+  const WFile *file;
+  unsigned date_index;
+  /* Absolute index of the first eddy, and the number of eddies */
+  unsigned first;
+  unsigned count;
+};
+typedef struct WDateView_tag WDateView;
+
+/* The eddies of all dates are stored in file order, with the data
+   fields decoded into parallel arrays.  Latitudes and longitudes are
+   in degrees, exactly as `WCTracksLayer.getEddy()' decodes them, and
+   `next' and `prev' are absolute eddy indexes.  The eddies of the
+   zero-based date index `d' are in the range [ date_chunk_starts[d],
+   date_chunk_starts[d+1] ), and they are ordered as the date's
+   kd-tree.  */
+struct WTracks_tag {
+  unsigned format_bits;
+  unsigned num_dates;
+  unsigned num_eddies;
+  unsigned *date_chunk_starts;
+  unsigned char *type;
+  float *lat;
+  float *lon;
+  unsigned *next;
+  unsigned *prev;
+};
+typedef struct WTracks_tag WTracks;
+
+int wfile_open(const char *filename, WFile *wf);
+void wfile_close(WFile *wf);
+int wfile_date(const WFile *wf, unsigned date_index, WDateView *view);
+void wfile_get_eddy(const WFile *wf, unsigned index, WEddy *eddy);
+void wfile_decode(const WFile *wf, unsigned first, unsigned count,
+		  unsigned char *type, float *lat, float *lon,
+		  unsigned *next, unsigned *prev);
+
+/* Byte offset of an eddy record within the file.  */
+#define WFILE_RECORD_OFF(wf, index) \
+  ((wf)->data_off + ((size_t)(index) * 4 + (index) / WTXT_PER_LINE) * 2)
+
+/* Eddy `i' of a date view, decoded.  */
+#define WDATE_GET_EDDY(view, i, eddy) \
+  wfile_get_eddy((view)->file, (view)->first + (i), (eddy))
+
+int wtxt_load(const char *filename, WTracks *tracks);
+void wtxt_destroy(WTracks *tracks);
+
+#endif /* not WTXT_H */
@@ -0,0 +1,118 @@
+/* Measure the throughput of `WCTracksLayer.kdPVS()' under Node.js on
+   the queries written by "../src/kdbench -q QUERY-FILE", for
+   comparison with the native port.
+
+   Usage: node kdbench.js TRACKS-FILE QUERY-FILE [MAX-SPLITS [REPEAT]]
+
+   The traversal code is taken verbatim from "../src/trackslayer.js"
+   so that the benchmark always measures the current version.  The
+   checksum line must match the one printed by the native
+   benchmark.  */
+
+var fs = require("fs");
+var path = require("path");
+
+/**
+ * Extract the source code of a method assignment such as
+ * "WCTracksLayer.getEddy = function(...) {...};" from a module.
+ */
+function extractMethod(source, name) {
+  var begin = source.indexOf("\n" + name + " = function");
+  if (begin < 0)
+    throw new Error("Could not find " + name);
+  var end = source.indexOf("\n};\n", begin);
+  return source.substring(begin + 1, end + 4);
+}
+
+var argv = process.argv.slice(2);
+if (argv.length < 2) {
+  console.error("Usage: node kdbench.js TRACKS-FILE QUERY-FILE " +
+		"[MAX-SPLITS [REPEAT]]");
+  process.exit(1);
+}
+var maxSplits = (argv.length > 2) ? parseInt(argv[2], 10) : 31;
+var repeat = (argv.length > 3) ? parseInt(argv[3], 10) : 10;
+
+var WCTracksLayer = {};
+var layerSrc = fs.readFileSync(path.join(__dirname, "..", "src",
+					 "trackslayer.js"), "utf8");
+eval(extractMethod(layerSrc, "WCTracksLayer.getEddy"));
+eval(extractMethod(layerSrc, "WCTracksLayer.kdPVS"));
+
+/* Parse the tracks data the same way as `WCTracksLayer.loadData'.  */
+var textBuf = fs.readFileSync(argv[0]).toString("utf16le");
+var re = /(^|\n)# BEGIN_DATA\n/g;
+if (!re.exec(textBuf)) {
+  console.error("Error: Invalid tracks data file.");
+  process.exit(1);
+}
+var curPos = re.lastIndex;
+var formatBits = textBuf.charCodeAt(curPos++);
+WCTracksLayer.INPUT_ZERO_SYM = (formatBits & 0x02) ? 0xffff : 0xd7ff;
+var numDates = textBuf.charCodeAt(curPos++);
+if (numDates == WCTracksLayer.INPUT_ZERO_SYM)
+  numDates = 0;
+else if (numDates > 0xd7ff)
+  numDates -= 0x0800;
+var dateChunkStarts = [ 0 ];
+for (var i = 0; i < numDates; i++) {
+  if (i % 32 == 0)
+    curPos++; // Skip the newline character.
+  var numEddies = textBuf.charCodeAt(curPos++);
+  if (numEddies == WCTracksLayer.INPUT_ZERO_SYM)
+    numEddies = 0;
+  else if (numEddies > 0xd7ff)
+    numEddies -= 0x0800;
+  dateChunkStarts.push(dateChunkStarts[i] + numEddies);
+}
+if (numDates > 0 && numDates % 32 == 0)
+  curPos++; // Skip the newline ending a full line of date counts.
+curPos++; // Skip the newline immediately at the end of the header.
+WCTracksLayer.textBuf = textBuf;
+WCTracksLayer.dateChunkStarts = dateChunkStarts;
+WCTracksLayer.startOfData = curPos;
+
+var queries = fs.readFileSync(argv[1], "utf8").split("\n")
+  .filter(function(line) { return line.length > 0; })
+  .map(function(line) {
+    var f = line.split(" ").map(Number);
+    return [ f[0], [ f[1], f[2], f[3], f[4] ] ];
+  });
+
+var totPVS = 0, numRuns = [ 0, 0, 0 ];
+var allRanges = [ [], [], [] ];
+var startTime = process.hrtime();
+for (var r = 0; r < repeat; r++) {
+  var lastRun = (r == repeat - 1);
+  totPVS = 0;
+  for (var q = 0; q < queries.length; q++) {
+    var ranges = WCTracksLayer.kdPVS(queries[q][0], queries[q][1],
+				     maxSplits);
+    totPVS += ranges[3];
+    if (lastRun) {
+      for (var k = 0; k < 3; k++)
+	allRanges[k].push(ranges[k]);
+    }
+  }
+}
+var elapsed = process.hrtime(startTime);
+elapsed = elapsed[0] + elapsed[1] * 1e-9;
+
+// FNV-1a hash over the runs of each class, in order.
+var hash = 2166136261;
+for (var k = 0; k < 3; k++) {
+  for (var q = 0; q < allRanges[k].length; q++) {
+    var runs = allRanges[k][q];
+    numRuns[k] += runs.length;
+    for (var j = 0; j < runs.length; j++) {
+      hash = Math.imul(hash ^ runs[j][0], 16777619) >>> 0;
+      hash = Math.imul(hash ^ runs[j][1], 16777619) >>> 0;
+    }
+  }
+}
+
+console.log(queries.length + " queries x " + repeat + ": " +
+	    elapsed.toFixed(3) + " s, " +
+	    (queries.length * repeat / elapsed).toFixed(0) + " queries/s");
+console.log("checksum: " + totPVS + " " + numRuns.join(" ") + " " +
+	    ("0000000" + hash.toString(16)).slice(-8));
@@ -0,0 +1,159 @@
+/* Decode SSH frames written in keyframe mode by "../src/csvtotga -kN"
+   with `SSHDeltaDecoder' under Node.js, and compare them with the
+   independent frames of the same class, if given, to measure the
+   total bytes of a full animation pass and the error of the delta
+   frames.
+
+   Usage: node sshdelta.js [-e MAX-ERROR] DATES-FILE KEYED-IMAGES
+			   [INDEPENDENT-IMAGES]
+
+   The images are given as file name templates with `%s' for the date,
+   as for "csvtotga", and must be PNG.  The "format.json" of the keyed
+   images is read from their directory.  The decoder is taken verbatim
+   from "../src/sshlayer.js" so that this always checks the current
+   version.  With `-e', the exit status is one if any code of the
+   delta frames is off by more than MAX-ERROR, or NaN where the
+   independent frame is not or the other way around, as when the
+   images were not converted again for keyframe mode.  */
+
+var fs = require("fs");
+var path = require("path");
+var zlib = require("zlib");
+
+/**
+ * Extract the source code of an assignment such as
+ * "SSHDeltaDecoder.prototype.decode = function(...) {...};" from a
+ * module.
+ */
+function extractDef(source, head) {
+  var begin = source.indexOf("\n" + head + " = function");
+  if (begin < 0)
+    throw new Error("Could not find " + head);
+  var end = source.indexOf("\n};\n", begin);
+  return source.substring(begin + 1, end + 4);
+}
+
+/**
+ * Decode an 8-bit grayscale or RGB PNG image into its pixels, top
+ * row first, as canvas image data would be but without alpha.
+ */
+function readPNG(buf) {
+  var width = buf.readUInt32BE(16), height = buf.readUInt32BE(20);
+  var depth = buf[24], colorType = buf[25];
+  if (depth != 8 || (colorType != 0 && colorType != 2))
+    throw new Error("Unsupported PNG image");
+  var stride = (colorType == 2) ? 3 : 1;
+  var idat = [];
+  for (var pos = 8; pos < buf.length; ) {
+    var len = buf.readUInt32BE(pos);
+    if (buf.toString("latin1", pos + 4, pos + 8) == "IDAT")
+      idat.push(buf.slice(pos + 8, pos + 8 + len));
+    pos += len + 12;
+  }
+  var raw = zlib.inflateSync(Buffer.concat(idat));
+  var rowLen = width * stride;
+  var pixels = new Uint8Array(rowLen * height);
+  var prev = new Uint8Array(rowLen);
+  for (var y = 0; y < height; y++) {
+    var filter = raw[y * (rowLen + 1)];
+    var src = y * (rowLen + 1) + 1, dest = y * rowLen;
+    for (var i = 0; i < rowLen; i++) {
+      var a = (i >= stride) ? pixels[dest + i - stride] : 0;
+      var b = prev[i];
+      var c = (i >= stride) ? prev[i - stride] : 0;
+      var x = raw[src + i];
+      switch (filter) {
+      case 1: x += a; break;
+      case 2: x += b; break;
+      case 3: x += (a + b) >> 1; break;
+      case 4:
+	var p = a + b - c;
+	var pa = Math.abs(p - a), pb = Math.abs(p - b), pc = Math.abs(p - c);
+	x += (pa <= pb && pa <= pc) ? a : (pb <= pc) ? b : c;
+	break;
+      }
+      pixels[dest + i] = x & 0xff;
+    }
+    prev = pixels.subarray(dest, dest + rowLen);
+  }
+  return { pixels: pixels, stride: stride };
+}
+
+var argv = process.argv.slice(2);
+var errorLimit = null;
+if (argv[0] == "-e") {
+  errorLimit = Number(argv[1]);
+  argv = argv.slice(2);
+}
+if (argv.length < 2 || (errorLimit !== null && argv.length < 3)) {
+  console.error("Usage: node sshdelta.js [-e MAX-ERROR] DATES-FILE " +
+		"KEYED-IMAGES [INDEPENDENT-IMAGES]");
+  process.exit(1);
+}
+var dates = fs.readFileSync(argv[0], "utf8").split(/\s+/)
+  .filter(function(date) { return date.length > 0; });
+var keyedTmpl = argv[1], indTmpl = argv[2];
+var format = JSON.parse(fs.readFileSync(
+  path.join(path.dirname(keyedTmpl), "format.json"), "utf8"));
+if (!format.keyInterval) {
+  console.error("Error: The images were not written in keyframe mode.");
+  process.exit(1);
+}
+
+var SSHDeltaDecoder;
+var layerSrc = fs.readFileSync(path.join(__dirname, "..", "src",
+					 "sshlayer.js"), "utf8");
+eval(extractDef(layerSrc, "var SSHDeltaDecoder").substring(4));
+[ "keyFrame", "deltaFrame", "decode", "getSSH" ].forEach(function(name) {
+  eval(extractDef(layerSrc, "SSHDeltaDecoder.prototype." + name));
+});
+
+var decoder = new SSHDeltaDecoder(format);
+var reference = new SSHDeltaDecoder(format);
+var keyedBytes = 0, indBytes = 0, decodeTime = 0;
+var maxError = 0, sumSqError = 0, numSamples = 0, numNaNDiffs = 0;
+for (var d = 0; d < dates.length; d++) {
+  var buf = fs.readFileSync(keyedTmpl.replace("%s", dates[d]));
+  keyedBytes += buf.length;
+  var startTime = process.hrtime();
+  var image = readPNG(buf);
+  decoder.decode(d, image.pixels, image.stride);
+  var elapsed = process.hrtime(startTime);
+  decodeTime += elapsed[0] + elapsed[1] * 1e-9;
+  if (!indTmpl)
+    continue;
+
+  buf = fs.readFileSync(indTmpl.replace("%s", dates[d]));
+  indBytes += buf.length;
+  image = readPNG(buf);
+  reference.keyFrame(image.pixels, image.stride);
+  var codes = decoder.codes, refCodes = reference.codes;
+  for (var i = 0; i < codes.length; i++) {
+    if ((codes[i] == 0) != (refCodes[i] == 0)) {
+      numNaNDiffs++;
+      continue;
+    }
+    if (codes[i] == 0)
+      continue;
+    var error = Math.abs(codes[i] - refCodes[i]);
+    if (error > maxError) maxError = error;
+    sumSqError += error * error;
+    numSamples++;
+  }
+}
+
+console.log(dates.length + " frames, key interval " + format.keyInterval +
+	    ", delta step " + format.deltaQuantum + ": " + keyedBytes +
+	    " bytes, decoded in " + decodeTime.toFixed(3) + " s");
+if (indTmpl) {
+  console.log("independent frames: " + indBytes + " bytes (keyed " +
+	      (100 * keyedBytes / indBytes).toFixed(1) + "%)");
+  console.log("error in codes: max " + maxError + ", rms " +
+	      Math.sqrt(sumSqError / Math.max(numSamples, 1)).toFixed(3) +
+	      ", NaN mismatches " + numNaNDiffs);
+}
+if (errorLimit !== null && (maxError > errorLimit || numNaNDiffs > 0)) {
+  console.error("Error: The delta frames differ from the independent " +
+		"frames by more than " + errorLimit + ".");
+  process.exit(1);
+}
@@ -0,0 +1,207 @@
+/* Check "../src/tracksslice" and the append mode of
+   "../src/tracksconv" under Node.js against full conversions of the
+   same date ranges, including ranges of only one or two dates.
+
+   Usage: node trackscheck.js TRACKSCONV TRACKSSLICE ACYC-JSON CYC-JSON
+
+   The kd-trees may order eddies with equal keys differently depending
+   on the order of the input, so the tracks data files are compared as
+   the set of eddies on every date, each with the eddies that it links
+   to, rather than byte for byte.  The files are written to a
+   temporary directory that is removed when done.  */
+
+var fs = require("fs");
+var os = require("os");
+var path = require("path");
+var childProcess = require("child_process");
+
+/**
+ * Decode a tracks data file into the number of eddies on every date
+ * and one string per eddy that holds its date, its raw fields, and
+ * the raw fields of the eddies that it links to.
+ */
+function loadTracks(filename) {
+  var textBuf = fs.readFileSync(filename).toString("utf16le");
+  var re = /(^|\n)# BEGIN_DATA\n/g;
+  if (!re.exec(textBuf))
+    throw new Error("Invalid tracks data file: " + filename);
+  var curPos = re.lastIndex;
+  var formatBits = textBuf.charCodeAt(curPos++);
+  var zeroSym = (formatBits & 0x02) ? 0xffff : 0xd7ff;
+  var decode = function(value) {
+    if (value == zeroSym)
+      return 0;
+    return (value > 0xd7ff) ? value - 0x0800 : value;
+  };
+  var numDates = decode(textBuf.charCodeAt(curPos++));
+  var counts = [];
+  for (var i = 0; i < numDates; i++) {
+    if (i % 32 == 0)
+      curPos++; // Skip the newline character.
+    counts.push(decode(textBuf.charCodeAt(curPos++)));
+  }
+  if (numDates > 0 && numDates % 32 == 0)
+    curPos++; // Skip the newline ending a full line of date counts.
+  curPos++; // Skip the newline immediately at the end of the header.
+
+  var eddies = [], dates = [];
+  for (var d = 0; d < numDates; d++) {
+    for (var j = 0; j < counts[d]; j++)
+      dates.push(d + 1);
+  }
+  for (var k = 0; k < dates.length; k++) {
+    var pos = curPos + k * 4 + (0|(k / 32));
+    eddies.push([ textBuf.charCodeAt(pos), textBuf.charCodeAt(pos + 1),
+		  decode(textBuf.charCodeAt(pos + 2)),
+		  decode(textBuf.charCodeAt(pos + 3)) ]);
+  }
+  var point = function(index) {
+    return dates[index] + ":" + eddies[index][0] + ":" + eddies[index][1];
+  };
+  var keys = eddies.map(function(eddy, index) {
+    return point(index) +
+      " next " + (eddy[2] ? point(index + eddy[2]) : "-") +
+      " prev " + (eddy[3] ? point(index - eddy[3]) : "-");
+  });
+  keys.sort();
+  return { counts: counts, keys: keys };
+}
+
+/**
+ * Compare two tracks data files, and return a description of the
+ * first difference, or null if they hold the same eddies and tracks.
+ */
+function compareTracks(nameA, nameB) {
+  var a = loadTracks(nameA), b = loadTracks(nameB);
+  if (a.counts.join(",") != b.counts.join(","))
+    return "different eddies per date";
+  for (var i = 0; i < a.keys.length; i++) {
+    if (a.keys[i] != b.keys[i])
+      return "eddy " + a.keys[i] + " differs from " + b.keys[i];
+  }
+  return null;
+}
+
+/**
+ * Write the tracks of a tracks JSON file cut to the dates `first'
+ * through `last', renumbered from one, as `tracksslice' cuts them.
+ */
+function cutJSON(tracks, first, last, filename) {
+  var cut = [];
+  tracks.forEach(function(track) {
+    var eddies = [];
+    track.forEach(function(eddy) {
+      if (eddy[2] >= first && eddy[2] <= last) {
+	var copy = eddy.slice();
+	copy[2] = eddy[2] - first + 1;
+	eddies.push(copy);
+      }
+    });
+    if (eddies.length > 0)
+      cut.push(eddies);
+  });
+  fs.writeFileSync(filename, JSON.stringify(cut));
+}
+
+var argv = process.argv.slice(2);
+if (argv.length < 4) {
+  console.error("Usage: node trackscheck.js TRACKSCONV TRACKSSLICE " +
+		"ACYC-JSON CYC-JSON");
+  process.exit(1);
+}
+var tracksconv = path.resolve(argv[0]), tracksslice = path.resolve(argv[1]);
+var jsonNames = [ argv[2], argv[3] ];
+var jsonTracks = jsonNames.map(function(name) {
+  return JSON.parse(fs.readFileSync(name, "utf8"));
+});
+var tmpDir = fs.mkdtempSync(path.join(os.tmpdir(), "trackscheck-"));
+var tmpName = function(name) { return path.join(tmpDir, name); };
+var run = function(prog, args) {
+  childProcess.execFileSync(prog, args, { stdio: "inherit" });
+};
+var convert = function(output, inputs, extraArgs) {
+  run(tracksconv, (extraArgs || []).concat(
+    [ "-o", output, "0", inputs[0], "1", inputs[1] ]));
+};
+
+/* Run one case, which returns null if it passes or a description of
+   the difference, and report the result.  */
+var numFailed = 0;
+var check = function(what, runCase) {
+  var difference;
+  try {
+    difference = runCase();
+  } catch (e) {
+    difference = e.message;
+  }
+  console.log(what + ": " + (difference ? "FAILED, " + difference : "ok"));
+  if (difference)
+    numFailed++;
+};
+
+try {
+  convert(tmpName("full.wtxt"), jsonNames);
+  var numDates = loadTracks(tmpName("full.wtxt")).counts.length;
+  var cutNames = [ tmpName("cut0.json"), tmpName("cut1.json") ];
+  var cutInputs = function(first, last) {
+    for (var t = 0; t < 2; t++)
+      cutJSON(jsonTracks[t], first, last, cutNames[t]);
+  };
+
+  // Short ranges at both ends and in the middle, and a long one.
+  var mid = Math.max(1, 0|(numDates / 2));
+  [ [ 1, 1 ], [ 1, 2 ], [ mid, mid ], [ mid, Math.min(mid + 1, numDates) ],
+    [ numDates, numDates ], [ Math.max(1, numDates - 1), numDates ],
+    [ Math.max(1, 0|(numDates / 4)), Math.max(1, 0|(numDates * 3 / 4)) ]
+  ].forEach(function(range) {
+    var first = range[0], last = Math.min(range[1], numDates);
+    check("slice " + first + "-" + last, function() {
+      run(tracksslice, [ tmpName("full.wtxt"), String(first), String(last),
+			 tmpName("slice.wtxt") ]);
+      cutInputs(first, last);
+      convert(tmpName("ref.wtxt"), cutNames);
+      return compareTracks(tmpName("ref.wtxt"), tmpName("slice.wtxt"));
+    });
+  });
+
+  // Append one new date, as for a weekly update, two, and a month.
+  [ 1, 2, 32 ].forEach(function(numNew) {
+    var numOld = numDates - numNew;
+    if (numOld < 1)
+      return;
+    check("append " + numNew + " to " + numOld, function() {
+      cutInputs(1, numOld);
+      convert(tmpName("old.wtxt"), cutNames);
+      convert(tmpName("append.wtxt"), jsonNames,
+	      [ "-a", tmpName("old.wtxt") ]);
+      return compareTracks(tmpName("full.wtxt"), tmpName("append.wtxt"));
+    });
+  });
+
+  /* Append one date in place, as the weekly update does, after an
+     append that fails, which must leave the file as it was.  */
+  check("append 1 in place", function() {
+    cutInputs(1, numDates - 1);
+    convert(tmpName("old.wtxt"), cutNames);
+    var oldData = fs.readFileSync(tmpName("old.wtxt"));
+    try {
+      convert(tmpName("old.wtxt"), [ tmpName("none.json"), jsonNames[1] ],
+	      [ "-a", tmpName("old.wtxt") ]);
+    } catch (e) {
+      // Expected: the input does not exist.
+    }
+    if (!fs.readFileSync(tmpName("old.wtxt")).equals(oldData))
+      return "a failed append changed the file";
+    convert(tmpName("old.wtxt"), jsonNames, [ "-a", tmpName("old.wtxt") ]);
+    return compareTracks(tmpName("full.wtxt"), tmpName("old.wtxt"));
+  });
+} catch (e) {
+  console.error("Error: " + e.message);
+  numFailed++;
+}
+
+fs.readdirSync(tmpDir).forEach(function(name) {
+  fs.unlinkSync(tmpName(name));
+});
+fs.rmdirSync(tmpDir);
+process.exit(numFailed > 0 ? 1 : 0);